@@ -0,0 +1,135 @@
+#!/bin/bash
+#
+# Generate a synthetic diary for benchmarks
+#
+# The layout matches what dry creates: YYYY/MM/DD/YYYY-MM-DD.org notes with
+# one "** HH:MM:SS" section per entry, and YYYY-MM-DD_HH-MM.mkv videos.
+#
+# Usage: ./bench/gen_diary.sh [options] <storage_dir> [<name>]
+#
+#   -y <years>      Years of history, ending today (default: 2)
+#   -D <percent>    Share of days that have entries (default: 70)
+#   -n <notes>      Note sections per active day (default: 3)
+#   -s <bytes>      Size of each note section (default: 600)
+#   -m <media>      Media files per active day (default: 1)
+#   -M <kbytes>     Size of each media file (default: 64)
+#   -e <password>   Create an encrypted (encfs) diary instead of plaintext
+#   -r <seed>       Random seed (default: 42)
+#
+# The diary is created at <storage_dir>/<name> (plaintext) or mounted there
+# from <storage_dir>/.<name> while generating (encrypted), and a matching
+# "name : path" line is printed for diaries.ref.
+#
+
+set -e
+
+YEARS=2
+DENSITY=70
+NOTES=3
+NOTE_SIZE=600
+MEDIA=1
+MEDIA_KB=64
+PASSWORD=""
+SEED=42
+
+usage() {
+    sed -n '4,21p' "$0" | sed 's/^# \{0,1\}//'
+    exit 1
+}
+
+while getopts "y:D:n:s:m:M:e:r:h" opt; do
+    case "$opt" in
+        y) YEARS="$OPTARG" ;;
+        D) DENSITY="$OPTARG" ;;
+        n) NOTES="$OPTARG" ;;
+        s) NOTE_SIZE="$OPTARG" ;;
+        m) MEDIA="$OPTARG" ;;
+        M) MEDIA_KB="$OPTARG" ;;
+        e) PASSWORD="$OPTARG" ;;
+        r) SEED="$OPTARG" ;;
+        *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+[[ $# -lt 1 ]] && usage
+
+STORAGE="$1"
+NAME="${2:-bench}"
+DIARY="$STORAGE/$NAME"
+ENC="$STORAGE/.$NAME"
+
+mkdir -p "$DIARY"
+
+if [[ -n "$PASSWORD" ]]; then
+    command -v encfs >/dev/null || { echo "Error: encfs not found" >&2; exit 1; }
+    mkdir -p "$ENC"
+    if [[ -f "$ENC/.encfs6.xml" ]]; then
+        echo "$PASSWORD" | encfs --stdinpass "$ENC" "$DIARY"
+    else
+        echo "$PASSWORD" | encfs --stdinpass --standard "$ENC" "$DIARY" >/dev/null
+    fi
+    trap 'fusermount -u "$DIARY"' EXIT
+else
+    # dry checks for the encrypted source even when DRY_NO_MOUNT is set
+    mkdir -p "$ENC"
+fi
+
+RANDOM=$SEED
+
+# Vocabulary for note text, so search has something to index
+WORDS=(meeting coffee train rain spectrometer garden review deadline lunch
+       release backup sunset walk bug kernel dinner call doctor paper chess
+       music guitar river mountain budget invoice holiday school project idea)
+
+# Text of roughly $1 bytes
+note_text() {
+    local want=$1 text="" word
+    while [[ ${#text} -lt $want ]]; do
+        word=${WORDS[RANDOM % ${#WORDS[@]}]}
+        text+="$word "
+        [[ $((RANDOM % 12)) -eq 0 ]] && text+=$'\n'
+    done
+    printf '%s\n' "$text"
+}
+
+# Media payload: Matroska (EBML) magic followed by zeroes
+media_blob() {
+    printf '\x1a\x45\xdf\xa3'
+    head -c $(($1 * 1024 - 4)) /dev/zero
+}
+
+days=$((YEARS * 365))
+entries=0
+start=$(date -d "-$((days - 1)) days" +%s)
+
+for ((d = 0; d < days; d++)); do
+    [[ $((RANDOM % 100)) -ge $DENSITY ]] && continue
+
+    day=$((start + d * 86400))
+    dir="$DIARY/$(date -d "@$day" +%Y/%m/%d)"
+    date=$(date -d "@$day" +%Y-%m-%d)
+    mkdir -p "$dir"
+
+    {
+        echo "* $date"
+        minute=$((8 * 60 + RANDOM % 120))
+        for ((n = 0; n < NOTES; n++)); do
+            printf '** %02d:%02d:%02d\n' $((minute / 60)) $((minute % 60)) $((RANDOM % 60))
+            note_text "$NOTE_SIZE"
+            minute=$((minute + 30 + RANDOM % 180))
+            [[ $minute -ge 1440 ]] && minute=1439
+        done
+    } > "$dir/$date.org"
+    entries=$((entries + 1))
+
+    for ((m = 0; m < MEDIA; m++)); do
+        minute=$((9 * 60 + m * 47 + RANDOM % 30))
+        [[ $minute -ge 1440 ]] && minute=1439
+        media_blob "$MEDIA_KB" > "$dir/$(printf '%s_%02d-%02d' "$date" $((minute / 60)) $((minute % 60))).mkv"
+        entries=$((entries + 1))
+    done
+done
+
+echo "Generated $entries entries over $YEARS year(s) in $DIARY" >&2
+echo "$NAME : $DIARY"
@@ -0,0 +1,142 @@
+#!/bin/bash
+#
+# Benchmark dry commands on a synthetic diary
+#
+# Usage: ./bench/run_bench.sh            (or: make bench)
+#
+# Environment:
+#   BENCH_RUNS       Runs per command (default: 10)
+#   BENCH_YEARS      Years of generated history (default: 3)
+#   BENCH_PASSWORD   Benchmark an encrypted (encfs) diary with this password
+#   BENCH_OUT        Result file (default: .build/bench.json)
+#
+# Results are written as one JSON document (min/median/mean/max wall time
+# in milliseconds per command), a summary table goes to stderr. A command
+# that fails aborts the run, so errors are never recorded as timings.
+#
+
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+PROJECT_ROOT="$(dirname "$SCRIPT_DIR")"
+DRY="$PROJECT_ROOT/.build/dry"
+BENCH_TMP="$SCRIPT_DIR/tmp"
+RUNS="${BENCH_RUNS:-10}"
+YEARS="${BENCH_YEARS:-3}"
+PASSWORD="${BENCH_PASSWORD:-}"
+OUT="${BENCH_OUT:-$PROJECT_ROOT/.build/bench.json}"
+NAME="bench"
+STORAGE="$BENCH_TMP/diaries"
+DIARY="$STORAGE/$NAME"
+
+cleanup() {
+    if [[ -n "$PASSWORD" ]] && mountpoint -q "$DIARY" 2>/dev/null; then
+        fusermount -u "$DIARY" 2>/dev/null || true
+    fi
+    rm -rf "$BENCH_TMP"
+}
+trap cleanup EXIT
+
+[[ -x "$DRY" ]] || make -C "$PROJECT_ROOT" -s >/dev/null
+
+COMMIT=$(git -C "$PROJECT_ROOT" rev-parse --short HEAD 2>/dev/null || true)
+
+rm -rf "$BENCH_TMP"
+mkdir -p "$BENCH_TMP/.dry" "$STORAGE"
+
+# Scratch home: status and the config lookup must not see the user's diaries
+export HOME="$BENCH_TMP"
+
+# Non-interactive editor for 'dry new note': appends one line
+cat > "$BENCH_TMP/editor.sh" << 'EOF'
+#!/bin/sh
+echo "benchmark entry" >> "$1"
+EOF
+chmod +x "$BENCH_TMP/editor.sh"
+
+cat > "$BENCH_TMP/.dry/dry.conf" << EOF
+default_diary = "$NAME";
+default_dir = "$STORAGE";
+text_editor = "$BENCH_TMP/editor.sh";
+pager = "cat";
+video_player = "true";
+EOF
+
+echo "Generating diary ($YEARS years)..." >&2
+if [[ -n "$PASSWORD" ]]; then
+    "$SCRIPT_DIR/gen_diary.sh" -y "$YEARS" -e "$PASSWORD" "$STORAGE" "$NAME" > "$BENCH_TMP/.dry/diaries.ref"
+    export DRY_ENCFS_PASSWORD="$PASSWORD"
+    unset DRY_NO_MOUNT
+else
+    "$SCRIPT_DIR/gen_diary.sh" -y "$YEARS" "$STORAGE" "$NAME" > "$BENCH_TMP/.dry/diaries.ref"
+    export DRY_NO_MOUNT=1
+fi
+
+ENTRIES=$(find "$DIARY" -path "$DIARY/.dry" -prune -o -type f -print | wc -l)
+DAY=$(cd "$DIARY" && find . -mindepth 3 -maxdepth 3 -type d | sort | tail -1 | cut -c3- | tr / -)
+MONTH=${DAY:0:7}
+
+RESULTS=()
+
+# bench <name> <dry args...>: time RUNS runs of a dry command
+bench() {
+    local name="$1"
+    shift
+    local times=() start end rc
+    local log="$BENCH_TMP/bench.log"
+
+    for ((i = 0; i < RUNS; i++)); do
+        start=${EPOCHREALTIME/./}
+        rc=0
+        (cd "$BENCH_TMP" && "$DRY" "$@" >"$log" 2>&1) || rc=$?
+        end=${EPOCHREALTIME/./}
+        if [[ $rc -ne 0 ]]; then
+            echo "Error: '$name' (dry $*) failed with status $rc:" >&2
+            tail -n 5 "$log" >&2
+            exit 1
+        fi
+        times+=($((end - start)))
+    done
+
+    # min, median, mean, max in microseconds
+    local sorted
+    sorted=($(printf '%s\n' "${times[@]}" | sort -n))
+    local sum=0
+    for t in "${sorted[@]}"; do sum=$((sum + t)); done
+    local min=${sorted[0]} max=${sorted[-1]}
+    local median=${sorted[$((RUNS / 2))]} mean=$((sum / RUNS))
+
+    ms() { printf '%d.%03d' $(($1 / 1000)) $(($1 % 1000)); }
+    printf '  %-22s median %9s ms   min %9s ms   max %9s ms\n' \
+        "$name" "$(ms "$median")" "$(ms "$min")" "$(ms "$max")" >&2
+    RESULTS+=("$(printf '{"name": "%s", "runs": %d, "min_ms": %s, "median_ms": %s, "mean_ms": %s, "max_ms": %s}' \
+        "$name" "$RUNS" "$(ms "$min")" "$(ms "$median")" "$(ms "$mean")" "$(ms "$max")")")
+}
+
+echo "Running benchmarks ($ENTRIES entries, $RUNS runs each)..." >&2
+bench "reindex"          reindex
+bench "list"             list
+bench "list_month"       list "$MONTH"
+bench "list_json"        list --json
+bench "show_head"        show --head "$DAY"
+bench "status"           status
+bench "search"           search coffee train
+bench "search_miss"      search nonexistentterm
+bench "new_note"         new note
+
+mkdir -p "$(dirname "$OUT")"
+{
+    printf '{\n'
+    printf '  "version": "%s",\n' "$("$DRY" -v 2>/dev/null | head -1)"
+    printf '  "commit": "%s",\n' "$COMMIT"
+    printf '  "date": "%s",\n' "$(date -u +%Y-%m-%dT%H:%M:%SZ)"
+    printf '  "diary": {"years": %d, "entries": %d, "encrypted": %s},\n' \
+        "$YEARS" "$ENTRIES" "$([[ -n "$PASSWORD" ]] && echo true || echo false)"
+    printf '  "results": [\n'
+    for ((i = 0; i < ${#RESULTS[@]}; i++)); do
+        printf '    %s%s\n' "${RESULTS[i]}" "$([[ $i -lt $((${#RESULTS[@]} - 1)) ]] && echo ,)"
+    done
+    printf '  ]\n}\n'
+} > "$OUT"
+
+echo "Results written to $OUT" >&2
@@ -0,0 +1,137 @@
+/*
+ * agent.c - Mount lease agent client implementation (the server is in agentd.c)
+ *
+ * Protocol (one line per request, one "OK" or "ERR" line per reply):
+ *   ACQUIRE <mount_point>   take a lease, held until RELEASE or disconnect
+ *   RELEASE <mount_point>   give the lease back, mount stays until idle
+ *   FORGET <mount_point>    stop managing the mount (lock/unlock)
+ *   STOP                    unmount everything and exit
+ *
+ * Mounting itself is always done by the dry command (encfs may need to
+ * prompt for the password on its terminal); the agent only unmounts.
+ */
+#include "agent.h"
+#include "config.h"
+#include "utils.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Connection of this process to the agent while it holds a lease */
+static int lease_fd = -1;
+static char lease_mount[2048];
+
+/* Starts the agent when a lease finds none running */
+static int (*spawn_agent)(void);
+
+void agent_socket_path(char *path, size_t size) {
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  if (runtime != NULL && runtime[0] != '\0') {
+    snprintf(path, size, "%s/dry-agent.sock", runtime);
+  } else {
+    struct passwd *pw = getpwuid(getuid());
+    snprintf(path, size, "%s/.dry/agent.sock", pw->pw_dir);
+  }
+}
+
+int agent_enabled(void) {
+  return get_config() != NULL && get_config()->agent_idle > 0;
+}
+
+void agent_set_spawn(int (*spawn)(void)) {
+  spawn_agent = spawn;
+}
+
+int agent_connect(void) {
+  struct sockaddr_un addr = {0};
+  int fd;
+
+  addr.sun_family = AF_UNIX;
+  agent_socket_path(addr.sun_path, sizeof(addr.sun_path));
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Send one request and wait for the reply. Returns 0 on "OK". */
+static int agent_request(int fd, const char *verb, const char *arg) {
+  char line[2200];
+  char reply[16];
+  ssize_t n;
+
+  snprintf(line, sizeof(line), "%s%s%s\n", verb, arg ? " " : "", arg ? arg : "");
+  if (write(fd, line, strlen(line)) != (ssize_t)strlen(line))
+    return 1;
+
+  n = read(fd, reply, sizeof(reply) - 1);
+  if (n <= 0)
+    return 1;
+  reply[n] = '\0';
+  return strncmp(reply, "OK", 2) != 0;
+}
+
+int agent_acquire(const char *mount_point) {
+  if (!agent_enabled())
+    return 1;
+
+  if (lease_fd >= 0 && strcmp(lease_mount, mount_point) == 0)
+    return 0;
+
+  int fd = agent_connect();
+  if (fd < 0) {
+    if (spawn_agent == NULL || spawn_agent() != 0)
+      return 1;
+    fd = agent_connect();
+    if (fd < 0)
+      return 1;
+  }
+
+  if (agent_request(fd, "ACQUIRE", mount_point) != 0) {
+    close(fd);
+    return 1;
+  }
+
+  if (lease_fd >= 0)
+    close(lease_fd);
+  lease_fd = fd;
+  snprintf(lease_mount, sizeof(lease_mount), "%s", mount_point);
+  return 0;
+}
+
+int agent_release(const char *mount_point) {
+  if (lease_fd < 0 || strcmp(lease_mount, mount_point) != 0)
+    return 1;
+
+  agent_request(lease_fd, "RELEASE", mount_point);
+  close(lease_fd);
+  lease_fd = -1;
+  lease_mount[0] = '\0';
+  return 0;
+}
+
+void agent_forget(const char *mount_point) {
+  int fd = lease_fd >= 0 ? lease_fd : agent_connect();
+  if (fd < 0)
+    return;
+
+  agent_request(fd, "FORGET", mount_point);
+  close(fd);
+  if (fd == lease_fd) {
+    lease_fd = -1;
+    lease_mount[0] = '\0';
+  }
+}
+
+int agent_stop(void) {
+  int fd = agent_connect();
+  if (fd < 0)
+    return 1;
+  agent_request(fd, "STOP", NULL);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * agent.h - Mount lease agent
+ *
+ * An optional background process that keeps diaries mounted between dry
+ * invocations. Commands take a lease on a mount point over a Unix socket
+ * instead of unmounting it; the agent unmounts it after it has been idle
+ * (no leases) for agent_idle seconds.
+ *
+ * The client side (agent.c) is part of libdry; running and starting the
+ * agent (agentd.c) is left to dry, as it forks.
+ */
+#ifndef AGENT_H
+#define AGENT_H
+
+#include "dry.h"
+
+/* Check whether the agent is enabled in the configuration */
+int agent_enabled(void);
+
+/*
+ * Set the function that starts the agent in the background when a lease
+ * finds none running (agent_spawn() in dry). Without one, leases are only
+ * taken from an agent that is already running.
+ */
+void agent_set_spawn(int (*spawn)(void));
+
+/*
+ * Take a lease on a mounted diary, starting the agent if needed.
+ * The lease lasts until agent_release() or process exit.
+ * Returns 0 if the agent now holds the mount.
+ */
+int agent_acquire(const char *mount_point);
+
+/*
+ * Give the lease on mount_point back to the agent, which will unmount it
+ * once idle. Returns 0 if a lease was held (the caller must not unmount).
+ */
+int agent_release(const char *mount_point);
+
+/* Tell the agent to stop managing a mount point (dry lock / dry unlock) */
+void agent_forget(const char *mount_point);
+
+/* Ask a running agent to unmount everything and exit. Returns 0 if one was running. */
+int agent_stop(void);
+
+/* Path of the agent socket */
+void agent_socket_path(char *path, size_t size);
+
+/* Connect to the running agent. Returns the socket, -1 if none is running. */
+int agent_connect(void);
+
+/* Run the agent in the foreground. Returns exit status. */
+int agent_serve(int idle);
+
+/* Start the agent in the background and wait for its socket. Returns 0 on success. */
+int agent_spawn(void);
+
+#endif /* AGENT_H */
@@ -0,0 +1,239 @@
+/*
+ * agentd.c - Mount lease agent server (protocol in agent.c)
+ */
+#include "agent.h"
+#include "config.h"
+#include "proc.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define AGENT_MAX_CLIENTS 64
+#define AGENT_MAX_MOUNTS 32
+
+/* Mount point tracked by the agent */
+typedef struct {
+  char mount[2048];
+  int leases;
+  time_t idle_since;
+} AGENT_MOUNT;
+
+/* Client connection of the agent */
+typedef struct {
+  int fd;
+  char buf[4096];
+  size_t len;
+  char lease[2048];   /* mount point the client holds a lease on, "" if none */
+} AGENT_CLIENT;
+
+/* Start the agent in the background and wait for its socket */
+int agent_spawn(void) {
+  pid_t pid = fork();
+  if (pid < 0)
+    return 1;
+
+  if (pid == 0) {
+    /* detach: new session, no terminal, double fork so we are reparented */
+    setsid();
+    if (fork() != 0)
+      _exit(0);
+    int null = open("/dev/null", O_RDWR);
+    if (null >= 0) {
+      dup2(null, STDIN_FILENO);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+      if (null > STDERR_FILENO)
+        close(null);
+    }
+    _exit(agent_serve(get_config()->agent_idle));
+  }
+
+  waitpid(pid, NULL, 0);
+
+  /* wait up to ~1s for the socket to appear */
+  for (int i = 0; i < 100; i++) {
+    int fd = agent_connect();
+    if (fd >= 0) {
+      close(fd);
+      return 0;
+    }
+    usleep(10000);
+  }
+  return 1;
+}
+
+static AGENT_MOUNT *find_mount(AGENT_MOUNT *mounts, int count, const char *mount) {
+  for (int i = 0; i < count; i++)
+    if (strcmp(mounts[i].mount, mount) == 0)
+      return &mounts[i];
+  return NULL;
+}
+
+static void unmount(const char *mount) {
+  char *fusermount[] = {"fusermount", "-u", (char *)mount, NULL};
+
+  if (!is_mount_point(mount))
+    return;
+
+  if (proc_run(fusermount, 0) == 0)
+    rmdir(mount);
+}
+
+static void drop_lease(AGENT_MOUNT *mounts, int count, AGENT_CLIENT *c) {
+  if (c->lease[0] == '\0')
+    return;
+  AGENT_MOUNT *m = find_mount(mounts, count, c->lease);
+  if (m != NULL && m->leases > 0 && --m->leases == 0)
+    m->idle_since = time(NULL);
+  c->lease[0] = '\0';
+}
+
+int agent_serve(int idle) {
+  struct sockaddr_un addr = {0};
+  AGENT_CLIENT clients[AGENT_MAX_CLIENTS];
+  AGENT_MOUNT mounts[AGENT_MAX_MOUNTS];
+  struct pollfd pfds[AGENT_MAX_CLIENTS + 1];
+  int nclients = 0, nmounts = 0;
+  int running = 1;
+  time_t last_activity = time(NULL);
+  int sock;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  addr.sun_family = AF_UNIX;
+  agent_socket_path(addr.sun_path, sizeof(addr.sun_path));
+
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0)
+    return EXIT_FAILURE;
+
+  /* remove a stale socket, but never steal it from a live agent */
+  int probe = agent_connect();
+  if (probe >= 0) {
+    close(probe);
+    msg_error("agent already running on %s", addr.sun_path);
+    close(sock);
+    return EXIT_FAILURE;
+  }
+  unlink(addr.sun_path);
+
+  mode_t old_mask = umask(0077);
+  int rc = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+  umask(old_mask);
+  if (rc != 0 || listen(sock, 16) != 0) {
+    msg_error("can't listen on %s: %s", addr.sun_path, strerror(errno));
+    close(sock);
+    return EXIT_FAILURE;
+  }
+
+  while (running) {
+    /* while full, leave new connections in the backlog instead of spinning on them */
+    pfds[0].fd = nclients < AGENT_MAX_CLIENTS ? sock : -1;
+    pfds[0].events = POLLIN;
+    for (int i = 0; i < nclients; i++) {
+      pfds[i + 1].fd = clients[i].fd;
+      pfds[i + 1].events = POLLIN;
+    }
+
+    int polled = nclients;
+    int ready = poll(pfds, polled + 1, 1000);
+    time_t now = time(NULL);
+
+    if (ready > 0 && (pfds[0].revents & POLLIN)) {
+      int fd = accept(sock, NULL, NULL);
+      if (fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        memset(&clients[nclients], 0, sizeof(AGENT_CLIENT));
+        clients[nclients++].fd = fd;
+        last_activity = now;
+      }
+    }
+
+    /* backwards, so removing a client only moves an already handled one */
+    for (int i = polled - 1; ready > 0 && i >= 0; i--) {
+      AGENT_CLIENT *c = &clients[i];
+      if (!(pfds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+
+      ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len - 1);
+      if (n <= 0) {
+        /* disconnect releases the lease (e.g. the command crashed) */
+        drop_lease(mounts, nmounts, c);
+        close(c->fd);
+        clients[i] = clients[--nclients];
+        continue;
+      }
+      c->len += n;
+      c->buf[c->len] = '\0';
+      last_activity = now;
+
+      char *eol;
+      while ((eol = strchr(c->buf, '\n')) != NULL) {
+        *eol = '\0';
+        char *arg = strchr(c->buf, ' ');
+        const char *reply = "OK\n";
+        if (arg != NULL)
+          *arg++ = '\0';
+
+        if (strcmp(c->buf, "ACQUIRE") == 0 && arg != NULL) {
+          AGENT_MOUNT *m = find_mount(mounts, nmounts, arg);
+          if (m == NULL && nmounts < AGENT_MAX_MOUNTS) {
+            m = &mounts[nmounts++];
+            snprintf(m->mount, sizeof(m->mount), "%s", arg);
+            m->leases = 0;
+          }
+          if (m != NULL) {
+            drop_lease(mounts, nmounts, c);
+            m->leases++;
+            snprintf(c->lease, sizeof(c->lease), "%s", arg);
+          } else {
+            reply = "ERR\n";
+          }
+        } else if (strcmp(c->buf, "RELEASE") == 0) {
+          drop_lease(mounts, nmounts, c);
+        } else if (strcmp(c->buf, "FORGET") == 0 && arg != NULL) {
+          AGENT_MOUNT *m = find_mount(mounts, nmounts, arg);
+          if (strcmp(c->lease, arg) == 0)
+            c->lease[0] = '\0';
+          if (m != NULL)
+            *m = mounts[--nmounts];
+        } else if (strcmp(c->buf, "STOP") == 0) {
+          running = 0;
+        } else {
+          reply = "ERR\n";
+        }
+
+        if (write(c->fd, reply, strlen(reply)) < 0)
+          break;
+        c->len -= (eol + 1 - c->buf);
+        memmove(c->buf, eol + 1, c->len + 1);
+      }
+    }
+
+    /* unmount diaries that have been idle long enough */
+    for (int i = nmounts - 1; i >= 0; i--) {
+      if (mounts[i].leases == 0 && now - mounts[i].idle_since >= idle) {
+        unmount(mounts[i].mount);
+        mounts[i] = mounts[--nmounts];
+      }
+    }
+
+    /* nothing left to manage: go away */
+    if (nmounts == 0 && nclients == 0 && now - last_activity >= idle)
+      running = 0;
+  }
+
+  /* lock everything on the way out */
+  for (int i = 0; i < nmounts; i++)
+    unmount(mounts[i].mount);
+  for (int i = 0; i < nclients; i++)
+    close(clients[i].fd);
+
+  close(sock);
+  unlink(addr.sun_path);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,663 @@
+/*
+ * backup.c - Incremental backup implementation
+ *
+ * A changed file is rebuilt next to its previous copy (the basis): the
+ * basis is cut into BLOCK_SIZE blocks, each with a weak rolling checksum
+ * and a strong one (the first bytes of its SHA-256). The new file is then
+ * scanned with a window that rolls one byte at a time; windows matching a
+ * basis block are copied from the basis, everything else is copied from
+ * the tree. The result is renamed over the basis once complete, so an
+ * interrupted backup leaves the previous copy in place.
+ */
+#define _GNU_SOURCE
+#include "backup.h"
+#include "sha256.h"
+#include "utils.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#define MANIFEST_HEADER "dry-backup 1"
+#define BLOCK_SIZE 2048
+#define STRONG_LEN 16
+#define SCAN_SIZE (1 << 20)
+#define COPY_SIZE (1 << 16)
+
+typedef struct {
+  char type;              /* 'f' or 'l' */
+  long long size;
+  long long mtime;        /* nanoseconds */
+  char *sum;              /* sha256 hex, or link target */
+  char *path;             /* relative to the tree */
+} BACKUP_ENTRY;
+
+typedef struct {
+  BACKUP_ENTRY *items;
+  int count;
+  int cap;
+} BACKUP_LIST;
+
+typedef struct {
+  uint32_t weak;
+  unsigned char strong[STRONG_LEN];
+} BLOCK_SUM;
+
+typedef struct {
+  BLOCK_SUM *blocks;
+  long long count;
+  long long *slots;       /* open addressing on weak, block index + 1 */
+  size_t mask;
+} SIGNATURE;
+
+static void list_free(BACKUP_LIST *list) {
+  for (int i = 0; i < list->count; i++) {
+    free(list->items[i].sum);
+    free(list->items[i].path);
+  }
+  free(list->items);
+  memset(list, 0, sizeof(*list));
+}
+
+static BACKUP_ENTRY *list_add(BACKUP_LIST *list, char type, const char *path) {
+  if (list->count == list->cap) {
+    int cap = list->cap ? list->cap * 2 : 256;
+    BACKUP_ENTRY *items = realloc(list->items, cap * sizeof(BACKUP_ENTRY));
+    if (items == NULL)
+      return NULL;
+    list->items = items;
+    list->cap = cap;
+  }
+  BACKUP_ENTRY *e = &list->items[list->count];
+  memset(e, 0, sizeof(*e));
+  e->type = type;
+  if ((e->path = strdup(path)) == NULL)
+    return NULL;
+  list->count++;
+  return e;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+  return strcmp(((const BACKUP_ENTRY *)a)->path, ((const BACKUP_ENTRY *)b)->path);
+}
+
+static BACKUP_ENTRY *list_find(const BACKUP_LIST *list, const char *path) {
+  BACKUP_ENTRY key = {.path = (char *)path};
+  return bsearch(&key, list->items, list->count, sizeof(BACKUP_ENTRY), entry_cmp);
+}
+
+/* Paths with tabs or newlines cannot be written to the manifest */
+static int manifest_safe(const char *s) {
+  return strpbrk(s, "\t\n") == NULL;
+}
+
+static int manifest_load(const char *manifest, BACKUP_LIST *list) {
+  FILE *fp = fopen(manifest, "r");
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  int rc = 0;
+
+  if (fp == NULL)
+    return errno == ENOENT ? 0 : 1;
+
+  if ((len = getline(&line, &cap, fp)) < 0 || strncmp(line, MANIFEST_HEADER "\n", len) != 0) {
+    fprintf(stderr, "Error: %s is not a backup manifest\n", manifest);
+    rc = 1;
+  }
+  while (rc == 0 && (len = getline(&line, &cap, fp)) > 0) {
+    char *fields[5];
+    char *p = line;
+
+    if (line[len - 1] == '\n')
+      line[len - 1] = '\0';
+    for (int i = 0; i < 5; i++) {
+      fields[i] = p;
+      if (i < 4 && (p = strchr(p, '\t')) != NULL)
+        *p++ = '\0';
+      if (p == NULL)
+        break;
+    }
+    if (p == NULL || (fields[0][0] != 'f' && fields[0][0] != 'l') || fields[4][0] == '\0') {
+      fprintf(stderr, "Error: malformed line in %s\n", manifest);
+      rc = 1;
+      break;
+    }
+    BACKUP_ENTRY *e = list_add(list, fields[0][0], fields[4]);
+    if (e == NULL || (e->sum = strdup(fields[3])) == NULL) {
+      rc = 1;
+      break;
+    }
+    e->size = atoll(fields[1]);
+    e->mtime = atoll(fields[2]);
+  }
+  free(line);
+  fclose(fp);
+  qsort(list->items, list->count, sizeof(BACKUP_ENTRY), entry_cmp);
+  return rc;
+}
+
+static int manifest_save(const char *manifest, const BACKUP_LIST *list) {
+  char tmp[4200];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", manifest);
+
+  FILE *fp = fopen(tmp, "w");
+  if (fp == NULL)
+    return 1;
+  fprintf(fp, "%s\n", MANIFEST_HEADER);
+  for (int i = 0; i < list->count; i++) {
+    const BACKUP_ENTRY *e = &list->items[i];
+    if (e->sum != NULL)
+      fprintf(fp, "%c\t%lld\t%lld\t%s\t%s\n", e->type, e->size, e->mtime, e->sum, e->path);
+  }
+  if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+    fclose(fp);
+    unlink(tmp);
+    return 1;
+  }
+  if (fclose(fp) != 0 || rename(tmp, manifest) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+  return 0;
+}
+
+/* Collect the files and links below root/rel */
+static void scan_tree(const char *root, const char *rel, BACKUP_LIST *list, BACKUP_STATS *stats) {
+  char dir[4200];
+  snprintf(dir, sizeof(dir), "%s%s%s", root, *rel ? "/" : "", rel);
+
+  DIR *d = opendir(dir);
+  if (d == NULL) {
+    fprintf(stderr, "Error: cannot read %s: %s\n", dir, strerror(errno));
+    stats->failed++;
+    return;
+  }
+
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL) {
+    char path[4200], full[4200], target[4096];
+    struct stat st;
+
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+      continue;
+    if (snprintf(path, sizeof(path), "%s%s%s", rel, *rel ? "/" : "", de->d_name) >= (int)sizeof(path) ||
+        snprintf(full, sizeof(full), "%s/%s", root, path) >= (int)sizeof(full) ||
+        lstat(full, &st) != 0)
+      continue;
+    if (!manifest_safe(path)) {
+      fprintf(stderr, "Warning: skipping %s (unsupported name)\n", full);
+      stats->failed++;
+      continue;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+      scan_tree(root, path, list, stats);
+    } else if (S_ISREG(st.st_mode)) {
+      BACKUP_ENTRY *e = list_add(list, 'f', path);
+      if (e != NULL) {
+        e->size = st.st_size;
+        e->mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+      }
+    } else if (S_ISLNK(st.st_mode)) {
+      ssize_t n = readlink(full, target, sizeof(target) - 1);
+      if (n < 0)
+        continue;
+      target[n] = '\0';
+      if (!manifest_safe(target)) {
+        fprintf(stderr, "Warning: skipping %s (unsupported link)\n", full);
+        stats->failed++;
+        continue;
+      }
+      BACKUP_ENTRY *e = list_add(list, 'l', path);
+      if (e != NULL)
+        e->sum = strdup(target);
+    }
+  }
+  closedir(d);
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return 1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Read up to len bytes, short only at end of file */
+static ssize_t read_full(int fd, void *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = read(fd, (char *)buf + done, len - done);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    done += n;
+  }
+  return done;
+}
+
+static void strong_sum(const unsigned char *p, unsigned char out[STRONG_LEN]) {
+  SHA256_STATE s;
+  unsigned char digest[SHA256_DIGEST_LEN];
+
+  sha256_init(&s);
+  sha256_update(&s, p, BLOCK_SIZE);
+  sha256_final(&s, digest);
+  memcpy(out, digest, STRONG_LEN);
+}
+
+/* a: sum of the bytes, b: sum weighted by distance to the window end */
+static void weak_init(const unsigned char *p, uint32_t *a, uint32_t *b) {
+  *a = *b = 0;
+  for (int i = 0; i < BLOCK_SIZE; i++) {
+    *a += p[i];
+    *b += (uint32_t)(BLOCK_SIZE - i) * p[i];
+  }
+}
+
+static uint32_t weak_sum(uint32_t a, uint32_t b) {
+  return (a & 0xffff) | (b << 16);
+}
+
+static void signature_free(SIGNATURE *sig) {
+  free(sig->blocks);
+  free(sig->slots);
+}
+
+/* Checksum every whole block of the basis */
+static int signature_build(int fd, long long size, SIGNATURE *sig) {
+  unsigned char block[BLOCK_SIZE];
+  size_t slots = 16;
+
+  memset(sig, 0, sizeof(*sig));
+  sig->count = size / BLOCK_SIZE;
+  while (slots < (size_t)sig->count * 2)
+    slots *= 2;
+  sig->blocks = malloc(sig->count * sizeof(BLOCK_SUM));
+  sig->slots = calloc(slots, sizeof(long long));
+  sig->mask = slots - 1;
+  if (sig->blocks == NULL || sig->slots == NULL) {
+    signature_free(sig);
+    return 1;
+  }
+
+  for (long long i = 0; i < sig->count; i++) {
+    uint32_t a, b;
+
+    if (read_full(fd, block, BLOCK_SIZE) != BLOCK_SIZE) {
+      signature_free(sig);
+      return 1;
+    }
+    weak_init(block, &a, &b);
+    sig->blocks[i].weak = weak_sum(a, b);
+    strong_sum(block, sig->blocks[i].strong);
+
+    size_t slot = sig->blocks[i].weak & sig->mask;
+    while (sig->slots[slot] != 0)
+      slot = (slot + 1) & sig->mask;
+    sig->slots[slot] = i + 1;
+  }
+  return 0;
+}
+
+/* Index of the basis block equal to the window at p, or -1 */
+static long long signature_match(const SIGNATURE *sig, uint32_t weak, const unsigned char *p) {
+  unsigned char strong[STRONG_LEN];
+  int have_strong = 0;
+
+  for (size_t slot = weak & sig->mask; sig->slots[slot] != 0; slot = (slot + 1) & sig->mask) {
+    long long i = sig->slots[slot] - 1;
+    if (sig->blocks[i].weak != weak)
+      continue;
+    if (!have_strong) {
+      strong_sum(p, strong);
+      have_strong = 1;
+    }
+    if (memcmp(sig->blocks[i].strong, strong, STRONG_LEN) == 0)
+      return i;
+  }
+  return -1;
+}
+
+/* Copy in to out whole, hashing on the way */
+static int copy_full(int in, int out, SHA256_STATE *sha, BACKUP_STATS *stats) {
+  char *buf = malloc(COPY_SIZE);
+  ssize_t n;
+  int rc = 0;
+
+  if (buf == NULL)
+    return 1;
+  while ((n = read_full(in, buf, COPY_SIZE)) > 0) {
+    sha256_update(sha, buf, n);
+    if (write_all(out, buf, n) != 0) {
+      rc = 1;
+      break;
+    }
+    stats->literal += n;
+  }
+  free(buf);
+  return rc || n < 0;
+}
+
+/* Rebuild in into out from the blocks of basis it still contains */
+static int copy_delta(int in, int basis, long long basis_size, int out, SHA256_STATE *sha,
+                      BACKUP_STATS *stats) {
+  SIGNATURE sig;
+  unsigned char block[BLOCK_SIZE];
+  size_t have = 0, pos = 0, lit = 0;
+  uint32_t a = 0, b = 0;
+  int fresh = 1, eof = 0, rc = 0;
+
+  if (signature_build(basis, basis_size, &sig) != 0)
+    return 1;
+  unsigned char *buf = malloc(SCAN_SIZE + BLOCK_SIZE);
+  if (buf == NULL) {
+    signature_free(&sig);
+    return 1;
+  }
+
+  for (;;) {
+    if (have - pos < BLOCK_SIZE && !eof) {
+      /* flush pending literal bytes and refill behind the window */
+      if (write_all(out, buf + lit, pos - lit) != 0) {
+        rc = 1;
+        break;
+      }
+      stats->literal += pos - lit;
+      memmove(buf, buf + pos, have - pos);
+      have -= pos;
+      pos = lit = 0;
+
+      ssize_t n = read_full(in, buf + have, SCAN_SIZE + BLOCK_SIZE - have);
+      if (n < 0) {
+        rc = 1;
+        break;
+      }
+      if (n < (ssize_t)(SCAN_SIZE + BLOCK_SIZE - have))
+        eof = 1;
+      sha256_update(sha, buf + have, n);
+      have += n;
+      continue;
+    }
+    if (have - pos < BLOCK_SIZE)
+      break;
+
+    if (fresh) {
+      weak_init(buf + pos, &a, &b);
+      fresh = 0;
+    }
+    long long i = signature_match(&sig, weak_sum(a, b), buf + pos);
+    if (i >= 0) {
+      if (write_all(out, buf + lit, pos - lit) != 0 ||
+          pread(basis, block, BLOCK_SIZE, i * BLOCK_SIZE) != BLOCK_SIZE ||
+          write_all(out, block, BLOCK_SIZE) != 0) {
+        rc = 1;
+        break;
+      }
+      stats->literal += pos - lit;
+      stats->matched += BLOCK_SIZE;
+      pos += BLOCK_SIZE;
+      lit = pos;
+      fresh = 1;
+      continue;
+    }
+
+    /* roll the window one byte forward */
+    if (pos + BLOCK_SIZE < have) {
+      uint32_t x = buf[pos], y = buf[pos + BLOCK_SIZE];
+      a += y - x;
+      b += a - (uint32_t)BLOCK_SIZE * x;
+    } else {
+      fresh = 1;
+    }
+    pos++;
+  }
+
+  if (rc == 0) {
+    rc = write_all(out, buf + lit, have - lit);
+    stats->literal += have - lit;
+  }
+  free(buf);
+  signature_free(&sig);
+  return rc;
+}
+
+static int make_parent(const char *path) {
+  char dir[4200];
+  snprintf(dir, sizeof(dir), "%s", path);
+  char *slash = strrchr(dir, '/');
+  if (slash == NULL || slash == dir)
+    return 0;
+  *slash = '\0';
+  return make_dirs(dir, 0700);
+}
+
+static int backup_link(const char *dpath, const BACKUP_ENTRY *e) {
+  char tmp[4200];
+  snprintf(tmp, sizeof(tmp), "%s.dry-backup", dpath);
+
+  unlink(tmp);
+  if (make_parent(dpath) != 0 || symlink(e->sum, tmp) != 0)
+    return 1;
+  if (rename(tmp, dpath) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+  return 0;
+}
+
+/* Write the file at spath to dpath, from the previous copy where possible */
+static int backup_file(const char *spath, const char *dpath, BACKUP_ENTRY *e, BACKUP_STATS *stats) {
+  char tmp[4200];
+  unsigned char digest[SHA256_DIGEST_LEN];
+  char hex[SHA256_HEX_LEN];
+  SHA256_STATE sha;
+  struct stat st, bst;
+  int rc;
+
+  int in = open(spath, O_RDONLY | O_CLOEXEC);
+  if (in < 0)
+    return 1;
+  if (fstat(in, &st) != 0 || make_parent(dpath) != 0) {
+    close(in);
+    return 1;
+  }
+
+  snprintf(tmp, sizeof(tmp), "%s.dry-backup-XXXXXX", dpath);
+  int out = mkstemp(tmp);
+  if (out < 0) {
+    close(in);
+    return 1;
+  }
+
+  sha256_init(&sha);
+  int basis = open(dpath, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (basis >= 0 && fstat(basis, &bst) == 0 && S_ISREG(bst.st_mode) && bst.st_size >= BLOCK_SIZE)
+    rc = copy_delta(in, basis, bst.st_size, out, &sha, stats);
+  else
+    rc = copy_full(in, out, &sha, stats);
+  if (basis >= 0)
+    close(basis);
+  close(in);
+
+  /* the copy carries the mtime of the tree, for the quick check */
+  struct timespec times[2] = {st.st_mtim, st.st_mtim};
+  if (rc != 0 || fchmod(out, st.st_mode & 07777) != 0 || futimens(out, times) != 0 ||
+      fsync(out) != 0) {
+    close(out);
+    unlink(tmp);
+    return 1;
+  }
+  if (close(out) != 0 || rename(tmp, dpath) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+
+  sha256_final(&sha, digest);
+  sha256_hex(digest, hex);
+  free(e->sum);
+  e->sum = strdup(hex);
+  e->size = st.st_size;
+  e->mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  return e->sum == NULL;
+}
+
+/* The mirror still holds the previous copy of a file that failed, if any */
+static void keep_previous(BACKUP_ENTRY *e, const BACKUP_ENTRY *prev) {
+  free(e->sum);
+  e->sum = NULL;
+  if (prev != NULL && prev->type == e->type) {
+    e->size = prev->size;
+    e->mtime = prev->mtime;
+    e->sum = strdup(prev->sum);
+  }
+}
+
+int backup_run(const char *src, const char *dest, const char *manifest, BACKUP_STATS *stats) {
+  BACKUP_LIST old = {0}, tree = {0};
+  char spath[8400], dpath[8400];
+
+  memset(stats, 0, sizeof(*stats));
+  if (manifest_load(manifest, &old) != 0) {
+    list_free(&old);
+    return 1;
+  }
+  if (make_dirs(dest, 0700) != 0) {
+    fprintf(stderr, "Error: cannot create %s: %s\n", dest, strerror(errno));
+    list_free(&old);
+    return 1;
+  }
+
+  scan_tree(src, "", &tree, stats);
+  qsort(tree.items, tree.count, sizeof(BACKUP_ENTRY), entry_cmp);
+
+  for (int i = 0; i < tree.count; i++) {
+    BACKUP_ENTRY *e = &tree.items[i];
+    BACKUP_ENTRY *prev = list_find(&old, e->path);
+    struct stat st;
+
+    snprintf(spath, sizeof(spath), "%s/%s", src, e->path);
+    snprintf(dpath, sizeof(dpath), "%s/%s", dest, e->path);
+    stats->files++;
+    stats->bytes += e->size;
+
+    int present = lstat(dpath, &st) == 0;
+    if (prev != NULL && prev->type == e->type && present) {
+      if (e->type == 'l' && S_ISLNK(st.st_mode) && strcmp(prev->sum, e->sum) == 0) {
+        stats->unchanged++;
+        continue;
+      }
+      if (e->type == 'f' && S_ISREG(st.st_mode) && prev->size == e->size &&
+          prev->mtime == e->mtime && st.st_size == e->size) {
+        e->sum = strdup(prev->sum);
+        stats->unchanged++;
+        continue;
+      }
+    }
+
+    int rc = 1;
+    if (present && S_ISDIR(st.st_mode))
+      fprintf(stderr, "Error: %s is a directory in the backup\n", dpath);
+    else if ((rc = e->type == 'l' ? backup_link(dpath, e) : backup_file(spath, dpath, e, stats)) != 0)
+      fprintf(stderr, "Error: cannot back up %s: %s\n", spath, strerror(errno));
+    if (rc != 0) {
+      keep_previous(e, prev);
+      stats->failed++;
+      continue;
+    }
+    stats->copied++;
+  }
+
+  /* drop what left the tree */
+  for (int i = 0; i < old.count; i++) {
+    if (list_find(&tree, old.items[i].path) != NULL)
+      continue;
+    snprintf(dpath, sizeof(dpath), "%s/%s", dest, old.items[i].path);
+    if (unlink(dpath) == 0 || errno == ENOENT)
+      stats->removed++;
+  }
+
+  int rc = manifest_save(manifest, &tree);
+  if (rc != 0)
+    fprintf(stderr, "Error: cannot write %s: %s\n", manifest, strerror(errno));
+  list_free(&old);
+  list_free(&tree);
+  return rc;
+}
+
+static int verify_file(const char *path, const BACKUP_ENTRY *e) {
+  unsigned char digest[SHA256_DIGEST_LEN];
+  char hex[SHA256_HEX_LEN];
+  SHA256_STATE sha;
+  long long size = 0;
+  ssize_t n;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd < 0)
+    return 1;
+  char *buf = malloc(COPY_SIZE);
+  if (buf == NULL) {
+    close(fd);
+    return 1;
+  }
+  sha256_init(&sha);
+  while ((n = read_full(fd, buf, COPY_SIZE)) > 0) {
+    sha256_update(&sha, buf, n);
+    size += n;
+  }
+  free(buf);
+  close(fd);
+  if (n < 0)
+    return 1;
+  sha256_final(&sha, digest);
+  sha256_hex(digest, hex);
+  return size != e->size || strcmp(hex, e->sum) != 0;
+}
+
+int backup_verify(const char *dest, const char *manifest, BACKUP_STATS *stats) {
+  BACKUP_LIST list = {0};
+  char path[8400], target[4096];
+
+  memset(stats, 0, sizeof(*stats));
+  if (access(manifest, F_OK) != 0) {
+    fprintf(stderr, "Error: no backup manifest at %s\n", manifest);
+    return 1;
+  }
+  if (manifest_load(manifest, &list) != 0) {
+    list_free(&list);
+    return 1;
+  }
+
+  for (int i = 0; i < list.count; i++) {
+    const BACKUP_ENTRY *e = &list.items[i];
+    int bad;
+
+    snprintf(path, sizeof(path), "%s/%s", dest, e->path);
+    stats->files++;
+    if (e->type == 'l') {
+      ssize_t n = readlink(path, target, sizeof(target) - 1);
+      bad = n < 0 || (target[n] = '\0', strcmp(target, e->sum) != 0);
+    } else {
+      bad = verify_file(path, e);
+      stats->bytes += e->size;
+    }
+    if (bad) {
+      fprintf(stderr, "Mismatch: %s%s\n", e->path, access(path, F_OK) != 0 ? " (missing)" : "");
+      stats->failed++;
+    }
+  }
+  list_free(&list);
+  return 0;
+}
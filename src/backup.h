@@ -0,0 +1,46 @@
+/*
+ * backup.h - Incremental backup of a diary's encrypted tree
+ *
+ * The ciphertext (the encfs source directory, or a native diary as it is
+ * on disk) is mirrored into a local directory, so a backup never needs the
+ * diary to be unlocked. A manifest next to the mirror lists every file:
+ *
+ *   dry-backup 1
+ *   <type>\t<size>\t<mtime ns>\t<sha256 | link target>\t<path>
+ *
+ * (type f: file, l: symbolic link). Files whose size and mtime match the
+ * manifest are skipped without being read. Changed files are rebuilt from
+ * their previous copy with rolling-checksum deltas (as rsync does), so an
+ * appended note costs its new blocks only; new files are copied whole.
+ * The manifest keeps the SHA-256 of each file for verification.
+ */
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include "dry.h"
+
+typedef struct {
+  int files;              /* files and links in the tree */
+  int copied;             /* new or changed files written */
+  int unchanged;          /* files skipped */
+  int removed;            /* files gone from the tree, removed from the mirror */
+  int failed;             /* files that could not be backed up or verified */
+  long long bytes;        /* size of the tree */
+  long long literal;      /* bytes copied from the tree */
+  long long matched;      /* bytes reused from previous copies */
+} BACKUP_STATS;
+
+/*
+ * Bring the mirror dest and its manifest up to date with the tree at src.
+ * Returns 0 on success (see stats.failed for files that were skipped).
+ */
+int backup_run(const char *src, const char *dest, const char *manifest, BACKUP_STATS *stats);
+
+/*
+ * Check every file of the mirror dest against the manifest. Mismatches are
+ * reported on stderr and counted in stats.failed. Returns 0 if the manifest
+ * could be read.
+ */
+int backup_verify(const char *dest, const char *manifest, BACKUP_STATS *stats);
+
+#endif /* BACKUP_H */
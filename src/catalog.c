@@ -0,0 +1,875 @@
+/*
+ * catalog.c - Persistent per-diary entry catalog implementation
+ *
+ * The catalog lives in the diary metadata directory (inside the encrypted
+ * mount) and holds one record per entry, grouped by day:
+ *
+ *   D <date> <dir_mtime>
+ *   E <id> <type> <size> <mtime> <link>
+ *
+ *   J <journal id> <offset>
+ *
+ * Fields are tab separated. Listing and showing entries only needs a single
+ * sequential read of this file instead of walking the YYYY/MM/DD tree.
+ *
+ * The change journal (.dry/catalog.journal) is kept by a watcher, which
+ * holds an exclusive flock on it while it runs:
+ *
+ *   # dry journal v1 <id> <pid>
+ *   R <from> <to>
+ *
+ * Each record names a range of days (YYYY-MM-DD, "*" for no bound) that
+ * changed. The J line of the catalog tells which journal records it holds.
+ */
+#include "catalog.h"
+#include "entry.h"
+#include "store.h"
+#include "utils.h"
+#include "walk.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#define CATALOG_FILE "catalog"
+#define CATALOG_MAGIC "# dry catalog v1"
+#define JOURNAL_FILE "catalog.journal"
+#define JOURNAL_MAGIC "# dry journal v1"
+
+/* Normalize YYYY/MM/DD or YYYY-MM-DD to YYYY-MM-DD */
+static int normalize_date(const char *in, char *out) {
+  if (strlen(in) != 10)
+    return 1;
+  for (int i = 0; i < 10; i++) {
+    if (i == 4 || i == 7) {
+      if (in[i] != '-' && in[i] != '/')
+        return 1;
+      out[i] = '-';
+    } else {
+      if (!isdigit((unsigned char)in[i]))
+        return 1;
+      out[i] = in[i];
+    }
+  }
+  out[10] = '\0';
+  return 0;
+}
+
+static void day_dir_path(const CATALOG *cat, const char *date, char *path, size_t size) {
+  snprintf(path, size, "%s/%.4s/%.2s/%.2s", cat->dpath, date, date + 5, date + 8);
+}
+
+/* Directory mtime with nanoseconds, so changes within a second are seen */
+static long long dir_mtime_ns(const struct stat *st) {
+  return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static void day_clear(CATALOG_DAY *day) {
+  free(day->entries);
+  day->entries = NULL;
+  day->count = 0;
+}
+
+/* Binary search; returns index of day or -(insert position) - 1 */
+static int find_day(const CATALOG *cat, const char *date) {
+  int lo = 0, hi = cat->count - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    int c = strcmp(cat->days[mid].date, date);
+    if (c == 0)
+      return mid;
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return -lo - 1;
+}
+
+static CATALOG_DAY *insert_day(CATALOG *cat, const char *date) {
+  int idx = find_day(cat, date);
+  if (idx >= 0)
+    return &cat->days[idx];
+  idx = -idx - 1;
+
+  if (cat->count == cat->cap) {
+    int cap = cat->cap ? cat->cap * 2 : 64;
+    CATALOG_DAY *days = realloc(cat->days, cap * sizeof(CATALOG_DAY));
+    if (days == NULL)
+      return NULL;
+    cat->days = days;
+    cat->cap = cap;
+  }
+
+  memmove(&cat->days[idx + 1], &cat->days[idx], (cat->count - idx) * sizeof(CATALOG_DAY));
+  memset(&cat->days[idx], 0, sizeof(CATALOG_DAY));
+  strcpy(cat->days[idx].date, date);
+  cat->count++;
+  return &cat->days[idx];
+}
+
+static void remove_day(CATALOG *cat, int idx) {
+  day_clear(&cat->days[idx]);
+  memmove(&cat->days[idx], &cat->days[idx + 1], (cat->count - idx - 1) * sizeof(CATALOG_DAY));
+  cat->count--;
+}
+
+/* Point every entry of a day at the main note of that day */
+static void link_day(CATALOG_DAY *day) {
+  CATALOG_ENTRY *main_entry = catalog_main_entry(day);
+  for (int i = 0; i < day->count; i++)
+    strcpy(day->entries[i].link, main_entry ? main_entry->id : "-");
+}
+
+/* A walked file waiting to be stat'ed */
+typedef struct {
+  int day;      /* index of its day in the catalog */
+  char *path;
+  const char *name;
+} SCAN_FILE;
+
+/* Walker state while scanning one or more days */
+typedef struct {
+  CATALOG *cat;
+  int day;            /* index of the day being filled, -1 before the first */
+  SCAN_FILE *files;
+  int count;
+  int cap;
+} SCAN_STATE;
+
+static int queue_file(SCAN_STATE *state, const WALK_ENTRY *we) {
+  if (strlen(we->name) >= sizeof(((CATALOG_ENTRY *)0)->id))
+    return 0;
+  if (we->d_type != DT_REG && we->d_type != DT_UNKNOWN && we->d_type != DT_LNK)
+    return 0;
+
+  if (state->count == state->cap) {
+    int cap = state->cap ? state->cap * 2 : 64;
+    SCAN_FILE *files = realloc(state->files, cap * sizeof(SCAN_FILE));
+    if (files == NULL)
+      return 1;
+    state->files = files;
+    state->cap = cap;
+  }
+
+  SCAN_FILE *f = &state->files[state->count];
+  f->day = state->day;
+  f->path = strdup(we->path);
+  if (f->path == NULL)
+    return 1;
+  f->name = f->path + strlen(f->path) - strlen(we->name);
+  state->count++;
+  return 0;
+}
+
+/*
+ * Stat all queued files in one batch (FUSE round-trips dominate, so they
+ * run in parallel) and add the regular files to their days, in walk order.
+ */
+static int flush_files(SCAN_STATE *state) {
+  CATALOG *cat = state->cat;
+  struct stat *st = NULL;
+  char **paths = NULL;
+  char *ok = NULL;
+  int rc = 0;
+
+  if (state->count > 0) {
+    st = malloc(state->count * sizeof(struct stat));
+    paths = malloc(state->count * sizeof(char *));
+    ok = malloc(state->count);
+    if (st == NULL || paths == NULL || ok == NULL) {
+      rc = 1;
+      goto out;
+    }
+    for (int i = 0; i < state->count; i++)
+      paths[i] = state->files[i].path;
+    stat_batch(paths, state->count, st, ok);
+  }
+
+  for (int i = 0; i < state->count; i++) {
+    CATALOG_DAY *day = &cat->days[state->files[i].day];
+
+    /* files of a day are contiguous: make room for all of them at once */
+    if (i == 0 || state->files[i - 1].day != state->files[i].day) {
+      int run = 1;
+      while (i + run < state->count && state->files[i + run].day == state->files[i].day)
+        run++;
+      CATALOG_ENTRY *entries = realloc(day->entries, (day->count + run) * sizeof(CATALOG_ENTRY));
+      if (entries == NULL) {
+        rc = 1;
+        break;
+      }
+      day->entries = entries;
+    }
+
+    if (!ok[i] || !S_ISREG(st[i].st_mode))
+      continue;
+
+    CATALOG_ENTRY *e = &day->entries[day->count++];
+    memset(e, 0, sizeof(*e));
+    strcpy(e->id, state->files[i].name);
+    e->type = get_file_type_stat(state->files[i].path, &st[i]);
+    e->size = store_plain_size(state->files[i].path, st[i].st_size);
+    e->mtime = st[i].st_mtime;
+  }
+
+out:
+  for (int i = 0; i < state->count; i++)
+    free(state->files[i].path);
+  free(state->files);
+  free(st);
+  free(paths);
+  free(ok);
+  state->files = NULL;
+  state->count = state->cap = 0;
+  return rc;
+}
+
+static int scan_one_day(const WALK_ENTRY *we, void *arg) {
+  return queue_file(arg, we);
+}
+
+/* Scan a day directory into day; returns number of entries or -1 */
+static int scan_day(CATALOG *cat, CATALOG_DAY *day) {
+  char dir[4200];
+  struct stat st;
+
+  day_dir_path(cat, day->date, dir, sizeof(dir));
+  if (stat(dir, &st) != 0)
+    return -1;
+  day->dir_mtime = dir_mtime_ns(&st);
+
+  day_clear(day);
+  SCAN_STATE state = {cat, (int)(day - cat->days), NULL, 0, 0};
+  if (walk_day(cat->dpath, day->date, scan_one_day, &state) < 0 || flush_files(&state) != 0) {
+    flush_files(&state);
+    return -1;
+  }
+
+  /* the walker yields names sorted, i.e. in chronological order */
+  link_day(day);
+
+  cat->dirty = 1;
+  return day->count;
+}
+
+static int scan_all_days(const WALK_ENTRY *we, void *arg) {
+  SCAN_STATE *state = arg;
+  CATALOG *cat = state->cat;
+  struct stat st;
+
+  if (state->day < 0 || strcmp(cat->days[state->day].date, we->date) != 0) {
+    /* days arrive in order, so each new one is appended */
+    CATALOG_DAY *day = insert_day(cat, we->date);
+    if (day == NULL)
+      return 1;
+    if (fstat(we->dirfd, &st) == 0)
+      day->dir_mtime = dir_mtime_ns(&st);
+    state->day = (int)(day - cat->days);
+  }
+
+  return queue_file(state, we);
+}
+
+int catalog_rebuild(CATALOG *cat) {
+  for (int i = 0; i < cat->count; i++)
+    day_clear(&cat->days[i]);
+  cat->count = 0;
+  cat->dirty = 1;
+
+  SCAN_STATE state = {cat, -1, NULL, 0, 0};
+  if (walk_diary(cat->dpath, NULL, NULL, scan_all_days, &state) != 0 || flush_files(&state) != 0) {
+    flush_files(&state);
+    return 1;
+  }
+
+  /* days where nothing was a regular file */
+  for (int i = cat->count - 1; i >= 0; i--) {
+    if (cat->days[i].count == 0)
+      remove_day(cat, i);
+    else
+      link_day(&cat->days[i]);
+  }
+
+  return 0;
+}
+
+/* Walker state of catalog_sync: day directories seen, in order */
+typedef struct {
+  CATALOG *cat;
+  int force;    /* rescan days even if their directory did not change */
+  char (*seen)[11];
+  int count;
+  int cap;
+} SYNC_STATE;
+
+static int sync_day(const char *date, int dirfd, void *arg) {
+  SYNC_STATE *state = arg;
+  CATALOG *cat = state->cat;
+  struct stat st;
+
+  if (state->count == state->cap) {
+    int cap = state->cap ? state->cap * 2 : 64;
+    char (*seen)[11] = realloc(state->seen, cap * sizeof(*seen));
+    if (seen == NULL)
+      return 1;
+    state->seen = seen;
+    state->cap = cap;
+  }
+  strcpy(state->seen[state->count++], date);
+
+  int idx = find_day(cat, date);
+  if (!state->force && idx >= 0 && fstat(dirfd, &st) == 0 &&
+      cat->days[idx].dir_mtime == dir_mtime_ns(&st))
+    return 0;
+
+  /* new or changed since last scan */
+  catalog_update_day(cat, date);
+  return 0;
+}
+
+static int seen_cmp(const void *a, const void *b) {
+  return strcmp(a, b);
+}
+
+static int sync_range(CATALOG *cat, const char *from, const char *to, int force) {
+  SYNC_STATE state = {cat, force, NULL, 0, 0};
+
+  if (walk_days(cat->dpath, from, to, sync_day, &state) != 0) {
+    free(state.seen);
+    return 1;
+  }
+
+  /* drop days in the range whose directory is gone */
+  for (int i = cat->count - 1; i >= 0; i--) {
+    const char *date = cat->days[i].date;
+    if ((from != NULL && strcmp(date, from) < 0) || (to != NULL && strcmp(date, to) > 0))
+      continue;
+    if (bsearch(date, state.seen, state.count, sizeof(*state.seen), seen_cmp) == NULL) {
+      remove_day(cat, i);
+      cat->dirty = 1;
+    }
+  }
+
+  free(state.seen);
+  return 0;
+}
+
+/* A journal kept by a running watcher, up to its last complete record */
+typedef struct {
+  char *text;
+  long long len;
+  long long start;    /* offset of the first record */
+  char id[32];
+  pid_t owner;
+} JOURNAL;
+
+/* Not get_meta_path(): the diary may not be mounted */
+static void journal_path(const char *dpath, char *path, size_t size) {
+  snprintf(path, size, "%s/%s/%s", dpath, DRY_META_DIR, JOURNAL_FILE);
+}
+
+/* Read the journal of dpath. Returns 0 if a watcher keeps it. */
+static int journal_read(const char *dpath, JOURNAL *j) {
+  char path[4200];
+  struct stat st;
+  int owner;
+
+  memset(j, 0, sizeof(*j));
+  journal_path(dpath, path, sizeof(path));
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 1;
+  if (flock(fd, LOCK_SH | LOCK_NB) == 0 || errno != EWOULDBLOCK || fstat(fd, &st) != 0) {
+    close(fd);
+    return 1;
+  }
+
+  j->text = malloc(st.st_size + 1);
+  ssize_t n = j->text != NULL ? pread(fd, j->text, st.st_size, 0) : -1;
+  close(fd);
+  if (n <= 0)
+    goto fail;
+  j->text[n] = '\0';
+
+  /* a record still being written is not there yet */
+  while (n > 0 && j->text[n - 1] != '\n')
+    n--;
+  j->len = n;
+
+  char *eol = strchr(j->text, '\n');
+  if (eol == NULL || eol - j->text >= n ||
+      sscanf(j->text, JOURNAL_MAGIC "\t%31[^\t\n]\t%d", j->id, &owner) != 2)
+    goto fail;
+  j->start = eol - j->text + 1;
+  j->owner = owner;
+  return 0;
+
+fail:
+  free(j->text);
+  j->text = NULL;
+  return 1;
+}
+
+/* Check whether the catalog holds the records of j up to some offset */
+static int journal_follows(const CATALOG *cat, const JOURNAL *j) {
+  return strcmp(cat->journal, j->id) == 0 && cat->journal_offset >= j->start &&
+         cat->journal_offset <= j->len;
+}
+
+/* Rescan the days of the records from offset on; cat then follows the journal */
+static int journal_replay(CATALOG *cat, const JOURNAL *j, long long offset) {
+  char from[16], to[16];
+
+  for (char *line = j->text + offset; line < j->text + j->len; line = strchr(line, '\n') + 1) {
+    if (sscanf(line, "R\t%15[^\t\n]\t%15[^\t\n]", from, to) != 2)
+      continue;
+    if (sync_range(cat, strcmp(from, "*") != 0 ? from : NULL,
+                   strcmp(to, "*") != 0 ? to : NULL, 1) != 0)
+      return 1;
+  }
+
+  if (strcmp(cat->journal, j->id) != 0 || cat->journal_offset != j->len) {
+    snprintf(cat->journal, sizeof(cat->journal), "%s", j->id);
+    cat->journal_offset = j->len;
+    cat->dirty = 1;
+  }
+  return 0;
+}
+
+int catalog_sync(CATALOG *cat, const char *from, const char *to) {
+  JOURNAL j;
+  int rc;
+
+  if (journal_read(cat->dpath, &j) != 0)
+    return sync_range(cat, from, to, 0);
+
+  if (journal_follows(cat, &j)) {
+    /* the watcher saw every change since: no need to walk the tree */
+    rc = journal_replay(cat, &j, cat->journal_offset);
+  } else {
+    rc = sync_range(cat, from, to, 0);
+    /* edits in place leave directories alone: only the journal has them */
+    if (rc == 0 && from == NULL && to == NULL)
+      rc = journal_replay(cat, &j, j.start);
+  }
+
+  free(j.text);
+  return rc;
+}
+
+/* Index of the first day on or after date, or after it if past */
+static int day_index(const CATALOG *cat, const char *date, int past) {
+  int idx = find_day(cat, date);
+  if (idx < 0)
+    return -idx - 1;
+  return past ? idx + 1 : idx;
+}
+
+/* Walker state of catalog_each_day */
+typedef struct {
+  CATALOG *cat;
+  const char *from;
+  const char *to;
+  int reverse;
+  CATALOG_DAY_FN fn;
+  void *arg;
+  char last[11];    /* last day directory walked, "" before the first */
+} EACH_STATE;
+
+/*
+ * Drop the days of the range between the last day walked and date, whose
+ * directories are gone (NULL: up to the end of the range).
+ */
+static void drop_gap(EACH_STATE *state, const char *date) {
+  CATALOG *cat = state->cat;
+  const char *last = state->last[0] != '\0' ? state->last : NULL;
+  const char *older = state->reverse ? date : last;
+  const char *newer = state->reverse ? last : date;
+
+  int lo = older ? day_index(cat, older, 1) : state->from ? day_index(cat, state->from, 0) : 0;
+  int hi = newer ? day_index(cat, newer, 0) : state->to ? day_index(cat, state->to, 1) : cat->count;
+  if (lo >= hi)
+    return;
+
+  for (int i = lo; i < hi; i++)
+    day_clear(&cat->days[i]);
+  memmove(&cat->days[lo], &cat->days[hi], (cat->count - hi) * sizeof(CATALOG_DAY));
+  cat->count -= hi - lo;
+  cat->dirty = 1;
+}
+
+static int each_day(const char *date, int dirfd, void *arg) {
+  EACH_STATE *state = arg;
+  CATALOG *cat = state->cat;
+  struct stat st;
+
+  drop_gap(state, date);
+  strcpy(state->last, date);
+
+  int idx = find_day(cat, date);
+  if (idx < 0 || fstat(dirfd, &st) != 0 || cat->days[idx].dir_mtime != dir_mtime_ns(&st)) {
+    catalog_update_day(cat, date);
+    idx = find_day(cat, date);
+  }
+  return idx >= 0 ? state->fn(&cat->days[idx], state->arg) : 0;
+}
+
+int catalog_each_day(CATALOG *cat, const char *from, const char *to, int reverse,
+                     CATALOG_DAY_FN fn, void *arg) {
+  EACH_STATE state = {cat, from, to, reverse, fn, arg, ""};
+  JOURNAL j;
+  int rc;
+
+  if (journal_read(cat->dpath, &j) == 0) {
+    /* the catalog is current once the journal is applied: no need to walk */
+    free(j.text);
+    if (catalog_sync(cat, from, to) != 0)
+      return -1;
+
+    int lo = from ? day_index(cat, from, 0) : 0;
+    int hi = to ? day_index(cat, to, 1) : cat->count;
+    rc = 0;
+    for (int i = 0; rc == 0 && i < hi - lo; i++)
+      rc = fn(&cat->days[reverse ? hi - 1 - i : lo + i], arg);
+    return rc;
+  }
+
+  if (reverse)
+    rc = walk_days_reverse(cat->dpath, from, to, each_day, &state);
+  else
+    rc = walk_days(cat->dpath, from, to, each_day, &state);
+
+  if (rc == 0)
+    drop_gap(&state, NULL);
+  return rc;
+}
+
+CATALOG_DAY *catalog_find_day(CATALOG *cat, const char *date) {
+  int idx = find_day(cat, date);
+  return idx >= 0 ? &cat->days[idx] : NULL;
+}
+
+/* Fixed length, so a new header is written over the old one in place */
+static int journal_header(int fd, char *id, size_t size) {
+  struct timespec now;
+  char line[128];
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  snprintf(id, size, "%016llx%08lx", (long long)now.tv_sec, (long)now.tv_nsec);
+  int len = snprintf(line, sizeof(line), "%s\t%s\t%010d\n", JOURNAL_MAGIC, id, (int)getpid());
+  if (pwrite(fd, line, len, 0) != len || ftruncate(fd, len) != 0)
+    return -1;
+  return len;
+}
+
+int catalog_journal_start(const char *dpath) {
+  char path[4200];
+  char id[32];
+
+  if (get_meta_path(dpath, JOURNAL_FILE, path, sizeof(path)) != 0)
+    return -1;
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return -1;
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    close(fd);
+    return -2;
+  }
+  if (journal_header(fd, id, sizeof(id)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int catalog_journal_add(int fd, const char *from, const char *to) {
+  char line[64];
+  int len = snprintf(line, sizeof(line), "R\t%s\t%s\n", from ? from : "*", to ? to : "*");
+
+  /* the watcher is the only writer */
+  if (lseek(fd, 0, SEEK_END) < 0)
+    return 1;
+  return write(fd, line, len) != len;
+}
+
+int catalog_journal_reset(int fd, CATALOG *cat) {
+  char id[32];
+  int len = journal_header(fd, id, sizeof(id));
+
+  if (len < 0)
+    return 1;
+  snprintf(cat->journal, sizeof(cat->journal), "%s", id);
+  cat->journal_offset = len;
+  cat->dirty = 1;
+  return 0;
+}
+
+pid_t catalog_journal_owner(const char *dpath) {
+  JOURNAL j;
+
+  if (journal_read(dpath, &j) != 0)
+    return 0;
+  free(j.text);
+  return j.owner;
+}
+
+static int parse_catalog(CATALOG *cat, FILE *fd) {
+  char line[2048];
+  CATALOG_DAY *day = NULL;
+  int cap = 0;
+
+  if (fgets(line, sizeof(line), fd) == NULL || strncmp(line, CATALOG_MAGIC, strlen(CATALOG_MAGIC)) != 0)
+    return 1;
+
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+
+    if (line[0] == 'D') {
+      char date[16];
+      long long dir_mtime;
+      if (sscanf(line, "D\t%15[^\t]\t%lld", date, &dir_mtime) != 2 || strlen(date) != 10)
+        return 1;
+      day = insert_day(cat, date);
+      if (day == NULL)
+        return 1;
+      day->dir_mtime = dir_mtime;
+      cap = 0;
+    } else if (line[0] == 'E' && day != NULL) {
+      CATALOG_ENTRY e = {0};
+      int type;
+      if (sscanf(line, "E\t%255[^\t]\t%d\t%lld\t%lld\t%255[^\t]", e.id, &type,
+                 &e.size, &e.mtime, e.link) != 5)
+        return 1;
+      e.type = (FILE_TYPE)type;
+
+      /* most days hold a few entries: start small, large catalogs are mostly page faults */
+      if (day->count == cap) {
+        cap = cap ? cap * 2 : 2;
+        CATALOG_ENTRY *entries = realloc(day->entries, cap * sizeof(CATALOG_ENTRY));
+        if (entries == NULL)
+          return 1;
+        day->entries = entries;
+      }
+      day->entries[day->count++] = e;
+    } else if (line[0] == 'J') {
+      if (sscanf(line, "J\t%31[^\t]\t%lld", cat->journal, &cat->journal_offset) != 2)
+        return 1;
+    }
+  }
+  return 0;
+}
+
+/* Apply what a running watcher recorded since the catalog was saved */
+static void journal_catch_up(CATALOG *cat) {
+  JOURNAL j;
+
+  if (journal_read(cat->dpath, &j) != 0)
+    return;
+  if (journal_follows(cat, &j))
+    journal_replay(cat, &j, cat->journal_offset);
+  free(j.text);
+}
+
+void catalog_init(CATALOG *cat, const char *dpath) {
+  memset(cat, 0, sizeof(*cat));
+  snprintf(cat->dpath, sizeof(cat->dpath), "%s", dpath);
+}
+
+int catalog_load(CATALOG *cat, const char *dpath) {
+  char path[4200];
+  FILE *fd;
+
+  catalog_init(cat, dpath);
+
+  if (get_meta_path(dpath, CATALOG_FILE, path, sizeof(path)) != 0)
+    return 1;
+
+  fd = store_fopen(path, "r");
+  if (fd != NULL) {
+    int rc = parse_catalog(cat, fd);
+    fclose(fd);
+    if (rc == 0) {
+      journal_catch_up(cat);
+      return 0;
+    }
+    msg_warning("catalog %s is corrupt, rebuilding", path);
+  }
+
+  return catalog_rebuild(cat);
+}
+
+int catalog_read(const char *dpath, CATALOG_READ_FN fn, void *arg) {
+  char path[4200];
+  char line[2048];
+  char date[11] = "";
+  int rc = 0;
+
+  snprintf(path, sizeof(path), "%s/%s/%s", dpath, DRY_META_DIR, CATALOG_FILE);
+  FILE *fd = store_fopen(path, "r");
+  if (fd == NULL)
+    return 1;
+  if (fgets(line, sizeof(line), fd) == NULL || strncmp(line, CATALOG_MAGIC, strlen(CATALOG_MAGIC)) != 0) {
+    fclose(fd);
+    return 1;
+  }
+
+  while (rc == 0 && fgets(line, sizeof(line), fd) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    if (line[0] == '\0' || line[1] != '\t')
+      continue;
+    char *field = line + 2;
+    char *end = strchr(field, '\t');
+    if (end == NULL)
+      continue;
+    *end = '\0';
+
+    if (line[0] == 'D' && end - field == 10) {
+      memcpy(date, field, sizeof(date));
+      rc = fn(date, NULL, arg);
+    } else if (line[0] == 'E' && date[0] != '\0') {
+      rc = fn(date, field, arg);
+    }
+  }
+  fclose(fd);
+  return rc;
+}
+
+int catalog_save(CATALOG *cat) {
+  char path[4200];
+  char tmp[4300];
+  FILE *fd;
+
+  if (!cat->dirty)
+    return 0;
+
+  if (get_meta_path(cat->dpath, CATALOG_FILE, path, sizeof(path)) != 0)
+    return 1;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  fd = store_fopen(tmp, "w");
+  if (fd == NULL) {
+    msg_warning("failed to write catalog %s", path);
+    return 1;
+  }
+
+  fprintf(fd, "%s\n", CATALOG_MAGIC);
+  if (cat->journal[0] != '\0')
+    fprintf(fd, "J\t%s\t%lld\n", cat->journal, cat->journal_offset);
+  for (int i = 0; i < cat->count; i++) {
+    const CATALOG_DAY *day = &cat->days[i];
+    fprintf(fd, "D\t%s\t%lld\n", day->date, day->dir_mtime);
+    for (int j = 0; j < day->count; j++) {
+      const CATALOG_ENTRY *e = &day->entries[j];
+      fprintf(fd, "E\t%s\t%d\t%lld\t%lld\t%s\n", e->id, e->type, e->size, e->mtime, e->link);
+    }
+  }
+
+  if (fclose(fd) != 0 || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+
+  cat->dirty = 0;
+  return 0;
+}
+
+void catalog_free(CATALOG *cat) {
+  for (int i = 0; i < cat->count; i++)
+    day_clear(&cat->days[i]);
+  free(cat->days);
+  cat->days = NULL;
+  cat->count = cat->cap = 0;
+}
+
+int catalog_update_day(CATALOG *cat, const char *date) {
+  char norm[11];
+  CATALOG_DAY *day;
+
+  if (normalize_date(date, norm) != 0)
+    return 1;
+
+  day = insert_day(cat, norm);
+  if (day == NULL)
+    return 1;
+
+  if (scan_day(cat, day) <= 0) {
+    remove_day(cat, find_day(cat, norm));
+    cat->dirty = 1;
+  }
+  return 0;
+}
+
+CATALOG_DAY *catalog_get_day(CATALOG *cat, const char *date) {
+  char norm[11];
+  char dir[4200];
+  struct stat st;
+  int idx;
+
+  if (normalize_date(date, norm) != 0)
+    return NULL;
+
+  day_dir_path(cat, norm, dir, sizeof(dir));
+  idx = find_day(cat, norm);
+
+  if (stat(dir, &st) != 0) {
+    /* day directory is gone */
+    if (idx >= 0) {
+      remove_day(cat, idx);
+      cat->dirty = 1;
+    }
+    return NULL;
+  }
+
+  if (idx >= 0 && cat->days[idx].dir_mtime == dir_mtime_ns(&st))
+    return &cat->days[idx];
+
+  /* new or changed since last scan */
+  catalog_update_day(cat, norm);
+  idx = find_day(cat, norm);
+  return idx >= 0 ? &cat->days[idx] : NULL;
+}
+
+int catalog_remove(CATALOG *cat, const char *id) {
+  char norm[11];
+  int idx;
+
+  if (strlen(id) < 10)
+    return 1;
+  memcpy(norm, id, 10);
+  norm[10] = '\0';
+  if (normalize_date(norm, norm) != 0)
+    return 1;
+
+  idx = find_day(cat, norm);
+  if (idx < 0)
+    return 1;
+
+  CATALOG_DAY *day = &cat->days[idx];
+  for (int i = 0; i < day->count; i++) {
+    if (strcmp(day->entries[i].id, id) == 0) {
+      memmove(&day->entries[i], &day->entries[i + 1], (day->count - i - 1) * sizeof(CATALOG_ENTRY));
+      day->count--;
+      if (day->count == 0)
+        remove_day(cat, idx);
+      else
+        link_day(day);
+      cat->dirty = 1;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+CATALOG_ENTRY *catalog_main_entry(CATALOG_DAY *day) {
+  for (int i = 0; i < day->count; i++)
+    if (day->entries[i].type == TEXT)
+      return &day->entries[i];
+  return NULL;
+}
+
+void catalog_entry_path(const CATALOG *cat, const CATALOG_DAY *day,
+                        const CATALOG_ENTRY *entry, char *path, size_t size) {
+  snprintf(path, size, "%s/%.4s/%.2s/%.2s/%s", cat->dpath, day->date,
+           day->date + 5, day->date + 8, entry->id);
+}
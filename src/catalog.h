@@ -0,0 +1,133 @@
+/*
+ * catalog.h - Persistent per-diary entry catalog
+ */
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "dry.h"
+
+/* One diary entry (a file inside a YYYY/MM/DD directory) */
+typedef struct {
+  char id[256];       /* file name, e.g. 2025-04-11_17-06.mkv */
+  FILE_TYPE type;     /* detected file type */
+  long long size;     /* size in bytes */
+  long long mtime;    /* modification time */
+  char link[256];     /* main note of the day the entry belongs to */
+} CATALOG_ENTRY;
+
+/* All entries of one day, sorted by id (chronological order) */
+typedef struct {
+  char date[11];          /* YYYY-MM-DD */
+  long long dir_mtime;    /* mtime (ns) of the day directory when scanned */
+  CATALOG_ENTRY *entries;
+  int count;
+} CATALOG_DAY;
+
+/* Catalog of a diary, days sorted by date */
+typedef struct {
+  char dpath[4096];   /* diary mount point */
+  CATALOG_DAY *days;
+  int count;
+  int cap;
+  int dirty;
+  char journal[32];         /* id of the change journal the catalog follows, "" if none */
+  long long journal_offset; /* journal records before this offset are applied */
+} CATALOG;
+
+/* Initialize an empty catalog for the diary mounted at dpath */
+void catalog_init(CATALOG *cat, const char *dpath);
+
+/*
+ * Load the catalog of the diary mounted at dpath.
+ * If no catalog file exists yet, it is built by walking the diary.
+ * Returns 0 on success.
+ */
+int catalog_load(CATALOG *cat, const char *dpath);
+
+/* Called for each record of a catalog file, id NULL for the day itself */
+typedef int (*CATALOG_READ_FN)(const char *date, const char *id, void *arg);
+
+/*
+ * Stream the records of the catalog file of the diary at dpath without
+ * loading it: nothing is built, synced or created (for shell completion,
+ * where the diary may not be mounted). Returns 0 when done, 1 if there is
+ * no readable catalog, or the non-zero value returned by fn.
+ */
+int catalog_read(const char *dpath, CATALOG_READ_FN fn, void *arg);
+
+/* Write the catalog back if it changed. Returns 0 on success. */
+int catalog_save(CATALOG *cat);
+
+/* Release memory held by the catalog */
+void catalog_free(CATALOG *cat);
+
+/* Drop all records and rebuild the catalog from the directory tree */
+int catalog_rebuild(CATALOG *cat);
+
+/*
+ * Get the records for a day (YYYY-MM-DD or YYYY/MM/DD).
+ * The day directory is stat'ed once and rescanned only if it changed
+ * since it was cataloged. Returns NULL if the day has no entries.
+ */
+CATALOG_DAY *catalog_get_day(CATALOG *cat, const char *date);
+
+/*
+ * Bring the days between from and to (YYYY-MM-DD, inclusive, NULL for no
+ * bound) up to date: every day directory is stat'ed once, changed ones are
+ * rescanned and days whose directory is gone are dropped. While a watcher
+ * keeps the change journal of the diary, only the days it recorded since
+ * the catalog was saved are rescanned instead. Returns 0 on success.
+ */
+int catalog_sync(CATALOG *cat, const char *from, const char *to);
+
+/* Called for each day of catalog_each_day() (day valid during the call only) */
+typedef int (*CATALOG_DAY_FN)(CATALOG_DAY *day, void *arg);
+
+/*
+ * Hand the days between from and to (NULL for no bound) to fn in date
+ * order, newest first if reverse, until fn returns non-zero. Each day is
+ * brought up to date as by catalog_sync() right before fn sees it, and the
+ * tree is walked no further than the day fn stopped at, so the latest days
+ * of a diary are cheap to reach whatever its size. Returns 0 when done, -1
+ * if the diary can't be read, or the non-zero value returned by fn.
+ */
+int catalog_each_day(CATALOG *cat, const char *from, const char *to, int reverse,
+                     CATALOG_DAY_FN fn, void *arg);
+
+/* Get the records of a day (YYYY-MM-DD) as cataloged, without checking the tree */
+CATALOG_DAY *catalog_find_day(CATALOG *cat, const char *date);
+
+/*
+ * Start a new change journal for the diary at dpath (.dry/catalog.journal).
+ * The returned descriptor holds the journal lock until it is closed; while
+ * it is held, catalog_load() and catalog_sync() trust the journal to name
+ * every changed day. Returns -1 on error, -2 if another process keeps it.
+ */
+int catalog_journal_start(const char *dpath);
+
+/* Record that the days from..to (NULL for no bound) changed */
+int catalog_journal_add(int fd, const char *from, const char *to);
+
+/*
+ * Empty the journal once cat (synced with catalog_sync) holds all its
+ * records; cat follows the new journal. Returns 0 on success.
+ */
+int catalog_journal_reset(int fd, CATALOG *cat);
+
+/* Pid of the process keeping the journal of the diary at dpath, 0 if none */
+pid_t catalog_journal_owner(const char *dpath);
+
+/* Rescan a single day directory (after new entries were written) */
+int catalog_update_day(CATALOG *cat, const char *date);
+
+/* Remove the record of an entry by id. Returns 0 if it was found. */
+int catalog_remove(CATALOG *cat, const char *id);
+
+/* Find the main (first text) entry of a day, NULL if none */
+CATALOG_ENTRY *catalog_main_entry(CATALOG_DAY *day);
+
+/* Build the absolute path of an entry */
+void catalog_entry_path(const CATALOG *cat, const CATALOG_DAY *day,
+                        const CATALOG_ENTRY *entry, char *path, size_t size);
+
+#endif /* CATALOG_H */
@@ -2,6 +2,9 @@
  * config.c - Configuration management implementation
  */
 #include "config.h"
+#include "proc.h"
+#include "registry.h"
+#include "transcode.h"
 #include "utils.h"
 
 CONFIG *conf = NULL;
@@ -10,7 +13,7 @@ CONFIG *get_config(void) {
   return conf; 
 }
 
-void get_conf_path(char *path) {
+int get_conf_path(char *path) {
   struct passwd *pw = getpwuid(getuid());
   const char *homedir = pw->pw_dir;
 
@@ -23,16 +26,16 @@ void get_conf_path(char *path) {
       /* Check /etc/dry/dry.conf */
       sprintf(path, "/etc/dry/%s", "dry.conf");
       if (!do_file_exist(path)) {
-        fprintf(stderr, "Error: can't find config file\n");
-        fprintf(stderr,
-                "Create config file in\n.dry/dry.conf\n~/.dry/dry.conf\n/etc/dry/dry.conf");
-        exit(EXIT_FAILURE);
+        msg_error("can't find config file\n"
+                  "Create config file in\n.dry/dry.conf\n~/.dry/dry.conf\n/etc/dry/dry.conf");
+        return 1;
       }
     }
   }
+  return 0;
 }
 
-void get_ref_path(char *path) {
+int get_ref_path(char *path) {
   struct passwd *pw = getpwuid(getuid());
   const char *homedir = pw->pw_dir;
 
@@ -49,21 +52,37 @@ void get_ref_path(char *path) {
       struct stat st = {0};
       if (stat(dir_path, &st) == -1) {
         if (mkdir(dir_path, 0700) != 0) {
-          fprintf(stderr, "Error: failed to create directory %s\n", dir_path);
-          exit(EXIT_FAILURE);
+          msg_error("failed to create directory %s", dir_path);
+          return 1;
         }
       }
       
       FILE *fd = fopen(path, "w");
       if (fd == NULL) {
-        fprintf(stderr, "Error: failed to create reference file %s\n", path);
-        exit(EXIT_FAILURE);
+        msg_error("failed to create reference file %s", path);
+        return 1;
       }
       fclose(fd);
       
-      fprintf(stderr, "Created reference file at %s\n", path);
+      msg_warning("created reference file at %s", path);
     }
   }
+  return 0;
+}
+
+static char **split_setting(const char *setting, const char *value) {
+  char **argv = proc_split(value);
+  if (argv == NULL)
+    msg_error("invalid '%s' setting: \"%s\"", setting, value);
+  return argv;
+}
+
+/* Drop a partially loaded configuration */
+static int config_fail(config_t *cfg) {
+  config_destroy(cfg);
+  free(conf);
+  conf = NULL;
+  return EXIT_FAILURE;
 }
 
 int config_load(void) {
@@ -73,22 +92,22 @@ int config_load(void) {
   config_init(&cfg);
 
   char path[1024];
-  get_conf_path(path);
+  if (get_conf_path(path) != 0)
+    return config_fail(&cfg);
 
   if(!config_read_file(&cfg, path)) {
-    fprintf(stderr, "%s:%d - %s\n", config_error_file(&cfg),
-            config_error_line(&cfg), config_error_text(&cfg));
-    config_destroy(&cfg);
-    return (EXIT_FAILURE);
+    msg_error("%s:%d - %s", config_error_file(&cfg), config_error_line(&cfg),
+              config_error_text(&cfg));
+    return config_fail(&cfg);
   }
 
   /* Required settings */
   if(!config_lookup_string(&cfg, "default_diary", &conf->name))
-    fprintf(stderr, "No 'default_diary' setting in configuration file.\n");
+    msg_warning("no 'default_diary' setting in configuration file");
   
   const char *config_path;
   if(!config_lookup_string(&cfg, "default_dir", &config_path)) {
-    fprintf(stderr, "No 'default_dir' setting in configuration file.\n");
+    msg_warning("no 'default_dir' setting in configuration file");
   } else {
     char *expanded_path = (char *)malloc(1024);
     expand_tilde(config_path, expanded_path);
@@ -102,8 +121,9 @@ int config_load(void) {
   if(!config_lookup_string(&cfg, "video_player", &conf->player))
     conf->player = "xdg-open";
   
+  /* Unset by default: entries are listed from the diary catalog */
   if(!config_lookup_string(&cfg, "list_command", &conf->list_cmd))
-    conf->list_cmd = "ls -lah";
+    conf->list_cmd = NULL;
   
   if(!config_lookup_string(&cfg, "file_manager", &conf->file_manager))
     conf->file_manager = "xdg-open";
@@ -111,25 +131,44 @@ int config_load(void) {
   if(!config_lookup_string(&cfg, "pager", &conf->pager))
     conf->pager = "less";
 
+  /* Commands are run without a shell: split them into argv once */
+  conf->editor_argv = split_setting("text_editor", conf->editor);
+  conf->player_argv = split_setting("video_player", conf->player);
+  conf->list_argv = conf->list_cmd ? split_setting("list_command", conf->list_cmd) : NULL;
+  conf->file_manager_argv = split_setting("file_manager", conf->file_manager);
+  conf->pager_argv = split_setting("pager", conf->pager);
+  if (conf->editor_argv == NULL || conf->player_argv == NULL ||
+      (conf->list_cmd != NULL && conf->list_argv == NULL) || conf->file_manager_argv == NULL ||
+      conf->pager_argv == NULL)
+    return config_fail(&cfg);
+
+  /* Recordings are kept as captured unless a transcode profile is set */
+  if(!config_lookup_string(&cfg, "transcode", &conf->transcode))
+    conf->transcode = "off";
+  if (!transcode_profile_valid(conf->transcode)) {
+    msg_error("unknown 'transcode' profile \"%s\" (off, x264, x265, av1)", conf->transcode);
+    return config_fail(&cfg);
+  }
+  if(!config_lookup_int(&cfg, "transcode_crf", &conf->transcode_crf) || conf->transcode_crf < 0)
+    conf->transcode_crf = 0;
+
+  /* Mount agent is off unless an idle timeout is configured */
+  if(!config_lookup_int(&cfg, "agent_idle", &conf->agent_idle) || conf->agent_idle < 0)
+    conf->agent_idle = 0;
+
+  /* Imported files are stored once per content if enabled */
+  if(!config_lookup_bool(&cfg, "attachment_store", &conf->attachment_store))
+    conf->attachment_store = 0;
+
   return(EXIT_SUCCESS);
 }
 
 int get_path_by_name(const char *dname, char *path) {
-  FILE *fd;
-  char rpath[1024];
-  char name[512];
-  char value[1024];
+  const char *found = registry_lookup(dname);
 
-  get_ref_path(rpath);
+  if (found == NULL)
+    return 1;
 
-  fd = fopen(rpath, "r");
-  while (fscanf(fd, "%s : %s", name, value) > 0) {
-    if (strcmp(name, dname) == 0) {
-      expand_tilde(value, path);
-      fclose(fd);
-      return 0;
-    }
-  }
-  fclose(fd);
-  return 1;
+  strcpy(path, found);
+  return 0;
 }
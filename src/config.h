@@ -13,14 +13,14 @@ extern CONFIG *conf;
 /* Get the global config */
 CONFIG *get_config(void);
 
-/* Load configuration from file */
+/* Load configuration from file. Returns 0 on success (get_config() is NULL otherwise). */
 int config_load(void);
 
-/* Get path to config file */
-void get_conf_path(char *path);
+/* Get path to config file. Returns 0 if one was found. */
+int get_conf_path(char *path);
 
-/* Get path to reference file */
-void get_ref_path(char *path);
+/* Get path to reference file, creating ~/.dry/diaries.ref if needed. Returns 0 on success. */
+int get_ref_path(char *path);
 
 /* Get diary path by name from reference file */
 int get_path_by_name(const char *dname, char *path);
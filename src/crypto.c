@@ -2,10 +2,77 @@
  * crypto.c - Encryption/decryption operations implementation
  */
 #include "crypto.h"
+#include "agent.h"
 #include "config.h"
+#include "proc.h"
+#include "store.h"
 #include "utils.h"
+#include "trace.h"
 
-void encdiary(int opcl, const char *name, const char *base_path) {
+void get_mount_point(const char *name, const char *base_path, char *path, size_t size) {
+  if (name == NULL)
+    name = get_config()->name;
+
+  if (base_path == NULL)
+    base_path = get_config()->path;
+
+  snprintf(path, size, "%s/%s", base_path, name);
+}
+
+void get_ciphertext_path(const char *name, const char *base_path, char *path, size_t size) {
+  const char *no_mount = getenv("DRY_NO_MOUNT");
+
+  if (name == NULL)
+    name = get_config()->name;
+
+  if (base_path == NULL)
+    base_path = get_config()->path;
+
+  get_mount_point(name, base_path, path, size);
+  if (store_is_native(path) || (no_mount != NULL && strncmp(no_mount, "1", 2) == 0))
+    return;
+  snprintf(path, size, "%s/.%s", base_path, name);
+}
+
+/*
+ * Passphrase given by the caller, else from the environment. Returns NULL
+ * if there is none.
+ */
+static const char *find_passphrase(const char *passphrase) {
+  if (passphrase == NULL || passphrase[0] == '\0')
+    passphrase = getenv("DRY_PASSWORD");
+  if (passphrase == NULL || passphrase[0] == '\0')
+    passphrase = getenv("DRY_ENCFS_PASSWORD");
+  return passphrase != NULL && passphrase[0] != '\0' ? passphrase : NULL;
+}
+
+/* Unlock the key of a native diary, asking for the passphrase if allowed */
+static int open_native(const char *dpath, const char *passphrase, int flags) {
+  char buf[256];
+
+  passphrase = find_passphrase(passphrase);
+  if (passphrase == NULL) {
+    if (flags & ENC_NO_PROMPT) {
+      msg_error("passphrase required to unlock %s", dpath);
+      return 1;
+    }
+    if (store_get_passphrase("Passphrase: ", 0, buf, sizeof(buf)) != 0)
+      return 1;
+    passphrase = buf;
+  }
+  int rc = store_open(dpath, passphrase);
+  memset(buf, 0, sizeof(buf));
+  if (rc == 1) {
+    msg_error("wrong passphrase for %s", dpath);
+    return 1;
+  }
+  if (rc != 0)
+    return -1;
+  return 0;
+}
+
+int encdiary_run(int opcl, const char *name, const char *base_path, const char *passphrase,
+                 int flags) {
   /*
    * Encryption (encfs)
    * 
@@ -17,13 +84,23 @@ void encdiary(int opcl, const char *name, const char *base_path) {
    *       enc_path    = /path/to/storage/.diary
    *
    * Environment variables:
-   *   DRY_ENCFS_PASSWORD - If set, use --extpass to provide password non-interactively
+   *   DRY_PASSWORD       - Passphrase of native diaries (if none is given)
+   *   DRY_ENCFS_PASSWORD - If set, pass the password to encfs on --stdinpass
+   *                        (native diaries use it too if DRY_PASSWORD is unset)
    *   DRY_NO_UNMOUNT     - If set to "1", skip unmounting (useful for testing)
+   *   DRY_NO_MOUNT       - If set to "1", use the mount point as a plaintext
+   *                        directory and never mount or unmount (tests, benchmarks);
+   *                        agent leases are taken all the same
+   *
+   * Native diaries (see store.h) are not mounted at all: open unlocks the
+   * diary key and close forgets it.
+   *
+   * With the mount agent enabled (agent_idle), open takes a lease on the
+   * mount point and close hands it back instead of unmounting.
    */
-  char cmd[8192];
   char enc_path[2048];
   char mount_point[2048];
-  
+
   if (name == NULL)
     name = get_config()->name;
 
@@ -31,7 +108,25 @@ void encdiary(int opcl, const char *name, const char *base_path) {
     base_path = get_config()->path;
 
   /* Construct mount_point and enc_path */
-  snprintf(mount_point, sizeof(mount_point), "%s/%s", base_path, name);
+  get_mount_point(name, base_path, mount_point, sizeof(mount_point));
+
+  if (store_is_native(mount_point)) {
+    if (!opcl)
+      return open_native(mount_point, passphrase, flags);
+    store_close();
+    return 0;
+  }
+
+  /* Plaintext diary: nothing to mount, but a lease still keeps the agent */
+  const char *no_mount = getenv("DRY_NO_MOUNT");
+  if (no_mount != NULL && strncmp(no_mount, "1", 2) == 0) {
+    if (!opcl)
+      agent_acquire(mount_point);
+    else
+      agent_release(mount_point);
+    return 0;
+  }
+
   snprintf(enc_path, sizeof(enc_path), "%s/.%s", base_path, name);
 
   if (!opcl) {
@@ -39,63 +134,88 @@ void encdiary(int opcl, const char *name, const char *base_path) {
     
     /* check if encrypted source exists */
     if (!do_file_exist(enc_path)) {
-      fprintf(stderr, "Error: encrypted directory %s does not exist\n", enc_path);
-      fprintf(stderr, "Please initialize the diary first with: dry init %s\n", name);
-      exit(EXIT_FAILURE);
+      msg_error("encrypted directory %s does not exist\n"
+                "Please initialize the diary first with: dry init %s", enc_path, name);
+      return -1;
     }
     
     /* check if already mounted */
-    snprintf(cmd, sizeof(cmd), "mountpoint -q %s 2>/dev/null", mount_point);
-    if (system(cmd) == 0) {
-      /* already mounted, nothing to do */
-      return;
+    if (is_mount_point(mount_point)) {
+      /* already mounted (possibly kept by the agent), just take a lease */
+      agent_acquire(mount_point);
+      return 0;
     }
     
     /* prepare clean mount point */
     rmdir(mount_point);  /* remove if empty */
     if (mkdir(mount_point, 0700) != 0 && errno != EEXIST) {
-      fprintf(stderr, "Error: failed to create mount point %s: %s\n", mount_point, strerror(errno));
-      exit(EXIT_FAILURE);
+      msg_error("failed to create mount point %s: %s", mount_point, strerror(errno));
+      return -1;
     }
     
     /* mount encrypted filesystem */
-    const char *extpass = getenv("DRY_ENCFS_PASSWORD");
-    if (extpass != NULL && extpass[0] != '\0') {
-      /* Use --extpass for non-interactive mode (testing/scripting) */
-      snprintf(cmd, sizeof(cmd), "encfs --extpass='echo %s' %s %s", extpass, enc_path, mount_point);
+    const char *password = passphrase != NULL && passphrase[0] != '\0'
+                               ? passphrase : getenv("DRY_ENCFS_PASSWORD");
+    int rc;
+    if (password != NULL && password[0] != '\0') {
+      /* Non-interactive mode (testing/scripting): password on a pipe, not in argv */
+      char input[1024];
+      char *encfs[] = {"encfs", "--stdinpass", enc_path, mount_point, NULL};
+      snprintf(input, sizeof(input), "%s\n", password);
+      rc = proc_run_input(encfs, input, 0);
+      memset(input, 0, sizeof(input));
+    } else if (flags & ENC_NO_PROMPT) {
+      msg_error("passphrase required to mount %s", mount_point);
+      rmdir(mount_point);
+      return 1;
     } else {
-      snprintf(cmd, sizeof(cmd), "encfs %s %s", enc_path, mount_point);
+      char *encfs[] = {"encfs", enc_path, mount_point, NULL};
+      rc = proc_run(encfs, 0);
     }
-    if (system(cmd) != 0) {
-      fprintf(stderr, "Error: failed to mount encrypted filesystem\n");
+    if (rc != 0) {
+      msg_error("failed to mount encrypted filesystem");
       rmdir(mount_point);
-      exit(EXIT_FAILURE);
+      return -1;
     }
+
+    agent_acquire(mount_point);
   }
   else {
     /* CLOSE: unmount and cleanup */
+
+    /* the agent keeps it mounted until it is idle */
+    if (agent_release(mount_point) == 0) {
+      return 0;
+    }
     
     /* Check if unmounting is disabled (for testing) */
     const char *no_unmount = getenv("DRY_NO_UNMOUNT");
     if (no_unmount != NULL && strncmp(no_unmount, "1", 2) == 0) {
-      return;
+      return 0;
     }
     
     /* check if mounted */
-    snprintf(cmd, sizeof(cmd), "mountpoint -q %s 2>/dev/null", mount_point);
-    if (system(cmd) != 0) {
+    if (!is_mount_point(mount_point)) {
       /* not mounted, just cleanup */
       rmdir(mount_point);
-      return;
+      return 0;
     }
     
     /* unmount */
-    snprintf(cmd, sizeof(cmd), "fusermount -u %s", mount_point);
-    if (system(cmd) != 0) {
-      fprintf(stderr, "Warning: failed to unmount %s\n", mount_point);
+    char *fusermount[] = {"fusermount", "-u", mount_point, NULL};
+    if (proc_run(fusermount, 0) != 0) {
+      msg_warning("failed to unmount %s", mount_point);
     }
     
     /* remove mount point directory */
     rmdir(mount_point);
   }
+  return 0;
+}
+
+int encdiary(int opcl, const char *name, const char *base_path) {
+  int span = trace_begin(opcl ? "encdiary close" : "encdiary open", name);
+  int rc = encdiary_run(opcl, name, base_path, NULL, 0);
+  trace_end(span);
+  return rc;
 }
@@ -6,10 +6,29 @@
 
 #include "dry.h"
 
-/* 
+/* Build the mount point of a diary (base_path NULL = default_dir) */
+void get_mount_point(const char *name, const char *base_path, char *path, size_t size);
+
+/*
+ * Build the path of the ciphertext of a diary: the encfs source directory,
+ * or the mount point itself for native and plaintext (DRY_NO_MOUNT) diaries
+ */
+void get_ciphertext_path(const char *name, const char *base_path, char *path, size_t size);
+
+/* Flags of encdiary_run() */
+#define ENC_NO_PROMPT 0x01  /* fail instead of asking for a passphrase on the terminal */
+
+/*
  * Mount or unmount encrypted diary
  * opcl: 0 = open (mount), 1 = close (unmount)
+ * passphrase: for native and encfs diaries, NULL = $DRY_PASSWORD or
+ * $DRY_ENCFS_PASSWORD, else asked on the terminal
+ * Returns 0 on success, 1 if the passphrase is missing or wrong and -1 on
+ * other failures (reported with msg_error())
  */
-void encdiary(int opcl, const char *name, const char *path);
+int encdiary_run(int opcl, const char *name, const char *path, const char *passphrase, int flags);
+
+/* encdiary_run() as a traced phase of a command, asking on the terminal */
+int encdiary(int opcl, const char *name, const char *path);
 
 #endif /* CRYPTO_H */
@@ -2,23 +2,96 @@
  * diary.c - Diary operations implementation
  */
 #include "diary.h"
+#include "catalog.h"
+#include "list.h"
+#include "search.h"
+#include "media.h"
+#include "transcode.h"
+#include "import.h"
+#include "export.h"
+#include "backup.h"
+#include "stats.h"
+#include "note.h"
+#include "objects.h"
 #include "config.h"
 #include "crypto.h"
+#include "agent.h"
+#include "registry.h"
+#include "walk.h"
+#include "range.h"
+#include "watch.h"
 #include "entry.h"
 #include "utils.h"
+#include "proc.h"
+#include "store.h"
+#include <ctype.h>
+#include <fcntl.h>
 
-void diary_init(const char *name, const char *dpath) {
+/* Create a native diary: a plain directory holding the wrapped key (see store.h) */
+static int init_native(const char *path) {
+  char passphrase[256];
+
+  if (!store_supported()) {
+    fprintf(stderr, "Error: dry was built without native storage support (libcrypto)\n");
+    return 1;
+  }
+  if (store_get_passphrase("New passphrase: ", 1, passphrase, sizeof(passphrase)) != 0)
+    return 1;
+
+  if (mkdir(path, 0700) != 0) {
+    fprintf(stderr, "Error: failed to create directory %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  int rc = store_create(path, passphrase);
+  memset(passphrase, 0, sizeof(passphrase));
+  if (rc != 0) {
+    fprintf(stderr, "Error: failed to create the key of %s\n", path);
+    rmdir(path);
+    return 1;
+  }
+  return 0;
+}
+
+/* Create an encfs diary: encrypted source directory and mount point */
+static int init_encfs(const char *path, const char *enc_path) {
+  /* create encrypted source directory */
+  if (mkdir(enc_path, 0700) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: failed to create directory %s: %s\n", enc_path, strerror(errno));
+    return 1;
+  }
+  
+  /* create mount point */
+  if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: failed to create directory %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  /* create encrypted filesystem */
+  char *encfs[] = {"encfs", "--paranoia", (char *)enc_path, (char *)path, NULL};
+  if (proc_run(encfs, 0) != 0) {
+    fprintf(stderr, "Error: failed to create encrypted filesystem\n");
+    /* cleanup on failure */
+    rmdir(path);
+    rmdir(enc_path);
+    return 1;
+  }
+  return 0;
+}
+
+int diary_init(const char *name, const char *dpath, int flags) {
   /*
    * Initialize a new encrypted diary:
    * 1. Create encrypted source directory
    * 2. Create mount point
    * 3. Initialize encfs
    * 4. Add reference to diaries.ref
+   *
+   * A native diary (INIT_FLAG_NATIVE) replaces 1-3 with a directory and
+   * its key file.
    */
   char fref[2048];
   char path[2048];
   char enc_path[2048];
-  char cmd[8192];
   
   if (dpath == NULL)
     dpath = get_config()->path;
@@ -26,61 +99,44 @@ void diary_init(const char *name, const char *dpath) {
   /* check if already exist */
   if (!get_path_by_name(name, path)) {
     printf("Diary already exists at %s\n", path);
-    exit(EXIT_FAILURE);
+    return 1;
   }
 
   snprintf(path, sizeof(path), "%s/%s", dpath, name);
   snprintf(enc_path, sizeof(enc_path), "%s/.%s", dpath, name);
   
   /* create parent storage directory if needed */
-  snprintf(cmd, sizeof(cmd), "mkdir -p -m 0700 %s", dpath);
-  if (system(cmd) != 0) {
-    fprintf(stderr, "Error: failed to create storage directory %s\n", dpath);
-    exit(EXIT_FAILURE);
-  }
-  
-  /* create encrypted source directory */
-  if (mkdir(enc_path, 0700) != 0 && errno != EEXIST) {
-    fprintf(stderr, "Error: failed to create directory %s: %s\n", enc_path, strerror(errno));
-    exit(EXIT_FAILURE);
+  if (make_dirs(dpath, 0700) != 0) {
+    fprintf(stderr, "Error: failed to create storage directory %s: %s\n", dpath, strerror(errno));
+    return 1;
   }
   
-  /* create mount point */
-  if (mkdir(path, 0700) != 0 && errno != EEXIST) {
-    fprintf(stderr, "Error: failed to create directory %s: %s\n", path, strerror(errno));
-    exit(EXIT_FAILURE);
-  }
-
-  /* create encrypted filesystem */
-  snprintf(cmd, sizeof(cmd), "encfs --paranoia %s %s", enc_path, path);
-  if (system(cmd) != 0) {
-    fprintf(stderr, "Error: failed to create encrypted filesystem\n");
-    /* cleanup on failure */
-    rmdir(path);
-    rmdir(enc_path);
-    exit(EXIT_FAILURE);
-  }
+  if ((flags & INIT_FLAG_NATIVE) ? init_native(path) : init_encfs(path, enc_path))
+    return 1;
 
   /* add reference to diary to ref file */
-  get_ref_path(fref);
-  FILE *fd = fopen(fref, "a");
-  if (fd == NULL) {
-    fprintf(stderr, "Error: failed to open reference file %s\n", fref);
-    exit(EXIT_FAILURE);
+  int rc = registry_add(name, path);
+  if (rc != 0) {
+    if (rc > 0) {
+      fprintf(stderr, "Error: diary %s was registered concurrently\n", name);
+    } else {
+      get_ref_path(fref);
+      fprintf(stderr, "Error: failed to update reference file %s\n", fref);
+    }
+    return 1;
   }
-  fprintf(fd, "%s : %s\n", name, path);
-  fclose(fd);
 
   printf("Created new diary %s at %s\n", name, path);
 
   /* unmount after initialization */
   encdiary(1, name, dpath);
+  return 0;
 }
 
-void diary_new(char type, const char *name) {
+int diary_new(char type, const char *name) {
   FORMAT fmt = ORG;
-  char cmd[1024];
   char path[1024];
+  int failed = 0;
 
   if (name == NULL)
     name = get_config()->name;
@@ -88,11 +144,12 @@ void diary_new(char type, const char *name) {
   /* check if diary exists */
   if (get_path_by_name(name, path) != 0) {
     printf("Error: can't find diary %s\n", name);
-    exit(EXIT_FAILURE);
+    return 1;
   }
 
   /* decrypt diary */
-  encdiary(0, name, get_config()->path);
+  if (encdiary(0, name, get_config()->path) != 0)
+    return 1;
 
   /* create directory tree */
   make_directory_tree(name);
@@ -100,130 +157,457 @@ void diary_new(char type, const char *name) {
   /* create entry */
   printf("Creating new %s\n", type == 'v' ? "video" : "note");
 
-  set_text_file_header(name, fmt);
+  int created;
+  if (set_text_file_header(name, fmt, &created) != 0) {
+    encdiary(1, name, get_config()->path);
+    return 1;
+  }
+  if (created) {
+    char text_path[2048];
+    get_text_path_by_name(name, text_path);
+    printf("Creating file %s\n", text_path);
+  }
 
   if (type == 'v') {
     char video_path[2048];
     char text_path[2048];
     
-    get_video_command(name, cmd);
     get_video_path_by_name(name, video_path);
     get_text_path_by_name(name, text_path);
 
-    FILE *fd = fopen(text_path, "a");
-    fprintf(fd, "file:%s\n", video_path);
-    fclose(fd);
+    FILE *fd = store_fopen(text_path, "a");
+    if (fd != NULL) {
+      fprintf(fd, "file:%s\n", video_path);
+      fclose(fd);
+    }
+
+    /* ffmpeg exits non-zero when stopped with ^C, the recording is still good */
+    if (record_video(video_path) < 0)
+      failed = 1;
+    else if (do_file_exist(video_path)) {
+      media_sidecar_create(path, video_path, 1);
+      transcode_queue(path, video_path);
+    }
   }
   else if (type == 'n') {
-    get_text_command(name, cmd);
+    failed = open_text_editor(name) < 0;
+  }
+  if (failed) {
+    encdiary(1, name, get_config()->path);
+    return 1;
   }
 
-  /* Execute */
-  system(cmd);
   printf("Written %s\n", "output");
 
+  /* record today's entries in the catalog */
+  CATALOG cat;
+  char today[16];
+  if (catalog_load(&cat, path) == 0) {
+    get_time(today, "%Y-%m-%d");
+    catalog_update_day(&cat, today);
+    catalog_save(&cat);
+
+    /* index what was written in the editor session */
+    SEARCH_INDEX idx;
+    if (search_load(&idx, path) == 0 && search_sync(&idx, &cat) >= 0)
+      search_save(&idx);
+    search_free(&idx);
+  }
+  catalog_free(&cat);
+
+  /* re-encode recordings in the background; the worker closes the diary */
+  if (transcode_start(name, path, 1) == 0)
+    return 0;
+
   /* encrypt diary */
   encdiary(1, name, get_config()->path);
+  return 0;
 }
 
-void diary_list(const char *name, char *filter) {
-  char cmd[16384];
+int diary_import(char *const *paths, int count, const char *name) {
   char dpath[4096];
-  char path[8192];
-
-  const char *list_cmd = get_config()->list_cmd;
+  char size[16];
+  IMPORT_BATCH batch;
 
   if (name == NULL)
     name = get_config()->name;
 
   if (get_path_by_name(name, dpath)) {
     printf("Error: can't find diary %s\n", name);
-    exit(EXIT_SUCCESS);
+    return 1;
   }
 
-  encdiary(0, name, get_config()->path);
+  int failed = import_collect(&batch, paths, count) != 0;
+  if (batch.count == 0) {
+    if (!failed)
+      printf("Nothing to import\n");
+    import_free(&batch);
+    return failed;
+  }
 
-  char tme[26];
-  int use_filter_path = 1;
-
-  if (filter == NULL) {
-    /* No filter: list entire diary */
-    use_filter_path = 0;
-  } else if (strncmp(filter, "today", 6) == 0) {
-    get_time(tme, "%Y/%m/%d");
-  } else if (strncmp(filter, "yesterday", 10) == 0) {
-    time_t now = time(NULL);
-    struct tm *ts = localtime(&now);
-    ts->tm_mday--;
-    mktime(ts);
-    strftime(tme, sizeof(tme), "%Y/%m/%d", ts);
-  } else if (strncmp(filter, "tomorrow", 9) == 0) {
-    time_t now = time(NULL);
-    struct tm *ts = localtime(&now);
-    ts->tm_mday++;
-    mktime(ts);
-    strftime(tme, sizeof(tme), "%Y/%m/%d", ts);
-  } else {
-    /* Assume filter is a date in YYYY/MM/DD or YYYY-MM-DD format */
-    strncpy(tme, filter, sizeof(tme) - 1);
-    tme[sizeof(tme) - 1] = '\0';
-    /* Convert dashes to slashes if present */
-    for (char *p = tme; *p; p++) {
-      if (*p == '-') *p = '/';
+  if (encdiary(0, name, get_config()->path) != 0) {
+    import_free(&batch);
+    return 1;
+  }
+
+  int copied = import_run(&batch, dpath);
+
+  /* link each file from its day note, oldest first */
+  long long bytes = 0;
+  int duplicates = 0;
+  int shared = 0;
+  for (int i = 0; i < batch.count; i++) {
+    IMPORT_FILE *f = &batch.files[i];
+    char note[4200];
+
+    duplicates += f->status == IMPORT_DUPLICATE;
+    shared += f->status == IMPORT_COPIED && f->shared;
+    failed |= f->status == IMPORT_FAILED;
+    if (f->status != IMPORT_COPIED)
+      continue;
+    bytes += f->size;
+
+    snprintf(note, sizeof(note), "%s/%.4s/%.2s/%.2s/%s.org", dpath, f->day, f->day + 5,
+             f->day + 8, f->day);
+    if (link_entry_file(note, ORG, f->mtime.tv_sec, f->dest) != 0)
+      fprintf(stderr, "Warning: failed to link %s from %s\n", f->dest, note);
+    if (get_file_type(f->dest) == MEDIA)
+      media_sidecar_create(dpath, f->dest, 1);
+  }
+
+  /* record the days in the catalog and index the notes */
+  CATALOG cat;
+  if (copied > 0) {
+    if (catalog_load(&cat, dpath) == 0) {
+      for (int i = 0; i < batch.count; i++)
+        if (batch.files[i].status == IMPORT_COPIED &&
+            (i == 0 || strcmp(batch.files[i].day, batch.files[i - 1].day) != 0))
+          catalog_update_day(&cat, batch.files[i].day);
+      catalog_save(&cat);
+
+      SEARCH_INDEX idx;
+      if (search_load(&idx, dpath) == 0 && search_sync(&idx, &cat) >= 0)
+        search_save(&idx);
+      search_free(&idx);
     }
+    catalog_free(&cat);
   }
 
-  if (use_filter_path) {
-    snprintf(path, sizeof(path), "%s/%s", dpath, tme);
+  format_size(bytes, size, sizeof(size));
+  printf("Imported %d file(s) (%s) into %s", copied, size, name);
+  if (duplicates > 0)
+    printf(", %d duplicate(s) skipped", duplicates);
+  if (shared > 0)
+    printf(", %d sharing stored content", shared);
+  printf("\n");
 
-    /* Check if path exists */
-    if (!do_file_exist(path)) {
+  import_free(&batch);
+  encdiary(1, name, get_config()->path);
+  return failed;
+}
+
+/* Days picked by catalog_each_day for list and show, in walk order */
+typedef struct {
+  char (*dates)[11];
+  int count;
+  int cap;
+  int entries;    /* entries selected so far */
+  int last;       /* stop once this many are selected, 0 for all */
+  int flags;      /* LIST_FLAG_* type selection */
+} DAY_SET;
+
+static int collect_day(CATALOG_DAY *day, void *arg) {
+  DAY_SET *set = arg;
+  int n = list_count(day, set->flags);
+
+  if (n == 0)
+    return 0;
+  if (set->count == set->cap) {
+    int cap = set->cap ? set->cap * 2 : 64;
+    char (*dates)[11] = realloc(set->dates, cap * sizeof(*dates));
+    if (dates == NULL)
+      return -1;
+    set->dates = dates;
+    set->cap = cap;
+  }
+  strcpy(set->dates[set->count++], day->date);
+  set->entries += n;
+  return set->last > 0 && set->entries >= set->last;
+}
+
+/*
+ * Parse the range of a filter and --from/--to into range. Returns 1 if no
+ * day is left, -1 if an expression is invalid.
+ */
+static int parse_range(const char *filter, const char *from, const char *to, DATE_RANGE *range) {
+  DATE_RANGE bound;
+
+  memset(range, 0, sizeof(*range));
+  if (filter != NULL && range_parse(filter, range) != 0) {
+    fprintf(stderr, "Error: invalid date or range '%s'\n", filter);
+    return -1;
+  }
+
+  const char *given[2] = {from, to};
+  for (int i = 0; i < 2; i++) {
+    if (given[i] == NULL)
+      continue;
+    if (range_parse(given[i], &bound) != 0) {
+      fprintf(stderr, "Error: invalid date '%s'\n", given[i]);
+      return -1;
+    }
+    /* --from takes the start of its span, --to the end */
+    if (i == 0)
+      bound.to[0] = '\0';
+    else
+      bound.from[0] = '\0';
+    if (range_clamp(range, &bound))
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * Get the days of range holding entries selected by flags, in date order,
+ * only the latest ones holding last entries if last > 0: the tree is then
+ * walked backwards from the end of the range and no further than needed.
+ */
+static int get_days(CATALOG *cat, const DATE_RANGE *range, int last, int flags,
+                    CATALOG_DAY ***days) {
+  DAY_SET set = {NULL, 0, 0, 0, last, flags};
+  int reverse = last > 0;
+
+  *days = NULL;
+  if (range_is_day(range)) {
+    /* single day: revalidated against the day directory */
+    CATALOG_DAY *day = catalog_get_day(cat, range->from);
+    if (day == NULL)
+      return 0;
+    *days = malloc(sizeof(CATALOG_DAY *));
+    if (*days == NULL)
+      return -1;
+    (*days)[0] = day;
+    return 1;
+  }
+
+  if (catalog_each_day(cat, range->from[0] ? range->from : NULL, range->to[0] ? range->to : NULL,
+                       reverse, collect_day, &set) < 0) {
+    free(set.dates);
+    return -1;
+  }
+
+  /* days don't move once walked: look them up after the walk */
+  *days = malloc((set.count ? set.count : 1) * sizeof(CATALOG_DAY *));
+  if (*days == NULL) {
+    free(set.dates);
+    return -1;
+  }
+  for (int i = 0; i < set.count; i++)
+    (*days)[i] = catalog_find_day(cat, set.dates[reverse ? set.count - 1 - i : i]);
+  free(set.dates);
+  return set.count;
+}
+
+int diary_list(const char *name, const char *filter, const char *from, const char *to,
+               int last, int flags) {
+  char dpath[4096];
+  char path[8192];
+  char dir[16];
+  DATE_RANGE range;
+
+  const char *list_cmd = get_config()->list_cmd;
+
+  if (name == NULL)
+    name = get_config()->name;
+
+  if (get_path_by_name(name, dpath)) {
+    printf("Error: can't find diary %s\n", name);
+    return 0;
+  }
+
+  int empty = parse_range(filter, from, to, &range);
+  if (empty < 0)
+    return 1;
+
+  if (encdiary(0, name, get_config()->path) != 0)
+    return 1;
+
+  /* a year, month or day must exist; other ranges may hold nothing */
+  int whole = range.from[0] == '\0' && range.to[0] == '\0';
+  int one_dir = !whole && range_path(&range, dir, sizeof(dir)) == 0;
+  if (one_dir) {
+    snprintf(path, sizeof(path), "%s/%s", dpath, dir);
+    if (filter != NULL && from == NULL && to == NULL && !do_file_exist(path)) {
       printf("Error: no entries for '%s' in %s\n", filter, name);
       encdiary(1, name, get_config()->path);
-      exit(EXIT_FAILURE);
+      return 1;
     }
   } else {
-    /* List entire diary */
     strcpy(path, dpath);
   }
 
-  snprintf(cmd, sizeof(cmd), "%s %s", list_cmd, path);
+  if (list_cmd != NULL && flags == 0 && last == 0 && (whole || one_dir)) {
+    /* External listing command (opt-in via list_command) */
+    proc_cmd(get_config()->list_argv, path, 0);
+    encdiary(1, name, get_config()->path);
+    return 0;
+  }
+
+  /* Answer from the catalog */
+  CATALOG cat;
+  if (catalog_load(&cat, dpath) != 0) {
+    fprintf(stderr, "Error: failed to load catalog of %s\n", name);
+    catalog_free(&cat);
+    encdiary(1, name, get_config()->path);
+    return 1;
+  }
+
+  CATALOG_DAY **days = NULL;
+  int ndays = empty ? 0 : get_days(&cat, &range, last, flags & LIST_FLAG_TYPES, &days);
+  if (ndays < 0) {
+    fprintf(stderr, "Error: failed to list entries of %s\n", name);
+    ndays = 0;
+  }
 
-  system(cmd);
+  int listed = list_render(days, ndays, last, flags);
+  free(days);
+
+  if (!listed && !whole && !(flags & LIST_FLAG_JSON)) {
+    if (filter != NULL)
+      printf("No entries found for '%s' in %s\n", filter, name);
+    else
+      printf("No entries found in %s\n", name);
+  }
+
+  catalog_save(&cat);
+  catalog_free(&cat);
 
   encdiary(1, name, get_config()->path);
+  return 0;
 }
 
-/* Helper to check if a string looks like a date filter */
-static int is_date_filter(const char *str, char *out_path, size_t out_size) {
-  if (strncmp(str, "today", 6) == 0) {
-    get_time(out_path, "%Y/%m/%d");
-    return 1;
-  } else if (strncmp(str, "yesterday", 10) == 0) {
-    time_t now = time(NULL);
-    struct tm *ts = localtime(&now);
-    ts->tm_mday--;
-    mktime(ts);
-    strftime(out_path, out_size, "%Y/%m/%d", ts);
-    return 1;
-  } else if (strncmp(str, "tomorrow", 9) == 0) {
-    time_t now = time(NULL);
-    struct tm *ts = localtime(&now);
-    ts->tm_mday++;
-    mktime(ts);
-    strftime(out_path, out_size, "%Y/%m/%d", ts);
-    return 1;
-  } else if (strlen(str) == 10 && (str[4] == '-' || str[4] == '/') &&
-             (str[7] == '-' || str[7] == '/')) {
-    /* Exactly a date (YYYY-MM-DD or YYYY/MM/DD) - must be exactly 10 chars */
-    strncpy(out_path, str, out_size - 1);
-    out_path[out_size - 1] = '\0';
-    /* Convert dashes to slashes */
-    for (char *p = out_path; *p; p++) {
-      if (*p == '-') *p = '/';
+int diary_reindex(const char *name) {
+  char dpath[4096];
+
+  if (name == NULL)
+    name = get_config()->name;
+
+  if (get_path_by_name(name, dpath)) {
+    printf("Error: can't find diary %s\n", name);
+    return 1;
+  }
+
+  if (encdiary(0, name, get_config()->path) != 0)
+    return 1;
+
+  CATALOG cat;
+  int entries = 0;
+
+  catalog_init(&cat, dpath);
+  file_type_cache_load(dpath);
+  file_type_cache_prune();
+  if (catalog_rebuild(&cat) != 0 || catalog_save(&cat) != 0) {
+    fprintf(stderr, "Error: failed to rebuild catalog of %s\n", name);
+    catalog_free(&cat);
+    encdiary(1, name, get_config()->path);
+    return 1;
+  }
+  file_type_cache_save();
+
+  for (int i = 0; i < cat.count; i++)
+    entries += cat.days[i].count;
+  printf("Indexed %d entry(s) over %d day(s) in %s\n", entries, cat.count, name);
+
+  /* recordings made before sidecars existed (or imported by hand) */
+  int created = 0;
+  int skipped = 0;
+  for (int i = 0; i < cat.count; i++) {
+    CATALOG_DAY *day = &cat.days[i];
+    for (int j = 0; j < day->count; j++) {
+      char entry_path[8192];
+      if (day->entries[j].type != MEDIA || media_sidecar_exists(dpath, day->entries[j].id))
+        continue;
+      if (!media_probe_available()) {
+        skipped++;
+        continue;
+      }
+      catalog_entry_path(&cat, day, &day->entries[j], entry_path, sizeof(entry_path));
+      created += media_sidecar_create(dpath, entry_path, 1) == 0;
     }
+  }
+  if (created > 0)
+    printf("Created %d media sidecar(s)\n", created);
+  if (skipped > 0)
+    fprintf(stderr, "Warning: ffprobe not found, %d recording(s) left without a sidecar\n",
+            skipped);
+
+  int removed = objects_rebuild(dpath, &cat);
+  if (removed < 0)
+    fprintf(stderr, "Warning: failed to recount the attachment store of %s\n", name);
+  else if (removed > 0)
+    printf("Removed %d unreferenced attachment(s)\n", removed);
+
+  catalog_free(&cat);
+  encdiary(1, name, get_config()->path);
+  return 0;
+}
+
+int diary_search(const char *query, const char *name, int limit) {
+  char dpath[4096];
+  struct timespec start, end;
+
+  if (name == NULL)
+    name = get_config()->name;
+
+  if (get_path_by_name(name, dpath)) {
+    printf("Error: can't find diary %s\n", name);
+    return 1;
+  }
+
+  if (encdiary(0, name, get_config()->path) != 0)
+    return 1;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  CATALOG cat;
+  SEARCH_INDEX idx;
+  if (catalog_load(&cat, dpath) != 0 || search_load(&idx, dpath) != 0) {
+    fprintf(stderr, "Error: failed to load search index of %s\n", name);
+    catalog_free(&cat);
+    encdiary(1, name, get_config()->path);
     return 1;
   }
+
+  /* only notes changed since the last search are read again */
+  search_sync(&idx, &cat);
+  search_save(&idx);
+  catalog_save(&cat);
+  catalog_free(&cat);
+
+  SEARCH_RESULT *results = malloc(limit * sizeof(SEARCH_RESULT));
+  int found = results ? search_query(&idx, query, results, limit) : 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  for (int i = 0; i < found; i++) {
+    const SEARCH_DOC *d = &idx.docs[results[i].doc];
+    const char *label = d->sections[results[i].section].label;
+
+    /* key is YYYY-MM-DD/<id> */
+    printf("%s", d->key + 11);
+    if (label[0] != '\0')
+      printf(" ** %s", label);
+    printf("  (%.2f)\n", results[i].score);
+    char snippet[128];
+    if (search_snippet(&idx, &results[i], query, snippet, sizeof(snippet)) == 0)
+      printf("    %s\n", snippet);
+  }
+
+  double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6;
+  printf("%s%d result(s) for '%s' in %.1f ms\n", found ? "\n" : "", found, query, ms);
+
+  free(results);
+  search_free(&idx);
+  encdiary(1, name, get_config()->path);
   return 0;
 }
 
@@ -245,61 +629,222 @@ static int extract_time_from_filename(const char *filename, char *time_out, size
   return 0;
 }
 
-/* Helper to print context from a text file for a specific media entry */
-static void print_note_context(const char *filepath, const char *media_filename, int max_lines) {
-  FILE *f = fopen(filepath, "r");
-  if (!f) return;
-  
+/* Print the section of the day note matching a media entry's time */
+static void print_note_context(const NOTE *note, const char *media_filename, int max_lines) {
   char time_pattern[16];
-  int found_section = 0;
-  
+
   /* Extract time from media filename to find matching section */
-  if (!extract_time_from_filename(media_filename, time_pattern, sizeof(time_pattern))) {
-    fclose(f);
+  if (!extract_time_from_filename(media_filename, time_pattern, sizeof(time_pattern)))
     return;
-  }
-  
-  char line[512];
+  const NOTE_SECTION *s = note_find(note, time_pattern);
+  if (s == NULL)
+    return;
+
+  const char *p = note->data + s->offset;
+  const char *end = note->data + s->end;
   int printed = 0;
-  
+
   printf("  \033[2m"); /* Dim text */
-  while (fgets(line, sizeof(line), f)) {
-    size_t len = strlen(line);
-    if (len > 0 && line[len - 1] == '\n') line[len - 1] = '\0';
-    
-    /* Check if this is a level-2 header with our timestamp (e.g., "** 17:06") */
-    if (strncmp(line, "** ", 3) == 0 && strstr(line, time_pattern)) {
-      found_section = 1;
-      printf(" %s\n", line);
+  const char *eoh = memchr(p, '\n', s->body - s->offset);
+  printf(" %.*s\n", (int)((eoh ? eoh : note->data + s->body) - p), p);
+  for (p = note->data + s->body; p < end && printed < max_lines;) {
+    const char *eol = memchr(p, '\n', end - p);
+    if (eol == NULL)
+      eol = end;
+
+    /* Skip empty lines */
+    const char *t = p;
+    while (t < eol && (*t == ' ' || *t == '\t')) t++;
+    if (t < eol) {
+      printf("  %.*s\n", (int)(eol - p), p);
       printed++;
+    }
+    p = eol + 1;
+  }
+  printf("\033[0m"); /* Reset */
+}
+
+/* Stream one section of a note to the pager */
+static int show_note_section(const char *path, const char *time) {
+  NOTE note;
+
+  if (note_load(&note, path) != 0) {
+    fprintf(stderr, "Error: can't read %s\n", path);
+    return 1;
+  }
+  const NOTE_SECTION *s = note_find(&note, time);
+  if (s == NULL) {
+    printf("Error: no section %s in %s\n", time, path);
+    note_free(&note);
+    return 1;
+  }
+  proc_run_data(get_config()->pager_argv, note.data + s->offset, s->end - s->offset, 0);
+  note_free(&note);
+  return 0;
+}
+
+/* Release the file list of a day built by diary_show */
+static void free_file_list(char **files, FILE_TYPE *ftypes, int total) {
+  for (int i = 0; i < total; i++)
+    free(files[i]);
+  free(files);
+  free(ftypes);
+}
+
+/*
+ * Show the entries of day from entry first on (earlier ones are counted but
+ * not shown), label naming the day in messages. Returns 0 on success.
+ */
+static int show_day(const char *name, const CATALOG *cat, const CATALOG_DAY *day, int first,
+                    const char *label, const char *section, int flags) {
+  const char *dpath = cat->dpath;
+  int total = 0;
+  int main_entry_idx = -1;
+
+  /* First pass: collect all files and find main entry */
+  char **files = calloc(day->count, sizeof(char *));
+  FILE_TYPE *ftypes = calloc(day->count, sizeof(FILE_TYPE));
+  if (files == NULL || ftypes == NULL) {
+    fprintf(stderr, "Error: out of memory\n");
+    free(files);
+    free(ftypes);
+    return 1;
+  }
+  for (int i = 0; i < day->count; i++) {
+    char entry_path[8192];
+    catalog_entry_path(cat, day, &day->entries[i], entry_path, sizeof(entry_path));
+    files[total] = strdup(entry_path);
+    if (files[total] == NULL)
+      break;
+    ftypes[total] = day->entries[i].type;
+
+    /* First text file is the main entry */
+    if (main_entry_idx < 0 && ftypes[total] == TEXT) {
+      main_entry_idx = total;
+    }
+    total++;
+  }
+  if (first > total)
+    first = total;
+
+  if (section != NULL) {
+    int rc = 1;
+    if (main_entry_idx < 0)
+      printf("Error: no note for '%s' in %s\n", label, name);
+    else
+      rc = show_note_section(files[main_entry_idx], section);
+    free_file_list(files, ftypes, total);
+    return rc;
+  }
+
+  /* Show header summary if --head flag (only prints summary, no content) */
+  if (flags & SHOW_FLAG_HEAD) {
+    double length = 0;
+    printf("=== %s: %d file(s) ===\n", label, total - first);
+    for (int i = first; i < total; i++) {
+      const char *fn = strrchr(files[i], '/');
+      fn = fn ? fn + 1 : files[i];
+      const char *type_str = (ftypes[i] == TEXT) ? "text" :
+                             (ftypes[i] == MEDIA) ? "media" : "other";
+      char details[128] = "";
+      MEDIA_INFO info;
+
+      /* recordings are described from their sidecar, never probed here */
+      if (ftypes[i] == MEDIA && media_sidecar_load(dpath, fn, &info) == 0) {
+        char duration[32];
+        media_format_duration(info.duration, duration, sizeof(duration));
+        if (info.width > 0)
+          snprintf(details, sizeof(details), ", %s, %dx%d %s%s%s", duration, info.width,
+                   info.height, info.video_codec, info.audio_codec[0] ? "/" : "",
+                   info.audio_codec);
+        else
+          snprintf(details, sizeof(details), ", %s, %s", duration, info.audio_codec);
+        length += info.duration;
+      }
+      printf("  [%d/%d] %s (%s%s)%s\n", i + 1 - first, total - first, fn, type_str, details,
+             (i == main_entry_idx) ? " *main*" : "");
+
+      if ((flags & SHOW_FLAG_THUMBS) && ftypes[i] == MEDIA && info.thumbs > 0)
+        list_print_thumbs(dpath, fn);
+    }
+    if (length > 0) {
+      char duration[32];
+      media_format_duration(length, duration, sizeof(duration));
+      printf("Total length: %s\n", duration);
+    }
+    free_file_list(files, ftypes, total);
+    return 0;
+  }
+
+  /* Handle --main flag: show only the main diary entry */
+  if ((flags & SHOW_FLAG_MAIN_ONLY) && main_entry_idx >= 0) {
+    const char *main_fn = strrchr(files[main_entry_idx], '/');
+    main_fn = main_fn ? main_fn + 1 : files[main_entry_idx];
+
+    printf("Showing main entry: %s\n", main_fn);
+    open_entry(files[main_entry_idx], TEXT);
+
+    free_file_list(files, ftypes, total);
+    return 0;
+  }
+
+  /* the note is indexed once for the context of every recording */
+  NOTE note;
+  int have_note = main_entry_idx >= 0 && note_load(&note, files[main_entry_idx]) == 0;
+
+  /* Second pass: display files with appropriate mode */
+  int shown = 0;
+  for (int i = first; i < total; i++) {
+    /* Skip non-text files if --text flag is set */
+    if ((flags & SHOW_FLAG_TEXT_ONLY) && ftypes[i] != TEXT) {
       continue;
     }
-    
-    /* If we found our section, print until next header or max lines */
-    if (found_section) {
-      /* Stop at next level-1 or level-2 header */
-      if (line[0] == '*') break;
-      
-      /* Skip empty lines */
-      char *p = line;
-      while (*p == ' ' || *p == '\t') p++;
-      if (*p == '\0') continue;
-      
-      if (printed < max_lines) {
-        printf("  %s\n", line);
-        printed++;
+
+    const char *filename = strrchr(files[i], '/');
+    filename = filename ? filename + 1 : files[i];
+
+    /* In interleaved mode, show main entry before each non-main entry */
+    if ((flags & SHOW_FLAG_INTERLEAVED) && main_entry_idx >= 0 &&
+        i != main_entry_idx && ftypes[main_entry_idx] == TEXT) {
+      const char *main_fn = strrchr(files[main_entry_idx], '/');
+      main_fn = main_fn ? main_fn + 1 : files[main_entry_idx];
+
+      printf("\n--- Main entry: %s (before viewing %s) ---\n", main_fn, filename);
+      open_entry(files[main_entry_idx], TEXT);
+    }
+
+    shown++;
+
+    switch (ftypes[i]) {
+    case TEXT:
+      printf("Showing [%d]: %s (text)\n", shown, filename);
+      break;
+    case MEDIA:
+      printf("Playing [%d]: %s (media)\n", shown, filename);
+      /* Show context from main entry if available (section matching this media's timestamp) */
+      if (have_note) {
+        print_note_context(&note, filename, 5);
       }
+      break;
+    case OTHER:
+    default:
+      printf("Opening [%d]: %s\n", shown, filename);
+      break;
     }
+    open_entry(files[i], ftypes[i]);
   }
-  printf("\033[0m"); /* Reset */
-  
-  fclose(f);
+
+  printf("\nShowed %d entry(s) for '%s'\n", total - first, label);
+  if (have_note)
+    note_free(&note);
+  free_file_list(files, ftypes, total);
+  return 0;
 }
 
-void diary_show(char *id_or_filter, const char *name, int flags) {
+int diary_show(char *id_or_filter, const char *name, int last, int flags) {
   /*
    * Show diary entries:
-   * - If id_or_filter is "today", "yesterday", "tomorrow", or a date: show all entries for that day
+   * - If id_or_filter is a date or range (see range.h): show all entries of its days
    * - Otherwise: treat as an entry ID and show that specific file
    *
    * Flags:
@@ -313,144 +858,95 @@ void diary_show(char *id_or_filter, const char *name, int flags) {
    */
   char dpath[4096];
   char path[8192];
-  char cmd[16384];
   char tme[26];
+  DATE_RANGE range = {"", ""};
 
   if (name == NULL)
     name = get_config()->name;
 
   if (get_path_by_name(name, dpath)) {
     printf("Error: can't find diary %s\n", name);
-    exit(EXIT_FAILURE);
+    return 1;
   }
 
-  encdiary(0, name, get_config()->path);
-
-  if (is_date_filter(id_or_filter, tme, sizeof(tme))) {
-    /* Show all entries for the date */
-    snprintf(path, sizeof(path), "%s/%s", dpath, tme);
+  /* "<day or note>#HH:MM" addresses one section of the note */
+  char *section = id_or_filter != NULL ? strchr(id_or_filter, '#') : NULL;
+  if (section != NULL)
+    *section++ = '\0';
 
-    if (!do_file_exist(path)) {
-      printf("Error: no entries for '%s' in %s\n", id_or_filter, name);
-      encdiary(1, name, get_config()->path);
-      exit(EXIT_FAILURE);
-    }
+  if (encdiary(0, name, get_config()->path) != 0)
+    return 1;
+  file_type_cache_load(dpath);
 
-    /* Find all files in the directory, sorted by name (chronological order) */
-    snprintf(cmd, sizeof(cmd), "find %s -maxdepth 1 -type f 2>/dev/null | sort", path);
+  if (id_or_filter == NULL || range_parse(id_or_filter, &range) == 0) {
+    const char *label = id_or_filter != NULL ? id_or_filter : name;
 
-    FILE *fp = popen(cmd, "r");
-    if (fp == NULL) {
-      fprintf(stderr, "Error: failed to list entries\n");
-      encdiary(1, name, get_config()->path);
-      exit(EXIT_FAILURE);
-    }
+    /* a year, month or day must exist */
+    if (range_path(&range, tme, sizeof(tme)) == 0) {
+      snprintf(path, sizeof(path), "%s/%s", dpath, tme);
 
-    /* First pass: collect all files and find main entry */
-    char files[256][4096];
-    FILE_TYPE ftypes[256];
-    int total = 0;
-    int main_entry_idx = -1;
-    char file_path[4096];
-
-    while (fgets(file_path, sizeof(file_path), fp) != NULL && total < 256) {
-      file_path[strcspn(file_path, "\n")] = '\0';
-      if (strlen(file_path) > 0) {
-        strncpy(files[total], file_path, sizeof(files[total]) - 1);
-        files[total][sizeof(files[total]) - 1] = '\0';
-        ftypes[total] = get_file_type(file_path);
-        
-        /* First text file is the main entry */
-        if (main_entry_idx < 0 && ftypes[total] == TEXT) {
-          main_entry_idx = total;
-        }
-        total++;
+      if (!do_file_exist(path)) {
+        printf("Error: no entries for '%s' in %s\n", label, name);
+        file_type_cache_save();
+        encdiary(1, name, get_config()->path);
+        return 1;
       }
     }
-    pclose(fp);
 
-    if (total == 0) {
-      printf("No entries found for '%s' in %s\n", id_or_filter, name);
+    /* Day records from the catalog, sorted by name (chronological order) */
+    CATALOG cat;
+    if (catalog_load(&cat, dpath) != 0) {
+      fprintf(stderr, "Error: failed to list entries\n");
+      catalog_free(&cat);
+      file_type_cache_save();
       encdiary(1, name, get_config()->path);
-      return;
+      return 1;
     }
 
-    /* Show header summary if --head flag (only prints summary, no content) */
-    if (flags & SHOW_FLAG_HEAD) {
-      printf("=== %s: %d file(s) ===\n", id_or_filter, total);
-      for (int i = 0; i < total; i++) {
-        const char *fn = strrchr(files[i], '/');
-        fn = fn ? fn + 1 : files[i];
-        const char *type_str = (ftypes[i] == TEXT) ? "text" :
-                               (ftypes[i] == MEDIA) ? "media" : "other";
-        printf("  [%d/%d] %s (%s)%s\n", i + 1, total, fn, type_str,
-               (i == main_entry_idx) ? " *main*" : "");
-      }
+    int types = (flags & SHOW_FLAG_TEXT_ONLY) ? LIST_FLAG_TEXT : 0;
+    CATALOG_DAY **days;
+    int ndays = get_days(&cat, &range, last, types, &days);
+    catalog_save(&cat);
+
+    if (ndays <= 0) {
+      if (ndays < 0)
+        fprintf(stderr, "Error: failed to list entries\n");
+      else
+        printf("No entries found for '%s' in %s\n", label, name);
+      free(days);
+      catalog_free(&cat);
+      file_type_cache_save();
       encdiary(1, name, get_config()->path);
-      return;
+      return 0;
     }
 
-    /* Handle --main flag: show only the main diary entry */
-    if ((flags & SHOW_FLAG_MAIN_ONLY) && main_entry_idx >= 0) {
-      const char *main_fn = strrchr(files[main_entry_idx], '/');
-      main_fn = main_fn ? main_fn + 1 : files[main_entry_idx];
-      
-      printf("Showing main entry: %s\n", main_fn);
-      snprintf(cmd, sizeof(cmd), "%s \"%s\"", get_config()->pager, files[main_entry_idx]);
-      system(cmd);
-      
-      encdiary(1, name, get_config()->path);
-      return;
+    /* with --last, the oldest day may hold more entries than asked for */
+    int skip = 0;
+    if (last > 0) {
+      for (int d = 0; d < ndays; d++)
+        skip += list_count(days[d], types);
+      skip -= last;
+    }
+    int first = 0;
+    while (skip > 0 && first < days[0]->count) {
+      if (types == 0 || days[0]->entries[first].type == TEXT)
+        skip--;
+      first++;
     }
 
-    /* Second pass: display files with appropriate mode */
-    int shown = 0;
-    for (int i = 0; i < total; i++) {
-      /* Skip non-text files if --text flag is set */
-      if ((flags & SHOW_FLAG_TEXT_ONLY) && ftypes[i] != TEXT) {
-        continue;
-      }
-
-      const char *filename = strrchr(files[i], '/');
-      filename = filename ? filename + 1 : files[i];
-
-      /* In interleaved mode, show main entry before each non-main entry */
-      if ((flags & SHOW_FLAG_INTERLEAVED) && main_entry_idx >= 0 &&
-          i != main_entry_idx && ftypes[main_entry_idx] == TEXT) {
-        const char *main_fn = strrchr(files[main_entry_idx], '/');
-        main_fn = main_fn ? main_fn + 1 : files[main_entry_idx];
-        
-        printf("\n--- Main entry: %s (before viewing %s) ---\n", main_fn, filename);
-        snprintf(cmd, sizeof(cmd), "%s \"%s\"", get_config()->pager, files[main_entry_idx]);
-        system(cmd);
-      }
-
-      shown++;
-      
-      switch (ftypes[i]) {
-      case TEXT:
-        printf("Showing [%d]: %s (text)\n", shown, filename);
-        snprintf(cmd, sizeof(cmd), "%s \"%s\"", get_config()->pager, files[i]);
-        break;
-      case MEDIA:
-        printf("Playing [%d]: %s (media)\n", shown, filename);
-        /* Show context from main entry if available (section matching this media's timestamp) */
-        if (main_entry_idx >= 0 && ftypes[main_entry_idx] == TEXT) {
-          print_note_context(files[main_entry_idx], filename, 5);
-        }
-        /* Suppress ffmpeg/player output by redirecting stderr and stdout to /dev/null */
-        snprintf(cmd, sizeof(cmd), "%s \"%s\" >/dev/null 2>&1", get_config()->player, files[i]);
-        break;
-      case OTHER:
-      default:
-        printf("Opening [%d]: %s\n", shown, filename);
-        snprintf(cmd, sizeof(cmd), "xdg-open \"%s\" >/dev/null 2>&1", files[i]);
-        break;
-      }
-      system(cmd);
+    int failed = 0;
+    for (int d = 0; d < ndays; d++) {
+      const char *day_label = ndays == 1 && range_is_day(&range) ? label : days[d]->date;
+      failed |= show_day(name, &cat, days[d], d == 0 ? first : 0, day_label, section, flags);
     }
+    free(days);
+    catalog_free(&cat);
 
-    printf("\nShowed %d entry(s) for '%s'\n", total, id_or_filter);
+    if (failed) {
+      file_type_cache_save();
+      encdiary(1, name, get_config()->path);
+      return 1;
+    }
   } else {
     /* Treat as entry ID - parse and find the file */
     char ch[256];
@@ -469,21 +965,230 @@ void diary_show(char *id_or_filter, const char *name, int flags) {
     /* Check if file exists */
     if (!do_file_exist(path)) {
       printf("Error: entry not found %s\n", path);
+      file_type_cache_save();
       encdiary(1, name, get_config()->path);
-      exit(EXIT_FAILURE);
+      return 1;
     }
 
-    open_file_command(path, cmd);
-    system(cmd);
+    if (section != NULL && show_note_section(path, section) != 0) {
+      file_type_cache_save();
+      encdiary(1, name, get_config()->path);
+      return 1;
+    } else if (section == NULL) {
+      open_entry(path, get_file_type(path));
+    }
   }
 
+  file_type_cache_save();
   encdiary(1, name, get_config()->path);
+  return 0;
 }
 
-void diary_delete(char *id, const char *name) {
+int diary_export(const char *from, const char *to, const char *format, const char *output,
+                 const char *name) {
+  char dpath[4096];
+  char title[256];
+  char size[16];
+  EXPORT_FORMAT fmt = EXPORT_ORG;
+  EXPORT_STATS stats;
+
+  if (name == NULL)
+    name = get_config()->name;
+
+  /* titled as asked: the bounds below may be padded */
+  if (from != NULL || to != NULL)
+    snprintf(title, sizeof(title), "%s %s..%s", name, from ? from : "", to ? to : "");
+  else
+    snprintf(title, sizeof(title), "%s", name);
+
+  /* --from 2025-03 starts with March, --to 2025-03 ends with it */
+  DATE_RANGE range;
+  if (parse_range(NULL, from, to, &range) < 0)
+    return 1;
+  from = range.from[0] != '\0' ? range.from : NULL;
+  to = range.to[0] != '\0' ? range.to : NULL;
+  if (format != NULL && export_format_parse(format, &fmt) != 0) {
+    fprintf(stderr, "Error: unknown format '%s' (use org, md, html or tar)\n", format);
+    return 1;
+  }
+
+  int to_stdout = output == NULL || strcmp(output, "-") == 0;
+  if (to_stdout && fmt == EXPORT_TAR && isatty(STDOUT_FILENO)) {
+    fprintf(stderr, "Error: not writing a tar archive to a terminal (use -o <file>)\n");
+    return 1;
+  }
+
+  if (get_path_by_name(name, dpath)) {
+    printf("Error: can't find diary %s\n", name);
+    return 1;
+  }
+
+  /* the export is plaintext: keep it private like the diary */
+  FILE *out = stdout;
+  if (!to_stdout) {
+    int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0 || (out = fdopen(fd, "w")) == NULL) {
+      fprintf(stderr, "Error: can't write %s: %s\n", output, strerror(errno));
+      return 1;
+    }
+  }
+  setvbuf(out, NULL, _IOFBF, 1 << 16);
+
+  if (encdiary(0, name, get_config()->path) != 0) {
+    if (out != stdout)
+      fclose(out);
+    return 1;
+  }
+
+  CATALOG cat;
+  int rc = catalog_load(&cat, dpath) != 0 ||
+           export_run(&cat, from, to, fmt, title, out, &stats) != 0;
+  catalog_save(&cat);
+  catalog_free(&cat);
+
+  if (fflush(out) != 0 || (out != stdout && fclose(out) != 0))
+    rc = 1;
+  encdiary(1, name, get_config()->path);
+
+  if (rc != 0) {
+    fprintf(stderr, "Error: export of %s failed\n", name);
+    return 1;
+  }
+  if (!to_stdout) {
+    format_size(stats.bytes, size, sizeof(size));
+    printf("Exported %d entry(s) over %d day(s) (%s) to %s\n", stats.entries, stats.days, size,
+           output);
+  }
+  return 0;
+}
+
+int diary_backup(const char *target, int verify, const char *name) {
+  char src[4096], real_src[4096], real_target[4096];
+  char dest[8200], manifest[8200];
+  char size[16], literal[16], matched[16];
+  BACKUP_STATS stats;
+
+  if (name == NULL)
+    name = get_config()->name;
+
+  if (get_path_by_name(name, src)) {
+    printf("Error: can't find diary %s\n", name);
+    return 1;
+  }
+  snprintf(dest, sizeof(dest), "%s/%s", target, name);
+  snprintf(manifest, sizeof(manifest), "%s/%s.manifest", target, name);
+
+  if (verify) {
+    if (backup_verify(dest, manifest, &stats) != 0)
+      return 1;
+    format_size(stats.bytes, size, sizeof(size));
+    if (stats.failed > 0) {
+      fprintf(stderr, "Error: %d of %d file(s) in %s do not match the manifest\n", stats.failed,
+              stats.files, dest);
+      return 1;
+    }
+    printf("Verified %d file(s) (%s) in %s\n", stats.files, size, dest);
+    return 0;
+  }
+
+  /* the ciphertext is copied as is: no need to unlock the diary */
+  get_ciphertext_path(name, get_config()->path, src, sizeof(src));
+  if (!do_file_exist(src)) {
+    fprintf(stderr, "Error: %s does not exist\n", src);
+    return 1;
+  }
+
+  /* the backup must not end up in what it copies: resolve the part of target that exists */
+  snprintf(dest, sizeof(dest), "%s", target);
+  while (realpath(dest, real_target) == NULL) {
+    char *slash = strrchr(dest, '/');
+    if (slash == NULL)
+      snprintf(dest, sizeof(dest), ".");
+    else if (slash == dest)
+      dest[1] = '\0';
+    else
+      *slash = '\0';
+  }
+  size_t len = realpath(src, real_src) != NULL ? strlen(real_src) : 0;
+  if (len > 0 && strncmp(real_target, real_src, len) == 0 &&
+      (real_target[len] == '/' || real_target[len] == '\0')) {
+    fprintf(stderr, "Error: the backup can't be inside the diary\n");
+    return 1;
+  }
+  snprintf(dest, sizeof(dest), "%s/%s", target, name);
+
+  if (backup_run(src, dest, manifest, &stats) != 0) {
+    fprintf(stderr, "Error: backup of %s failed\n", name);
+    return 1;
+  }
+  format_size(stats.bytes, size, sizeof(size));
+  format_size(stats.literal, literal, sizeof(literal));
+  format_size(stats.matched, matched, sizeof(matched));
+  printf("Backed up %d file(s) (%s) to %s: %d copied (%s sent, %s reused), %d unchanged, "
+         "%d removed\n", stats.files, size, dest, stats.copied, literal, matched,
+         stats.unchanged, stats.removed);
+  if (stats.failed > 0) {
+    fprintf(stderr, "Error: %d file(s) could not be backed up\n", stats.failed);
+    return 1;
+  }
+  return 0;
+}
+
+int diary_stats(const char *name, int json) {
+  char dpath[4096];
+  char stored[16], saved[16];
+  OBJECT_STATS stats;
+  STATS_DIARY activity;
+  CATALOG cat;
+
+  if (name == NULL)
+    name = get_config()->name;
+
+  if (get_path_by_name(name, dpath)) {
+    printf("Error: can't find diary %s\n", name);
+    return 1;
+  }
+
+  if (encdiary(0, name, get_config()->path) != 0)
+    return 1;
+
+  int rc = catalog_load(&cat, dpath) != 0 || stats_collect(&cat, &activity) != 0;
+  catalog_save(&cat);
+  catalog_free(&cat);
+  if (rc != 0) {
+    encdiary(1, name, get_config()->path);
+    fprintf(stderr, "Error: failed to collect statistics of %s\n", name);
+    return 1;
+  }
+
+  objects_stats(dpath, &stats);
+  if (json) {
+    printf("{\"diary\":");
+    print_json_string(stdout, name);
+    printf(",\"attachment_store\":{\"enabled\":%s,\"objects\":%d,\"stored\":%lld,"
+           "\"references\":%lld,\"saved\":%lld},\"activity\":",
+           get_config()->attachment_store ? "true" : "false", stats.objects, stats.stored,
+           stats.refs, stats.saved);
+    stats_print_json(&activity, stdout);
+    printf("}\n");
+  } else {
+    stats_print(&activity, stdout);
+    format_size(stats.stored, stored, sizeof(stored));
+    format_size(stats.saved, saved, sizeof(saved));
+    printf("\nAttachment store: %s\n", get_config()->attachment_store ? "on" : "off");
+    printf("  objects:    %d (%s)\n", stats.objects, stored);
+    printf("  references: %lld\n", stats.refs);
+    printf("  saved:      %s\n", saved);
+  }
+  stats_free(&activity);
+
+  encdiary(1, name, get_config()->path);
+  return 0;
+}
+
+int diary_delete(char *id, const char *name) {
   char dpath[4096];
   char path[8192];
-  char cmd[16384];
   char ch[256];
 
   if (name == NULL)
@@ -491,10 +1196,11 @@ void diary_delete(char *id, const char *name) {
 
   if (get_path_by_name(name, dpath)) {
     printf("Error: can't find diary %s", name);
-    exit(EXIT_FAILURE);
+    return 1;
   }
 
-  encdiary(0, name, get_config()->path);
+  if (encdiary(0, name, get_config()->path) != 0)
+    return 1;
 
   /* Parse id to path */
   char *c = ch;
@@ -511,107 +1217,286 @@ void diary_delete(char *id, const char *name) {
   if (!do_file_exist(path)) {
     printf("Error: file not found %s\n", path);
     encdiary(1, name, get_config()->path);
-    exit(EXIT_FAILURE);
+    return 1;
   }
 
   printf("Deleting %s\n", path);
 
-  snprintf(cmd, sizeof(cmd), "%s %s", get_config()->file_manager, path);
+  char object[SHA256_HEX_LEN];
+  int stored = objects_ref_id(path, object) == 0;
+
+  proc_cmd(get_config()->file_manager_argv, path, 0);
+
+  /* drop the record if the entry was removed */
+  if (!do_file_exist(path)) {
+    if (stored)
+      objects_release(dpath, object);
+    import_forget(dpath, path + strlen(dpath) + 1);
+    CATALOG cat;
+    if (catalog_load(&cat, dpath) == 0) {
+      catalog_remove(&cat, id);
+      catalog_save(&cat);
+      media_sidecar_remove(dpath, id);
+    }
+    catalog_free(&cat);
+  }
 
-  system(cmd);
   encdiary(1, name, get_config()->path);
+  return 0;
 }
 
-void diary_explore(const char *name) {
+int diary_explore(const char *name) {
   char path[4096];
-  char cmd[8192];
 
   if (name == NULL)
     name = get_config()->name;
 
   if (get_path_by_name(name, path)) {
     printf("Error: can't find diary %s", name);
-    exit(EXIT_FAILURE);
+    return 1;
+  }
+
+  if (store_is_native(path)) {
+    printf("Error: diary %s uses native storage, its files can only be read through dry\n", name);
+    return 1;
   }
 
-  encdiary(0, name, get_config()->path);
+  if (encdiary(0, name, get_config()->path) != 0)
+    return 1;
 
   /* Check if file exists */
   if (!do_file_exist(path)) {
     printf("Error: dir not found %s\n", path);
     encdiary(1, name, get_config()->path);
-    exit(EXIT_FAILURE);
+    return 1;
   }
 
-  snprintf(cmd, sizeof(cmd), "%s %s", get_config()->file_manager, path);
-
   /* Display files */
-  system(cmd);
+  proc_cmd(get_config()->file_manager_argv, path, 0);
   encdiary(1, name, get_config()->path);
+  return 0;
 }
 
 int diary_is_unlocked(const char *name) {
   char mount_point[2048];
-  char cmd[4096];
   
   if (name == NULL)
     name = get_config()->name;
   
-  snprintf(mount_point, sizeof(mount_point), "%s/%s", get_config()->path, name);
-  snprintf(cmd, sizeof(cmd), "mountpoint -q %s 2>/dev/null", mount_point);
+  get_mount_point(name, NULL, mount_point, sizeof(mount_point));
   
-  return (system(cmd) == 0);
+  return is_mount_point(mount_point);
 }
 
-void diary_unlock(const char *name) {
+/* Keep the catalog of an unlocked diary current until 'dry lock' */
+static void unlock_watch(const char *path) {
+  int rc = watch_start(path);
+  if (rc < 0)
+    fprintf(stderr, "Warning: failed to watch %s for changes\n", path);
+  else
+    printf("  Watching for changes%s\n", rc > 0 ? " (already running)" : "");
+}
+
+int diary_unlock(const char *name, int flags) {
   char path[2048];
+  char mount_point[2048];
   
   if (name == NULL)
     name = get_config()->name;
 
   if (get_path_by_name(name, path)) {
     printf("Error: can't find diary %s\n", name);
-    exit(EXIT_FAILURE);
+    return 1;
+  }
+
+  if (store_is_native(path)) {
+    printf("Diary '%s' uses native storage: nothing to mount, each command asks for the passphrase\n", name);
+    if (flags & UNLOCK_FLAG_WATCH) {
+      /* the watcher keeps a copy of the key until 'dry lock' */
+      if (encdiary(0, name, get_config()->path) != 0)
+        return 1;
+      unlock_watch(path);
+      encdiary(1, name, get_config()->path);
+    }
+    return 0;
   }
 
   if (diary_is_unlocked(name)) {
+    /* may be held by the agent: keep it mounted until 'dry lock' */
+    get_mount_point(name, NULL, mount_point, sizeof(mount_point));
+    agent_forget(mount_point);
     printf("Diary '%s' is already unlocked\n", name);
     printf("  Path: %s\n", path);
-    return;
+    if (flags & UNLOCK_FLAG_WATCH)
+      unlock_watch(path);
+    return 0;
   }
 
   /* Mount and keep open (don't unmount) */
-  encdiary(0, name, get_config()->path);
+  if (encdiary(0, name, get_config()->path) != 0)
+    return 1;
+  get_mount_point(name, NULL, mount_point, sizeof(mount_point));
+  agent_forget(mount_point);
+
+  /* recordings left over from a previous session */
+  transcode_start(name, path, 0);
   
   printf("Diary '%s' unlocked\n", name);
   printf("  Path: %s\n", path);
+  if (flags & UNLOCK_FLAG_WATCH)
+    unlock_watch(path);
   printf("\nRemember to lock when done: dry lock");
   if (strcmp(name, get_config()->name) != 0) {
     printf(" -d %s", name);
   }
   printf("\n");
+  return 0;
 }
 
-void diary_lock(const char *name) {
+int diary_lock(const char *name) {
   char path[2048];
+  char mount_point[2048];
   
   if (name == NULL)
     name = get_config()->name;
 
   if (get_path_by_name(name, path)) {
     printf("Error: can't find diary %s\n", name);
-    exit(EXIT_FAILURE);
+    return 1;
+  }
+
+  /* the watcher saves the catalog and lets go of the mount first */
+  if (watch_stop(path) == 0)
+    printf("Stopped watching '%s'\n", name);
+
+  if (store_is_native(path)) {
+    printf("Diary '%s' uses native storage: nothing to unmount\n", name);
+    return 0;
   }
 
   if (!diary_is_unlocked(name)) {
     printf("Diary '%s' is not unlocked\n", name);
-    return;
+    return 0;
   }
 
-  /* Force unmount */
+  /* Take it away from the agent and force unmount */
+  get_mount_point(name, NULL, mount_point, sizeof(mount_point));
+  transcode_stop(path);
+  agent_forget(mount_point);
   encdiary(1, name, get_config()->path);
   
   printf("Diary '%s' locked\n", name);
+  return 0;
+}
+
+int diary_watch(const char *name) {
+  char dpath[4096];
+
+  if (name == NULL)
+    name = get_config()->name;
+
+  if (get_path_by_name(name, dpath)) {
+    printf("Error: can't find diary %s\n", name);
+    return 1;
+  }
+
+  if (encdiary(0, name, get_config()->path) != 0)
+    return 1;
+  int rc = watch_run(dpath);
+  encdiary(1, name, get_config()->path);
+  return rc != 0;
+}
+
+/* Days offered when completing without a prefix */
+#define COMPLETE_RECENT_DAYS 7
+
+typedef struct {
+  const char *prefix;
+  const char *since;    /* without a prefix, days before are skipped */
+  int dates;
+  int ids;
+} COMPLETE_STATE;
+
+static int has_prefix(const char *s, const char *prefix) {
+  return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+static int complete_record(const char *date, const char *id, void *arg) {
+  COMPLETE_STATE *cs = arg;
+
+  if (strcmp(date, cs->since) < 0)
+    return 0;
+  if (id == NULL ? cs->dates && has_prefix(date, cs->prefix) : cs->ids && has_prefix(id, cs->prefix))
+    puts(id == NULL ? date : id);
+  return 0;
+}
+
+static int complete_day(const char *date, int dirfd, void *arg) {
+  (void)dirfd;
+  return complete_record(date, NULL, arg);
+}
+
+static int complete_entry(const WALK_ENTRY *we, void *arg) {
+  return complete_record(we->date, we->name, arg);
+}
+
+void diary_complete(const char *kind, const char *prefix, const char *name) {
+  static const char *filters[] = {"today", "yesterday", "tomorrow"};
+  COMPLETE_STATE cs = {prefix != NULL ? prefix : "", "", 0, 0};
+  char dpath[4096], since[16];
+
+  cs.dates = strcmp(kind, "dates") == 0 || strcmp(kind, "entries") == 0;
+  cs.ids = strcmp(kind, "ids") == 0 || strcmp(kind, "entries") == 0;
+
+  if (strcmp(kind, "diaries") == 0) {
+    registry_load(NULL);
+    for (int i = 0; i < registry_count(); i++)
+      if (has_prefix(registry_entry(i)->name, cs.prefix))
+        puts(registry_entry(i)->name);
+    return;
+  }
+
+  for (int i = 0; cs.dates && i < 3; i++)
+    if (has_prefix(filters[i], cs.prefix))
+      puts(filters[i]);
+
+  if (name == NULL && get_config() != NULL)
+    name = get_config()->name;
+  if ((!cs.dates && !cs.ids) || name == NULL || get_path_by_name(name, dpath) != 0)
+    return;
+
+  /* without a prefix only the last week, a whole diary is too much to offer */
+  if (*cs.prefix == '\0') {
+    time_t t = time(NULL) - COMPLETE_RECENT_DAYS * 86400;
+    strftime(since, sizeof(since), "%Y-%m-%d", localtime(&t));
+    cs.since = since;
+  }
+
+  if (catalog_read(dpath, complete_record, &cs) == 0)
+    return;
+
+  /*
+   * A locked native diary has an encrypted catalog but plain names: walk
+   * the days the prefix can match (ids start with their date).
+   */
+  if (!store_is_native(dpath) || (*cs.prefix != '\0' && !isdigit((unsigned char)*cs.prefix)))
+    return;
+  char from[16], to[16];
+  if (*cs.prefix == '\0') {
+    snprintf(from, sizeof(from), "%s", cs.since);
+    snprintf(to, sizeof(to), "9999-99-99");
+  } else {
+    static const char low[] = "0000-00-00", high[] = "9999-19-39";
+    size_t n = strspn(cs.prefix, "0123456789-");
+    if (n > 10)
+      n = 10;
+    snprintf(from, sizeof(from), "%.*s%s", (int)n, cs.prefix, low + n);
+    snprintf(to, sizeof(to), "%.*s%s", (int)n, cs.prefix, high + n);
+  }
+  if (cs.dates)
+    walk_days(dpath, from, to, complete_day, &cs);
+  if (cs.ids)
+    walk_diary(dpath, from, to, complete_entry, &cs);
 }
 
 void diary_status(void) {
@@ -624,35 +1509,28 @@ void diary_status(void) {
    *   or in zsh RPROMPT, bash PS1, etc.
    */
   char ref_path[2048];
-  char line[4096];
+  MOUNT_TABLE mounts;
   
   snprintf(ref_path, sizeof(ref_path), "%s/.dry/diaries.ref", getenv("HOME"));
   
-  FILE *f = fopen(ref_path, "r");
-  if (!f) return;
+  if (registry_load(ref_path) != 0) return;
+  
+  /* One read of the mount table for all diaries; never spawns a process */
+  if (mount_table_load(&mounts) != 0) return;
   
   int found = 0;
-  while (fgets(line, sizeof(line), f)) {
-    /* Parse "name : path" format */
-    char *sep = strstr(line, " : ");
-    if (!sep) continue;
-    
-    *sep = '\0';
-    char *name = line;
-    
-    /* Trim whitespace */
-    while (*name == ' ') name++;
-    char *end = name + strlen(name) - 1;
-    while (end > name && (*end == ' ' || *end == '\n')) *end-- = '\0';
+  for (int i = 0; i < registry_count(); i++) {
+    const REGISTRY_ENTRY *e = registry_entry(i);
     
-    if (diary_is_unlocked(name)) {
+    /* The registered path is the mount point of the diary */
+    if (mount_table_has(&mounts, e->path)) {
       if (found) printf(",");
-      printf("%s", name);
+      printf("%s", e->name);
       found++;
     }
   }
   
-  fclose(f);
+  mount_table_free(&mounts);
   
   if (found) printf("\n");
 }
@@ -11,31 +11,94 @@
 #define SHOW_FLAG_INTERLEAVED 0x02  /* Show main entry between each attachment */
 #define SHOW_FLAG_TEXT_ONLY   0x04  /* Show only text entries, skip media */
 #define SHOW_FLAG_MAIN_ONLY   0x08  /* Show only the main diary entry */
+#define SHOW_FLAG_THUMBS      0x10  /* With HEAD: render media thumbnails inline */
 
-/* Initialize a new encrypted diary */
-void diary_init(const char *name, const char *dpath);
+/* List flags (bitfield) */
+#define LIST_FLAG_JSON        0x01  /* Print entries as a JSON array */
+#define LIST_FLAG_SORT_SIZE   0x02  /* Sort all entries by size (largest first) */
+#define LIST_FLAG_SORT_TIME   0x04  /* Sort all entries by modification time */
+#define LIST_FLAG_REVERSE     0x08  /* Reverse the order (newest/smallest first) */
+#define LIST_FLAG_TEXT        0x10  /* Type filter: text entries */
+#define LIST_FLAG_MEDIA       0x20  /* Type filter: media entries */
+#define LIST_FLAG_OTHER       0x40  /* Type filter: other entries */
+#define LIST_FLAG_TYPES       (LIST_FLAG_TEXT | LIST_FLAG_MEDIA | LIST_FLAG_OTHER)
+
+/* Init flags (bitfield) */
+#define INIT_FLAG_NATIVE      0x01  /* Native encrypted storage instead of encfs */
+
+/* Unlock flags (bitfield) */
+#define UNLOCK_FLAG_WATCH     0x01  /* Keep the catalog current until locked (see watch.h) */
+
+/* Initialize a new encrypted diary
+ * flags: combination of INIT_FLAG_* constants */
+int diary_init(const char *name, const char *dpath, int flags);
 
 /* Create a new entry (note or video) */
-void diary_new(char type, const char *name);
+int diary_new(char type, const char *name);
+
+/* Import files and directories of files, filed by modification time */
+int diary_import(char *const *paths, int count, const char *name);
+
+/* List diary entries in a range expression (see range.h, NULL for all)
+ * narrowed by from and to, only the latest last ones if last > 0
+ * flags: combination of LIST_FLAG_* constants */
+int diary_list(const char *name, const char *filter, const char *from, const char *to,
+               int last, int flags);
 
-/* List diary entries */
-void diary_list(const char *name, char *filter);
+/* Rebuild the entry catalog of a diary */
+int diary_reindex(const char *name);
 
-/* Show entries (by ID or date filter like today/yesterday)
+/*
+ * Export the entries from the start of from to the end of to (dates or
+ * range expressions, see range.h; NULL for no bound)
+ * as format (org, md, html or tar, default org) to output (stdout if NULL)
+ */
+int diary_export(const char *from, const char *to, const char *format, const char *output,
+                 const char *name);
+
+/*
+ * Back up the encrypted tree of a diary to target/<name>, incrementally
+ * (see backup.h); with verify, check the backup against its manifest instead
+ */
+int diary_backup(const char *target, int verify, const char *name);
+
+/*
+ * Print activity (entries, words, recorded time and storage per year, and a
+ * heatmap of the last year) and storage statistics of a diary, as JSON if json
+ */
+int diary_stats(const char *name, int json);
+
+/* Search notes for all terms of query, print at most limit results */
+int diary_search(const char *query, const char *name, int limit);
+
+/* Show entries (by ID, or a date or range expression like today or -7d,
+ * NULL for all), only the latest last ones if last > 0
  * flags: combination of SHOW_FLAG_* constants */
-void diary_show(char *id_or_filter, const char *name, int flags);
+int diary_show(char *id_or_filter, const char *name, int last, int flags);
 
 /* Delete a specific entry */
-void diary_delete(char *id, const char *name);
+int diary_delete(char *id, const char *name);
 
 /* Explore diary with file manager */
-void diary_explore(const char *name);
+int diary_explore(const char *name);
 
-/* Unlock diary (mount and keep open) */
-void diary_unlock(const char *name);
+/* Unlock diary (mount and keep open)
+ * flags: combination of UNLOCK_FLAG_* constants */
+int diary_unlock(const char *name, int flags);
 
-/* Lock diary (unmount) */
-void diary_lock(const char *name);
+/* Lock diary (stop its watcher, unmount) */
+int diary_lock(const char *name);
+
+/* Watch a diary in the foreground, keeping its catalog and search index current */
+int diary_watch(const char *name);
+
+/*
+ * Print shell completion candidates starting with prefix, one per line:
+ * kind is diaries, dates (filters and days), ids or entries (dates and ids).
+ * Answers from the registry and the catalog only; nothing is mounted,
+ * unlocked or walked except the day names of a locked native diary.
+ */
+void diary_complete(const char *kind, const char *prefix, const char *name);
 
 /* Print status of unlocked diaries (for shell prompt integration) */
 void diary_status(void);
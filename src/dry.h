@@ -13,15 +13,27 @@
 #include <pwd.h>
 #include <errno.h>
 
+/* Per-diary metadata directory (inside the diary mount point) */
+#define DRY_META_DIR ".dry"
+
 /* Configuration structure */
 typedef struct {
   const char *name;         /* default diary name */
   const char *path;         /* storage directory path */
   const char *editor;       /* text editor command */
   const char *player;       /* video player command */
-  const char *list_cmd;     /* directory listing command */
+  const char *list_cmd;     /* directory listing command (optional) */
   const char *file_manager; /* file manager/explorer command */
   const char *pager;        /* pager for viewing text files */
+  char **editor_argv;       /* the commands above, split once by config_load() */
+  char **player_argv;
+  char **list_argv;         /* NULL if list_command is unset */
+  char **file_manager_argv;
+  char **pager_argv;
+  const char *transcode;    /* profile for re-encoding recordings ("off", "x264", ...) */
+  int transcode_crf;        /* quality override for the profile (0 = profile default) */
+  int agent_idle;           /* seconds the mount agent keeps idle diaries mounted (0 = off) */
+  int attachment_store;     /* keep imported files once per content in .dry/objects */
 } CONFIG;
 
 /* Command types for CLI */
@@ -35,7 +47,16 @@ typedef enum {
   EXPLORE,
   UNLOCK,
   LOCK,
-  STATUS
+  STATUS,
+  REINDEX,
+  SEARCH,
+  AGENT,
+  IMPORT,
+  STATS,
+  EXPORT,
+  BACKUP,
+  SERVE,
+  WATCH
 } COMMAND;
 
 /* Entry format types */
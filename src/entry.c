@@ -3,7 +3,10 @@
  */
 #include "entry.h"
 #include "config.h"
+#include "proc.h"
+#include "store.h"
 #include "utils.h"
+#include <fcntl.h>
 
 static char *l1_header_fmt(FORMAT fmt, char *fstring) {
   char *header;
@@ -71,22 +74,22 @@ int make_directory_tree(const char *name) {
   /*
    * Create directory path: /path/to/diary/yyyy/mm/dd/
    */
-  char mkdr[4096];
+  char dir[4096];
   char subdir[64];
   char path[2048];
 
   get_path_by_name(name, path);
   get_time(subdir, "%Y/%m/%d");
-  snprintf(mkdr, sizeof(mkdr), "mkdir -p %s/%s", path, subdir);
-  
-  int result = system(mkdr);
+  snprintf(dir, sizeof(dir), "%s/%s", path, subdir);
+
+  int result = make_dirs(dir, 0777);
   if (result != 0) {
-    fprintf(stderr, "Error: failed to create directory tree %s/%s\n", path, subdir);
+    msg_error("failed to create directory tree %s: %s", dir, strerror(errno));
   }
   return result;
 }
 
-void set_text_file_header(const char *name, FORMAT fmt) {
+int set_text_file_header(const char *name, FORMAT fmt, int *created) {
   FILE *fd;
   char path[1024];
   char buffer[1024];
@@ -95,19 +98,17 @@ void set_text_file_header(const char *name, FORMAT fmt) {
   get_text_path_by_name(name, path);
 
   /* if file not exists add level 1 headers */
-  if (!do_file_exist(path)) {
-    printf("Creating file %s\n", path);
-
+  *created = !do_file_exist(path);
+  if (*created) {
     /* get date header */
     l1_header_fmt(fmt, fstring);
     get_time(buffer, fstring);
 
     /* create file and write header */
-    fd = fopen(path, "w");
+    fd = store_fopen(path, "w");
     if (fd == NULL) {
-      fprintf(stderr, "Error: failed to create file %s\n", path);
-      perror("fopen");
-      exit(EXIT_FAILURE);
+      msg_error("failed to create file %s: %s", path, strerror(errno));
+      return 1;
     }
     fprintf(fd, "%s", buffer);
     fclose(fd);
@@ -117,101 +118,428 @@ void set_text_file_header(const char *name, FORMAT fmt) {
   l2_header_fmt(fmt, fstring);
   get_time(buffer, fstring);
 
-  fd = fopen(path, "a");
+  fd = store_fopen(path, "a");
   if (fd == NULL) {
-    fprintf(stderr, "Error: failed to open file %s\n", path);
-    perror("fopen");
-    exit(EXIT_FAILURE);
+    msg_error("failed to open file %s: %s", path, strerror(errno));
+    return 1;
   }
   fprintf(fd, "%s", buffer);
-  fclose(fd);
+  return fclose(fd) != 0;
+}
+
+int append_entry_text(const char *note, FORMAT fmt, time_t when, const char *text) {
+  char fstring[64];
+  char buffer[128];
+  struct tm tm;
+  size_t len = strlen(text);
+
+  localtime_r(&when, &tm);
+  int exists = do_file_exist((char *)note);
+  FILE *fd = store_fopen(note, "a");
+  if (fd == NULL)
+    return 1;
+
+  if (!exists) {
+    strftime(buffer, sizeof(buffer), l1_header_fmt(fmt, fstring), &tm);
+    fprintf(fd, "%s", buffer);
+  }
+  strftime(buffer, sizeof(buffer), l2_header_fmt(fmt, fstring), &tm);
+  fprintf(fd, "%s%s%s", buffer, text, len > 0 && text[len - 1] == '\n' ? "" : "\n");
+  return fclose(fd) != 0;
+}
+
+int link_entry_file(const char *note, FORMAT fmt, time_t when, const char *file) {
+  char line[4200];
+
+  snprintf(line, sizeof(line), "file:%s", file);
+  return append_entry_text(note, fmt, when, line);
 }
 
-int get_text_command(const char *name, char *cmd) {
+int open_text_editor(const char *name) {
   char path[2048];
   
   if (get_config()->editor == NULL) {
-    fprintf(stderr, "Error: text_editor not configured\n");
-    fprintf(stderr, "Please set 'text_editor' in your config file\n");
-    exit(EXIT_FAILURE);
+    msg_error("text_editor not configured\nPlease set 'text_editor' in your config file");
+    return -1;
   }
   
   get_text_path_by_name(name, path);
-  return snprintf(cmd, 4096, "%s %s", get_config()->editor, path);
+
+  /* native diaries: edit a decrypted copy */
+  char plain[4096];
+  if (store_checkout(path, plain, sizeof(plain)) != 0) {
+    msg_error("can't decrypt %s", path);
+    return -1;
+  }
+  int rc = proc_cmd(get_config()->editor_argv, plain, 0);
+  if (store_checkin(plain, path) != 0)
+    msg_error("failed to write back %s", path);
+  return rc;
 }
 
-int get_video_command(const char *name, char *cmd) {
-  char path[2048];
-  
+int record_video(const char *path) {
+  char plain[4096];
+
   if (get_config()->player == NULL) {
-    fprintf(stderr, "Error: video_player not configured\n");
-    fprintf(stderr, "Please set 'video_player' in your config file\n");
-    exit(EXIT_FAILURE);
+    msg_error("video_player not configured\nPlease set 'video_player' in your config file");
+    return -1;
   }
   
   /*
    * Webcam recordings (ffmpeg)
    * ffmpeg -f pulse -ac 2 -i default -f v4l2 -i /dev/video0 -t 00:00:20 -vcodec libx264 record.mp4
    */
-  char *ffmpeg = "ffmpeg "
-    "-f v4l2 "
-    "-framerate 30 "
-    "-video_size 1024x768 "
-    "-input_format mjpeg "
-    "-i /dev/video0 "
-    "-f pulse "
-    "-i default "
-    "-ac 1 "
-    "-c:a pcm_s16le "
-    "-c:v mjpeg "
-    "-b:v 64000k "
-    "%s "
-    "-map 0:v "
-    "-vf \"format=yuv420p\" "
-    "-f xv display";
-
-  get_video_path_by_name(name, path);
-  snprintf(cmd, 4096, ffmpeg, path);
+  if (store_checkout(path, plain, sizeof(plain)) != 0) {
+    msg_error("can't record to %s", path);
+    return -1;
+  }
 
-  return 0;
+  char *ffmpeg[] = {
+    "ffmpeg",
+    "-f", "v4l2",
+    "-framerate", "30",
+    "-video_size", "1024x768",
+    "-input_format", "mjpeg",
+    "-i", "/dev/video0",
+    "-f", "pulse",
+    "-i", "default",
+    "-ac", "1",
+    "-c:a", "pcm_s16le",
+    "-c:v", "mjpeg",
+    "-b:v", "64000k",
+    plain,
+    "-map", "0:v",
+    "-vf", "format=yuv420p",
+    "-f", "xv", "display",
+    NULL
+  };
+
+  int rc = proc_run(ffmpeg, 0);
+  if (do_file_exist(plain) && store_checkin(plain, path) != 0)
+    msg_error("failed to encrypt %s", path);
+  return rc;
 }
 
-FILE_TYPE get_file_type(char *path) {
+/*
+ * File type detection
+ *
+ * Types are sniffed in-process from the first bytes of the file instead of
+ * spawning file(1). Results are cached by path relative to the diary with
+ * the mtime (in nanoseconds) and size they were sniffed at, in the diary
+ * metadata directory, so repeated runs over the same day only need a stat.
+ * Inode numbers are not stable on FUSE mounts, so they are not used.
+ *
+ * Cache file, after the magic line:
+ *   <mtime ns> <size> <type> <path relative to the diary>
+ */
+#define SNIFF_SIZE 4096
+#define FTYPE_CACHE_FILE "types.cache"
+#define FTYPE_CACHE_MAGIC "# dry types v2"
+
+typedef struct {
+  char *rel;            /* NULL: empty slot */
+  long long mtime;      /* nanoseconds */
+  long long size;
   FILE_TYPE type;
-  char c2[4096];
-  char c3[4096];
-  char c4[4096];
-
-  /* Check file type */
-  snprintf(c2, sizeof(c2), "file %s | grep ASCII > /dev/null", path);
-  snprintf(c4, sizeof(c4), "file %s | grep Unicode > /dev/null", path);
-  snprintf(c3, sizeof(c3), "file %s | grep Matroska > /dev/null", path);
-
-  if (system(c2) == 0 || system(c4) == 0)
-    type = TEXT;
-  else if (system(c3) == 0)
-    type = MEDIA;
+} FTYPE_ENTRY;
+
+static FTYPE_ENTRY *ftype_cache = NULL; /* open addressing */
+static size_t ftype_cap = 0;
+static size_t ftype_len = 0;
+static int ftype_dirty = 0;
+static char ftype_path[4096] = "";
+static char ftype_root[4096] = "";      /* diary the cache belongs to */
+static size_t ftype_root_len = 0;
+
+static long long mtime_ns(const struct stat *st) {
+  return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static size_t ftype_slot(const char *rel) {
+  /* FNV-1a */
+  unsigned long long h = 0xcbf29ce484222325ULL;
+  for (const unsigned char *c = (const unsigned char *)rel; *c; c++)
+    h = (h ^ *c) * 0x100000001b3ULL;
+  return (size_t)h & (ftype_cap - 1);
+}
+
+/* Path of a diary file relative to the diary, NULL if it is not in it */
+static const char *ftype_rel(const char *path) {
+  if (ftype_root_len == 0 || strncmp(path, ftype_root, ftype_root_len) != 0 ||
+      path[ftype_root_len] != '/' || strchr(path, '\n') != NULL)
+    return NULL;
+  return path + ftype_root_len + 1;
+}
+
+/* Add or replace the entry of rel, taking over e->rel */
+static void ftype_insert(FTYPE_ENTRY *e) {
+  if ((ftype_len + 1) * 2 > ftype_cap) {
+    FTYPE_ENTRY *old = ftype_cache;
+    size_t old_cap = ftype_cap;
+
+    ftype_cap = old_cap ? old_cap * 2 : 256;
+    ftype_cache = calloc(ftype_cap, sizeof(FTYPE_ENTRY));
+    if (ftype_cache == NULL) {
+      ftype_cache = old;
+      ftype_cap = old_cap;
+      free(e->rel);
+      return;
+    }
+    ftype_len = 0;
+    for (size_t i = 0; i < old_cap; i++)
+      if (old[i].rel != NULL)
+        ftype_insert(&old[i]);
+    free(old);
+  }
+
+  size_t i = ftype_slot(e->rel);
+  while (ftype_cache[i].rel != NULL && strcmp(ftype_cache[i].rel, e->rel) != 0)
+    i = (i + 1) & (ftype_cap - 1);
+  if (ftype_cache[i].rel == NULL)
+    ftype_len++;
+  else
+    free(ftype_cache[i].rel);
+  ftype_cache[i] = *e;
+}
+
+static FTYPE_ENTRY *ftype_lookup(const char *rel, const struct stat *st) {
+  if (ftype_cap == 0 || rel == NULL)
+    return NULL;
+
+  size_t i = ftype_slot(rel);
+  while (ftype_cache[i].rel != NULL) {
+    FTYPE_ENTRY *e = &ftype_cache[i];
+    if (strcmp(e->rel, rel) == 0)
+      return (e->mtime == mtime_ns(st) && e->size == (long long)st->st_size) ? e : NULL;
+    i = (i + 1) & (ftype_cap - 1);
+  }
+  return NULL;
+}
+
+static void ftype_clear(void) {
+  for (size_t i = 0; i < ftype_cap; i++)
+    free(ftype_cache[i].rel);
+  free(ftype_cache);
+  ftype_cache = NULL;
+  ftype_cap = ftype_len = 0;
+}
+
+void file_type_cache_load(const char *dpath) {
+  char line[4200];
+  FILE *fd;
+  FTYPE_ENTRY e;
+  int type, off;
+
+  ftype_clear();
+  ftype_dirty = 0;
+  ftype_root_len = 0;
+  if (get_meta_path(dpath, FTYPE_CACHE_FILE, ftype_path, sizeof(ftype_path)) != 0) {
+    ftype_path[0] = '\0';
+    return;
+  }
+  snprintf(ftype_root, sizeof(ftype_root), "%s", dpath);
+  ftype_root_len = strlen(ftype_root);
+  while (ftype_root_len > 1 && ftype_root[ftype_root_len - 1] == '/')
+    ftype_root[--ftype_root_len] = '\0';
+
+  fd = store_fopen(ftype_path, "r");
+  if (fd == NULL)
+    return;
+
+  /* an older cache (keyed by inode) is dropped and rebuilt */
+  if (fgets(line, sizeof(line), fd) == NULL ||
+      strncmp(line, FTYPE_CACHE_MAGIC "\n", sizeof(FTYPE_CACHE_MAGIC)) != 0) {
+    fclose(fd);
+    ftype_dirty = 1;
+    return;
+  }
+
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    if (sscanf(line, "%lld %lld %d %n", &e.mtime, &e.size, &type, &off) != 3 ||
+        type < TEXT || type > OTHER || line[off] == '\0')
+      continue;
+    e.type = (FILE_TYPE)type;
+    if ((e.rel = strdup(line + off)) != NULL)
+      ftype_insert(&e);
+  }
+  fclose(fd);
+}
+
+void file_type_cache_save(void) {
+  char tmp[4200];
+  char path[8192];
+  struct stat st;
+  FILE *fd;
+
+  if (!ftype_dirty || ftype_path[0] == '\0')
+    return;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", ftype_path);
+  fd = store_fopen(tmp, "w");
+  if (fd == NULL)
+    return;
+
+  /* rewriting anyway: drop the files that are gone */
+  fprintf(fd, "%s\n", FTYPE_CACHE_MAGIC);
+  for (size_t i = 0; i < ftype_cap; i++) {
+    const FTYPE_ENTRY *e = &ftype_cache[i];
+    if (e->rel == NULL)
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", ftype_root, e->rel);
+    if (lstat(path, &st) != 0 && errno == ENOENT)
+      continue;
+    fprintf(fd, "%lld %lld %d %s\n", e->mtime, e->size, e->type, e->rel);
+  }
+
+  if (fclose(fd) == 0)
+    rename(tmp, ftype_path);
   else
-    type = OTHER;
-
-  return type;
-}
-
-int open_file_command(char *path, char *cmd) {
-  FILE_TYPE type = get_file_type(path);
-  if (cmd != NULL) {
-    switch (type) {
-    case TEXT:
-      snprintf(cmd, 4096, "%s \"%s\"", get_config()->pager, path);
-      break;
-    case MEDIA:
-      /* Suppress ffmpeg/player output */
-      snprintf(cmd, 4096, "%s \"%s\" >/dev/null 2>&1", get_config()->player, path);
-      break;
-    case OTHER:
-      snprintf(cmd, 4096, "xdg-open \"%s\" >/dev/null 2>&1", path);
-      break;
+    unlink(tmp);
+  ftype_dirty = 0;
+}
+
+void file_type_cache_prune(void) {
+  if (ftype_len > 0)
+    ftype_dirty = 1;
+}
+
+/* Check that buf holds UTF-8 text without control characters. A multibyte
+ * sequence cut off by the end of the buffer is accepted. */
+static int is_utf8_text(const unsigned char *buf, size_t len) {
+  size_t i = 0;
+
+  while (i < len) {
+    unsigned char c = buf[i];
+    size_t n;
+
+    if (c < 0x80) {
+      if (c < 0x20 && c != '\n' && c != '\t' && c != '\r' &&
+          c != '\f' && c != '\b' && c != 0x1b)
+        return 0;
+      if (c == 0x7f)
+        return 0;
+      i++;
+      continue;
     }
+
+    if ((c & 0xE0) == 0xC0 && c >= 0xC2)
+      n = 1;
+    else if ((c & 0xF0) == 0xE0)
+      n = 2;
+    else if ((c & 0xF8) == 0xF0 && c <= 0xF4)
+      n = 3;
+    else
+      return 0;
+
+    for (size_t k = 1; k <= n; k++) {
+      if (i + k >= len)
+        return 1;
+      if ((buf[i + k] & 0xC0) != 0x80)
+        return 0;
+    }
+    i += n + 1;
+  }
+  return 1;
+}
+
+static FILE_TYPE sniff_file_type(const unsigned char *buf, size_t len) {
+  /* Matroska / WebM (EBML header) */
+  if (len >= 4 && memcmp(buf, "\x1A\x45\xDF\xA3", 4) == 0)
+    return MEDIA;
+  /* MP4 / QuickTime (ISO base media 'ftyp' box) */
+  if (len >= 8 && memcmp(buf + 4, "ftyp", 4) == 0)
+    return MEDIA;
+  /* Ogg */
+  if (len >= 4 && memcmp(buf, "OggS", 4) == 0)
+    return MEDIA;
+  /* PNG, JPEG and PDF are opened with the default application */
+  if (len >= 8 && memcmp(buf, "\x89PNG\r\n\x1A\n", 8) == 0)
+    return OTHER;
+  if (len >= 3 && memcmp(buf, "\xFF\xD8\xFF", 3) == 0)
+    return OTHER;
+  if (len >= 5 && memcmp(buf, "%PDF-", 5) == 0)
+    return OTHER;
+
+  if (len > 0 && is_utf8_text(buf, len))
+    return TEXT;
+
+  return OTHER;
+}
+
+FILE_TYPE get_file_type(char *path) {
+  struct stat st;
+
+  if (stat(path, &st) != 0)
+    return OTHER;
+
+  return get_file_type_stat(path, &st);
+}
+
+FILE_TYPE get_file_type_stat(const char *path, const struct stat *st) {
+  unsigned char buf[SNIFF_SIZE];
+  FTYPE_ENTRY e;
+  ssize_t len;
+  int fd;
+
+  /* Cache hit: no need to touch the file contents */
+  const char *rel = ftype_rel(path);
+  FTYPE_ENTRY *cached = ftype_lookup(rel, st);
+  if (cached != NULL)
+    return cached->type;
+
+  if (store_active(path)) {
+    FILE *f = store_fopen(path, "r");
+    if (f == NULL)
+      return OTHER;
+    len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+  } else {
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return OTHER;
+
+    len = read(fd, buf, sizeof(buf));
+    close(fd);
+  }
+
+  e.type = sniff_file_type(buf, len > 0 ? (size_t)len : 0);
+
+  if (ftype_path[0] != '\0' && rel != NULL && S_ISREG(st->st_mode) &&
+      (e.rel = strdup(rel)) != NULL) {
+    e.mtime = mtime_ns(st);
+    e.size = st->st_size;
+    ftype_insert(&e);
+    ftype_dirty = 1;
+  }
+
+  return e.type;
+}
+
+int open_entry(const char *path, FILE_TYPE type) {
+  char plain[4096];
+  int rc;
+
+  /* native diaries: show a decrypted copy */
+  if (store_checkout(path, plain, sizeof(plain)) != 0) {
+    msg_error("can't decrypt %s", path);
+    return 1;
+  }
+  char *xdg_open[] = {"xdg-open", plain, NULL};
+
+  switch (type) {
+  case TEXT:
+    rc = proc_cmd(get_config()->pager_argv, plain, 0);
+    break;
+  case MEDIA:
+    /* Suppress ffmpeg/player output */
+    rc = proc_cmd(get_config()->player_argv, plain, PROC_QUIET);
+    break;
+  case OTHER:
+  default:
+    rc = proc_run(xdg_open, PROC_QUIET);
+    break;
   }
-  return type;
+  store_release(plain, path);
+  return rc;
 }
@@ -15,19 +15,55 @@ int get_video_path_by_name(const char *name, char *path);
 /* Create directory tree for current date */
 int make_directory_tree(const char *name);
 
-/* Set header in text file */
-void set_text_file_header(const char *name, FORMAT fmt);
+/*
+ * Set header in text file, setting created if the file was new. Returns 0
+ * on success.
+ */
+int set_text_file_header(const char *name, FORMAT fmt, int *created);
+
+/*
+ * Link file from a day note under a time header for when, creating the
+ * note with its date header if needed. Returns 0 on success.
+ */
+int link_entry_file(const char *note, FORMAT fmt, time_t when, const char *file);
 
-/* Get command to open text editor */
-int get_text_command(const char *name, char *cmd);
+/*
+ * Append text to a day note under a time header for when, creating the
+ * note with its date header if needed. Returns 0 on success.
+ */
+int append_entry_text(const char *note, FORMAT fmt, time_t when, const char *text);
+
+/*
+ * Open today's text entry in the configured editor. Returns the exit status,
+ * -1 if the editor is not configured or the note can't be decrypted.
+ */
+int open_text_editor(const char *name);
 
-/* Get command to record video */
-int get_video_command(const char *name, char *cmd);
+/*
+ * Record a video entry from the webcam to path. Returns the exit status of
+ * ffmpeg, -1 if no player is configured or path can't be checked out.
+ */
+int record_video(const char *path);
 
-/* Get file type (TEXT, MEDIA, OTHER) */
+/* Get file type (TEXT, MEDIA, OTHER) from the file's magic bytes */
 FILE_TYPE get_file_type(char *path);
 
-/* Get command to open file based on type */
-int open_file_command(char *path, char *cmd);
+/* Same as get_file_type() for a file that was already stat'ed */
+FILE_TYPE get_file_type_stat(const char *path, const struct stat *st);
+
+/* Load the file type cache kept in the diary metadata directory */
+void file_type_cache_load(const char *dpath);
+
+/*
+ * Write back the file type cache if new types were detected, dropping the
+ * entries of files that are gone
+ */
+void file_type_cache_save(void);
+
+/* Have the next save rewrite the cache (and so drop files that are gone) */
+void file_type_cache_prune(void);
+
+/* Open a file with the pager, video player or xdg-open depending on its type */
+int open_entry(const char *path, FILE_TYPE type);
 
 #endif /* ENTRY_H */
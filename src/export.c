@@ -0,0 +1,390 @@
+/*
+ * export.c - Export of a date range implementation
+ */
+#include "export.h"
+#include "store.h"
+
+/* Notes are converted a line (or this much of a long line) at a time */
+#define LINE_CHUNK 16384
+#define COPY_CHUNK (64 << 10)
+#define TAR_BLOCK 512
+
+typedef struct {
+  FILE *out;
+  EXPORT_FORMAT fmt;
+  const char *dpath;
+  size_t dlen;
+  EXPORT_STATS *stats;
+  int header;             /* html: level of the open <hN>, 0 if none */
+  int in_pre;             /* html: inside a <pre> block */
+} EXPORT_STATE;
+
+static const unsigned char zero_block[TAR_BLOCK];
+
+int export_format_parse(const char *name, EXPORT_FORMAT *fmt) {
+  if (strcmp(name, "org") == 0)
+    *fmt = EXPORT_ORG;
+  else if (strcmp(name, "md") == 0 || strcmp(name, "markdown") == 0)
+    *fmt = EXPORT_MARKDOWN;
+  else if (strcmp(name, "html") == 0)
+    *fmt = EXPORT_HTML;
+  else if (strcmp(name, "tar") == 0)
+    *fmt = EXPORT_TAR;
+  else
+    return 1;
+  return 0;
+}
+
+static void put_escaped(FILE *out, const char *s, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    switch (s[i]) {
+    case '&': fputs("&amp;", out); break;
+    case '<': fputs("&lt;", out); break;
+    case '>': fputs("&gt;", out); break;
+    case '"': fputs("&quot;", out); break;
+    default: fputc(s[i], out); break;
+    }
+  }
+}
+
+static void put_text(EXPORT_STATE *ex, const char *s, size_t len) {
+  if (ex->fmt == EXPORT_HTML)
+    put_escaped(ex->out, s, len);
+  else
+    fwrite(s, 1, len, ex->out);
+}
+
+static void close_pre(EXPORT_STATE *ex) {
+  if (ex->in_pre) {
+    fputs("</pre>\n", ex->out);
+    ex->in_pre = 0;
+  }
+}
+
+/* Header level of a line ("* ", "** ", "# ", "## "), 0 if it is none */
+static int header_level(const char *s, size_t len, size_t *marker) {
+  size_t level = 0;
+
+  if (len == 0 || (s[0] != '*' && s[0] != '#'))
+    return 0;
+  while (level < len && s[level] == s[0])
+    level++;
+  if (level > 2 || level >= len || s[level] != ' ')
+    return 0;
+  *marker = level + 1;
+  return (int)level;
+}
+
+static void open_header(EXPORT_STATE *ex, int level) {
+  switch (ex->fmt) {
+  case EXPORT_ORG:
+    fprintf(ex->out, "%.*s ", level, "**");
+    break;
+  case EXPORT_MARKDOWN:
+    fprintf(ex->out, "%.*s ", level, "##");
+    break;
+  default:
+    close_pre(ex);
+    fprintf(ex->out, "<h%d>", level);
+    ex->header = level;
+    break;
+  }
+}
+
+static void end_line(EXPORT_STATE *ex) {
+  if (ex->header > 0) {
+    fprintf(ex->out, "</h%d>\n", ex->header);
+    ex->header = 0;
+  } else {
+    fputc('\n', ex->out);
+  }
+}
+
+/* Entry path relative to the diary: links stay valid next to a tar export */
+static const char *relative(const EXPORT_STATE *ex, const char *path) {
+  if (strncmp(path, ex->dpath, ex->dlen) == 0 && path[ex->dlen] == '/')
+    return path + ex->dlen + 1;
+  return path;
+}
+
+/* file:<path> line of a note */
+static void put_link(EXPORT_STATE *ex, const char *target, size_t len) {
+  char path[LINE_CHUNK];
+
+  snprintf(path, sizeof(path), "%.*s", (int)len, target);
+  const char *rel = relative(ex, path);
+  switch (ex->fmt) {
+  case EXPORT_ORG:
+    fprintf(ex->out, "file:%s", rel);
+    break;
+  case EXPORT_MARKDOWN:
+    fprintf(ex->out, "[%s](<%s>)", rel, rel);
+    break;
+  default:
+    fputs("<a href=\"", ex->out);
+    put_escaped(ex->out, rel, strlen(rel));
+    fputs("\">", ex->out);
+    put_escaped(ex->out, rel, strlen(rel));
+    fputs("</a>", ex->out);
+    break;
+  }
+}
+
+static void start_line(EXPORT_STATE *ex, const char *s, size_t len) {
+  size_t marker;
+  int level = header_level(s, len, &marker);
+
+  if (level > 0) {
+    open_header(ex, level);
+    put_text(ex, s + marker, len - marker);
+    return;
+  }
+  if (ex->fmt == EXPORT_HTML && !ex->in_pre) {
+    fputs("<pre>", ex->out);
+    ex->in_pre = 1;
+  }
+  if (len > 5 && strncmp(s, "file:", 5) == 0)
+    put_link(ex, s + 5, len - 5);
+  else
+    put_text(ex, s, len);
+}
+
+/* Stream a day note, rewriting headers and links for the format */
+static int export_note(EXPORT_STATE *ex, const char *path) {
+  char buf[LINE_CHUNK];
+  int bol = 1;
+
+  FILE *in = store_fopen(path, "r");
+  if (in == NULL)
+    return 1;
+  while (fgets(buf, sizeof(buf), in) != NULL) {
+    size_t n = strlen(buf);
+    int eol = n > 0 && buf[n - 1] == '\n';
+    ex->stats->bytes += n;
+    n -= eol;
+    if (bol)
+      start_line(ex, buf, n);
+    else
+      put_text(ex, buf, n);
+    if (eol)
+      end_line(ex);
+    bol = eol;
+  }
+  if (!bol)
+    end_line(ex);
+  if (ex->fmt == EXPORT_HTML)
+    close_pre(ex);
+  else
+    fputc('\n', ex->out);
+  fclose(in);
+  return 0;
+}
+
+/* Link to a file that is not inlined */
+static void export_reference(EXPORT_STATE *ex, const char *rel, const char *id) {
+  switch (ex->fmt) {
+  case EXPORT_ORG:
+    fprintf(ex->out, "- [[file:%s][%s]]\n\n", rel, id);
+    break;
+  case EXPORT_MARKDOWN:
+    fprintf(ex->out, "- [%s](<%s>)\n\n", id, rel);
+    break;
+  default:
+    fputs("<p><a href=\"", ex->out);
+    put_escaped(ex->out, rel, strlen(rel));
+    fputs("\">", ex->out);
+    put_escaped(ex->out, id, strlen(id));
+    fputs("</a></p>\n", ex->out);
+    break;
+  }
+}
+
+/* ustar numeric field; sizes past 8 GiB use the base-256 extension */
+static void tar_number(unsigned char *field, size_t size, unsigned long long v) {
+  if (size == 12 && v > 077777777777ULL) {
+    field[0] = 0x80;
+    for (size_t i = size - 1; i > 0; i--, v >>= 8)
+      field[i] = v & 0xff;
+    return;
+  }
+  snprintf((char *)field, size, "%0*llo", (int)size - 1, v);
+}
+
+static int tar_header(FILE *out, const char *name, char type, long long size, long long mtime) {
+  unsigned char h[TAR_BLOCK] = {0};
+  size_t len = strlen(name);
+  unsigned sum = 0;
+
+  if (len <= 100) {
+    memcpy(h, name, len);
+  } else {
+    /* split into prefix and name at a directory separator */
+    const char *slash = strchr(name + len - 101, '/');
+    if (slash == NULL || slash - name > 155)
+      return 1;
+    memcpy(h, slash + 1, len - (slash - name) - 1);
+    memcpy(h + 345, name, slash - name);
+  }
+  tar_number(h + 100, 8, 0600);
+  tar_number(h + 108, 8, 0);
+  tar_number(h + 116, 8, 0);
+  tar_number(h + 124, 12, size);
+  tar_number(h + 136, 12, mtime > 0 ? mtime : 0);
+  h[156] = type;
+  memcpy(h + 257, "ustar", 6);
+  memcpy(h + 263, "00", 2);
+
+  memset(h + 148, ' ', 8);
+  for (int i = 0; i < TAR_BLOCK; i++)
+    sum += h[i];
+  snprintf((char *)h + 148, 7, "%06o", sum);
+  return fwrite(h, 1, TAR_BLOCK, out) != TAR_BLOCK;
+}
+
+static void tar_pad(FILE *out, long long size) {
+  if (size % TAR_BLOCK != 0)
+    fwrite(zero_block, 1, TAR_BLOCK - size % TAR_BLOCK, out);
+}
+
+/* pax header carrying a path too long for the ustar fields */
+static int tar_long_name(FILE *out, const char *name) {
+  char record[600];
+  int len = (int)strlen(name) + (int)strlen(" path=\n");
+  int total = len + 1;
+
+  /* the record length counts its own digits */
+  while (snprintf(NULL, 0, "%d", total) + len != total)
+    total++;
+  snprintf(record, sizeof(record), "%d path=%s\n", total, name);
+  if (tar_header(out, "PaxHeader", 'x', total, 0) != 0)
+    return 1;
+  fwrite(record, 1, total, out);
+  tar_pad(out, total);
+  return 0;
+}
+
+static int export_tar_entry(EXPORT_STATE *ex, const char *path, const char *rel) {
+  char buf[COPY_CHUNK];
+  struct stat st;
+
+  if (stat(path, &st) != 0)
+    return 1;
+  long long size = store_plain_size(path, st.st_size);
+  FILE *in = store_fopen(path, "r");
+  if (in == NULL)
+    return 1;
+
+  int rc = tar_header(ex->out, rel, '0', size, st.st_mtime);
+  if (rc != 0) {
+    char shortened[101];
+    snprintf(shortened, sizeof(shortened), "%s", rel);
+    rc = tar_long_name(ex->out, rel) != 0 ||
+         tar_header(ex->out, shortened, '0', size, st.st_mtime) != 0;
+  }
+  if (rc != 0) {
+    fclose(in);
+    return 1;
+  }
+
+  long long done = 0;
+  size_t n;
+  while (done < size &&
+         (n = fread(buf, 1, size - done < COPY_CHUNK ? size - done : COPY_CHUNK, in)) > 0) {
+    fwrite(buf, 1, n, ex->out);
+    done += n;
+  }
+  fclose(in);
+  ex->stats->bytes += done;
+
+  /* the header promised size bytes */
+  if (done < size) {
+    fprintf(stderr, "Warning: %s changed while exporting\n", rel);
+    for (long long left = size - done; left > 0; left -= TAR_BLOCK)
+      fwrite(zero_block, 1, left < TAR_BLOCK ? left : TAR_BLOCK, ex->out);
+  }
+  tar_pad(ex->out, size);
+  return 0;
+}
+
+static void begin_document(EXPORT_STATE *ex, const char *title) {
+  switch (ex->fmt) {
+  case EXPORT_ORG:
+    fprintf(ex->out, "#+TITLE: %s\n\n", title);
+    break;
+  case EXPORT_HTML:
+    fputs("<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n<title>", ex->out);
+    put_escaped(ex->out, title, strlen(title));
+    fputs("</title>\n<style>pre { white-space: pre-wrap; }</style>\n</head>\n<body>\n", ex->out);
+    break;
+  default:
+    break;
+  }
+}
+
+static void end_document(EXPORT_STATE *ex) {
+  if (ex->fmt == EXPORT_HTML)
+    fputs("</body>\n</html>\n", ex->out);
+  else if (ex->fmt == EXPORT_TAR)
+    for (int i = 0; i < 2; i++)
+      fwrite(zero_block, 1, TAR_BLOCK, ex->out);
+}
+
+/* The day notes (YYYY-MM-DD.<ext>) are inlined, other files referenced */
+static int is_day_note(const CATALOG_DAY *day, const CATALOG_ENTRY *e) {
+  return e->type == TEXT && strncmp(e->id, day->date, 10) == 0 && e->id[10] == '.';
+}
+
+int export_run(CATALOG *cat, const char *from, const char *to, EXPORT_FORMAT fmt,
+               const char *title, FILE *out, EXPORT_STATS *stats) {
+  char path[8192];
+  char rel[300];
+  EXPORT_STATE ex = {out, fmt, cat->dpath, strlen(cat->dpath), stats, 0, 0};
+
+  memset(stats, 0, sizeof(*stats));
+  if (catalog_sync(cat, from, to) != 0)
+    return 1;
+
+  begin_document(&ex, title);
+  for (int i = 0; i < cat->count; i++) {
+    const CATALOG_DAY *day = &cat->days[i];
+    if (from != NULL && strcmp(day->date, from) < 0)
+      continue;
+    if (to != NULL && strcmp(day->date, to) > 0)
+      break;
+    if (day->count == 0)
+      continue;
+    stats->days++;
+
+    /* a day without a note still gets its heading */
+    if (fmt != EXPORT_TAR && !is_day_note(day, &day->entries[0])) {
+      open_header(&ex, 1);
+      put_text(&ex, day->date, strlen(day->date));
+      end_line(&ex);
+      if (fmt != EXPORT_HTML)
+        fputc('\n', out);
+    }
+
+    for (int j = 0; j < day->count; j++) {
+      const CATALOG_ENTRY *e = &day->entries[j];
+      int rc = 0;
+
+      catalog_entry_path(cat, day, e, path, sizeof(path));
+      snprintf(rel, sizeof(rel), "%.4s/%.2s/%.2s/%s", day->date, day->date + 5, day->date + 8,
+               e->id);
+      if (fmt == EXPORT_TAR)
+        rc = export_tar_entry(&ex, path, rel);
+      else if (is_day_note(day, e))
+        rc = export_note(&ex, path);
+      else
+        export_reference(&ex, rel, e->id);
+
+      if (rc != 0)
+        fprintf(stderr, "Warning: failed to export %s\n", rel);
+      else
+        stats->entries++;
+    }
+  }
+  end_document(&ex);
+
+  return ferror(out) != 0;
+}
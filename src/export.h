@@ -0,0 +1,41 @@
+/*
+ * export.h - Export of a date range to one document or archive
+ *
+ * Entries are streamed in chronological order straight from the diary
+ * (through the native store where needed) into a single output: the day
+ * notes concatenated as org, markdown or HTML with other files referenced
+ * by their path in the diary (YYYY/MM/DD/<id>), or every file packed into
+ * a tar archive under that same path. Nothing is staged on disk and memory
+ * use does not depend on the size of the range.
+ */
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "dry.h"
+#include "catalog.h"
+
+typedef enum {
+  EXPORT_ORG,
+  EXPORT_MARKDOWN,
+  EXPORT_HTML,
+  EXPORT_TAR
+} EXPORT_FORMAT;
+
+typedef struct {
+  int days;               /* days written */
+  int entries;            /* entries written */
+  long long bytes;        /* bytes of entry contents read */
+} EXPORT_STATS;
+
+/* Parse a format name (org, md, html, tar). Returns 0 on success. */
+int export_format_parse(const char *name, EXPORT_FORMAT *fmt);
+
+/*
+ * Write the entries of cat between from and to (YYYY-MM-DD, inclusive,
+ * NULL for no bound) to out; title names the document. The days of the
+ * range are synced first. Returns 0 on success.
+ */
+int export_run(CATALOG *cat, const char *from, const char *to, EXPORT_FORMAT fmt,
+               const char *title, FILE *out, EXPORT_STATS *stats);
+
+#endif /* EXPORT_H */
@@ -0,0 +1,561 @@
+/*
+ * import.c - Bulk import implementation
+ *
+ * Checksum file (.dry/checksums), one imported file per line:
+ *   <sha256> <path relative to the diary>
+ */
+#define _GNU_SOURCE
+#include "import.h"
+#include "config.h"
+#include "objects.h"
+#include "store.h"
+#include "utils.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+/* Copy threads, on top of one hashing thread each */
+#define IMPORT_THREADS 8
+
+/* copy_file_range() step: progress is reported between steps */
+#define COPY_STEP (8 << 20)
+#define IO_BUF_SIZE (1 << 20)
+#define PROGRESS_MS 200
+
+#define CHECKSUM_FILE "checksums"
+
+/* Work shared by the copy threads */
+typedef struct {
+  IMPORT_BATCH *batch;
+  int next;             /* next file to copy, taken atomically */
+  int done;             /* files finished */
+  long long bytes;      /* bytes copied */
+} IMPORT_WORK;
+
+static int add_file(IMPORT_BATCH *batch, const char *path, const struct stat *st) {
+  if (batch->count == batch->cap) {
+    int cap = batch->cap ? batch->cap * 2 : 64;
+    IMPORT_FILE *files = realloc(batch->files, cap * sizeof(IMPORT_FILE));
+    if (files == NULL)
+      return 1;
+    batch->files = files;
+    batch->cap = cap;
+  }
+
+  IMPORT_FILE *f = &batch->files[batch->count];
+  memset(f, 0, sizeof(*f));
+  if ((f->src = strdup(path)) == NULL)
+    return 1;
+  f->atime = st->st_atim;
+  f->mtime = st->st_mtim;
+  f->size = st->st_size;
+  batch->bytes += st->st_size;
+  batch->count++;
+  return 0;
+}
+
+static int collect_path(IMPORT_BATCH *batch, const char *path) {
+  struct stat st;
+
+  if (stat(path, &st) != 0) {
+    printf("Error: can't import %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  if (S_ISREG(st.st_mode))
+    return add_file(batch, path, &st);
+  if (!S_ISDIR(st.st_mode)) {
+    printf("Error: can't import %s: not a regular file\n", path);
+    return 1;
+  }
+
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    printf("Error: can't read %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  struct dirent *ent;
+  int rc = 0;
+  while ((ent = readdir(dir)) != NULL) {
+    char child[4096];
+    if (ent->d_name[0] == '.')
+      continue;
+    snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+    rc |= collect_path(batch, child);
+  }
+  closedir(dir);
+  return rc;
+}
+
+static int mtime_cmp(const void *a, const void *b) {
+  const IMPORT_FILE *x = a, *y = b;
+  if (x->mtime.tv_sec != y->mtime.tv_sec)
+    return x->mtime.tv_sec < y->mtime.tv_sec ? -1 : 1;
+  if (x->mtime.tv_nsec != y->mtime.tv_nsec)
+    return x->mtime.tv_nsec < y->mtime.tv_nsec ? -1 : 1;
+  return strcmp(x->src, y->src);
+}
+
+int import_collect(IMPORT_BATCH *batch, char *const *paths, int count) {
+  int rc = 0;
+
+  memset(batch, 0, sizeof(*batch));
+  for (int i = 0; i < count; i++)
+    rc |= collect_path(batch, paths[i]);
+
+  /* oldest first: names are given and notes linked in time order */
+  if (batch->count > 1)
+    qsort(batch->files, batch->count, sizeof(IMPORT_FILE), mtime_cmp);
+  return rc;
+}
+
+void import_free(IMPORT_BATCH *batch) {
+  for (int i = 0; i < batch->count; i++)
+    free(batch->files[i].src);
+  free(batch->files);
+  memset(batch, 0, sizeof(*batch));
+}
+
+/*
+ * Choose the name of a file in its day directory and reserve it with an
+ * empty placeholder, so concurrent imports or recordings can't take it.
+ */
+static int plan_dest(IMPORT_FILE *f, const char *dpath) {
+  char dir[3800], stamp[24], seconds[4], ext[17] = "";
+  struct tm tm;
+
+  localtime_r(&f->mtime.tv_sec, &tm);
+  strftime(f->day, sizeof(f->day), "%Y-%m-%d", &tm);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%d_%H-%M", &tm);
+  strftime(seconds, sizeof(seconds), "%S", &tm);
+  snprintf(dir, sizeof(dir), "%s/%.4s/%.2s/%.2s", dpath, f->day, f->day + 5, f->day + 8);
+  if (make_dirs(dir, 0700) != 0)
+    return 1;
+
+  /* keep the extension, lowercased: players and file types go by it */
+  const char *base = strrchr(f->src, '/');
+  base = base ? base + 1 : f->src;
+  const char *dot = strrchr(base, '.');
+  if (dot != NULL && dot != base && strlen(dot) < sizeof(ext))
+    for (int i = 0; dot[i]; i++)
+      ext[i] = tolower((unsigned char)dot[i]);
+
+  /* 2025-04-11_17-06.mkv, then 2025-04-11_17-06-42.mkv, then 2025-04-11_17-06-42-2.mkv */
+  for (int n = 0; n < 1000; n++) {
+    if (n == 0)
+      snprintf(f->dest, sizeof(f->dest), "%s/%s%s", dir, stamp, ext);
+    else if (n == 1)
+      snprintf(f->dest, sizeof(f->dest), "%s/%s-%s%s", dir, stamp, seconds, ext);
+    else
+      snprintf(f->dest, sizeof(f->dest), "%s/%s-%s-%d%s", dir, stamp, seconds, n, ext);
+
+    int fd = open(f->dest, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+      close(fd);
+      return 0;
+    }
+    if (errno != EEXIST)
+      return 1;
+  }
+  errno = EEXIST;
+  return 1;
+}
+
+static void add_progress(IMPORT_WORK *work, long long bytes) {
+  __atomic_fetch_add(&work->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/* Source hashing, run next to the copy of the same file */
+typedef struct {
+  const char *path;
+  SHA256_STATE sha;
+  int failed;
+} HASH_JOB;
+
+static void *hash_worker(void *arg) {
+  HASH_JOB *job = arg;
+  char *buf = malloc(IO_BUF_SIZE);
+  int fd = open(job->path, O_RDONLY | O_CLOEXEC);
+  ssize_t n = 0;
+
+  job->failed = buf == NULL || fd < 0;
+  if (!job->failed) {
+    /* the copy pulls the same pages in: this is mostly a page cache read */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while ((n = read(fd, buf, IO_BUF_SIZE)) > 0)
+      sha256_update(&job->sha, buf, n);
+    job->failed = n < 0;
+  }
+  if (fd >= 0)
+    close(fd);
+  free(buf);
+  return NULL;
+}
+
+/* Plain read/write copy, for file systems without copy offload */
+static int copy_rw(int in, int out, IMPORT_WORK *work) {
+  char *buf = malloc(IO_BUF_SIZE);
+  ssize_t n;
+
+  if (buf == NULL)
+    return 1;
+  while ((n = read(in, buf, IO_BUF_SIZE)) > 0) {
+    for (ssize_t off = 0; off < n;) {
+      ssize_t w = write(out, buf + off, n - off);
+      if (w < 0) {
+        free(buf);
+        return 1;
+      }
+      off += w;
+    }
+    add_progress(work, n);
+  }
+  free(buf);
+  return n < 0;
+}
+
+/* Copy without moving the data through user space where the file system allows */
+static int copy_offload(int in, int out, IMPORT_WORK *work, long long size) {
+#ifdef FICLONE
+  /* reflink (btrfs, XFS): shares the extents, nothing is copied */
+  if (ioctl(out, FICLONE, in) == 0) {
+    add_progress(work, size);
+    return 0;
+  }
+#endif
+
+  long long done = 0;
+  for (;;) {
+    ssize_t n = copy_file_range(in, NULL, out, NULL, COPY_STEP, 0);
+    if (n < 0) {
+      /* across file systems on older kernels, FUSE, ... */
+      if (done == 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP ||
+                        errno == EINVAL))
+        return copy_rw(in, out, work);
+      return 1;
+    }
+    if (n == 0)
+      return 0;
+    done += n;
+    add_progress(work, n);
+  }
+}
+
+/* Native diaries: the data goes through the cipher, hash it on the way */
+static int copy_encrypted(int in, IMPORT_FILE *f, IMPORT_WORK *work, SHA256_STATE *sha) {
+  char *buf = malloc(IO_BUF_SIZE);
+  FILE *out = store_fopen(f->dest, "w");
+  ssize_t n = 0;
+  int rc = buf == NULL || out == NULL;
+
+  while (rc == 0 && (n = read(in, buf, IO_BUF_SIZE)) > 0) {
+    sha256_update(sha, buf, n);
+    rc = fwrite(buf, 1, n, out) != (size_t)n;
+    add_progress(work, n);
+  }
+  if (n < 0)
+    rc = 1;
+  if (out != NULL && fclose(out) != 0)
+    rc = 1;
+  free(buf);
+  return rc;
+}
+
+static int import_file(IMPORT_FILE *f, IMPORT_WORK *work) {
+  unsigned char digest[SHA256_DIGEST_LEN];
+  int rc;
+
+  int in = open(f->src, O_RDONLY | O_CLOEXEC);
+  if (in < 0)
+    return 1;
+
+  if (store_active(f->dest)) {
+    HASH_JOB job;
+    sha256_init(&job.sha);
+    rc = copy_encrypted(in, f, work, &job.sha);
+    sha256_final(&job.sha, digest);
+  } else {
+    /* hidden while being written, renamed over the placeholder when complete */
+    char tmp[4200];
+    const char *base = strrchr(f->dest, '/') + 1;
+    snprintf(tmp, sizeof(tmp), "%.*s.%s.import", (int)(base - f->dest), f->dest, base);
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) {
+      close(in);
+      return 1;
+    }
+
+    HASH_JOB job = {.path = f->src};
+    pthread_t hasher;
+    sha256_init(&job.sha);
+    int threaded = pthread_create(&hasher, NULL, hash_worker, &job) == 0;
+
+    rc = copy_offload(in, out, work, f->size);
+    if (close(out) != 0)
+      rc = 1;
+
+    if (threaded)
+      pthread_join(hasher, NULL);
+    else
+      hash_worker(&job);
+    rc |= job.failed;
+    sha256_final(&job.sha, digest);
+
+    if (rc == 0 && rename(tmp, f->dest) != 0)
+      rc = 1;
+    if (rc != 0)
+      unlink(tmp);
+  }
+  close(in);
+
+  if (rc == 0) {
+    sha256_hex(digest, f->sha256);
+    struct timespec times[2] = {f->atime, f->mtime};
+    utimensat(AT_FDCWD, f->dest, times, 0);
+  }
+  return rc;
+}
+
+static void *import_worker(void *arg) {
+  IMPORT_WORK *work = arg;
+  IMPORT_BATCH *batch = work->batch;
+  int i;
+
+  while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+    IMPORT_FILE *f = &batch->files[i];
+    if (f->status == IMPORT_PENDING) {
+      if (import_file(f, work) == 0) {
+        f->status = IMPORT_COPIED;
+      } else {
+        f->status = IMPORT_FAILED;
+        f->error = errno;
+        unlink(f->dest);
+      }
+    }
+    __atomic_fetch_add(&work->done, 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static void print_progress(IMPORT_WORK *work, const struct timespec *start) {
+  char done[16], total[16], rate[16];
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double secs = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+  long long bytes = __atomic_load_n(&work->bytes, __ATOMIC_RELAXED);
+
+  format_size(bytes, done, sizeof(done));
+  format_size(work->batch->bytes, total, sizeof(total));
+  format_size(secs > 0 ? (long long)(bytes / secs) : 0, rate, sizeof(rate));
+  fprintf(stderr, "\rImporting %d/%d file(s)  %s/%s  %s/s\033[K",
+          __atomic_load_n(&work->done, __ATOMIC_ACQUIRE), work->batch->count, done, total,
+          rate);
+}
+
+/* Checksums already recorded, sorted for lookup */
+typedef struct {
+  char **lines;         /* "<sha256> <path>" */
+  int count;
+} CHECKSUMS;
+
+static int line_cmp(const void *a, const void *b) {
+  return strncmp(*(char *const *)a, *(char *const *)b, SHA256_HEX_LEN - 1);
+}
+
+static void checksums_load(CHECKSUMS *sums, const char *path) {
+  char line[4200];
+  int cap = 0;
+
+  memset(sums, 0, sizeof(*sums));
+  FILE *fd = store_fopen(path, "r");
+  if (fd == NULL)
+    return;
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    if (strlen(line) < SHA256_HEX_LEN + 1 || line[SHA256_HEX_LEN - 1] != ' ')
+      continue;
+    if (sums->count == cap) {
+      cap = cap ? cap * 2 : 256;
+      char **lines = realloc(sums->lines, cap * sizeof(char *));
+      if (lines == NULL)
+        break;
+      sums->lines = lines;
+    }
+    if ((sums->lines[sums->count] = strdup(line)) != NULL)
+      sums->count++;
+  }
+  fclose(fd);
+  if (sums->count > 1)
+    qsort(sums->lines, sums->count, sizeof(char *), line_cmp);
+}
+
+/*
+ * Path of an earlier import with this checksum that is still in the diary,
+ * or NULL. A recorded copy may have been deleted or moved since, and a new
+ * copy (self) may have taken its place: *recorded tells whether its line
+ * is there already.
+ */
+static const char *checksums_find(const CHECKSUMS *sums, const char *sha256, const char *dpath,
+                                  const char *self, int *recorded) {
+  char path[8192];
+  const char *key = sha256;
+  char **hit = sums->count ? bsearch(&key, sums->lines, sums->count, sizeof(char *), line_cmp)
+                           : NULL;
+  *recorded = 0;
+  if (hit == NULL)
+    return NULL;
+
+  /* the same content may be recorded again after its first copy went away */
+  while (hit > sums->lines && line_cmp(hit - 1, &key) == 0)
+    hit--;
+  for (; hit < sums->lines + sums->count && line_cmp(hit, &key) == 0; hit++) {
+    const char *rel = *hit + SHA256_HEX_LEN;
+    snprintf(path, sizeof(path), "%s/%s", dpath, rel);
+    if (strcmp(rel, self) == 0)
+      *recorded = 1;
+    else if (do_file_exist(path))
+      return rel;
+  }
+  return NULL;
+}
+
+static void checksums_free(CHECKSUMS *sums) {
+  for (int i = 0; i < sums->count; i++)
+    free(sums->lines[i]);
+  free(sums->lines);
+}
+
+/*
+ * Drop copies of content the diary already has, and record the rest. With
+ * the attachment store every copy goes to the store instead, where equal
+ * contents share one object.
+ */
+static void dedupe(IMPORT_BATCH *batch, const char *dpath) {
+  char path[4096];
+  CHECKSUMS sums;
+  size_t dlen = strlen(dpath);
+  int objects = get_config() != NULL && get_config()->attachment_store;
+
+  if (get_meta_path(dpath, CHECKSUM_FILE, path, sizeof(path)) != 0)
+    return;
+  checksums_load(&sums, path);
+
+  FILE *fd = NULL;
+  for (int i = 0; i < batch->count; i++) {
+    IMPORT_FILE *f = &batch->files[i];
+    if (f->status != IMPORT_COPIED)
+      continue;
+
+    int recorded;
+    const char *same = checksums_find(&sums, f->sha256, dpath, f->dest + dlen + 1, &recorded);
+    for (int j = 0; same == NULL && j < i; j++)
+      if (batch->files[j].status == IMPORT_COPIED && strcmp(batch->files[j].sha256, f->sha256) == 0)
+        same = batch->files[j].dest + dlen + 1;
+    if (objects && objects_adopt(dpath, f->dest, f->sha256, &f->shared) != 0)
+      fprintf(stderr, "Warning: failed to add %s to the attachment store\n", f->dest);
+    if (same != NULL && objects)
+      continue;
+    if (same != NULL) {
+      printf("Skipped %s: same content as %s\n", f->src, same);
+      unlink(f->dest);
+      f->status = IMPORT_DUPLICATE;
+      continue;
+    }
+    if (recorded)
+      continue;
+
+    if (fd == NULL && (fd = store_fopen(path, "a")) == NULL)
+      break;
+    fprintf(fd, "%s %s\n", f->sha256, f->dest + dlen + 1);
+  }
+  if (fd != NULL && fclose(fd) != 0)
+    fprintf(stderr, "Warning: failed to update %s\n", path);
+  checksums_free(&sums);
+}
+
+void import_forget(const char *dpath, const char *rel) {
+  char path[4096];
+  char tmp[4200];
+  char line[4200];
+  int dropped = 0;
+
+  if (get_meta_path(dpath, CHECKSUM_FILE, path, sizeof(path)) != 0)
+    return;
+  FILE *in = store_fopen(path, "r");
+  if (in == NULL)
+    return;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *out = store_fopen(tmp, "w");
+  if (out == NULL) {
+    fclose(in);
+    return;
+  }
+
+  while (fgets(line, sizeof(line), in) != NULL) {
+    size_t len = strcspn(line, "\n");
+    if (len >= SHA256_HEX_LEN && strncmp(line + SHA256_HEX_LEN, rel, len - SHA256_HEX_LEN) == 0 &&
+        rel[len - SHA256_HEX_LEN] == '\0') {
+      dropped++;
+      continue;
+    }
+    fputs(line, out);
+  }
+  fclose(in);
+
+  if (fclose(out) != 0 || !dropped || rename(tmp, path) != 0)
+    unlink(tmp);
+}
+
+int import_run(IMPORT_BATCH *batch, const char *dpath) {
+  IMPORT_WORK work = {batch, 0, 0, 0};
+  pthread_t threads[IMPORT_THREADS];
+  int started = 0;
+
+  for (int i = 0; i < batch->count; i++) {
+    IMPORT_FILE *f = &batch->files[i];
+    if (plan_dest(f, dpath) != 0) {
+      f->status = IMPORT_FAILED;
+      f->error = errno;
+    }
+  }
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int wanted = cpus < 1 ? 1 : cpus > IMPORT_THREADS ? IMPORT_THREADS : (int)cpus;
+  if (wanted > batch->count)
+    wanted = batch->count;
+  for (; started < wanted; started++)
+    if (pthread_create(&threads[started], NULL, import_worker, &work) != 0)
+      break;
+  if (started == 0)
+    import_worker(&work);
+
+  /* the calling thread reports progress */
+  if (isatty(STDERR_FILENO) && batch->count > 0) {
+    struct timespec start, tick = {0, PROGRESS_MS * 1000000L};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (__atomic_load_n(&work.done, __ATOMIC_ACQUIRE) < batch->count) {
+      print_progress(&work, &start);
+      nanosleep(&tick, NULL);
+    }
+    print_progress(&work, &start);
+    fprintf(stderr, "\n");
+  }
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+
+  for (int i = 0; i < batch->count; i++) {
+    IMPORT_FILE *f = &batch->files[i];
+    if (f->status == IMPORT_FAILED)
+      printf("Error: failed to import %s: %s\n", f->src, strerror(f->error));
+  }
+
+  dedupe(batch, dpath);
+
+  int copied = 0;
+  for (int i = 0; i < batch->count; i++)
+    copied += batch->files[i].status == IMPORT_COPIED;
+  return copied;
+}
@@ -0,0 +1,66 @@
+/*
+ * import.h - Bulk import of existing files into a diary
+ *
+ * Files are filed under the day of their modification time
+ * (YYYY/MM/DD/YYYY-MM-DD_HH-MM.<ext>, like recordings made with 'dry new')
+ * and copied by a pool of threads. Each copy is offloaded to the kernel
+ * (reflink, else copy_file_range) while a second thread hashes the source,
+ * so the SHA-256 costs no extra pass over the data. Checksums of imported
+ * files are kept in .dry/checksums; importing the same content again is
+ * detected and skipped, or with 'attachment_store' enabled, linked to the
+ * stored copy (see objects.h).
+ */
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include "dry.h"
+#include "sha256.h"
+
+typedef enum {
+  IMPORT_PENDING,
+  IMPORT_COPIED,
+  IMPORT_DUPLICATE,   /* same content as an earlier import, copy removed */
+  IMPORT_FAILED
+} IMPORT_STATUS;
+
+typedef struct {
+  char *src;                      /* file to import */
+  char dest[4096];                /* its path in the diary */
+  char day[11];                   /* YYYY-MM-DD of the modification time */
+  struct timespec atime, mtime;   /* kept on the copy */
+  long long size;
+  char sha256[SHA256_HEX_LEN];
+  IMPORT_STATUS status;
+  int shared;                     /* content already in the attachment store */
+  int error;                      /* errno of a failed copy */
+} IMPORT_FILE;
+
+typedef struct {
+  IMPORT_FILE *files;             /* sorted by modification time */
+  int count;
+  int cap;
+  long long bytes;                /* total size */
+} IMPORT_BATCH;
+
+/*
+ * Collect the regular files given on the command line, descending into
+ * directories (hidden entries are skipped). Returns 0 on success.
+ */
+int import_collect(IMPORT_BATCH *batch, char *const *paths, int count);
+
+/*
+ * Copy the batch into the diary mounted at dpath, showing progress on a
+ * terminal, and record the checksums. Returns the number of files copied.
+ */
+int import_run(IMPORT_BATCH *batch, const char *dpath);
+
+/*
+ * Forget the checksum of a file that left the diary (rel is its path
+ * relative to dpath), so its content can be imported again.
+ */
+void import_forget(const char *dpath, const char *rel);
+
+/* Release a batch */
+void import_free(IMPORT_BATCH *batch);
+
+#endif /* IMPORT_H */
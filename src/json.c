@@ -0,0 +1,321 @@
+/*
+ * json.c - Minimal JSON parser implementation
+ */
+#include "json.h"
+#include "utils.h"
+
+#define JSON_MAX_DEPTH 64
+
+typedef struct {
+  const char *p;
+  const char *end;
+} PARSER;
+
+static int parse_value(PARSER *ps, JSON *v, int depth);
+
+static void skip_space(PARSER *ps) {
+  while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r'))
+    ps->p++;
+}
+
+static int literal(PARSER *ps, const char *word) {
+  size_t n = strlen(word);
+  if ((size_t)(ps->end - ps->p) < n || memcmp(ps->p, word, n) != 0)
+    return 1;
+  ps->p += n;
+  return 0;
+}
+
+static int hex4(const char *p, unsigned *out) {
+  *out = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    *out <<= 4;
+    if (c >= '0' && c <= '9')
+      *out |= c - '0';
+    else if (c >= 'a' && c <= 'f')
+      *out |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      *out |= c - 'A' + 10;
+    else
+      return 1;
+  }
+  return 0;
+}
+
+static size_t put_utf8(char *out, unsigned cp) {
+  if (cp < 0x80) {
+    out[0] = cp;
+    return 1;
+  } else if (cp < 0x800) {
+    out[0] = 0xc0 | (cp >> 6);
+    out[1] = 0x80 | (cp & 0x3f);
+    return 2;
+  } else if (cp < 0x10000) {
+    out[0] = 0xe0 | (cp >> 12);
+    out[1] = 0x80 | ((cp >> 6) & 0x3f);
+    out[2] = 0x80 | (cp & 0x3f);
+    return 3;
+  }
+  out[0] = 0xf0 | (cp >> 18);
+  out[1] = 0x80 | ((cp >> 12) & 0x3f);
+  out[2] = 0x80 | ((cp >> 6) & 0x3f);
+  out[3] = 0x80 | (cp & 0x3f);
+  return 4;
+}
+
+/* Parse a string at ps->p (on the opening quote) into a new NUL-terminated buffer */
+static int parse_string(PARSER *ps, char **out) {
+  const char *p = ps->p + 1;
+  const char *close = p;
+
+  /* escapes never expand, so the raw length bounds the decoded one */
+  while (close < ps->end && *close != '"')
+    close += *close == '\\' ? 2 : 1;
+  if (close >= ps->end)
+    return 1;
+
+  char *s = malloc(close - p + 1);
+  size_t n = 0;
+  if (s == NULL)
+    return 1;
+
+  while (p < close) {
+    unsigned char c = *p++;
+    if (c < 0x20)
+      goto fail;
+    if (c != '\\') {
+      s[n++] = c;
+      continue;
+    }
+    c = *p++;
+    switch (c) {
+    case '"': case '\\': case '/': s[n++] = c; break;
+    case 'b': s[n++] = '\b'; break;
+    case 'f': s[n++] = '\f'; break;
+    case 'n': s[n++] = '\n'; break;
+    case 'r': s[n++] = '\r'; break;
+    case 't': s[n++] = '\t'; break;
+    case 'u': {
+      unsigned cp, lo;
+      if (close - p < 4 || hex4(p, &cp) != 0)
+        goto fail;
+      p += 4;
+      if (cp >= 0xd800 && cp < 0xdc00) {
+        /* surrogate pair */
+        if (close - p < 6 || p[0] != '\\' || p[1] != 'u' || hex4(p + 2, &lo) != 0 ||
+            lo < 0xdc00 || lo >= 0xe000)
+          goto fail;
+        p += 6;
+        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+      } else if (cp >= 0xdc00 && cp < 0xe000) {
+        goto fail;
+      }
+      /* strings are NUL-terminated */
+      if (cp == 0)
+        goto fail;
+      n += put_utf8(s + n, cp);
+      break;
+    }
+    default:
+      goto fail;
+    }
+  }
+  s[n] = '\0';
+  *out = s;
+  ps->p = close + 1;
+  return 0;
+
+fail:
+  free(s);
+  return 1;
+}
+
+static int parse_number(PARSER *ps, JSON *v) {
+  const char *start = ps->p;
+  const char *p = ps->p;
+
+  if (p < ps->end && *p == '-')
+    p++;
+  if (p >= ps->end || *p < '0' || *p > '9')
+    return 1;
+  if (*p == '0')
+    p++;
+  else
+    while (p < ps->end && *p >= '0' && *p <= '9') p++;
+  if (p < ps->end && *p == '.') {
+    p++;
+    if (p >= ps->end || *p < '0' || *p > '9')
+      return 1;
+    while (p < ps->end && *p >= '0' && *p <= '9') p++;
+  }
+  if (p < ps->end && (*p == 'e' || *p == 'E')) {
+    p++;
+    if (p < ps->end && (*p == '+' || *p == '-'))
+      p++;
+    if (p >= ps->end || *p < '0' || *p > '9')
+      return 1;
+    while (p < ps->end && *p >= '0' && *p <= '9') p++;
+  }
+
+  v->string = strndup(start, p - start);
+  if (v->string == NULL)
+    return 1;
+  v->type = JSON_NUMBER;
+  v->number = strtod(v->string, NULL);
+  ps->p = p;
+  return 0;
+}
+
+/* Append a zeroed slot to an array or object, returns it or NULL */
+static JSON *add_item(JSON *v, int *cap) {
+  if (v->count == *cap) {
+    int ncap = *cap ? *cap * 2 : 4;
+    JSON *items = realloc(v->items, ncap * sizeof(JSON));
+    if (items == NULL)
+      return NULL;
+    v->items = items;
+    if (v->type == JSON_OBJECT) {
+      char **keys = realloc(v->keys, ncap * sizeof(char *));
+      if (keys == NULL)
+        return NULL;
+      v->keys = keys;
+    }
+    *cap = ncap;
+  }
+  memset(&v->items[v->count], 0, sizeof(JSON));
+  if (v->type == JSON_OBJECT)
+    v->keys[v->count] = NULL;
+  return &v->items[v->count++];
+}
+
+static int parse_container(PARSER *ps, JSON *v, int depth) {
+  char close = *ps->p == '[' ? ']' : '}';
+  int cap = 0;
+
+  v->type = close == ']' ? JSON_ARRAY : JSON_OBJECT;
+  ps->p++;
+  skip_space(ps);
+  if (ps->p < ps->end && *ps->p == close) {
+    ps->p++;
+    return 0;
+  }
+
+  for (;;) {
+    JSON *item = add_item(v, &cap);
+    if (item == NULL)
+      return 1;
+    if (v->type == JSON_OBJECT) {
+      skip_space(ps);
+      if (ps->p >= ps->end || *ps->p != '"' || parse_string(ps, &v->keys[v->count - 1]) != 0)
+        return 1;
+      skip_space(ps);
+      if (ps->p >= ps->end || *ps->p++ != ':')
+        return 1;
+    }
+    if (parse_value(ps, item, depth + 1) != 0)
+      return 1;
+    skip_space(ps);
+    if (ps->p >= ps->end)
+      return 1;
+    if (*ps->p == close) {
+      ps->p++;
+      return 0;
+    }
+    if (*ps->p++ != ',')
+      return 1;
+  }
+}
+
+static int parse_value(PARSER *ps, JSON *v, int depth) {
+  if (depth > JSON_MAX_DEPTH)
+    return 1;
+  skip_space(ps);
+  if (ps->p >= ps->end)
+    return 1;
+
+  switch (*ps->p) {
+  case '{':
+  case '[':
+    return parse_container(ps, v, depth);
+  case '"':
+    v->type = JSON_STRING;
+    return parse_string(ps, &v->string);
+  case 't':
+    v->type = JSON_BOOL;
+    v->boolean = 1;
+    return literal(ps, "true");
+  case 'f':
+    v->type = JSON_BOOL;
+    return literal(ps, "false");
+  case 'n':
+    v->type = JSON_NULL;
+    return literal(ps, "null");
+  default:
+    return parse_number(ps, v);
+  }
+}
+
+int json_parse(const char *text, size_t len, JSON *value) {
+  PARSER ps = {text, text + len};
+
+  memset(value, 0, sizeof(*value));
+  if (parse_value(&ps, value, 0) != 0) {
+    json_free(value);
+    return 1;
+  }
+  skip_space(&ps);
+  if (ps.p != ps.end) {
+    json_free(value);
+    return 1;
+  }
+  return 0;
+}
+
+void json_free(JSON *value) {
+  for (int i = 0; i < value->count; i++) {
+    json_free(&value->items[i]);
+    if (value->keys != NULL)
+      free(value->keys[i]);
+  }
+  free(value->items);
+  free(value->keys);
+  free(value->string);
+  memset(value, 0, sizeof(*value));
+}
+
+const JSON *json_get(const JSON *obj, const char *key) {
+  if (obj == NULL || obj->type != JSON_OBJECT)
+    return NULL;
+  for (int i = 0; i < obj->count; i++)
+    if (obj->keys[i] != NULL && strcmp(obj->keys[i], key) == 0)
+      return &obj->items[i];
+  return NULL;
+}
+
+const char *json_get_string(const JSON *obj, const char *key) {
+  const JSON *v = json_get(obj, key);
+  return v != NULL && v->type == JSON_STRING ? v->string : NULL;
+}
+
+long long json_get_int(const JSON *obj, const char *key, long long def) {
+  const JSON *v = json_get(obj, key);
+  return v != NULL && v->type == JSON_NUMBER ? (long long)v->number : def;
+}
+
+void json_print_scalar(FILE *out, const JSON *value) {
+  switch (value->type) {
+  case JSON_STRING:
+    print_json_string(out, value->string);
+    break;
+  case JSON_NUMBER:
+    fputs(value->string, out);
+    break;
+  case JSON_BOOL:
+    fputs(value->boolean ? "true" : "false", out);
+    break;
+  default:
+    fputs("null", out);
+    break;
+  }
+}
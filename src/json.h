@@ -0,0 +1,42 @@
+/*
+ * json.h - Minimal JSON parser for requests read by dry serve
+ *
+ * Parses a complete document into a tree of JSON values. Output is written
+ * directly with printf() and print_json_string() (see utils.h).
+ */
+#ifndef JSON_H
+#define JSON_H
+
+#include "dry.h"
+
+typedef enum { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT } JSON_TYPE;
+
+typedef struct JSON {
+  JSON_TYPE type;
+  int boolean;
+  double number;
+  char *string;         /* string value, or the text of a number */
+  struct JSON *items;   /* array elements, or object member values */
+  char **keys;          /* object member names */
+  int count;
+} JSON;
+
+/* Parse len bytes of text into value. Returns 0 on success. */
+int json_parse(const char *text, size_t len, JSON *value);
+
+/* Release memory held by value */
+void json_free(JSON *value);
+
+/* Member key of an object, or NULL if obj is not an object or has no such member */
+const JSON *json_get(const JSON *obj, const char *key);
+
+/* String member key of obj, or NULL if missing or not a string */
+const char *json_get_string(const JSON *obj, const char *key);
+
+/* Integer member key of obj, or def if missing or not a number */
+long long json_get_int(const JSON *obj, const char *key, long long def);
+
+/* Print a string, number, boolean or null value as it was read */
+void json_print_scalar(FILE *out, const JSON *value);
+
+#endif /* JSON_H */
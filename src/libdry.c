@@ -0,0 +1,410 @@
+/*
+ * libdry.c - C API of the dry diary implementation
+ */
+#include "libdry.h"
+#include "dry.h"
+#include "catalog.h"
+#include "config.h"
+#include "crypto.h"
+#include "entry.h"
+#include "note.h"
+#include "range.h"
+#include "search.h"
+#include "store.h"
+#include "utils.h"
+#include <stdarg.h>
+
+struct dry_diary {
+  char name[256];
+  char dpath[4096];
+  int refs;                 /* dry_open() calls not closed yet */
+  CATALOG cat;
+  SEARCH_INDEX idx;
+  int have_idx;
+  char path[8192];          /* strings handed out in dry_entry */
+  char date[11];
+  struct dry_diary *next;
+};
+
+struct dry_iter {
+  dry_diary *diary;
+  char from[11];
+  char to[11];
+  int day;
+  int entry;
+  char path[8192];
+};
+
+static char last_error[1024];
+static char detail[512];    /* last error reported by the core since */
+static dry_message_fn message_fn;
+static void *message_arg;
+static dry_diary *open_diaries;
+
+static dry_status fail(dry_status status, const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  int len = vsnprintf(last_error, sizeof(last_error), fmt, ap);
+  va_end(ap);
+  if (detail[0] && len >= 0 && (size_t)len < sizeof(last_error))
+    snprintf(last_error + len, sizeof(last_error) - len, " (%s)", detail);
+  detail[0] = '\0';
+  if (message_fn != NULL)
+    message_fn(status, last_error, message_arg);
+  return status;
+}
+
+/*
+ * Diagnostics of the core modules: errors become the detail of the failure
+ * that follows, warnings go to the message callback right away
+ */
+static void core_message(MSG_LEVEL level, const char *message, void *arg) {
+  (void)arg;
+  if (level == MSG_ERROR)
+    snprintf(detail, sizeof(detail), "%s", message);
+  else if (message_fn != NULL)
+    message_fn(DRY_OK, message, message_arg);
+}
+
+int dry_api_version(void) {
+  return DRY_API_VERSION;
+}
+
+const char *dry_strerror(dry_status status) {
+  switch (status) {
+  case DRY_OK: return "success";
+  case DRY_ERR_INVALID: return "invalid argument";
+  case DRY_ERR_CONFIG: return "invalid configuration";
+  case DRY_ERR_NOT_FOUND: return "not found";
+  case DRY_ERR_LOCKED: return "diary is locked";
+  case DRY_ERR_IO: return "input/output error";
+  case DRY_ERR_NOMEM: return "out of memory";
+  }
+  return "unknown error";
+}
+
+const char *dry_last_error(void) {
+  return last_error;
+}
+
+void dry_set_message_fn(dry_message_fn fn, void *arg) {
+  message_fn = fn;
+  message_arg = arg;
+}
+
+dry_status dry_init(void) {
+  msg_set_sink(core_message, NULL);
+  detail[0] = '\0';
+  if (get_config() == NULL && config_load() != 0)
+    return fail(DRY_ERR_CONFIG, "can't load the configuration");
+  return DRY_OK;
+}
+
+const char *dry_default_diary(void) {
+  return dry_init() == DRY_OK ? get_config()->name : NULL;
+}
+
+/*
+ * Diaries
+ */
+
+static dry_status unlock(dry_diary *d, const char *passphrase) {
+  if (store_is_native(d->dpath)) {
+    for (dry_diary *o = open_diaries; o != NULL; o = o->next)
+      if (store_is_native(o->dpath))
+        return fail(DRY_ERR_LOCKED, "can't unlock %s while %s is open", d->name, o->name);
+  }
+
+  /* never prompts: the host may not have a terminal, or not ours */
+  int rc = encdiary_run(0, d->name, NULL, passphrase, ENC_NO_PROMPT);
+  if (rc == 1)
+    return fail(DRY_ERR_LOCKED, "can't unlock %s", d->name);
+  if (rc != 0)
+    return fail(DRY_ERR_IO, "failed to unlock %s", d->name);
+  return DRY_OK;
+}
+
+dry_status dry_open(const char *name, const char *passphrase, dry_diary **diary) {
+  char dpath[4096];
+  dry_status rc;
+
+  *diary = NULL;
+  if ((rc = dry_init()) != DRY_OK)
+    return rc;
+  if (name == NULL)
+    name = get_config()->name;
+  if (name == NULL)
+    return fail(DRY_ERR_INVALID, "no diary given and no default diary configured");
+
+  for (dry_diary *o = open_diaries; o != NULL; o = o->next) {
+    if (strcmp(o->name, name) == 0) {
+      o->refs++;
+      *diary = o;
+      return DRY_OK;
+    }
+  }
+
+  if (strlen(name) >= sizeof(((dry_diary *)0)->name) || get_path_by_name(name, dpath) != 0)
+    return fail(DRY_ERR_NOT_FOUND, "can't find diary %s", name);
+
+  dry_diary *d = calloc(1, sizeof(*d));
+  if (d == NULL)
+    return fail(DRY_ERR_NOMEM, "out of memory");
+  snprintf(d->name, sizeof(d->name), "%s", name);
+  snprintf(d->dpath, sizeof(d->dpath), "%s", dpath);
+
+  if ((rc = unlock(d, passphrase)) != DRY_OK) {
+    free(d);
+    return rc;
+  }
+  if (catalog_load(&d->cat, d->dpath) != 0) {
+    catalog_free(&d->cat);
+    encdiary_run(1, d->name, NULL, NULL, 0);
+    free(d);
+    return fail(DRY_ERR_IO, "failed to load the catalog of %s", name);
+  }
+
+  d->refs = 1;
+  d->next = open_diaries;
+  open_diaries = d;
+  *diary = d;
+  return DRY_OK;
+}
+
+/*
+ * Write back the catalog and search index if they changed. They are caches,
+ * so the call that wrote them still succeeds.
+ */
+static void save_diary(dry_diary *d) {
+  if (catalog_save(&d->cat) != 0)
+    fail(DRY_ERR_IO, "failed to save the catalog of %s", d->name);
+  if (d->have_idx && search_save(&d->idx) != 0)
+    fail(DRY_ERR_IO, "failed to save the search index of %s", d->name);
+}
+
+void dry_close(dry_diary *diary) {
+  if (diary == NULL || --diary->refs > 0)
+    return;
+
+  for (dry_diary **p = &open_diaries; *p != NULL; p = &(*p)->next) {
+    if (*p == diary) {
+      *p = diary->next;
+      break;
+    }
+  }
+  save_diary(diary);
+  catalog_free(&diary->cat);
+  if (diary->have_idx)
+    search_free(&diary->idx);
+
+  /* unmounts, hands the mount back to the agent, or forgets the native key */
+  encdiary_run(1, diary->name, NULL, NULL, 0);
+  free(diary);
+}
+
+const char *dry_diary_name(const dry_diary *diary) {
+  return diary->name;
+}
+
+/*
+ * Entries
+ */
+
+static void fill_entry(dry_diary *d, const CATALOG_DAY *day, const CATALOG_ENTRY *e, char *path,
+                       size_t size, dry_entry *entry) {
+  catalog_entry_path(&d->cat, day, e, path, size);
+  entry->date = day->date;
+  entry->id = e->id;
+  entry->path = path;
+  entry->main = strcmp(e->link, "-") == 0 ? NULL : e->link;
+  entry->type = e->type == TEXT ? DRY_ENTRY_TEXT : e->type == MEDIA ? DRY_ENTRY_MEDIA
+                                                                     : DRY_ENTRY_OTHER;
+  entry->size = e->size;
+  entry->mtime = e->mtime;
+}
+
+dry_status dry_iter_open(dry_diary *diary, const char *from, const char *to, dry_iter **iter) {
+  DATE_RANGE range = {"", ""};
+  DATE_RANGE bound;
+  const char *given[2] = {from, to};
+  int empty = 0;
+
+  *iter = NULL;
+  for (int i = 0; i < 2; i++) {
+    if (given[i] == NULL)
+      continue;
+    if (range_parse(given[i], &bound) != 0)
+      return fail(DRY_ERR_INVALID, "invalid date %s", given[i]);
+    /* from takes the start of its span, to the end */
+    if (i == 0)
+      bound.to[0] = '\0';
+    else
+      bound.from[0] = '\0';
+    empty |= range_clamp(&range, &bound);
+  }
+
+  dry_iter *it = calloc(1, sizeof(*it));
+  if (it == NULL)
+    return fail(DRY_ERR_NOMEM, "out of memory");
+  it->diary = diary;
+  if (empty) {
+    it->day = diary->cat.count;
+    *iter = it;
+    return DRY_OK;
+  }
+  memcpy(it->from, range.from, sizeof(it->from));
+  memcpy(it->to, range.to, sizeof(it->to));
+
+  /* only days whose directory changed are scanned again */
+  if (catalog_sync(&diary->cat, it->from[0] ? it->from : NULL, it->to[0] ? it->to : NULL) != 0) {
+    free(it);
+    return fail(DRY_ERR_IO, "can't read %s", diary->dpath);
+  }
+  save_diary(diary);
+
+  while (it->day < diary->cat.count && it->from[0] &&
+         strcmp(diary->cat.days[it->day].date, it->from) < 0)
+    it->day++;
+  *iter = it;
+  return DRY_OK;
+}
+
+int dry_iter_next(dry_iter *iter, dry_entry *entry) {
+  CATALOG *cat = &iter->diary->cat;
+
+  while (iter->day < cat->count) {
+    CATALOG_DAY *day = &cat->days[iter->day];
+    if (iter->to[0] && strcmp(day->date, iter->to) > 0)
+      return 0;
+    if (iter->entry < day->count) {
+      fill_entry(iter->diary, day, &day->entries[iter->entry++], iter->path, sizeof(iter->path),
+                 entry);
+      return 1;
+    }
+    iter->day++;
+    iter->entry = 0;
+  }
+  return 0;
+}
+
+void dry_iter_close(dry_iter *iter) {
+  free(iter);
+}
+
+dry_status dry_entry_find(dry_diary *diary, const char *id, dry_entry *entry) {
+  DATE_RANGE range;
+  char prefix[11];
+
+  /* entry ids start with their day */
+  snprintf(prefix, sizeof(prefix), "%s", id);
+  if (strlen(id) < 10 || range_parse(prefix, &range) != 0 || !range_is_day(&range))
+    return fail(DRY_ERR_NOT_FOUND, "entry not found: %s", id);
+  memcpy(diary->date, range.from, sizeof(diary->date));
+  if (catalog_sync(&diary->cat, diary->date, diary->date) != 0)
+    return fail(DRY_ERR_IO, "can't read %s", diary->dpath);
+  save_diary(diary);
+
+  CATALOG_DAY *day = catalog_get_day(&diary->cat, diary->date);
+  for (int i = 0; day != NULL && i < day->count; i++) {
+    if (strcmp(day->entries[i].id, id) == 0) {
+      fill_entry(diary, day, &day->entries[i], diary->path, sizeof(diary->path), entry);
+      return DRY_OK;
+    }
+  }
+  return fail(DRY_ERR_NOT_FOUND, "entry not found: %s", id);
+}
+
+dry_status dry_read_note(dry_diary *diary, const char *id, const char *section, dry_write_fn fn,
+                         void *arg) {
+  dry_entry entry;
+  NOTE note;
+  dry_status rc;
+
+  if ((rc = dry_entry_find(diary, id, &entry)) != DRY_OK)
+    return rc;
+  if (entry.type != DRY_ENTRY_TEXT)
+    return fail(DRY_ERR_INVALID, "%s is not a note", id);
+  if (note_load(&note, entry.path) != 0)
+    return fail(DRY_ERR_IO, "can't read %s", entry.path);
+
+  size_t start = 0;
+  size_t end = note.len;
+  if (section != NULL) {
+    const NOTE_SECTION *s = note_find(&note, section);
+    if (s == NULL) {
+      note_free(&note);
+      return fail(DRY_ERR_NOT_FOUND, "no section %s in %s", section, id);
+    }
+    start = s->offset;
+    end = s->end;
+  }
+  rc = fn(note.data + start, end - start, arg) == 0 ? DRY_OK : fail(DRY_ERR_IO, "output failed");
+  note_free(&note);
+  return rc;
+}
+
+dry_status dry_append(dry_diary *diary, const char *text, long long when) {
+  time_t t = when != 0 ? (time_t)when : time(NULL);
+  char dir[4200], path[4300];
+  struct tm tm;
+
+  if (text == NULL)
+    return fail(DRY_ERR_INVALID, "no text to append");
+
+  localtime_r(&t, &tm);
+  strftime(diary->date, sizeof(diary->date), "%Y-%m-%d", &tm);
+  snprintf(dir, sizeof(dir), "%s/%.4s/%.2s/%.2s", diary->dpath, diary->date, diary->date + 5,
+           diary->date + 8);
+  snprintf(path, sizeof(path), "%s/%s.org", dir, diary->date);
+
+  if (make_dirs(dir, 0777) != 0)
+    return fail(DRY_ERR_IO, "failed to create %s: %s", dir, strerror(errno));
+  if (append_entry_text(path, ORG, t, text) != 0)
+    return fail(DRY_ERR_IO, "failed to write %s", path);
+  catalog_update_day(&diary->cat, diary->date);
+  save_diary(diary);
+  return DRY_OK;
+}
+
+dry_status dry_search(dry_diary *diary, const char *query, int limit, dry_result_fn fn,
+                      void *arg) {
+  dry_status rc = DRY_OK;
+
+  if (query == NULL || query[0] == '\0' || limit < 1)
+    return fail(DRY_ERR_INVALID, "search requires a query and a positive limit");
+  if (!diary->have_idx) {
+    if (search_load(&diary->idx, diary->dpath) != 0)
+      return fail(DRY_ERR_IO, "failed to load the search index of %s", diary->name);
+    diary->have_idx = 1;
+  }
+
+  /* other dry processes may have written since the last search */
+  if (catalog_sync(&diary->cat, NULL, NULL) != 0 || search_sync(&diary->idx, &diary->cat) < 0)
+    return fail(DRY_ERR_IO, "failed to update the search index of %s", diary->name);
+  save_diary(diary);
+
+  SEARCH_RESULT *results = malloc(limit * sizeof(SEARCH_RESULT));
+  if (results == NULL)
+    return fail(DRY_ERR_NOMEM, "out of memory");
+  int found = search_query(&diary->idx, query, results, limit);
+
+  for (int i = 0; i < found && rc == DRY_OK; i++) {
+    const SEARCH_DOC *doc = &diary->idx.docs[results[i].doc];
+    char snippet[128];
+    dry_result r;
+
+    /* key is YYYY-MM-DD/<id> */
+    snprintf(diary->date, sizeof(diary->date), "%.10s", doc->key);
+    r.date = diary->date;
+    r.id = doc->key + 11;
+    r.section = doc->sections[results[i].section].label;
+    r.score = results[i].score;
+    r.snippet = search_snippet(&diary->idx, &results[i], query, snippet, sizeof(snippet)) == 0
+                    ? snippet : NULL;
+    if (fn(&r, arg) != 0)
+      rc = fail(DRY_ERR_IO, "output failed");
+  }
+  free(results);
+  return rc;
+}
@@ -0,0 +1,151 @@
+/*
+ * libdry.h - C API of the dry diary (libdry.a, libdry.so)
+ *
+ * Opens diaries, iterates their entries, reads notes, appends to them and
+ * searches them in-process, without spawning dry. Calls return a status
+ * instead of exiting; the message of the last failure is kept for
+ * dry_last_error() and passed to the message callback if one is set.
+ * Output (note text, search results) goes to caller-provided callbacks; the
+ * library writes nothing to stdout or stderr, registers no exit handlers
+ * and never forks (a running mount agent is used, but only dry starts one).
+ *
+ * The configuration and diary registry are the ones dry uses (.dry/dry.conf,
+ * ~/.dry/dry.conf or /etc/dry/dry.conf). The library is not thread-safe, and
+ * only one native diary can be open at a time.
+ *
+ * Strings in dry_entry and dry_result are valid until the next call on the
+ * same diary or iterator.
+ */
+#ifndef LIBDRY_H
+#define LIBDRY_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define DRY_API __attribute__((visibility("default")))
+#else
+#define DRY_API
+#endif
+
+/* Bumped on incompatible changes of this header */
+#define DRY_API_VERSION 1
+
+typedef enum {
+  DRY_OK = 0,
+  DRY_ERR_INVALID = -1,     /* invalid argument */
+  DRY_ERR_CONFIG = -2,      /* no or invalid configuration */
+  DRY_ERR_NOT_FOUND = -3,   /* no such diary, day, entry or section */
+  DRY_ERR_LOCKED = -4,      /* diary can't be unlocked (passphrase missing or wrong) */
+  DRY_ERR_IO = -5,          /* read, write or callback failed */
+  DRY_ERR_NOMEM = -6
+} dry_status;
+
+typedef enum { DRY_ENTRY_TEXT, DRY_ENTRY_MEDIA, DRY_ENTRY_OTHER } dry_entry_type;
+
+typedef struct dry_diary dry_diary;   /* an open (unlocked) diary */
+typedef struct dry_iter dry_iter;     /* entries of a date range */
+
+typedef struct {
+  const char *date;         /* YYYY-MM-DD */
+  const char *id;           /* file name, e.g. 2025-04-11_17-06.mkv */
+  const char *path;         /* full path of the file */
+  const char *main;         /* main note of the day, NULL if none */
+  dry_entry_type type;
+  long long size;           /* bytes */
+  long long mtime;          /* seconds since the epoch */
+} dry_entry;
+
+typedef struct {
+  const char *date;         /* YYYY-MM-DD */
+  const char *id;           /* note the section is in */
+  const char *section;      /* header, e.g. "17:06:00" ("" before the first one) */
+  const char *snippet;      /* first matching line, NULL if none */
+  double score;
+} dry_result;
+
+/* Receives len bytes of output; returns 0 to continue */
+typedef int (*dry_write_fn)(const char *data, size_t len, void *arg);
+
+/* Receives a search result; returns 0 to continue */
+typedef int (*dry_result_fn)(const dry_result *result, void *arg);
+
+/*
+ * Receives the message of every failed call, and with DRY_OK warnings about
+ * problems that were worked around (e.g. a corrupt catalog was rebuilt)
+ */
+typedef void (*dry_message_fn)(dry_status status, const char *message, void *arg);
+
+/* DRY_API_VERSION of the library */
+DRY_API int dry_api_version(void);
+
+/* Short description of a status */
+DRY_API const char *dry_strerror(dry_status status);
+
+/* Message of the last failed call */
+DRY_API const char *dry_last_error(void);
+
+/* Set (or with NULL, clear) the callback for failure messages */
+DRY_API void dry_set_message_fn(dry_message_fn fn, void *arg);
+
+/* Load the configuration; dry_open() does it on first use */
+DRY_API dry_status dry_init(void);
+
+/* Name of the default diary of the configuration, NULL if unset */
+DRY_API const char *dry_default_diary(void);
+
+/*
+ * Unlock diary name (NULL: the default one) and load its catalog. The
+ * passphrase is for native and encfs diaries; NULL takes it from
+ * $DRY_PASSWORD or $DRY_ENCFS_PASSWORD (never from a terminal).
+ */
+DRY_API dry_status dry_open(const char *name, const char *passphrase, dry_diary **diary);
+
+/* Write back cached state and lock the diary */
+DRY_API void dry_close(dry_diary *diary);
+
+DRY_API const char *dry_diary_name(const dry_diary *diary);
+
+/*
+ * Iterate the entries from the start of from to the end of to in date
+ * order. Bounds are dates or range expressions as in dry list (2025-03-14,
+ * 2025-03, 2025, today, -7d, ...), so from "2025-03" starts on March 1st
+ * and to "2025-03" ends on March 31st; NULL is unbounded. The diary must
+ * not be written to while iterating.
+ */
+DRY_API dry_status dry_iter_open(dry_diary *diary, const char *from, const char *to,
+                                 dry_iter **iter);
+
+/* Next entry: returns 1 and fills entry, 0 at the end */
+DRY_API int dry_iter_next(dry_iter *iter, dry_entry *entry);
+
+DRY_API void dry_iter_close(dry_iter *iter);
+
+/* Look up one entry by id */
+DRY_API dry_status dry_entry_find(dry_diary *diary, const char *id, dry_entry *entry);
+
+/*
+ * Write the text of note id, or of its section (HH:MM or HH:MM:SS) if
+ * section is not NULL, to fn
+ */
+DRY_API dry_status dry_read_note(dry_diary *diary, const char *id, const char *section,
+                                 dry_write_fn fn, void *arg);
+
+/*
+ * Append text under a time header to the note of the day of when (seconds
+ * since the epoch, 0: now), creating the note if needed
+ */
+DRY_API dry_status dry_append(dry_diary *diary, const char *text, long long when);
+
+/* Pass at most limit sections matching all terms of query to fn, best first */
+DRY_API dry_status dry_search(dry_diary *diary, const char *query, int limit,
+                              dry_result_fn fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBDRY_H */
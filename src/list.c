@@ -0,0 +1,172 @@
+/*
+ * list.c - Rendering of diary listings
+ */
+#include "list.h"
+#include "diary.h"
+#include "media.h"
+#include "utils.h"
+
+/* An entry selected for output */
+typedef struct {
+  const CATALOG_DAY *day;
+  const CATALOG_ENTRY *entry;
+} LIST_ITEM;
+
+static const char *type_name(FILE_TYPE type) {
+  return type == TEXT ? "text" : type == MEDIA ? "media" : "other";
+}
+
+static int type_selected(FILE_TYPE type, int flags) {
+  if (!(flags & LIST_FLAG_TYPES))
+    return 1;
+  switch (type) {
+  case TEXT:
+    return flags & LIST_FLAG_TEXT;
+  case MEDIA:
+    return flags & LIST_FLAG_MEDIA;
+  default:
+    return flags & LIST_FLAG_OTHER;
+  }
+}
+
+static int size_cmp(const void *a, const void *b) {
+  long long x = ((const LIST_ITEM *)a)->entry->size;
+  long long y = ((const LIST_ITEM *)b)->entry->size;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int time_cmp(const void *a, const void *b) {
+  long long x = ((const LIST_ITEM *)a)->entry->mtime;
+  long long y = ((const LIST_ITEM *)b)->entry->mtime;
+  if (x != y)
+    return x < y ? -1 : 1;
+  return strcmp(((const LIST_ITEM *)a)->entry->id, ((const LIST_ITEM *)b)->entry->id);
+}
+
+static void print_json_item(const LIST_ITEM *item, int first) {
+  const CATALOG_ENTRY *e = item->entry;
+  char hm[8];
+  time_t mtime = (time_t)e->mtime;
+
+  strftime(hm, sizeof(hm), "%H:%M", localtime(&mtime));
+  printf("%s\n  {\"date\": \"%s\", \"time\": \"%s\", \"id\": ", first ? "" : ",", item->day->date, hm);
+  print_json_string(stdout, e->id);
+  printf(", \"type\": \"%s\", \"size\": %lld, \"mtime\": %lld, \"main\": ", type_name(e->type),
+         e->size, e->mtime);
+  if (strcmp(e->link, "-") == 0)
+    printf("null");
+  else
+    print_json_string(stdout, e->link);
+  printf("}");
+}
+
+static void print_text_item(const LIST_ITEM *item, int grouped) {
+  const CATALOG_ENTRY *e = item->entry;
+  char size[16];
+  char hm[8];
+  time_t mtime = (time_t)e->mtime;
+
+  format_size(e->size, size, sizeof(size));
+  strftime(hm, sizeof(hm), "%H:%M", localtime(&mtime));
+  if (grouped)
+    printf("  %s  %-5s %7s  %s%s\n", hm, type_name(e->type), size, e->id,
+           strcmp(e->id, e->link) == 0 ? "  *main*" : "");
+  else
+    printf("%s %s  %-5s %7s  %s\n", item->day->date, hm, type_name(e->type), size, e->id);
+}
+
+int list_count(const CATALOG_DAY *day, int flags) {
+  int n = 0;
+  for (int i = 0; i < day->count; i++)
+    n += type_selected(day->entries[i].type, flags) != 0;
+  return n;
+}
+
+int list_render(CATALOG_DAY **days, int ndays, int last, int flags) {
+  LIST_ITEM *items = NULL;
+  int count = 0, cap = 0;
+
+  for (int d = 0; d < ndays; d++) {
+    for (int i = 0; i < days[d]->count; i++) {
+      if (!type_selected(days[d]->entries[i].type, flags))
+        continue;
+      if (count == cap) {
+        cap = cap ? cap * 2 : 256;
+        LIST_ITEM *grown = realloc(items, cap * sizeof(LIST_ITEM));
+        if (grown == NULL) {
+          free(items);
+          fprintf(stderr, "Error: out of memory\n");
+          return 0;
+        }
+        items = grown;
+      }
+      items[count].day = days[d];
+      items[count++].entry = &days[d]->entries[i];
+    }
+  }
+
+  /* the newest ones, whatever the order they are shown in */
+  if (last > 0 && count > last) {
+    memmove(items, items + count - last, last * sizeof(LIST_ITEM));
+    count = last;
+  }
+
+  int grouped = !(flags & (LIST_FLAG_SORT_SIZE | LIST_FLAG_SORT_TIME));
+  if (flags & LIST_FLAG_SORT_SIZE)
+    qsort(items, count, sizeof(LIST_ITEM), size_cmp);
+  else if (flags & LIST_FLAG_SORT_TIME)
+    qsort(items, count, sizeof(LIST_ITEM), time_cmp);
+
+  if (flags & LIST_FLAG_REVERSE) {
+    for (int i = 0, j = count - 1; i < j; i++, j--) {
+      LIST_ITEM tmp = items[i];
+      items[i] = items[j];
+      items[j] = tmp;
+    }
+  }
+
+  if (flags & LIST_FLAG_JSON) {
+    printf("[");
+    for (int i = 0; i < count; i++)
+      print_json_item(&items[i], i == 0);
+    printf("%s]\n", count ? "\n" : "");
+  } else {
+    for (int i = 0; i < count; i++) {
+      if (grouped && (i == 0 || items[i].day != items[i - 1].day))
+        printf("%s%s\n", i ? "\n" : "", items[i].day->date);
+      print_text_item(&items[i], grouped);
+    }
+  }
+
+  free(items);
+  return count;
+}
+
+int list_print_thumbs(const char *dpath, const char *id) {
+  static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t n, len = 0;
+
+  unsigned char *png = media_thumbs_load(dpath, id, &n);
+  char *enc = png != NULL ? malloc((n + 2) / 3 * 4) : NULL;
+  for (size_t i = 0; enc != NULL && i < n; i += 3) {
+    unsigned v = png[i] << 16 | (i + 1 < n ? png[i + 1] << 8 : 0) | (i + 2 < n ? png[i + 2] : 0);
+    enc[len++] = b64[v >> 18 & 0x3f];
+    enc[len++] = b64[v >> 12 & 0x3f];
+    enc[len++] = i + 1 < n ? b64[v >> 6 & 0x3f] : '=';
+    enc[len++] = i + 2 < n ? b64[v & 0x3f] : '=';
+  }
+  free(png);
+
+  /* kitty graphics protocol: transmit and display a png, 4096 bytes per escape */
+  for (size_t off = 0; off < len; off += 4096) {
+    size_t chunk = len - off < 4096 ? len - off : 4096;
+    printf("\033_G%sm=%d;%.*s\033\\", off == 0 ? "a=T,f=100," : "",
+           off + chunk < len, (int)chunk, enc + off);
+  }
+  free(enc);
+
+  if (len == 0)
+    return 1;
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * list.h - Rendering of diary listings
+ */
+#ifndef LIST_H
+#define LIST_H
+
+#include "dry.h"
+#include "catalog.h"
+
+/* Number of entries of day selected by the type flags (LIST_FLAG_*) */
+int list_count(const CATALOG_DAY *day, int flags);
+
+/*
+ * Print the entries of days (in date order) to stdout, only the latest
+ * last ones if last > 0.
+ * flags: combination of LIST_FLAG_* constants (see diary.h).
+ * Entries are grouped by day unless sorted by size or time, which orders
+ * them across days. Returns the number of entries printed.
+ */
+int list_render(CATALOG_DAY **days, int ndays, int last, int flags);
+
+/*
+ * Print the thumbnail strip of entry id inline with the kitty terminal
+ * graphics protocol. Returns 0 if a strip was printed.
+ */
+int list_print_thumbs(const char *dpath, const char *id);
+
+#endif /* LIST_H */
@@ -4,6 +4,12 @@
 #include "dry.h"
 #include "config.h"
 #include "diary.h"
+#include "agent.h"
+#include "serve.h"
+#include "store.h"
+#include "trace.h"
+#include "range.h"
+#include <ctype.h>
 #include <getopt.h>
 
 #define VERSION "0.1.0"
@@ -12,6 +18,12 @@ static char *prog_name = "dry";  /* Set from argv[0] in main() */
 
 #define usage(T) usages(prog_name, (T))
 
+/* Write the trace at exit, its summary after the command's own output */
+static void finish_trace(void) {
+  fflush(stdout);
+  trace_finish(stderr);
+}
+
 static void print_version(void) {
   printf("dry version %s\n", VERSION);
 }
@@ -22,27 +34,40 @@ static void print_help(char *name) {
   printf("OPTIONS\n");
   printf("  -d, --diary <name>  Specify diary to use (default from config)\n");
   printf("  -h, --help          Show this help message\n");
-  printf("  -v, --version       Show version information\n\n");
+  printf("  -v, --version       Show version information\n");
+  printf("  --trace[=<file>]    Write a Chrome trace of the command's phases\n\n");
   printf("COMMANDS\n");
-  printf("  init <name> [<path>]  Initialize a new diary\n");
+  printf("  init <name> [<path>]  Initialize a new diary (--native: without encfs)\n");
   printf("  new <note|video>      Add a note or video entry\n");
+  printf("  import <path>...      Import existing files into the diary\n");
   printf("  show <id|filter>      Show entries by ID or date filter\n");
   printf("  list [<filter>]       List entries (today, yesterday, date)\n");
   printf("  delete <id>           Delete an entry\n");
   printf("  explore               Open diary in file manager\n");
   printf("  unlock                Unlock diary for manual editing\n");
   printf("  lock                  Lock diary after manual editing\n");
+  printf("  watch                 Keep the catalog and search index current\n");
   printf("  status                Show unlocked diaries (for shell prompt)\n");
+  printf("  reindex               Rebuild the entry catalog\n");
+  printf("  stats                 Show activity and storage statistics\n");
+  printf("  search <terms>        Search notes (all terms must match)\n");
+  printf("  export                Export a date range as org, md, html or tar\n");
+  printf("  backup <dir>          Back up the encrypted diary incrementally\n");
+  printf("  agent [stop]          Run (or stop) the mount lease agent\n");
+  printf("  serve                 Answer JSON-RPC requests on stdin (editors)\n");
 }
 
 static void print_subcommand_help(COMMAND command) {
   switch (command) {
   case INIT:
     printf("Initialize a new diary\n\n");
-    printf("Usage: %s init <name> [<path>]\n\n", prog_name);
+    printf("Usage: %s init [--native] <name> [<path>]\n\n", prog_name);
     printf("Arguments:\n");
     printf("  <name>    Name of the diary to create\n");
-    printf("  <path>    Optional path where to create the diary\n");
+    printf("  <path>    Optional path where to create the diary\n\n");
+    printf("Options:\n");
+    printf("  --native  Encrypt files in place (no encfs/FUSE mount);\n");
+    printf("            the passphrase is read from $DRY_PASSWORD or the terminal\n");
     break;
   case NEW:
     printf("Add a new entry to the diary\n\n");
@@ -52,6 +77,19 @@ static void print_subcommand_help(COMMAND command) {
     printf("Options:\n");
     printf("  -d, --diary <name>  Diary to use (default from config)\n");
     break;
+  case IMPORT:
+    printf("Import existing files into the diary\n\n");
+    printf("Usage: %s [-d <diary>] import <path>...\n\n", prog_name);
+    printf("Arguments:\n");
+    printf("  <path>    Files, or directories to import recursively\n\n");
+    printf("Options:\n");
+    printf("  -d, --diary <name>  Diary to use (default from config)\n\n");
+    printf("Each file is copied to the day of its modification time as\n");
+    printf("YYYY-MM-DD_HH-MM.<ext> and linked from that day's note. Copies use\n");
+    printf("reflinks or copy_file_range where possible and run in parallel; files\n");
+    printf("whose content (SHA-256) was imported before are skipped, or with\n");
+    printf("'attachment_store' set, linked to the stored copy.\n");
+    break;
   case SHOW:
     printf("Show diary entries\n\n");
     printf("Usage: %s [-d <diary>] show [OPTIONS] <id|filter>\n\n", prog_name);
@@ -59,13 +97,18 @@ static void print_subcommand_help(COMMAND command) {
     printf("  <id>      Show a specific entry by ID\n");
     printf("  today     Show all entries from today\n");
     printf("  yesterday Show all entries from yesterday\n");
-    printf("  <date>    Show all entries from date (YYYY-MM-DD)\n\n");
+    printf("  <date>    Show all entries from date (YYYY-MM-DD)\n");
+    printf("  <range>   Show all entries of a range, day by day (see 'list --help')\n");
+    printf("  <date|id>#<HH:MM>\n");
+    printf("            Page only that section of the day's note\n\n");
     printf("Options:\n");
     printf("  -d, --diary <name>  Diary to use (default from config)\n");
     printf("  -m, --main          Show only the main diary entry\n");
     printf("  --text              Show only text entries (skip media)\n");
     printf("  --head              List files only (no content displayed)\n");
-    printf("  --interleaved       Re-show main entry before each attachment\n\n");
+    printf("  --interleaved       Re-show main entry before each attachment\n");
+    printf("  --thumbs            With --head, show video thumbnails (kitty graphics)\n");
+    printf("  --last <n>          Show only the latest n entries (of the range)\n\n");
     printf("When showing multiple entries, they are displayed sequentially:\n");
     printf("  - Text files open in pager (press q to continue)\n");
     printf("  - Videos play in video player\n");
@@ -73,11 +116,22 @@ static void print_subcommand_help(COMMAND command) {
     break;
   case LIST:
     printf("List diary entries\n\n");
-    printf("Usage: %s [-d <diary>] list [<filter>]\n\n", prog_name);
+    printf("Usage: %s [-d <diary>] list [options] [<filter>]\n\n", prog_name);
     printf("Arguments:\n");
-    printf("  <filter>  Optional filter: 'today', 'yesterday', 'tomorrow', or a date\n\n");
+    printf("  <filter>  Optional filter: 'today', 'yesterday', 'tomorrow', a date,\n");
+    printf("            a month (2025/03), a year (2025), a span back from today\n");
+    printf("            (-7d, -2w, -3m, -1y) or ahead (+7d), or a range A..B of any\n");
+    printf("            of these (2025-01-01..2025-02-15, 2025-03.., ..-1m)\n\n");
     printf("Options:\n");
     printf("  -d, --diary <name>  Diary to use (default from config)\n");
+    printf("  --from <date>       Only from the start of date (or month, year, span)\n");
+    printf("  --to <date>         Only up to the end of date\n");
+    printf("  --last <n>          Only the latest n entries; the tree is walked from\n");
+    printf("                      the newest day back, no further than needed\n");
+    printf("  -t, --type <types>  Only list these types: text, media, other (comma separated)\n");
+    printf("  --sort <key>        date (grouped by day, default), time or size (across days)\n");
+    printf("  -r, --reverse       Reverse the order\n");
+    printf("  --json              Print entries as a JSON array\n");
     break;
   case DELETE:
     printf("Delete an entry from the diary\n\n");
@@ -95,16 +149,19 @@ static void print_subcommand_help(COMMAND command) {
     break;
   case UNLOCK:
     printf("Unlock diary for manual editing\n\n");
-    printf("Usage: %s [-d <diary>] unlock\n\n", prog_name);
+    printf("Usage: %s [-d <diary>] unlock [--watch]\n\n", prog_name);
     printf("Decrypts and mounts the diary, leaving it accessible for manual\n");
     printf("file operations. Remember to lock when done.\n\n");
     printf("Options:\n");
     printf("  -d, --diary <name>  Diary to use (default from config)\n");
+    printf("  --watch             Watch the diary in the background until locked\n");
+    printf("                      (see '%s watch --help')\n", prog_name);
     break;
   case LOCK:
     printf("Lock diary after manual editing\n\n");
     printf("Usage: %s [-d <diary>] lock\n\n", prog_name);
-    printf("Unmounts and re-encrypts the diary.\n\n");
+    printf("Stops the watcher, if any, once it saved pending changes, then\n");
+    printf("unmounts and re-encrypts the diary.\n\n");
     printf("Options:\n");
     printf("  -d, --diary <name>  Diary to use (default from config)\n");
     break;
@@ -119,6 +176,105 @@ static void print_subcommand_help(COMMAND command) {
     printf("  # zsh\n");
     printf("  RPROMPT='\\$(dry status)'\n");
     break;
+  case REINDEX:
+    printf("Rebuild the entry catalog\n\n");
+    printf("Usage: %s [-d <diary>] reindex\n\n", prog_name);
+    printf("Walks the whole diary and rewrites the catalog used by list and show.\n");
+    printf("Only needed after editing the diary outside of dry.\n\n");
+    printf("Options:\n");
+    printf("  -d, --diary <name>  Diary to use (default from config)\n");
+    break;
+  case EXPORT:
+    printf("Export entries to a single document or archive\n\n");
+    printf("Usage: %s [-d <diary>] export [OPTIONS]\n\n", prog_name);
+    printf("Options:\n");
+    printf("  -d, --diary <name>  Diary to use (default from config)\n");
+    printf("  --from <date>       First day to export (YYYY-MM-DD)\n");
+    printf("  --to <date>         Last day to export (YYYY-MM-DD)\n");
+    printf("  --format <fmt>      org (default), md, html or tar\n");
+    printf("  -o, --output <file> Write to file instead of stdout\n\n");
+    printf("Entries are streamed in chronological order. org, md and html inline\n");
+    printf("the day notes and link other files by their path in the diary\n");
+    printf("(YYYY/MM/DD/<id>); tar packs every file under that path. Decrypted\n");
+    printf("contents go to the output only, never to temporary files.\n");
+    break;
+  case BACKUP:
+    printf("Back up the encrypted diary\n\n");
+    printf("Usage: %s [-d <diary>] backup [--verify] <dir>\n\n", prog_name);
+    printf("Arguments:\n");
+    printf("  <dir>     Backup directory; the diary is mirrored to <dir>/<diary>\n\n");
+    printf("Options:\n");
+    printf("  -d, --diary <name>  Diary to use (default from config)\n");
+    printf("  --verify            Check the backup against its manifest\n\n");
+    printf("The encrypted files are copied as they are, so the diary stays locked.\n");
+    printf("A manifest (<dir>/<diary>.manifest) records size, mtime and SHA-256 of\n");
+    printf("each file: unchanged files are skipped and changed ones only send the\n");
+    printf("blocks that differ from their previous copy.\n");
+    break;
+  case STATS:
+    printf("Show activity and storage statistics\n\n");
+    printf("Usage: %s [-d <diary>] stats [--json]\n\n", prog_name);
+    printf("Reports entries per day, week and month, words written, recorded time\n");
+    printf("and storage per year, a calendar heatmap of the last year, and the\n");
+    printf("attachment store: stored objects, references to them from the days\n");
+    printf("and the space saved by sharing equal content. Per-day figures are\n");
+    printf("cached, so only days that changed are read again.\n\n");
+    printf("Options:\n");
+    printf("  -d, --diary <name>  Diary to use (default from config)\n");
+    printf("  --json              Print JSON (with per year, month, week and day figures)\n");
+    break;
+  case SEARCH:
+    printf("Search diary notes\n\n");
+    printf("Usage: %s [-d <diary>] search [OPTIONS] <terms>...\n\n", prog_name);
+    printf("Arguments:\n");
+    printf("  <terms>   Words that must all occur in the same section of a note\n\n");
+    printf("Options:\n");
+    printf("  -d, --diary <name>  Diary to use (default from config)\n");
+    printf("  -n, --limit <n>     Show at most n results (default 20)\n\n");
+    printf("Results are ranked by relevance and recency and report the note and\n");
+    printf("the '** HH:MM:SS' section they were found in. The index is kept inside\n");
+    printf("the encrypted diary and updated incrementally.\n");
+    break;
+  case AGENT:
+    printf("Run the mount lease agent\n\n");
+    printf("Usage: %s agent [stop]\n\n", prog_name);
+    printf("Keeps diaries mounted between commands so back-to-back commands\n");
+    printf("don't pay for encfs key derivation and FUSE mount/unmount each time.\n");
+    printf("A diary is unmounted once no command used it for 'agent_idle'\n");
+    printf("seconds, or immediately on 'dry lock'.\n\n");
+    printf("With 'agent_idle' set in the config the agent is started on demand;\n");
+    printf("this command runs it in the foreground (e.g. from a service manager).\n\n");
+    printf("Arguments:\n");
+    printf("  stop      Unmount all diaries held by the agent and stop it\n");
+    break;
+  case SERVE:
+    printf("Serve JSON-RPC requests over stdin/stdout\n\n");
+    printf("Usage: %s [-d <diary>] serve\n\n", prog_name);
+    printf("For editor integration: one process answers many requests and keeps\n");
+    printf("diaries unlocked, with their catalog and search index in memory,\n");
+    printf("until stdin is closed. Requests are JSON-RPC 2.0, one per line or\n");
+    printf("with LSP-style Content-Length headers, and may be pipelined.\n\n");
+    printf("Methods:\n");
+    printf("  list    {diary, date | from, to}     Days and their entries\n");
+    printf("  show    {diary, id | date, section}  Metadata and text of an entry or day\n");
+    printf("  append  {diary, text, time}          Add text to the day note\n");
+    printf("  search  {diary, query, limit}        Ranked sections with a snippet\n");
+    printf("  unlock  {diary, passphrase}          Unlock a diary until lock or exit\n");
+    printf("  lock    {diary}                      Lock a diary\n\n");
+    printf("Options:\n");
+    printf("  -d, --diary <name>  Default diary of the requests (default from config)\n");
+    break;
+  case WATCH:
+    printf("Keep the catalog and search index current\n\n");
+    printf("Usage: %s [-d <diary>] watch\n\n", prog_name);
+    printf("Watches the YYYY/MM/DD tree with inotify until interrupted, so files\n");
+    printf("edited with other tools are listed and searchable without a rescan.\n");
+    printf("Changed days are recorded in a journal at once, which other commands\n");
+    printf("replay instead of walking the tree, and applied to the catalog and\n");
+    printf("search index once the tree is quiet.\n\n");
+    printf("Options:\n");
+    printf("  -d, --diary <name>  Diary to use (default from config)\n");
+    break;
   case HELP:
   default:
     print_help(prog_name);
@@ -130,11 +286,12 @@ static void usages(char *name, COMMAND command) {
   switch (command) {
   case LIST:
     fprintf(stderr, "Error: too many arguments!\n");
-    printf("Usage: %s [-d <diary>] list [<today|yesterday|tomorrow|date>]\n", name);
+    printf("Usage: %s [-d <diary>] list [--last <n>] [<today|yesterday|tomorrow|date|range>]\n",
+           name);
     break;
   case SHOW:
     fprintf(stderr, "Error: additional arguments required\n");
-    printf("Usage: %s [-d <diary>] show <id|today|yesterday|date>\n", name);
+    printf("Usage: %s [-d <diary>] show [--last <n>] <id|today|yesterday|date|range>\n", name);
     break;
   case NEW:
     fprintf(stderr, "Error: additional arguments required\n");
@@ -142,12 +299,29 @@ static void usages(char *name, COMMAND command) {
     break;
   case INIT:
     fprintf(stderr, "Error, additional arguments required\n");
-    printf("Usage: %s init <name> [<path>]\n", name);
+    printf("Usage: %s init [--native] <name> [<path>]\n", name);
     break;
   case DELETE:
     fprintf(stderr, "Error, additional arguments required\n");
     printf("Usage: %s -d <diary> delete <id>\n", name);
     break;
+  case IMPORT:
+    fprintf(stderr, "Error: additional arguments required\n");
+    printf("Usage: %s [-d <diary>] import <path>...\n", name);
+    break;
+  case EXPORT:
+    fprintf(stderr, "Error: too many arguments!\n");
+    printf("Usage: %s [-d <diary>] export [--from <date>] [--to <date>] "
+           "[--format org|md|html|tar] [-o <file>]\n", name);
+    break;
+  case BACKUP:
+    fprintf(stderr, "Error: backup requires <dir>\n");
+    printf("Usage: %s [-d <diary>] backup [--verify] <dir>\n", name);
+    break;
+  case SEARCH:
+    fprintf(stderr, "Error: additional arguments required\n");
+    printf("Usage: %s [-d <diary>] search <terms>...\n", name);
+    break;
   case HELP:
   default:
     print_help(name);
@@ -156,13 +330,24 @@ static void usages(char *name, COMMAND command) {
   exit(command == HELP ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
-int main(int argc, char *argv[], char *envp[]) {
+int main(int argc, char *argv[]) {
   char *dname = NULL;
   char *filter = NULL;
   char *path = NULL;
   int opt;
+  int rc = 0;
   int show_help = 0;
   int show_flags = 0;  /* Flags for show command */
+  int list_flags = 0;  /* Flags for list command */
+  int init_flags = 0;  /* Flags for init command */
+  int unlock_flags = 0; /* Flags for unlock command */
+  int verify = 0;      /* Check a backup instead of running it */
+  int limit = 20;      /* Max results for search command */
+  int last = 0;        /* Latest entries only for list and show */
+  char *from = NULL;   /* Date range of list and export, output of export */
+  char *to = NULL;
+  char *format = NULL;
+  char *output = NULL;
 
   /* Save program name before any argv manipulation */
   prog_name = argv[0];
@@ -172,7 +357,18 @@ int main(int argc, char *argv[], char *envp[]) {
     OPT_HEAD = 256,
     OPT_INTERLEAVED,
     OPT_TEXT,
-    OPT_MAIN
+    OPT_MAIN,
+    OPT_SORT,
+    OPT_JSON,
+    OPT_TRACE,
+    OPT_THUMBS,
+    OPT_NATIVE,
+    OPT_FROM,
+    OPT_TO,
+    OPT_FORMAT,
+    OPT_VERIFY,
+    OPT_WATCH,
+    OPT_LAST
   };
 
   static struct option long_options[] = {
@@ -183,6 +379,21 @@ int main(int argc, char *argv[], char *envp[]) {
     {"interleaved", no_argument,       0, OPT_INTERLEAVED},
     {"text",        no_argument,       0, OPT_TEXT},
     {"main",        no_argument,       0, 'm'},
+    {"limit",       required_argument, 0, 'n'},
+    {"type",        required_argument, 0, 't'},
+    {"sort",        required_argument, 0, OPT_SORT},
+    {"reverse",     no_argument,       0, 'r'},
+    {"json",        no_argument,       0, OPT_JSON},
+    {"trace",       optional_argument, 0, OPT_TRACE},
+    {"thumbs",      no_argument,       0, OPT_THUMBS},
+    {"native",      no_argument,       0, OPT_NATIVE},
+    {"from",        required_argument, 0, OPT_FROM},
+    {"to",          required_argument, 0, OPT_TO},
+    {"format",      required_argument, 0, OPT_FORMAT},
+    {"output",      required_argument, 0, 'o'},
+    {"verify",      no_argument,       0, OPT_VERIFY},
+    {"watch",       no_argument,       0, OPT_WATCH},
+    {"last",        required_argument, 0, OPT_LAST},
     {0, 0, 0, 0}
   };
 
@@ -198,12 +409,24 @@ int main(int argc, char *argv[], char *envp[]) {
     case 'v':
       print_version();
       exit(EXIT_SUCCESS);
+    case OPT_TRACE:
+      trace_init(optarg != NULL ? optarg : "");
+      break;
     default:
       print_help(argv[0]);
       exit(EXIT_FAILURE);
     }
   }
 
+  /* DRY_TRACE in the environment (no-op if --trace was given) */
+  trace_init(NULL);
+  if (trace_enabled())
+    atexit(finish_trace);
+
+  /* no decrypted copy outlives the command; leases start the agent if needed */
+  atexit(store_remove_checkouts);
+  agent_set_spawn(agent_spawn);
+
   /* Shift argv to point to subcommand */
   argc -= optind;
   argv += optind;
@@ -216,9 +439,26 @@ int main(int argc, char *argv[], char *envp[]) {
   /* Save subcommand (don't shift argv - keep it for getopt which needs argv[0]) */
   char *subcmd = argv[0];
 
+  /* A span like -7d is a filter, not options: take it out of getopt's way */
+  char *timespan = NULL;
+  if (strcmp(subcmd, "list") == 0 || strcmp(subcmd, "show") == 0) {
+    DATE_RANGE range;
+    for (int i = 1; i < argc && strcmp(argv[i], "--") != 0; i++) {
+      if (strcmp(argv[i - 1], "--from") == 0 || strcmp(argv[i - 1], "--to") == 0)
+        continue;
+      if (argv[i][0] == '-' && isdigit((unsigned char)argv[i][1]) &&
+          range_parse(argv[i], &range) == 0) {
+        timespan = argv[i];
+        memmove(&argv[i], &argv[i + 1], (argc - i) * sizeof(char *));
+        argc--;
+        break;
+      }
+    }
+  }
+
   /* Reset getopt fully to enable permutation (finds options anywhere in argv) */
   optind = 0;
-  while ((opt = getopt_long(argc, argv, "d:hm", long_options, NULL)) != -1) {
+  while ((opt = getopt_long(argc, argv, "d:hmn:o:rt:", long_options, NULL)) != -1) {
     switch (opt) {
     case 'd':
       dname = optarg;
@@ -235,10 +475,80 @@ int main(int argc, char *argv[], char *envp[]) {
     case OPT_TEXT:
       show_flags |= SHOW_FLAG_TEXT_ONLY;
       break;
+    case OPT_NATIVE:
+      init_flags |= INIT_FLAG_NATIVE;
+      break;
+    case OPT_THUMBS:
+      show_flags |= SHOW_FLAG_HEAD | SHOW_FLAG_THUMBS;
+      break;
     case 'm':
     case OPT_MAIN:
       show_flags |= SHOW_FLAG_MAIN_ONLY;
       break;
+    case 'n':
+      limit = atoi(optarg);
+      if (limit <= 0) {
+        fprintf(stderr, "Error: --limit must be a positive number\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 't':
+      /* Comma separated list of types */
+      for (char *t = strtok(optarg, ","); t != NULL; t = strtok(NULL, ",")) {
+        if (strcmp(t, "text") == 0 || strcmp(t, "note") == 0)
+          list_flags |= LIST_FLAG_TEXT;
+        else if (strcmp(t, "media") == 0 || strcmp(t, "video") == 0)
+          list_flags |= LIST_FLAG_MEDIA;
+        else if (strcmp(t, "other") == 0)
+          list_flags |= LIST_FLAG_OTHER;
+        else {
+          fprintf(stderr, "Error: unknown type '%s' (use text, media or other)\n", t);
+          exit(EXIT_FAILURE);
+        }
+      }
+      break;
+    case OPT_SORT:
+      list_flags &= ~(LIST_FLAG_SORT_SIZE | LIST_FLAG_SORT_TIME);
+      if (strcmp(optarg, "size") == 0)
+        list_flags |= LIST_FLAG_SORT_SIZE;
+      else if (strcmp(optarg, "time") == 0)
+        list_flags |= LIST_FLAG_SORT_TIME;
+      else if (strcmp(optarg, "date") != 0) {
+        fprintf(stderr, "Error: unknown sort '%s' (use date, time or size)\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'r':
+      list_flags |= LIST_FLAG_REVERSE;
+      break;
+    case OPT_JSON:
+      list_flags |= LIST_FLAG_JSON;
+      break;
+    case OPT_FROM:
+      from = optarg;
+      break;
+    case OPT_TO:
+      to = optarg;
+      break;
+    case OPT_FORMAT:
+      format = optarg;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case OPT_VERIFY:
+      verify = 1;
+      break;
+    case OPT_WATCH:
+      unlock_flags |= UNLOCK_FLAG_WATCH;
+      break;
+    case OPT_LAST:
+      last = atoi(optarg);
+      if (last <= 0) {
+        fprintf(stderr, "Error: --last must be a positive number\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
     default:
       break;
     }
@@ -252,18 +562,48 @@ int main(int argc, char *argv[], char *envp[]) {
   if (show_help) {
     if (strncmp(subcmd, "init", 5) == 0) print_subcommand_help(INIT);
     else if (strncmp(subcmd, "new", 4) == 0) print_subcommand_help(NEW);
+    else if (strncmp(subcmd, "import", 7) == 0) print_subcommand_help(IMPORT);
     else if (strncmp(subcmd, "list", 5) == 0) print_subcommand_help(LIST);
     else if (strncmp(subcmd, "show", 5) == 0) print_subcommand_help(SHOW);
     else if (strncmp(subcmd, "delete", 7) == 0) print_subcommand_help(DELETE);
     else if (strncmp(subcmd, "explore", 8) == 0) print_subcommand_help(EXPLORE);
     else if (strncmp(subcmd, "unlock", 7) == 0) print_subcommand_help(UNLOCK);
     else if (strncmp(subcmd, "lock", 5) == 0) print_subcommand_help(LOCK);
+    else if (strncmp(subcmd, "watch", 6) == 0) print_subcommand_help(WATCH);
     else if (strncmp(subcmd, "status", 7) == 0) print_subcommand_help(STATUS);
+    else if (strncmp(subcmd, "reindex", 8) == 0) print_subcommand_help(REINDEX);
+    else if (strncmp(subcmd, "stats", 6) == 0) print_subcommand_help(STATS);
+    else if (strncmp(subcmd, "export", 7) == 0) print_subcommand_help(EXPORT);
+    else if (strncmp(subcmd, "backup", 7) == 0) print_subcommand_help(BACKUP);
+    else if (strncmp(subcmd, "search", 7) == 0) print_subcommand_help(SEARCH);
+    else if (strncmp(subcmd, "agent", 6) == 0) print_subcommand_help(AGENT);
+    else if (strncmp(subcmd, "serve", 6) == 0) print_subcommand_help(SERVE);
     else print_help("dry");
     exit(EXIT_SUCCESS);
   }
 
-  config_load();
+  char span_name[64];
+  snprintf(span_name, sizeof(span_name), "dry %s", subcmd);
+  trace_begin(span_name, NULL);   /* ends at exit */
+
+  /* Fast path for shell prompts: status needs neither config nor diary */
+  if (strncmp(subcmd, "status", 7) == 0) {
+    diary_status();
+    exit(EXIT_SUCCESS);
+  }
+
+  int span = trace_begin("config_load", NULL);
+  if (config_load() != 0)
+    exit(EXIT_FAILURE);
+  trace_end(span);
+
+  /* Hidden: candidates for the shell completion functions */
+  if (strncmp(subcmd, "__complete", 11) == 0) {
+    if (argc < 1)
+      exit(EXIT_FAILURE);
+    diary_complete(argv[0], argc > 1 ? argv[1] : NULL, dname);
+    exit(EXIT_SUCCESS);
+  }
 
   if (strncmp(subcmd, "init", 5) == 0) {
     if (argc < 1) {
@@ -272,7 +612,7 @@ int main(int argc, char *argv[], char *envp[]) {
       if (argc > 1)
         path = argv[1];
 
-      diary_init(argv[0], path);
+      rc = diary_init(argv[0], path, init_flags);
     }
   } else if (strncmp(subcmd, "new", 4) == 0) {
     if (argc < 1)
@@ -288,38 +628,86 @@ int main(int argc, char *argv[], char *envp[]) {
 
     /* Call new if type is set */
     if (type)
-      diary_new(type, dname);
+      rc = diary_new(type, dname);
     else
       fprintf(stderr, "Error: wrong type (use 'video' or 'note')\n");
 
   } else if (strncmp(subcmd, "list", 5) == 0) {
-    if (argc > 1)
+    if (argc + (timespan != NULL) > 1)
       usage(LIST);
 
     if (argc > 0)
       filter = argv[0];
+    else
+      filter = timespan;
 
-    diary_list(dname, filter);
+    rc = diary_list(dname, filter, from, to, last, list_flags);
   } else if (strncmp(subcmd, "show", 5) == 0) {
-    if (argc < 1)
+    if (timespan == NULL && argc < 1 && last == 0)
       usage(SHOW);
 
-    diary_show(argv[0], dname, show_flags);
+    rc = diary_show(timespan != NULL ? timespan : argc > 0 ? argv[0] : NULL, dname, last,
+                    show_flags);
+  } else if (strncmp(subcmd, "import", 7) == 0) {
+    if (argc < 1)
+      usage(IMPORT);
+
+    rc = diary_import(argv, argc, dname);
   } else if (strncmp(subcmd, "delete", 7) == 0) {
     if (argc < 1) {
       fprintf(stderr, "Error: delete requires <id>\n");
       usage(DELETE);
     }
 
-    diary_delete(argv[0], dname);
+    rc = diary_delete(argv[0], dname);
   } else if (strncmp(subcmd, "explore", 8) == 0) {
-    diary_explore(dname);
+    rc = diary_explore(dname);
   } else if (strncmp(subcmd, "unlock", 7) == 0) {
-    diary_unlock(dname);
+    rc = diary_unlock(dname, unlock_flags);
   } else if (strncmp(subcmd, "lock", 5) == 0) {
-    diary_lock(dname);
-  } else if (strncmp(subcmd, "status", 7) == 0) {
-    diary_status();
+    rc = diary_lock(dname);
+  } else if (strncmp(subcmd, "watch", 6) == 0) {
+    rc = diary_watch(dname);
+  } else if (strncmp(subcmd, "reindex", 8) == 0) {
+    rc = diary_reindex(dname);
+  } else if (strncmp(subcmd, "stats", 6) == 0) {
+    rc = diary_stats(dname, (list_flags & LIST_FLAG_JSON) != 0);
+  } else if (strncmp(subcmd, "export", 7) == 0) {
+    if (argc > 0)
+      usage(EXPORT);
+
+    rc = diary_export(from, to, format, output, dname);
+  } else if (strncmp(subcmd, "backup", 7) == 0) {
+    if (argc != 1)
+      usage(BACKUP);
+
+    rc = diary_backup(argv[0], verify, dname);
+  } else if (strncmp(subcmd, "search", 7) == 0) {
+    if (argc < 1)
+      usage(SEARCH);
+
+    /* Join all terms into one query */
+    char query[1024] = "";
+    for (int i = 0; i < argc; i++) {
+      if (i > 0)
+        strncat(query, " ", sizeof(query) - strlen(query) - 1);
+      strncat(query, argv[i], sizeof(query) - strlen(query) - 1);
+    }
+
+    rc = diary_search(query, dname, limit);
+  } else if (strncmp(subcmd, "agent", 6) == 0) {
+    if (argc > 0 && strncmp(argv[0], "stop", 5) == 0) {
+      if (agent_stop() != 0) {
+        fprintf(stderr, "Error: agent is not running\n");
+        exit(EXIT_FAILURE);
+      }
+    } else {
+      if (get_config()->agent_idle <= 0)
+        get_config()->agent_idle = 300;
+      exit(agent_serve(get_config()->agent_idle));
+    }
+  } else if (strncmp(subcmd, "serve", 6) == 0) {
+    exit(serve_run(dname) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
   } else {
     fprintf(stderr, "Error: unknown command '%s'\n", subcmd);
     print_help("dry");
@@ -329,5 +717,5 @@ int main(int argc, char *argv[], char *envp[]) {
   if (conf != NULL)
     free(conf);
 
-  exit(EXIT_SUCCESS);
+  exit(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -0,0 +1,297 @@
+/*
+ * media.c - Media metadata sidecars implementation
+ *
+ * Sidecar format, one "<key> <value>" pair per line:
+ *   duration 205.330
+ *   width 1024
+ *   height 768
+ *   video mjpeg
+ *   audio pcm_s16le
+ *   thumbs 5
+ */
+#include "media.h"
+#include "proc.h"
+#include "store.h"
+#include "utils.h"
+
+#define MEDIA_DIR "media"
+#define MEDIA_MAX_STREAMS 16
+
+/* Thumbnail strip: frames spread over the recording, side by side */
+#define THUMB_FRAMES 5
+#define THUMB_WIDTH 160
+
+/* Build the path of a sidecar file (.dry/media/<id><ext>), creating the directory */
+static int sidecar_path(const char *dpath, const char *id, const char *ext, char *path,
+                        size_t size) {
+  if (get_meta_path(dpath, MEDIA_DIR, path, size) != 0)
+    return 1;
+  if (mkdir(path, 0700) != 0 && errno != EEXIST)
+    return 1;
+  size_t len = strlen(path);
+  return snprintf(path + len, size - len, "/%s%s", id, ext) >= (int)(size - len);
+}
+
+/* Value of a "key=value" or key="value" line, quotes removed */
+static char *flat_value(char *line) {
+  char *v = strchr(line, '=');
+  if (v == NULL)
+    return NULL;
+  *v++ = '\0';
+  v[strcspn(v, "\r\n")] = '\0';
+  size_t len = strlen(v);
+  if (len >= 2 && v[0] == '"' && v[len - 1] == '"') {
+    v[len - 1] = '\0';
+    v++;
+  }
+  return v;
+}
+
+/*
+ * Parse ffprobe "-of flat" output:
+ *   streams.stream.0.codec_name="mjpeg"
+ *   streams.stream.0.codec_type="video"
+ *   streams.stream.0.width=1024
+ *   format.duration="205.330000"
+ */
+static int parse_probe(const char *path, MEDIA_INFO *info) {
+  struct {
+    char type[16];
+    char codec[32];
+    int width, height;
+  } streams[MEDIA_MAX_STREAMS] = {0};
+  char line[1024];
+
+  FILE *fd = fopen(path, "r");
+  if (fd == NULL)
+    return 1;
+
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    char *value = flat_value(line);
+    if (value == NULL)
+      continue;
+
+    if (strcmp(line, "format.duration") == 0) {
+      info->duration = atof(value);
+    } else if (strncmp(line, "streams.stream.", 15) == 0) {
+      char *key;
+      long i = strtol(line + 15, &key, 10);
+      if (i < 0 || i >= MEDIA_MAX_STREAMS || *key != '.')
+        continue;
+      key++;
+      if (strcmp(key, "codec_type") == 0)
+        snprintf(streams[i].type, sizeof(streams[i].type), "%s", value);
+      else if (strcmp(key, "codec_name") == 0)
+        snprintf(streams[i].codec, sizeof(streams[i].codec), "%s", value);
+      else if (strcmp(key, "width") == 0)
+        streams[i].width = atoi(value);
+      else if (strcmp(key, "height") == 0)
+        streams[i].height = atoi(value);
+    }
+  }
+  fclose(fd);
+
+  /* first video and first audio stream */
+  for (int i = MEDIA_MAX_STREAMS - 1; i >= 0; i--) {
+    if (strcmp(streams[i].type, "video") == 0) {
+      snprintf(info->video_codec, sizeof(info->video_codec), "%s", streams[i].codec);
+      info->width = streams[i].width;
+      info->height = streams[i].height;
+    } else if (strcmp(streams[i].type, "audio") == 0) {
+      snprintf(info->audio_codec, sizeof(info->audio_codec), "%s", streams[i].codec);
+    }
+  }
+  return info->duration <= 0 && info->video_codec[0] == '\0' && info->audio_codec[0] == '\0';
+}
+
+/* Render the thumbnail strip of a video to png. Returns the number of frames. */
+static int make_thumbs(const char *file, const MEDIA_INFO *info, const char *png) {
+  char filter[128];
+
+  if (info->video_codec[0] == '\0')
+    return 0;
+
+  if (info->duration > 0)
+    snprintf(filter, sizeof(filter), "fps=%.6f,scale=%d:-2,tile=%dx1",
+             THUMB_FRAMES / info->duration, THUMB_WIDTH, THUMB_FRAMES);
+  else
+    snprintf(filter, sizeof(filter), "fps=1,scale=%d:-2,tile=%dx1", THUMB_WIDTH, THUMB_FRAMES);
+
+  /* keyframes only: no full decode of the recording */
+  char *ffmpeg[] = {
+    "ffmpeg", "-nostdin", "-v", "error", "-y",
+    "-skip_frame", "nokey", "-i", (char *)file,
+    "-an", "-vf", filter, "-frames:v", "1", (char *)png, NULL
+  };
+  if (proc_run(ffmpeg, PROC_QUIET) != 0 || !do_file_exist((char *)png)) {
+    unlink(png);
+    return 0;
+  }
+  return THUMB_FRAMES;
+}
+
+int media_probe_available(void) {
+  static int available = -1;
+
+  if (available < 0)
+    available = proc_exists("ffprobe");
+  return available;
+}
+
+int media_sidecar_create(const char *dpath, const char *file, int thumbs) {
+  MEDIA_INFO info = {0};
+  char probe[4200];
+  char meta[4200];
+  char png[4200];
+  char tmp[4300];
+  char plain_file[4096];
+  char plain_probe[4096];
+  char plain_png[4096];
+
+  const char *id = strrchr(file, '/');
+  id = id ? id + 1 : file;
+
+  /* not once per file: "can't run ffprobe" for each recording is noise */
+  if (!media_probe_available())
+    return 1;
+
+  if (sidecar_path(dpath, id, ".probe", probe, sizeof(probe)) != 0 ||
+      sidecar_path(dpath, id, ".meta", meta, sizeof(meta)) != 0 ||
+      sidecar_path(dpath, id, ".png", png, sizeof(png)) != 0)
+    return 1;
+
+  /* native diaries: ffmpeg works on decrypted copies, the probe output stays outside */
+  if (store_checkout(file, plain_file, sizeof(plain_file)) != 0)
+    return 1;
+  if (store_checkout(probe, plain_probe, sizeof(plain_probe)) != 0) {
+    store_release(plain_file, file);
+    return 1;
+  }
+
+  char *ffprobe[] = {
+    "ffprobe", "-v", "error",
+    "-show_entries", "format=duration:stream=codec_type,codec_name,width,height",
+    "-of", "flat", plain_file, NULL
+  };
+  int rc = proc_run_output(ffprobe, plain_probe, PROC_NULL_STDERR);
+  if (rc == 0)
+    rc = parse_probe(plain_probe, &info);
+  unlink(plain_probe);
+  if (rc != 0) {
+    store_release(plain_file, file);
+    return 1;
+  }
+
+  if (thumbs) {
+    if (store_checkout(png, plain_png, sizeof(plain_png)) == 0) {
+      info.thumbs = make_thumbs(plain_file, &info, plain_png);
+      if (info.thumbs > 0 && store_checkin(plain_png, png) != 0)
+        info.thumbs = 0;
+    }
+  } else {
+    MEDIA_INFO old;
+    if (media_sidecar_load(dpath, id, &old) == 0 && do_file_exist(png))
+      info.thumbs = old.thumbs;
+  }
+
+  store_release(plain_file, file);
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", meta);
+  FILE *fd = store_fopen(tmp, "w");
+  if (fd == NULL)
+    return 1;
+  fprintf(fd, "duration %.3f\n", info.duration);
+  fprintf(fd, "width %d\nheight %d\n", info.width, info.height);
+  if (info.video_codec[0] != '\0')
+    fprintf(fd, "video %s\n", info.video_codec);
+  if (info.audio_codec[0] != '\0')
+    fprintf(fd, "audio %s\n", info.audio_codec);
+  fprintf(fd, "thumbs %d\n", info.thumbs);
+
+  if (fclose(fd) != 0 || rename(tmp, meta) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+  return 0;
+}
+
+int media_sidecar_load(const char *dpath, const char *id, MEDIA_INFO *info) {
+  char path[4200];
+  char line[256];
+
+  memset(info, 0, sizeof(*info));
+  snprintf(path, sizeof(path), "%s/%s/%s/%s.meta", dpath, DRY_META_DIR, MEDIA_DIR, id);
+  FILE *fd = store_fopen(path, "r");
+  if (fd == NULL)
+    return 1;
+
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    char *value = strchr(line, ' ');
+    if (value == NULL)
+      continue;
+    *value++ = '\0';
+    value[strcspn(value, "\n")] = '\0';
+
+    if (strcmp(line, "duration") == 0)
+      info->duration = atof(value);
+    else if (strcmp(line, "width") == 0)
+      info->width = atoi(value);
+    else if (strcmp(line, "height") == 0)
+      info->height = atoi(value);
+    else if (strcmp(line, "video") == 0)
+      snprintf(info->video_codec, sizeof(info->video_codec), "%s", value);
+    else if (strcmp(line, "audio") == 0)
+      snprintf(info->audio_codec, sizeof(info->audio_codec), "%s", value);
+    else if (strcmp(line, "thumbs") == 0)
+      info->thumbs = atoi(value);
+  }
+  fclose(fd);
+  return 0;
+}
+
+int media_sidecar_exists(const char *dpath, const char *id) {
+  char path[4200];
+  snprintf(path, sizeof(path), "%s/%s/%s/%s.meta", dpath, DRY_META_DIR, MEDIA_DIR, id);
+  return do_file_exist(path);
+}
+
+void media_sidecar_remove(const char *dpath, const char *id) {
+  char path[4200];
+  snprintf(path, sizeof(path), "%s/%s/%s/%s.meta", dpath, DRY_META_DIR, MEDIA_DIR, id);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/%s/%s/%s.png", dpath, DRY_META_DIR, MEDIA_DIR, id);
+  unlink(path);
+}
+
+unsigned char *media_thumbs_load(const char *dpath, const char *id, size_t *len) {
+  char path[4200];
+  struct stat st;
+
+  *len = 0;
+  snprintf(path, sizeof(path), "%s/%s/%s/%s.png", dpath, DRY_META_DIR, MEDIA_DIR, id);
+  if (stat(path, &st) != 0 || st.st_size == 0)
+    return NULL;
+  FILE *fd = store_fopen(path, "rb");
+  if (fd == NULL)
+    return NULL;
+
+  /* strips are a few tens of kB: read in one go */
+  long long size = store_plain_size(path, st.st_size);
+  unsigned char *png = malloc(size);
+  if (png != NULL)
+    *len = fread(png, 1, size, fd);
+  fclose(fd);
+  if (*len == 0) {
+    free(png);
+    return NULL;
+  }
+  return png;
+}
+
+void media_format_duration(double seconds, char *buf, size_t size) {
+  long s = (long)(seconds + 0.5);
+  if (s >= 3600)
+    snprintf(buf, size, "%ld:%02ld:%02ld", s / 3600, s / 60 % 60, s % 60);
+  else
+    snprintf(buf, size, "%ld:%02ld", s / 60, s % 60);
+}
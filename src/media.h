@@ -0,0 +1,53 @@
+/*
+ * media.h - Media metadata sidecars
+ *
+ * Each recording gets a sidecar in the diary metadata directory
+ * (.dry/media/<id>.meta, inside the encrypted mount) holding its duration,
+ * resolution and codecs, plus a strip of keyframe thumbnails
+ * (.dry/media/<id>.png). It is written once when the entry is recorded, so
+ * 'show --head' can describe a day without probing the media again.
+ */
+#ifndef MEDIA_H
+#define MEDIA_H
+
+#include "dry.h"
+
+typedef struct {
+  double duration;        /* seconds, 0 if unknown */
+  int width;              /* video size, 0 if there is no video stream */
+  int height;
+  char video_codec[32];   /* "" if there is no such stream */
+  char audio_codec[32];
+  int thumbs;             /* frames in the thumbnail strip, 0 if none */
+} MEDIA_INFO;
+
+/* Check whether ffprobe can be run (looked up once) */
+int media_probe_available(void);
+
+/*
+ * Probe a media file of the diary mounted at dpath with ffprobe and write
+ * its sidecar. With thumbs the thumbnail strip is (re)generated as well,
+ * otherwise an existing strip is kept. Returns 0 on success, 1 without
+ * trying if ffprobe is not available.
+ */
+int media_sidecar_create(const char *dpath, const char *file, int thumbs);
+
+/* Read the sidecar of entry id. Returns 0 if it exists. */
+int media_sidecar_load(const char *dpath, const char *id, MEDIA_INFO *info);
+
+/* Check whether entry id has a sidecar */
+int media_sidecar_exists(const char *dpath, const char *id);
+
+/* Remove the sidecar of a deleted entry */
+void media_sidecar_remove(const char *dpath, const char *id);
+
+/*
+ * Read the thumbnail strip (a png) of entry id into a buffer the caller
+ * frees. Returns NULL if there is none.
+ */
+unsigned char *media_thumbs_load(const char *dpath, const char *id, size_t *len);
+
+/* Format a duration as M:SS or H:MM:SS */
+void media_format_duration(double seconds, char *buf, size_t size);
+
+#endif /* MEDIA_H */
@@ -0,0 +1,138 @@
+/*
+ * note.c - Section index of a day note implementation
+ */
+#include "note.h"
+#include "store.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+/* Header level of the line at p (0 if it is not a header) */
+static int header_level(const char *p, const char *eol, size_t *marker) {
+  char c = *p;
+  int level = 0;
+
+  if (c != '*' && c != '#')
+    return 0;
+  while (p + level < eol && p[level] == c)
+    level++;
+  if (level > 2 || p + level >= eol || p[level] != ' ')
+    return 0;
+  *marker = level + 1;
+  return level;
+}
+
+static int add_section(NOTE *note, int *cap, size_t offset, size_t body, int level,
+                       const char *label, size_t len) {
+  if (note->count == *cap) {
+    int grown = *cap ? *cap * 2 : 16;
+    NOTE_SECTION *sections = realloc(note->sections, grown * sizeof(NOTE_SECTION));
+    if (sections == NULL)
+      return 1;
+    note->sections = sections;
+    *cap = grown;
+  }
+  NOTE_SECTION *s = &note->sections[note->count++];
+  s->offset = offset;
+  s->body = body;
+  s->end = note->len;
+  s->level = level;
+  while (len > 0 && (label[len - 1] == ' ' || label[len - 1] == '\r'))
+    len--;
+  if (len >= sizeof(s->label))
+    len = sizeof(s->label) - 1;
+  memcpy(s->label, label, len);
+  s->label[len] = '\0';
+  return 0;
+}
+
+/* Map a plain file, or read a whole native one */
+static int read_note(NOTE *note, const char *path) {
+  struct stat st;
+
+  if (store_active(path)) {
+    if (stat(path, &st) != 0)
+      return 1;
+    FILE *fd = store_fopen(path, "r");
+    if (fd == NULL)
+      return 1;
+    size_t plain = store_plain_size(path, st.st_size);
+    char *buf = malloc(plain > 0 ? plain : 1);
+    note->len = buf ? fread(buf, 1, plain, fd) : 0;
+    note->data = buf;
+    fclose(fd);
+    return buf == NULL;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 1;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return 1;
+  }
+  note->len = st.st_size;
+  if (note->len > 0) {
+    void *map = mmap(NULL, note->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, note->len, MADV_SEQUENTIAL);
+      note->data = map;
+      note->mapped = 1;
+    }
+  }
+  close(fd);
+  return note->len > 0 && !note->mapped;
+}
+
+int note_load(NOTE *note, const char *path) {
+  int cap = 0;
+
+  memset(note, 0, sizeof(*note));
+  if (read_note(note, path) != 0) {
+    note_free(note);
+    return 1;
+  }
+
+  const char *p = note->data;
+  const char *end = note->data + note->len;
+  while (p < end) {
+    const char *eol = memchr(p, '\n', end - p);
+    if (eol == NULL)
+      eol = end;
+
+    size_t marker;
+    int level = header_level(p, eol, &marker);
+    if (level > 0) {
+      size_t offset = p - note->data;
+      if (note->count > 0)
+        note->sections[note->count - 1].end = offset;
+      size_t body = eol < end ? (size_t)(eol + 1 - note->data) : note->len;
+      if (add_section(note, &cap, offset, body, level, p + marker, eol - p - marker) != 0) {
+        note_free(note);
+        return 1;
+      }
+    }
+    p = eol + 1;
+  }
+  return 0;
+}
+
+const NOTE_SECTION *note_find(const NOTE *note, const char *time) {
+  size_t len = strlen(time);
+
+  for (int i = 0; i < note->count; i++) {
+    const NOTE_SECTION *s = &note->sections[i];
+    if (s->level == 2 && strncmp(s->label, time, len) == 0 &&
+        (s->label[len] == '\0' || s->label[len] == ':' || s->label[len] == ' '))
+      return s;
+  }
+  return NULL;
+}
+
+void note_free(NOTE *note) {
+  if (note->mapped)
+    munmap((void *)note->data, note->len);
+  else
+    free((void *)note->data);
+  free(note->sections);
+  memset(note, 0, sizeof(*note));
+}
@@ -0,0 +1,43 @@
+/*
+ * note.h - Section index of a day note
+ *
+ * A note is read once (mapped for plain files, one read for native
+ * diaries) and split at its headers: level 1 ("* 2025-04-11", "# ...") and
+ * level 2 ("** 17:06:42", "## ..."). Each section spans its header up to
+ * the next header, so the context of every attachment and single sections
+ * ('dry show 2025-04-11#17:06') are served without rescanning the file.
+ */
+#ifndef NOTE_H
+#define NOTE_H
+
+#include "dry.h"
+
+typedef struct {
+  size_t offset;        /* first byte of the header line */
+  size_t body;          /* first byte after the header line */
+  size_t end;           /* start of the next header, or end of the note */
+  int level;            /* 1 or 2 */
+  char label[64];       /* header text after the marker */
+} NOTE_SECTION;
+
+typedef struct {
+  const char *data;     /* note contents, not NUL-terminated */
+  size_t len;
+  int mapped;           /* data is an mmap() of the file */
+  NOTE_SECTION *sections;
+  int count;
+} NOTE;
+
+/* Read and index the note at path. Returns 0 on success. */
+int note_load(NOTE *note, const char *path);
+
+/*
+ * Find the level-2 section whose header starts with time ("17:06" or
+ * "17:06:42"), the first one if several match. Returns NULL if none does.
+ */
+const NOTE_SECTION *note_find(const NOTE *note, const char *time);
+
+/* Release a note */
+void note_free(NOTE *note);
+
+#endif /* NOTE_H */
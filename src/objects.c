@@ -0,0 +1,312 @@
+/*
+ * objects.c - Content-addressed attachment store implementation
+ *
+ * Reference counts (.dry/objects/refs), one object per line:
+ *   <id> <references>
+ */
+#include "objects.h"
+#include "store.h"
+#include "utils.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#define OBJECTS_DIR "objects"
+#define REFS_FILE "refs"
+#define LOCK_FILE ".lock"
+
+/* entries live in YYYY/MM/DD, three levels below the diary root */
+#define REF_PREFIX "../../../" DRY_META_DIR "/" OBJECTS_DIR "/"
+
+typedef struct {
+  char id[SHA256_HEX_LEN];
+  long long refs;
+} OBJECT_REF;
+
+typedef struct {
+  OBJECT_REF *items;
+  int count;
+  int cap;
+} REF_TABLE;
+
+static int valid_id(const char *id) {
+  for (int i = 0; i < SHA256_HEX_LEN - 1; i++)
+    if (!((id[i] >= '0' && id[i] <= '9') || (id[i] >= 'a' && id[i] <= 'f')))
+      return 0;
+  return id[SHA256_HEX_LEN - 1] == '\0';
+}
+
+static void object_path(const char *dpath, const char *id, char *path, size_t size) {
+  snprintf(path, size, "%s/%s/%s/%.2s/%s", dpath, DRY_META_DIR, OBJECTS_DIR, id, id + 2);
+}
+
+static void refs_path(const char *dpath, const char *file, char *path, size_t size) {
+  snprintf(path, size, "%s/%s/%s/%s", dpath, DRY_META_DIR, OBJECTS_DIR, file);
+}
+
+/* Serialize changes to the store between processes */
+static int refs_lock(const char *dpath) {
+  char path[4200];
+
+  if (get_meta_path(dpath, OBJECTS_DIR, path, sizeof(path)) != 0 ||
+      (mkdir(path, 0700) != 0 && errno != EEXIST))
+    return -1;
+  refs_path(dpath, LOCK_FILE, path, sizeof(path));
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd >= 0 && flock(fd, LOCK_EX) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static OBJECT_REF *refs_find(REF_TABLE *table, const char *id, int create) {
+  for (int i = 0; i < table->count; i++)
+    if (strcmp(table->items[i].id, id) == 0)
+      return &table->items[i];
+  if (!create)
+    return NULL;
+
+  if (table->count == table->cap) {
+    int cap = table->cap ? table->cap * 2 : 64;
+    OBJECT_REF *items = realloc(table->items, cap * sizeof(OBJECT_REF));
+    if (items == NULL)
+      return NULL;
+    table->items = items;
+    table->cap = cap;
+  }
+  OBJECT_REF *ref = &table->items[table->count++];
+  snprintf(ref->id, sizeof(ref->id), "%s", id);
+  ref->refs = 0;
+  return ref;
+}
+
+static void refs_load(const char *dpath, REF_TABLE *table) {
+  char path[4200];
+  char id[SHA256_HEX_LEN];
+  long long refs;
+
+  memset(table, 0, sizeof(*table));
+  refs_path(dpath, REFS_FILE, path, sizeof(path));
+  FILE *fd = store_fopen(path, "r");
+  if (fd == NULL)
+    return;
+  while (fscanf(fd, "%64s %lld", id, &refs) == 2) {
+    OBJECT_REF *ref = valid_id(id) ? refs_find(table, id, 1) : NULL;
+    if (ref != NULL)
+      ref->refs = refs;
+  }
+  fclose(fd);
+}
+
+static int refs_save(const char *dpath, const REF_TABLE *table) {
+  char path[4200];
+  char tmp[4300];
+
+  refs_path(dpath, REFS_FILE, path, sizeof(path));
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *fd = store_fopen(tmp, "w");
+  if (fd == NULL)
+    return 1;
+  for (int i = 0; i < table->count; i++)
+    if (table->items[i].refs > 0)
+      fprintf(fd, "%s %lld\n", table->items[i].id, table->items[i].refs);
+  if (fclose(fd) != 0 || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+  return 0;
+}
+
+int objects_adopt(const char *dpath, const char *file, const char *sha256, int *shared) {
+  char id[SHA256_HEX_LEN];
+  char obj[4200];
+  char target[256];
+  char tmp[4200];
+  REF_TABLE table;
+
+  /* native diaries: names on disk must not give the content hash away */
+  if (store_keyed_id(dpath, sha256, id) != 0)
+    snprintf(id, sizeof(id), "%s", sha256);
+
+  object_path(dpath, id, obj, sizeof(obj));
+  snprintf(target, sizeof(target), "%s%.2s/%s", REF_PREFIX, id, id + 2);
+
+  int lock = refs_lock(dpath);
+  if (lock < 0)
+    return 1;
+
+  /* the object's directory */
+  char *slash = strrchr(obj, '/');
+  *slash = '\0';
+  int rc = mkdir(obj, 0700) != 0 && errno != EEXIST;
+  *slash = '/';
+
+  *shared = do_file_exist(obj);
+  if (rc == 0 && *shared) {
+    /* swap the copy for a reference in one step */
+    snprintf(tmp, sizeof(tmp), "%s.ref", file);
+    rc = symlink(target, tmp) != 0 || rename(tmp, file) != 0;
+    if (rc != 0)
+      unlink(tmp);
+  } else if (rc == 0) {
+    rc = rename(file, obj) != 0;
+    if (rc == 0 && symlink(target, file) != 0) {
+      rename(obj, file);
+      rc = 1;
+    }
+  }
+
+  if (rc == 0) {
+    refs_load(dpath, &table);
+    OBJECT_REF *ref = refs_find(&table, id, 1);
+    if (ref != NULL)
+      ref->refs++;
+    rc = ref == NULL || refs_save(dpath, &table) != 0;
+    free(table.items);
+  }
+  close(lock);
+  return rc;
+}
+
+int objects_ref_id(const char *path, char id[SHA256_HEX_LEN]) {
+  char target[256];
+  const size_t prefix = strlen(REF_PREFIX);
+
+  ssize_t len = readlink(path, target, sizeof(target) - 1);
+  if (len < 0)
+    return 1;
+  target[len] = '\0';
+
+  /* ../../../.dry/objects/ab/cdef... */
+  if (strncmp(target, REF_PREFIX, prefix) != 0 || (size_t)len != prefix + SHA256_HEX_LEN ||
+      target[prefix + 2] != '/')
+    return 1;
+  snprintf(id, SHA256_HEX_LEN, "%.2s%s", target + prefix, target + prefix + 3);
+  return !valid_id(id);
+}
+
+void objects_release(const char *dpath, const char *id) {
+  char obj[4200];
+  REF_TABLE table;
+
+  int lock = refs_lock(dpath);
+  if (lock < 0)
+    return;
+
+  refs_load(dpath, &table);
+  OBJECT_REF *ref = refs_find(&table, id, 0);
+  if (ref != NULL && --ref->refs <= 0) {
+    object_path(dpath, id, obj, sizeof(obj));
+    unlink(obj);
+  }
+  if (ref != NULL)
+    refs_save(dpath, &table);
+  free(table.items);
+  close(lock);
+}
+
+/* Call fn for each stored object */
+static void each_object(const char *dpath, void (*fn)(const char *id, const char *path, void *ctx),
+                        void *ctx) {
+  char root[4096];
+  char sub[4200];
+  char path[4300];
+  char id[SHA256_HEX_LEN];
+
+  snprintf(root, sizeof(root), "%s/%s/%s", dpath, DRY_META_DIR, OBJECTS_DIR);
+  DIR *dir = opendir(root);
+  if (dir == NULL)
+    return;
+
+  struct dirent *fan;
+  while ((fan = readdir(dir)) != NULL) {
+    if (strlen(fan->d_name) != 2 || fan->d_name[0] == '.')
+      continue;
+    snprintf(sub, sizeof(sub), "%s/%.2s", root, fan->d_name);
+    DIR *objects = opendir(sub);
+    if (objects == NULL)
+      continue;
+    struct dirent *ent;
+    while ((ent = readdir(objects)) != NULL) {
+      if (strlen(ent->d_name) != SHA256_HEX_LEN - 3)
+        continue;
+      snprintf(id, sizeof(id), "%.2s%.62s", fan->d_name, ent->d_name);
+      if (!valid_id(id))
+        continue;
+      snprintf(path, sizeof(path), "%s/%.62s", sub, ent->d_name);
+      fn(id, path, ctx);
+    }
+    closedir(objects);
+  }
+  closedir(dir);
+}
+
+typedef struct {
+  REF_TABLE *table;
+  int removed;
+  OBJECT_STATS *stats;
+} OBJECT_SCAN;
+
+static void drop_unreferenced(const char *id, const char *path, void *ctx) {
+  OBJECT_SCAN *scan = ctx;
+  if (refs_find(scan->table, id, 0) == NULL && unlink(path) == 0)
+    scan->removed++;
+}
+
+int objects_rebuild(const char *dpath, const CATALOG *cat) {
+  char path[8192];
+  char id[SHA256_HEX_LEN];
+  REF_TABLE table = {0};
+
+  int lock = refs_lock(dpath);
+  if (lock < 0)
+    return -1;
+
+  for (int i = 0; i < cat->count; i++) {
+    const CATALOG_DAY *day = &cat->days[i];
+    for (int j = 0; j < day->count; j++) {
+      catalog_entry_path(cat, day, &day->entries[j], path, sizeof(path));
+      if (objects_ref_id(path, id) != 0)
+        continue;
+      OBJECT_REF *ref = refs_find(&table, id, 1);
+      if (ref != NULL)
+        ref->refs++;
+    }
+  }
+
+  OBJECT_SCAN scan = {&table, 0, NULL};
+  each_object(dpath, drop_unreferenced, &scan);
+  int rc = refs_save(dpath, &table) == 0 ? scan.removed : -1;
+  free(table.items);
+  close(lock);
+  return rc;
+}
+
+static void add_stats(const char *id, const char *path, void *ctx) {
+  OBJECT_SCAN *scan = ctx;
+  struct stat st;
+
+  if (stat(path, &st) != 0)
+    return;
+  long long size = store_plain_size(path, st.st_size);
+  OBJECT_REF *ref = refs_find(scan->table, id, 0);
+  long long refs = ref != NULL ? ref->refs : 0;
+
+  scan->stats->objects++;
+  scan->stats->refs += refs;
+  scan->stats->stored += size;
+  if (refs > 1)
+    scan->stats->saved += (refs - 1) * size;
+}
+
+int objects_stats(const char *dpath, OBJECT_STATS *stats) {
+  REF_TABLE table;
+
+  memset(stats, 0, sizeof(*stats));
+  refs_load(dpath, &table);
+  OBJECT_SCAN scan = {&table, 0, stats};
+  each_object(dpath, add_stats, &scan);
+  free(table.items);
+  return 0;
+}
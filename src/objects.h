@@ -0,0 +1,49 @@
+/*
+ * objects.h - Content-addressed attachment store
+ *
+ * With 'attachment_store' enabled, imported files are kept once per
+ * content in the diary metadata directory (.dry/objects/<id[0:2]>/<id[2:]>,
+ * the id being the SHA-256 of the content, keyed with the diary key in
+ * native diaries). Day directories hold relative symlinks to the objects,
+ * so everything that opens or stats an entry resolves them transparently.
+ * Reference counts are kept in .dry/objects/refs; an object is removed
+ * with its last reference, and 'dry reindex' recounts them.
+ */
+#ifndef OBJECTS_H
+#define OBJECTS_H
+
+#include "dry.h"
+#include "catalog.h"
+#include "sha256.h"
+
+typedef struct {
+  int objects;            /* stored objects */
+  long long refs;         /* references from day directories */
+  long long stored;       /* bytes stored for the objects */
+  long long saved;        /* bytes that copies per reference would add */
+} OBJECT_STATS;
+
+/*
+ * Move file, a complete entry of the diary at dpath with content hash
+ * sha256, into the store and leave a reference in its place. shared is
+ * set if the content was already stored (the copy is dropped).
+ * Returns 0 on success.
+ */
+int objects_adopt(const char *dpath, const char *file, const char *sha256, int *shared);
+
+/* Get the object id an entry refers to. Returns 0 if path is a reference. */
+int objects_ref_id(const char *path, char id[SHA256_HEX_LEN]);
+
+/* Drop a reference to object id; the object goes with its last reference */
+void objects_release(const char *dpath, const char *id);
+
+/*
+ * Recount the references from the entries of cat and remove objects
+ * nothing refers to. Returns the number of objects removed, -1 on error.
+ */
+int objects_rebuild(const char *dpath, const CATALOG *cat);
+
+/* Sizes and reference counts of the store. Returns 0 on success. */
+int objects_stats(const char *dpath, OBJECT_STATS *stats);
+
+#endif /* OBJECTS_H */
@@ -0,0 +1,250 @@
+/*
+ * proc.c - Running external programs implementation
+ */
+#include "proc.h"
+#include "utils.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static int is_blank(char c) {
+  return c == ' ' || c == '\t' || c == '\n';
+}
+
+char **proc_split(const char *line) {
+  size_t len = strlen(line);
+  /* every word takes at least one character and a separator */
+  size_t max = len / 2 + 2;
+  char **argv = malloc(max * sizeof(char *) + len + 1);
+  if (argv == NULL)
+    return NULL;
+
+  char *out = (char *)(argv + max);
+  const char *p = line;
+  int argc = 0;
+
+  for (;;) {
+    while (is_blank(*p))
+      p++;
+    if (*p == '\0')
+      break;
+
+    char quote = 0;
+    argv[argc++] = out;
+    for (; *p != '\0'; p++) {
+      if (quote == '\'') {
+        if (*p == '\'')
+          quote = 0;
+        else
+          *out++ = *p;
+      } else if (quote == '"') {
+        if (*p == '"')
+          quote = 0;
+        else if (*p == '\\' && (p[1] == '"' || p[1] == '\\'))
+          *out++ = *++p;
+        else
+          *out++ = *p;
+      } else if (*p == '\'' || *p == '"') {
+        quote = *p;
+      } else if (*p == '\\' && p[1] != '\0') {
+        *out++ = *++p;
+      } else if (is_blank(*p)) {
+        break;
+      } else {
+        *out++ = *p;
+      }
+    }
+    *out++ = '\0';
+
+    if (quote != 0) {
+      free(argv);
+      return NULL;
+    }
+  }
+
+  if (argc == 0) {
+    free(argv);
+    return NULL;
+  }
+  argv[argc] = NULL;
+  return argv;
+}
+
+/*
+ * Spawn argv and wait for it. stdin comes from in if it is not -1, else
+ * from the data bytes (if any) written through a pipe once it runs.
+ */
+static int proc_wait(char *const argv[], int in, const char *data, size_t len, const char *out,
+                     int flags) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  struct sigaction ignore = {0}, old_int, old_quit, old_pipe;
+  sigset_t chld, old_mask, defaults;
+  char name[64];
+  pid_t pid;
+  int status, rc;
+  int fds[2] = {-1, -1};
+
+  if (in < 0 && data != NULL) {
+    if (pipe(fds) != 0)
+      return 127;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    in = fds[0];
+  }
+
+  /* "exec <program>": arguments may hold entry paths, so they are left out */
+  snprintf(name, sizeof(name), "exec %.58s", argv[0]);
+  int span = trace_begin(name, NULL);
+
+  posix_spawn_file_actions_init(&actions);
+  if (in >= 0)
+    posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+  if (out != NULL)
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, out,
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  else if (flags & PROC_NULL_STDOUT)
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  if (flags & PROC_NULL_STDERR)
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+  /*
+   * Like system(): the editor or pager owns the terminal, so ^C and ^\ reach
+   * only the child while we wait for it.
+   */
+  ignore.sa_handler = SIG_IGN;
+  sigemptyset(&ignore.sa_mask);
+  sigaction(SIGINT, &ignore, &old_int);
+  sigaction(SIGQUIT, &ignore, &old_quit);
+  sigaction(SIGPIPE, &ignore, &old_pipe);
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &old_mask);
+
+  sigemptyset(&defaults);
+  if (old_int.sa_handler != SIG_IGN)
+    sigaddset(&defaults, SIGINT);
+  if (old_quit.sa_handler != SIG_IGN)
+    sigaddset(&defaults, SIGQUIT);
+  if (old_pipe.sa_handler != SIG_IGN)
+    sigaddset(&defaults, SIGPIPE);
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  posix_spawnattr_setsigmask(&attr, &old_mask);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+  rc = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+  if (fds[0] >= 0)
+    close(fds[0]);
+  if (rc == 0 && fds[1] >= 0) {
+    /* a pager that quits early just ends the stream (EPIPE) */
+    for (size_t done = 0; done < len;) {
+      ssize_t n = write(fds[1], data + done, len - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      done += n;
+    }
+  }
+  if (fds[1] >= 0)
+    close(fds[1]);
+  if (rc != 0) {
+    msg_error("can't run %s: %s", argv[0], strerror(rc));
+    status = 127;
+  } else {
+    while (waitpid(pid, &rc, 0) < 0 && errno == EINTR)
+      ;
+    if (WIFEXITED(rc))
+      status = WEXITSTATUS(rc);
+    else if (WIFSIGNALED(rc))
+      status = 128 + WTERMSIG(rc);
+    else
+      status = 127;
+  }
+
+  sigaction(SIGINT, &old_int, NULL);
+  sigaction(SIGQUIT, &old_quit, NULL);
+  sigaction(SIGPIPE, &old_pipe, NULL);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+
+  trace_end(span);
+  return status;
+}
+
+int proc_run(char *const argv[], int flags) {
+  return proc_wait(argv, -1, NULL, 0, NULL, flags);
+}
+
+int proc_run_data(char *const argv[], const char *data, size_t len, int flags) {
+  return proc_wait(argv, -1, data, len, NULL, flags);
+}
+
+int proc_run_input(char *const argv[], const char *input, int flags) {
+  int fds[2];
+  size_t len = strlen(input);
+
+  /* written up front: fits in the pipe buffer, no writer process needed */
+  if (len > PIPE_BUF || pipe(fds) != 0)
+    return 127;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+  if (write(fds[1], input, len) != (ssize_t)len) {
+    close(fds[0]);
+    close(fds[1]);
+    return 127;
+  }
+  close(fds[1]);
+
+  int status = proc_wait(argv, fds[0], NULL, 0, NULL, flags);
+  close(fds[0]);
+  return status;
+}
+
+int proc_run_output(char *const argv[], const char *out, int flags) {
+  return proc_wait(argv, -1, NULL, 0, out, flags);
+}
+
+int proc_exists(const char *name) {
+  char path[4096];
+
+  if (strchr(name, '/') != NULL)
+    return access(name, X_OK) == 0;
+
+  const char *dirs = getenv("PATH");
+  if (dirs == NULL)
+    dirs = "/usr/bin:/bin";
+  for (const char *p = dirs;; p++) {
+    const char *end = p + strcspn(p, ":");
+    /* an empty entry is the current directory */
+    snprintf(path, sizeof(path), "%.*s%s%s", (int)(end - p), p, end > p ? "/" : "", name);
+    if (access(path, X_OK) == 0)
+      return 1;
+    if (*end == '\0')
+      return 0;
+    p = end;
+  }
+}
+
+int proc_cmd(char *const cmd[], const char *arg, int flags) {
+  char *argv[64];
+  int argc = 0;
+
+  while (cmd[argc] != NULL && argc < 62) {
+    argv[argc] = cmd[argc];
+    argc++;
+  }
+  if (arg != NULL)
+    argv[argc++] = (char *)arg;
+  argv[argc] = NULL;
+
+  return proc_run(argv, flags);
+}
@@ -0,0 +1,48 @@
+/*
+ * proc.h - Running external programs
+ *
+ * Programs are started with posix_spawnp() and an explicit argv, without a
+ * shell in between: one process per command, and paths with spaces or
+ * quotes are passed through untouched. Every run is recorded as an
+ * "exec <program>" phase when tracing is enabled.
+ */
+#ifndef PROC_H
+#define PROC_H
+
+#include "dry.h"
+
+/* Redirections for proc_run() */
+#define PROC_NULL_STDOUT 0x01
+#define PROC_NULL_STDERR 0x02
+#define PROC_QUIET (PROC_NULL_STDOUT | PROC_NULL_STDERR)
+
+/*
+ * Split a configured command line ("emacsclient -t", "bat --paging=always")
+ * into a NULL-terminated argv. Single and double quotes and backslash
+ * escapes work as in sh; nothing is expanded. Returns NULL for an empty
+ * line or unbalanced quotes. The result is a single allocation for free().
+ */
+char **proc_split(const char *line);
+
+/*
+ * Run argv[0] (looked up in PATH) and wait for it. Returns the exit status,
+ * 128 + n if it was killed by signal n and 127 if it could not be started.
+ */
+int proc_run(char *const argv[], int flags);
+
+/* proc_run() with len bytes of data streamed to the child's stdin */
+int proc_run_data(char *const argv[], const char *data, size_t len, int flags);
+
+/* proc_run() with input (at most PIPE_BUF bytes) on the child's stdin */
+int proc_run_input(char *const argv[], const char *input, int flags);
+
+/* proc_run() with stdout written to the file out (created 0600) */
+int proc_run_output(char *const argv[], const char *out, int flags);
+
+/* Check whether name can be run (looked up in PATH like proc_run()) */
+int proc_exists(const char *name);
+
+/* Run a command from proc_split() with arg appended (arg may be NULL) */
+int proc_cmd(char *const cmd[], const char *arg, int flags);
+
+#endif /* PROC_H */
@@ -0,0 +1,162 @@
+/*
+ * range.c - Date range expressions for list, show and export
+ */
+#include "range.h"
+#include <ctype.h>
+
+/* First and last day of a point (a year, month, day or relative day) */
+typedef struct {
+  char first[11];
+  char last[11];
+} POINT;
+
+static int digits(const char *s, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    if (!isdigit((unsigned char)s[i]))
+      return 0;
+  return 1;
+}
+
+/* Today moved by n units (d, w, m or y) */
+static int shift_today(long n, char unit, char *out) {
+  time_t now = time(NULL);
+  struct tm tm;
+
+  localtime_r(&now, &tm);
+  switch (unit) {
+  case 'd':
+    tm.tm_mday += n;
+    break;
+  case 'w':
+    tm.tm_mday += 7 * n;
+    break;
+  case 'm':
+    tm.tm_mon += n;
+    break;
+  case 'y':
+    tm.tm_year += n;
+    break;
+  default:
+    return 1;
+  }
+  tm.tm_isdst = -1;
+  if (mktime(&tm) == (time_t)-1)
+    return 1;
+  strftime(out, 11, "%Y-%m-%d", &tm);
+  return 0;
+}
+
+/* Parse len chars of s as one point */
+static int parse_point(const char *s, size_t len, POINT *p) {
+  char buf[32];
+
+  if (len == 0 || len >= sizeof(buf))
+    return 1;
+  memcpy(buf, s, len);
+  buf[len] = '\0';
+
+  if (strcmp(buf, "today") == 0 || strcmp(buf, "yesterday") == 0 || strcmp(buf, "tomorrow") == 0) {
+    if (shift_today(buf[0] == 't' ? (buf[2] == 'd' ? 0 : 1) : -1, 'd', p->first) != 0)
+      return 1;
+    strcpy(p->last, p->first);
+    return 0;
+  }
+
+  if (buf[0] == '-' || buf[0] == '+') {
+    char *end;
+    long n = strtol(buf + 1, &end, 10);
+    if (end == buf + 1 || !isdigit((unsigned char)buf[1]) || (end[0] != '\0' && end[1] != '\0'))
+      return 1;
+    if (shift_today(buf[0] == '-' ? -n : n, end[0] != '\0' ? end[0] : 'd', p->first) != 0)
+      return 1;
+    strcpy(p->last, p->first);
+    return 0;
+  }
+
+  /* YYYY, YYYY-MM or YYYY-MM-DD */
+  if ((len != 4 && len != 7 && len != 10) || !digits(buf, 4))
+    return 1;
+  if (len >= 7 && ((buf[4] != '-' && buf[4] != '/') || !digits(buf + 5, 2)))
+    return 1;
+  if (len == 10 && ((buf[7] != '-' && buf[7] != '/') || !digits(buf + 8, 2)))
+    return 1;
+
+  int month = len >= 7 ? atoi(buf + 5) : 0;
+  int day = len == 10 ? atoi(buf + 8) : 0;
+  if ((len >= 7 && (month < 1 || month > 12)) || (len == 10 && (day < 1 || day > 31)))
+    return 1;
+
+  /* the tree holds real days only, so the 31st ends every month */
+  snprintf(p->first, sizeof(p->first), "%.4s-%.2s-%.2s", buf,
+           len >= 7 ? buf + 5 : "01", len == 10 ? buf + 8 : "01");
+  snprintf(p->last, sizeof(p->last), "%.4s-%.2s-%.2s", buf,
+           len >= 7 ? buf + 5 : "12", len == 10 ? buf + 8 : "31");
+  return 0;
+}
+
+int range_parse(const char *expr, DATE_RANGE *range) {
+  const char *dots = strstr(expr, "..");
+  POINT a, b;
+
+  memset(range, 0, sizeof(*range));
+
+  if (dots == NULL) {
+    if (parse_point(expr, strlen(expr), &a) != 0)
+      return 1;
+    if (expr[0] == '-') {
+      /* since then */
+      strcpy(range->from, a.first);
+      shift_today(0, 'd', range->to);
+    } else if (expr[0] == '+') {
+      /* until then */
+      shift_today(0, 'd', range->from);
+      strcpy(range->to, a.last);
+    } else {
+      strcpy(range->from, a.first);
+      strcpy(range->to, a.last);
+    }
+    return 0;
+  }
+
+  if (dots == expr && dots[2] == '\0')
+    return 1;
+  if (dots > expr) {
+    if (parse_point(expr, dots - expr, &a) != 0)
+      return 1;
+    strcpy(range->from, a.first);
+  }
+  if (dots[2] != '\0') {
+    if (parse_point(dots + 2, strlen(dots + 2), &b) != 0)
+      return 1;
+    strcpy(range->to, b.last);
+  }
+  return 0;
+}
+
+int range_clamp(DATE_RANGE *range, const DATE_RANGE *other) {
+  if (other->from[0] != '\0' && strcmp(other->from, range->from) > 0)
+    strcpy(range->from, other->from);
+  if (other->to[0] != '\0' && (range->to[0] == '\0' || strcmp(other->to, range->to) < 0))
+    strcpy(range->to, other->to);
+  return range->from[0] != '\0' && range->to[0] != '\0' && strcmp(range->from, range->to) > 0;
+}
+
+int range_is_day(const DATE_RANGE *range) {
+  return range->from[0] != '\0' && strcmp(range->from, range->to) == 0;
+}
+
+int range_path(const DATE_RANGE *range, char *path, size_t size) {
+  const char *f = range->from, *t = range->to;
+
+  if (f[0] == '\0' || t[0] == '\0' || strncmp(f, t, 4) != 0)
+    return 1;
+  if (range_is_day(range))
+    snprintf(path, size, "%.4s/%.2s/%.2s", f, f + 5, f + 8);
+  else if (strncmp(f, t, 7) == 0 && strcmp(f + 8, "01") == 0 && strcmp(t + 8, "31") == 0)
+    snprintf(path, size, "%.4s/%.2s", f, f + 5);
+  else if (strcmp(f + 5, "01-01") == 0 && strcmp(t + 5, "12-31") == 0)
+    snprintf(path, size, "%.4s", f);
+  else
+    return 1;
+  return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * range.h - Date range expressions for list, show and export
+ *
+ * An expression names a span of days:
+ *
+ *   today, yesterday, tomorrow
+ *   2025, 2025-03, 2025-03-14     a year, month or day (or with '/')
+ *   -7d, -2w, -3m, -1y            from that long ago through today
+ *   +7d                           from today through that far ahead
+ *   A..B                          from the start of A to the end of B,
+ *                                 either may be left out (2025-01..)
+ */
+#ifndef RANGE_H
+#define RANGE_H
+
+#include "dry.h"
+
+/* Days from and to (YYYY-MM-DD, inclusive), "" for no bound */
+typedef struct {
+  char from[11];
+  char to[11];
+} DATE_RANGE;
+
+/* Parse a range expression. Returns 0 on success. */
+int range_parse(const char *expr, DATE_RANGE *range);
+
+/* Narrow range to the days it shares with other. Returns 1 if none are left. */
+int range_clamp(DATE_RANGE *range, const DATE_RANGE *other);
+
+/* Check whether range is a single day */
+int range_is_day(const DATE_RANGE *range);
+
+/*
+ * Tree path (YYYY, YYYY/MM or YYYY/MM/DD) of a range that is exactly one
+ * year, month or day. Returns 0 on success, 1 for any other range.
+ */
+int range_path(const DATE_RANGE *range, char *path, size_t size);
+
+#endif /* RANGE_H */
@@ -0,0 +1,229 @@
+/*
+ * registry.c - Registered diaries
+ *
+ * Reference file format, one diary per line:
+ *   <name> : <path>
+ */
+#include "registry.h"
+#include "config.h"
+#include "trace.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/file.h>
+
+static REGISTRY_ENTRY *entries;   /* in file order */
+static int count;
+static int cap;
+static int *slots;                /* open addressing: index into entries, -1 if free */
+static uint32_t slots_cap;
+static int loaded;
+static char loaded_path[2048];
+
+static uint32_t hash_name(const char *s) {
+  uint32_t h = 2166136261u;
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int find_slot(const char *name) {
+  if (slots_cap == 0)
+    return -1;
+  uint32_t i = hash_name(name) & (slots_cap - 1);
+  while (slots[i] >= 0) {
+    if (strcmp(entries[slots[i]].name, name) == 0)
+      return slots[i];
+    i = (i + 1) & (slots_cap - 1);
+  }
+  return -1;
+}
+
+static int grow_slots(void) {
+  uint32_t new_cap = slots_cap ? slots_cap * 2 : 64;
+  int *new_slots = malloc(new_cap * sizeof(int));
+  if (new_slots == NULL)
+    return 1;
+  memset(new_slots, 0xff, new_cap * sizeof(int));
+
+  for (int j = 0; j < count; j++) {
+    uint32_t i = hash_name(entries[j].name) & (new_cap - 1);
+    while (new_slots[i] >= 0)
+      i = (i + 1) & (new_cap - 1);
+    new_slots[i] = j;
+  }
+  free(slots);
+  slots = new_slots;
+  slots_cap = new_cap;
+  return 0;
+}
+
+/* Add an entry to the table; the first registration of a name wins */
+static int insert(const char *name, const char *path) {
+  char expanded[2048];
+
+  if (find_slot(name) >= 0)
+    return 1;
+
+  if ((uint32_t)(count + 1) * 2 > slots_cap && grow_slots() != 0)
+    return -1;
+
+  if (count == cap) {
+    int new_cap = cap ? cap * 2 : 16;
+    REGISTRY_ENTRY *e = realloc(entries, new_cap * sizeof(REGISTRY_ENTRY));
+    if (e == NULL)
+      return -1;
+    entries = e;
+    cap = new_cap;
+  }
+
+  expand_tilde(path, expanded);
+  entries[count].name = strdup(name);
+  entries[count].path = strdup(expanded);
+  if (entries[count].name == NULL || entries[count].path == NULL) {
+    free(entries[count].name);
+    free(entries[count].path);
+    return -1;
+  }
+
+  uint32_t i = hash_name(name) & (slots_cap - 1);
+  while (slots[i] >= 0)
+    i = (i + 1) & (slots_cap - 1);
+  slots[i] = count++;
+  return 0;
+}
+
+static void clear(void) {
+  for (int i = 0; i < count; i++) {
+    free(entries[i].name);
+    free(entries[i].path);
+  }
+  count = 0;
+  if (slots_cap > 0)
+    memset(slots, 0xff, slots_cap * sizeof(int));
+}
+
+/* Parse "name : path" lines */
+static void read_entries(FILE *fd) {
+  char line[4096];
+
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    char *sep = strstr(line, " : ");
+    if (sep == NULL)
+      continue;
+    *sep = '\0';
+
+    char *name = line;
+    char *path = sep + 3;
+    while (*name == ' ' || *name == '\t')
+      name++;
+    char *end = name + strlen(name);
+    while (end > name && (end[-1] == ' ' || end[-1] == '\t'))
+      *--end = '\0';
+    while (*path == ' ' || *path == '\t')
+      path++;
+    end = path + strlen(path);
+    while (end > path && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+      *--end = '\0';
+
+    if (*name != '\0' && *path != '\0')
+      insert(name, path);
+  }
+}
+
+int registry_load(const char *ref_path) {
+  char path[2048];
+
+  if (loaded)
+    return 0;
+
+  if (ref_path == NULL) {
+    if (get_ref_path(path) != 0)
+      return 1;
+    ref_path = path;
+  }
+
+  FILE *fd = fopen(ref_path, "r");
+  if (fd == NULL)
+    return 1;
+
+  int span = trace_begin("registry_load", NULL);
+  read_entries(fd);
+  fclose(fd);
+  trace_end(span);
+
+  snprintf(loaded_path, sizeof(loaded_path), "%s", ref_path);
+  loaded = 1;
+  return 0;
+}
+
+const char *registry_lookup(const char *name) {
+  if (registry_load(NULL) != 0)
+    return NULL;
+
+  int i = find_slot(name);
+  return i >= 0 ? entries[i].path : NULL;
+}
+
+int registry_count(void) {
+  if (registry_load(NULL) != 0)
+    return 0;
+  return count;
+}
+
+const REGISTRY_ENTRY *registry_entry(int i) {
+  if (i < 0 || i >= count)
+    return NULL;
+  return &entries[i];
+}
+
+int registry_add(const char *name, const char *path) {
+  char ref_path[2048];
+  int rc;
+
+  if (loaded)
+    snprintf(ref_path, sizeof(ref_path), "%s", loaded_path);
+  else if (get_ref_path(ref_path) != 0)
+    return -1;
+
+  int fd = open(ref_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return -1;
+
+  if (flock(fd, LOCK_EX) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  /* Re-read under the lock: another init may have registered it meanwhile */
+  FILE *in = fdopen(dup(fd), "r");
+  if (in == NULL) {
+    close(fd);
+    return -1;
+  }
+  clear();
+  read_entries(in);
+  fclose(in);
+  snprintf(loaded_path, sizeof(loaded_path), "%s", ref_path);
+  loaded = 1;
+
+  if (find_slot(name) >= 0) {
+    close(fd);
+    return 1;
+  }
+
+  char line[4200];
+  int len = snprintf(line, sizeof(line), "%s : %s\n", name, path);
+  if (len < 0 || (size_t)len >= sizeof(line) || write(fd, line, len) != len) {
+    close(fd);
+    return -1;
+  }
+
+  rc = insert(name, path) < 0 ? -1 : 0;
+
+  /* closing the descriptor releases the lock */
+  close(fd);
+  return rc;
+}
@@ -0,0 +1,40 @@
+/*
+ * registry.h - Registered diaries (diaries.ref)
+ *
+ * The reference file is read once per process into a hash table keyed by
+ * diary name; lookups never touch the file again.
+ */
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include "dry.h"
+
+/* A registered diary */
+typedef struct {
+  char *name;
+  char *path;   /* mount point, tilde expanded */
+} REGISTRY_ENTRY;
+
+/*
+ * Load the registry from ref_path (NULL: the default reference file).
+ * Only the first successful call reads the file. Returns 0 on success.
+ */
+int registry_load(const char *ref_path);
+
+/* Get the path of a diary by name, NULL if not registered */
+const char *registry_lookup(const char *name);
+
+/* Number of registered diaries */
+int registry_count(void);
+
+/* Get the i-th registered diary, in reference file order */
+const REGISTRY_ENTRY *registry_entry(int i);
+
+/*
+ * Register a new diary, appending to the reference file under an exclusive
+ * lock so concurrent 'dry init' runs don't interleave or register a name twice.
+ * Returns 0 on success, 1 if the name is already registered, -1 on error.
+ */
+int registry_add(const char *name, const char *path);
+
+#endif /* REGISTRY_H */
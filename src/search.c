@@ -0,0 +1,727 @@
+/*
+ * search.c - Full-text search over diary notes implementation
+ *
+ * The index is kept in the diary metadata directory (inside the encrypted
+ * mount), so no plaintext ever leaves it. Layout of .dry/search.idx:
+ *
+ *   "DRYIDX1\n"
+ *   ndocs, then per note: key, mtime, size, sections (offset + label)
+ *   nterms, then per term (sorted): term, postings count, postings
+ *
+ * All integers are varints. Postings of a term are grouped by note (one
+ * note per day) and section, and stored as: note delta, section, term
+ * frequency.
+ */
+#include "search.h"
+#include "note.h"
+#include "store.h"
+#include "utils.h"
+#include <ctype.h>
+#include <math.h>
+
+#define SEARCH_FILE "search.idx"
+#define SEARCH_MAGIC "DRYIDX1\n"
+#define TERM_MAX 64
+
+/* ---- hashing ---------------------------------------------------------- */
+
+static uint32_t hash_term(const char *s) {
+  uint32_t h = 2166136261u;
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int grow_terms(SEARCH_INDEX *idx);
+
+static SEARCH_TERM *find_term(const SEARCH_INDEX *idx, const char *term) {
+  if (idx->terms_cap == 0)
+    return NULL;
+  uint32_t i = hash_term(term) & (idx->terms_cap - 1);
+  while (idx->terms[i].term != NULL) {
+    if (strcmp(idx->terms[i].term, term) == 0)
+      return &idx->terms[i];
+    i = (i + 1) & (idx->terms_cap - 1);
+  }
+  return NULL;
+}
+
+static SEARCH_TERM *insert_term(SEARCH_INDEX *idx, const char *term) {
+  if ((idx->nterms + 1) * 2 > idx->terms_cap && grow_terms(idx) != 0)
+    return NULL;
+
+  uint32_t i = hash_term(term) & (idx->terms_cap - 1);
+  while (idx->terms[i].term != NULL) {
+    if (strcmp(idx->terms[i].term, term) == 0)
+      return &idx->terms[i];
+    i = (i + 1) & (idx->terms_cap - 1);
+  }
+
+  idx->terms[i].term = strdup(term);
+  if (idx->terms[i].term == NULL)
+    return NULL;
+  idx->nterms++;
+  return &idx->terms[i];
+}
+
+static int grow_terms(SEARCH_INDEX *idx) {
+  uint32_t old_cap = idx->terms_cap;
+  SEARCH_TERM *old = idx->terms;
+  uint32_t cap = old_cap ? old_cap * 2 : 4096;
+
+  idx->terms = calloc(cap, sizeof(SEARCH_TERM));
+  if (idx->terms == NULL) {
+    idx->terms = old;
+    return 1;
+  }
+  idx->terms_cap = cap;
+
+  for (uint32_t j = 0; j < old_cap; j++) {
+    if (old[j].term == NULL)
+      continue;
+    uint32_t i = hash_term(old[j].term) & (cap - 1);
+    while (idx->terms[i].term != NULL)
+      i = (i + 1) & (cap - 1);
+    idx->terms[i] = old[j];
+  }
+  free(old);
+  return 0;
+}
+
+/* ---- tokenizer -------------------------------------------------------- */
+
+/* Read the next lowercase term from *p, returns its length (0 at end) */
+static size_t next_term(const char **p, const char *end, char *term) {
+  const char *s = *p;
+
+  while (s < end && !isalnum((unsigned char)*s) && (unsigned char)*s < 0x80)
+    s++;
+
+  size_t len = 0;
+  while (s < end && (isalnum((unsigned char)*s) || (unsigned char)*s >= 0x80)) {
+    if (len < TERM_MAX)
+      term[len++] = (char)tolower((unsigned char)*s);
+    s++;
+  }
+  term[len] = '\0';
+  *p = s;
+  return len;
+}
+
+/* ---- documents -------------------------------------------------------- */
+
+static int add_posting(SEARCH_TERM *t, uint32_t doc, uint32_t section) {
+  if (t->count > 0) {
+    SEARCH_POSTING *last = &t->postings[t->count - 1];
+    if (last->doc == doc && last->section == section) {
+      last->tf++;
+      return 0;
+    }
+  }
+  if (t->count == t->cap) {
+    uint32_t cap = t->cap ? t->cap * 2 : 4;
+    SEARCH_POSTING *p = realloc(t->postings, cap * sizeof(SEARCH_POSTING));
+    if (p == NULL)
+      return 1;
+    t->postings = p;
+    t->cap = cap;
+  }
+  t->postings[t->count].doc = doc;
+  t->postings[t->count].section = section;
+  t->postings[t->count].tf = 1;
+  t->count++;
+  return 0;
+}
+
+static SEARCH_DOC *new_doc(SEARCH_INDEX *idx) {
+  if (idx->ndocs == idx->docs_cap) {
+    uint32_t cap = idx->docs_cap ? idx->docs_cap * 2 : 256;
+    SEARCH_DOC *docs = realloc(idx->docs, cap * sizeof(SEARCH_DOC));
+    if (docs == NULL)
+      return NULL;
+    idx->docs = docs;
+    idx->docs_cap = cap;
+  }
+  SEARCH_DOC *d = &idx->docs[idx->ndocs++];
+  memset(d, 0, sizeof(*d));
+  return d;
+}
+
+static int add_section(SEARCH_DOC *d, uint32_t offset, const char *label, size_t len) {
+  SEARCH_SECTION *s = realloc(d->sections, (d->nsections + 1) * sizeof(SEARCH_SECTION));
+  if (s == NULL)
+    return 1;
+  d->sections = s;
+  s = &d->sections[d->nsections++];
+  s->offset = offset;
+  if (len >= sizeof(s->label))
+    len = sizeof(s->label) - 1;
+  memcpy(s->label, label, len);
+  s->label[len] = '\0';
+  return 0;
+}
+
+/* Read a note and add its terms, section by section */
+static int index_note(SEARCH_INDEX *idx, const char *path, const char *key,
+                      long long mtime, long long size) {
+  NOTE note;
+
+  /* read the whole note; the cataloged size may lag behind the file */
+  if (note_load(&note, path) != 0)
+    return 1;
+
+  SEARCH_DOC *d = new_doc(idx);
+  if (d == NULL) {
+    note_free(&note);
+    return 1;
+  }
+  uint32_t doc = idx->ndocs - 1;
+  snprintf(d->key, sizeof(d->key), "%s", key);
+  d->mtime = mtime;
+  d->size = size;
+  add_section(d, 0, "", 0);
+
+  const char *buf = note.data;
+  const char *p = buf;
+  const char *end = buf + note.len;
+  char term[TERM_MAX + 1];
+
+  while (p < end) {
+    const char *eol = memchr(p, '\n', end - p);
+    if (eol == NULL)
+      eol = end;
+
+    if ((eol - p > 3 && strncmp(p, "** ", 3) == 0) ||
+        (eol - p > 3 && strncmp(p, "## ", 3) == 0)) {
+      /* level-2 header starts a new section */
+      add_section(d, (uint32_t)(p - buf), p + 3, eol - p - 3);
+    } else if (*p != '*' && *p != '#' && strncmp(p, "file:", 5) != 0) {
+      const char *q = p;
+      while (next_term(&q, eol, term) > 0) {
+        if (strlen(term) < 2)
+          continue;
+        SEARCH_TERM *t = insert_term(idx, term);
+        if (t == NULL || add_posting(t, doc, d->nsections - 1) != 0) {
+          note_free(&note);
+          return 1;
+        }
+      }
+    }
+    p = eol + 1;
+  }
+
+  note_free(&note);
+  idx->dirty = 1;
+  return 0;
+}
+
+/* Note paired with its position before compaction */
+typedef struct {
+  SEARCH_DOC doc;
+  uint32_t old;
+} DOC_SLOT;
+
+static int doc_slot_cmp(const void *a, const void *b) {
+  return strcmp(((const DOC_SLOT *)a)->doc.key, ((const DOC_SLOT *)b)->doc.key);
+}
+
+static int posting_cmp(const void *a, const void *b) {
+  const SEARCH_POSTING *x = a, *y = b;
+  if (x->doc != y->doc)
+    return x->doc < y->doc ? -1 : 1;
+  if (x->section != y->section)
+    return x->section < y->section ? -1 : 1;
+  return 0;
+}
+
+/* Drop dead notes, sort notes by key and remap/sort all postings */
+static int compact(SEARCH_INDEX *idx) {
+  uint32_t old_count = idx->ndocs;
+  uint32_t *remap = malloc((old_count + 1) * sizeof(uint32_t));
+  DOC_SLOT *slots = malloc((old_count + 1) * sizeof(DOC_SLOT));
+  uint32_t live = 0;
+
+  if (remap == NULL || slots == NULL) {
+    free(remap);
+    free(slots);
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < old_count; i++) {
+    remap[i] = UINT32_MAX;
+    if (idx->docs[i].dead) {
+      free(idx->docs[i].sections);
+      continue;
+    }
+    slots[live].doc = idx->docs[i];
+    slots[live].old = i;
+    live++;
+  }
+  qsort(slots, live, sizeof(DOC_SLOT), doc_slot_cmp);
+
+  for (uint32_t i = 0; i < live; i++) {
+    idx->docs[i] = slots[i].doc;
+    remap[slots[i].old] = i;
+  }
+  idx->ndocs = live;
+  free(slots);
+
+  for (uint32_t i = 0; i < idx->terms_cap; i++) {
+    SEARCH_TERM *t = &idx->terms[i];
+    uint32_t n = 0;
+    if (t->term == NULL)
+      continue;
+    for (uint32_t j = 0; j < t->count; j++) {
+      SEARCH_POSTING p = t->postings[j];
+      if (p.doc >= old_count || remap[p.doc] == UINT32_MAX)
+        continue;
+      p.doc = remap[p.doc];
+      t->postings[n++] = p;
+    }
+    t->count = n;
+    qsort(t->postings, t->count, sizeof(SEARCH_POSTING), posting_cmp);
+  }
+
+  free(remap);
+  return 0;
+}
+
+/* ---- serialization ---------------------------------------------------- */
+
+static void put_varint(FILE *fd, uint64_t v) {
+  while (v >= 0x80) {
+    fputc((int)(v & 0x7f) | 0x80, fd);
+    v >>= 7;
+  }
+  fputc((int)v, fd);
+}
+
+static int get_varint(FILE *fd, uint64_t *v) {
+  int shift = 0, c;
+  *v = 0;
+  while ((c = fgetc(fd)) != EOF) {
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return 0;
+    shift += 7;
+    if (shift > 63)
+      return 1;
+  }
+  return 1;
+}
+
+static void put_string(FILE *fd, const char *s) {
+  size_t len = strlen(s);
+  put_varint(fd, len);
+  fwrite(s, 1, len, fd);
+}
+
+static int get_string(FILE *fd, char *s, size_t size) {
+  uint64_t len;
+  if (get_varint(fd, &len) != 0 || len >= size || fread(s, 1, len, fd) != len)
+    return 1;
+  s[len] = '\0';
+  return 0;
+}
+
+static int term_ptr_cmp(const void *a, const void *b) {
+  return strcmp((*(SEARCH_TERM *const *)a)->term, (*(SEARCH_TERM *const *)b)->term);
+}
+
+int search_save(SEARCH_INDEX *idx) {
+  char path[4200];
+  char tmp[4300];
+  FILE *fd;
+
+  if (!idx->dirty)
+    return 0;
+
+  if (compact(idx) != 0 || get_meta_path(idx->dpath, SEARCH_FILE, path, sizeof(path)) != 0)
+    return 1;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  fd = store_fopen(tmp, "w");
+  if (fd == NULL)
+    return 1;
+
+  fwrite(SEARCH_MAGIC, 1, strlen(SEARCH_MAGIC), fd);
+
+  put_varint(fd, idx->ndocs);
+  for (uint32_t i = 0; i < idx->ndocs; i++) {
+    const SEARCH_DOC *d = &idx->docs[i];
+    put_string(fd, d->key);
+    put_varint(fd, (uint64_t)d->mtime);
+    put_varint(fd, (uint64_t)d->size);
+    put_varint(fd, d->nsections);
+    for (uint32_t j = 0; j < d->nsections; j++) {
+      put_varint(fd, d->sections[j].offset);
+      put_string(fd, d->sections[j].label);
+    }
+  }
+
+  /* terms in sorted order so the file is stable */
+  SEARCH_TERM **sorted = malloc((idx->nterms + 1) * sizeof(SEARCH_TERM *));
+  uint32_t n = 0;
+  if (sorted == NULL) {
+    fclose(fd);
+    unlink(tmp);
+    return 1;
+  }
+  for (uint32_t i = 0; i < idx->terms_cap; i++)
+    if (idx->terms[i].term != NULL && idx->terms[i].count > 0)
+      sorted[n++] = &idx->terms[i];
+  qsort(sorted, n, sizeof(SEARCH_TERM *), term_ptr_cmp);
+
+  put_varint(fd, n);
+  for (uint32_t i = 0; i < n; i++) {
+    const SEARCH_TERM *t = sorted[i];
+    uint32_t prev = 0;
+    put_string(fd, t->term);
+    put_varint(fd, t->count);
+    for (uint32_t j = 0; j < t->count; j++) {
+      put_varint(fd, t->postings[j].doc - prev);
+      put_varint(fd, t->postings[j].section);
+      put_varint(fd, t->postings[j].tf);
+      prev = t->postings[j].doc;
+    }
+  }
+  free(sorted);
+
+  if (fclose(fd) != 0 || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+
+  idx->dirty = 0;
+  return 0;
+}
+
+static int parse_index(SEARCH_INDEX *idx, FILE *fd) {
+  char magic[sizeof(SEARCH_MAGIC)];
+  char term[TERM_MAX + 1];
+  uint64_t n, v;
+
+  if (fread(magic, 1, strlen(SEARCH_MAGIC), fd) != strlen(SEARCH_MAGIC) ||
+      memcmp(magic, SEARCH_MAGIC, strlen(SEARCH_MAGIC)) != 0)
+    return 1;
+
+  if (get_varint(fd, &n) != 0)
+    return 1;
+  for (uint64_t i = 0; i < n; i++) {
+    SEARCH_DOC *d = new_doc(idx);
+    uint64_t nsections, mtime, size;
+    if (d == NULL || get_string(fd, d->key, sizeof(d->key)) != 0 ||
+        get_varint(fd, &mtime) != 0 || get_varint(fd, &size) != 0 ||
+        get_varint(fd, &nsections) != 0)
+      return 1;
+    d->mtime = (long long)mtime;
+    d->size = (long long)size;
+    for (uint64_t j = 0; j < nsections; j++) {
+      char label[16];
+      if (get_varint(fd, &v) != 0 || get_string(fd, label, sizeof(label)) != 0 ||
+          add_section(d, (uint32_t)v, label, strlen(label)) != 0)
+        return 1;
+    }
+  }
+
+  if (get_varint(fd, &n) != 0)
+    return 1;
+  for (uint64_t i = 0; i < n; i++) {
+    uint64_t count, section, tf;
+    uint32_t doc = 0;
+    if (get_string(fd, term, sizeof(term)) != 0 || get_varint(fd, &count) != 0)
+      return 1;
+    SEARCH_TERM *t = insert_term(idx, term);
+    if (t == NULL)
+      return 1;
+    t->postings = malloc((count ? count : 1) * sizeof(SEARCH_POSTING));
+    if (t->postings == NULL)
+      return 1;
+    t->cap = (uint32_t)count;
+    for (uint64_t j = 0; j < count; j++) {
+      if (get_varint(fd, &v) != 0 || get_varint(fd, &section) != 0 || get_varint(fd, &tf) != 0)
+        return 1;
+      doc += (uint32_t)v;
+      if (doc >= idx->ndocs)
+        return 1;
+      t->postings[j].doc = doc;
+      t->postings[j].section = (uint32_t)section;
+      t->postings[j].tf = (uint32_t)tf;
+    }
+    t->count = (uint32_t)count;
+  }
+  return 0;
+}
+
+int search_load(SEARCH_INDEX *idx, const char *dpath) {
+  char path[4200];
+  FILE *fd;
+
+  memset(idx, 0, sizeof(*idx));
+  snprintf(idx->dpath, sizeof(idx->dpath), "%s", dpath);
+
+  if (get_meta_path(dpath, SEARCH_FILE, path, sizeof(path)) != 0)
+    return 1;
+
+  fd = store_fopen(path, "r");
+  if (fd == NULL)
+    return 0;
+
+  int rc = parse_index(idx, fd);
+  fclose(fd);
+  if (rc != 0) {
+    msg_warning("search index %s is corrupt, rebuilding", path);
+    search_free(idx);
+    memset(idx, 0, sizeof(*idx));
+    snprintf(idx->dpath, sizeof(idx->dpath), "%s", dpath);
+    idx->dirty = 1;
+  }
+  return 0;
+}
+
+void search_free(SEARCH_INDEX *idx) {
+  for (uint32_t i = 0; i < idx->ndocs; i++)
+    free(idx->docs[i].sections);
+  free(idx->docs);
+  for (uint32_t i = 0; i < idx->terms_cap; i++) {
+    free(idx->terms[i].term);
+    free(idx->terms[i].postings);
+  }
+  free(idx->terms);
+  idx->docs = NULL;
+  idx->terms = NULL;
+  idx->ndocs = idx->nterms = idx->docs_cap = idx->terms_cap = 0;
+}
+
+/* ---- sync ------------------------------------------------------------- */
+
+/* Binary search among the first count notes (sorted by key after load) */
+static int find_doc(const SEARCH_INDEX *idx, const char *key, uint32_t count) {
+  int lo = 0, hi = (int)count - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    int c = strcmp(idx->docs[mid].key, key);
+    if (c == 0)
+      return mid;
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return -1;
+}
+
+int search_sync(SEARCH_INDEX *idx, CATALOG *cat) {
+  char key[272];
+  char path[4500];
+  int indexed = 0;
+  uint32_t existing = idx->ndocs;
+  char *seen = calloc(existing + 1, 1);
+
+  if (seen == NULL)
+    return -1;
+
+  for (int i = 0; i < cat->count; i++) {
+    CATALOG_DAY *day = &cat->days[i];
+    for (int j = 0; j < day->count; j++) {
+      CATALOG_ENTRY *e = &day->entries[j];
+      if (e->type != TEXT)
+        continue;
+
+      snprintf(key, sizeof(key), "%s/%s", day->date, e->id);
+      int d = find_doc(idx, key, existing);
+      if (d >= 0) {
+        seen[d] = 1;
+        if (idx->docs[d].mtime == e->mtime && idx->docs[d].size == e->size)
+          continue;
+        idx->docs[d].dead = 1;
+      }
+
+      catalog_entry_path(cat, day, e, path, sizeof(path));
+      if (index_note(idx, path, key, e->mtime, e->size) == 0)
+        indexed++;
+    }
+  }
+
+  /* notes that are no longer in the catalog */
+  for (uint32_t i = 0; i < existing; i++) {
+    if (!seen[i] && !idx->docs[i].dead) {
+      idx->docs[i].dead = 1;
+      idx->dirty = 1;
+    }
+  }
+  free(seen);
+
+  if (idx->dirty)
+    compact(idx);
+  return indexed;
+}
+
+/* ---- query ------------------------------------------------------------ */
+
+/* Best score first; ties go to the note indexed last, then to its earlier section */
+static int result_cmp(const void *a, const void *b) {
+  const SEARCH_RESULT *x = a, *y = b;
+  if (x->score != y->score)
+    return x->score < y->score ? 1 : -1;
+  if (x->doc != y->doc)
+    return x->doc < y->doc ? 1 : -1;
+  return (x->section > y->section) - (x->section < y->section);
+}
+
+/* Age of a note in days, from the YYYY-MM-DD prefix of its key */
+static double doc_age_days(const SEARCH_DOC *d, time_t now) {
+  struct tm tm = {0};
+  if (sscanf(d->key, "%4d-%2d-%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3)
+    return 0;
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = -1;
+  double age = difftime(now, mktime(&tm)) / 86400.0;
+  return age > 0 ? age : 0;
+}
+
+int search_query(SEARCH_INDEX *idx, const char *query, SEARCH_RESULT *results, int max) {
+  SEARCH_TERM *terms[16];
+  int nterms = 0;
+  char term[TERM_MAX + 1];
+  const char *p = query;
+  const char *end = query + strlen(query);
+
+  while (next_term(&p, end, term) > 0 && nterms < 16) {
+    if (strlen(term) < 2)
+      continue;
+    SEARCH_TERM *t = find_term(idx, term);
+    if (t == NULL || t->count == 0)
+      return 0;
+    terms[nterms++] = t;
+  }
+  if (nterms == 0)
+    return 0;
+
+  /* start from the rarest term and intersect the others into it */
+  for (int i = 1; i < nterms; i++) {
+    if (terms[i]->count < terms[0]->count) {
+      SEARCH_TERM *tmp = terms[0];
+      terms[0] = terms[i];
+      terms[i] = tmp;
+    }
+  }
+
+  uint32_t ncand = terms[0]->count;
+  SEARCH_RESULT *cand = malloc(ncand * sizeof(SEARCH_RESULT));
+  uint32_t *cursor = calloc(nterms, sizeof(uint32_t));
+  if (cand == NULL || cursor == NULL) {
+    free(cand);
+    free(cursor);
+    return 0;
+  }
+
+  time_t now = time(NULL);
+  uint32_t n = 0;
+
+  for (uint32_t c = 0; c < ncand; c++) {
+    SEARCH_POSTING *base = &terms[0]->postings[c];
+    double score = 0;
+    int match = 1;
+
+    for (int i = 0; i < nterms && match; i++) {
+      SEARCH_TERM *t = terms[i];
+      SEARCH_POSTING *hit = base;
+
+      if (i > 0) {
+        /* advance the cursor of this term to (doc, section) */
+        while (cursor[i] < t->count && posting_cmp(&t->postings[cursor[i]], base) < 0)
+          cursor[i]++;
+        if (cursor[i] == t->count || posting_cmp(&t->postings[cursor[i]], base) != 0) {
+          match = 0;
+          break;
+        }
+        hit = &t->postings[cursor[i]];
+      }
+
+      double idf = log(1.0 + (double)idx->ndocs / (double)t->count);
+      score += (1.0 + log((double)hit->tf)) * idf;
+    }
+    if (!match)
+      continue;
+
+    /* recent notes rank higher: the boost halves after about three months */
+    double age = doc_age_days(&idx->docs[base->doc], now);
+    score *= 1.0 + 1.0 / (1.0 + age / 90.0);
+
+    cand[n].doc = base->doc;
+    cand[n].section = base->section;
+    cand[n].score = score;
+    n++;
+  }
+
+  qsort(cand, n, sizeof(SEARCH_RESULT), result_cmp);
+  if ((int)n > max)
+    n = (uint32_t)max;
+  memcpy(results, cand, n * sizeof(SEARCH_RESULT));
+
+  free(cand);
+  free(cursor);
+  return (int)n;
+}
+
+/* Case-insensitive check whether line contains any query term */
+static int line_matches(const char *line, const char *query) {
+  char term[TERM_MAX + 1];
+  char word[TERM_MAX + 1];
+  const char *q = query;
+  const char *qend = query + strlen(query);
+
+  while (next_term(&q, qend, term) > 0) {
+    const char *l = line;
+    const char *lend = line + strlen(line);
+    while (next_term(&l, lend, word) > 0)
+      if (strcmp(word, term) == 0)
+        return 1;
+  }
+  return 0;
+}
+
+int search_snippet(const SEARCH_INDEX *idx, const SEARCH_RESULT *res, const char *query,
+                   char *out, size_t size) {
+  const SEARCH_DOC *d = &idx->docs[res->doc];
+  const SEARCH_SECTION *s = &d->sections[res->section];
+  char path[4500];
+  char line[1024];
+  int found = 1;
+
+  /* key is YYYY-MM-DD/<id> */
+  snprintf(path, sizeof(path), "%s/%.4s/%.2s/%.2s/%s", idx->dpath, d->key, d->key + 5,
+           d->key + 8, d->key + 11);
+
+  FILE *fd = store_fopen(path, "r");
+  if (fd == NULL)
+    return 1;
+
+  /* encrypted notes can't seek: skip to the section by reading */
+  if (fseek(fd, s->offset, SEEK_SET) != 0)
+    for (long i = 0; i < s->offset && fgetc(fd) != EOF; i++)
+      ;
+  int first = res->section > 0;
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    if (first) {
+      first = 0;
+      continue;
+    }
+    if (line[0] == '*' || line[0] == '#')
+      break;
+    if (line_matches(line, query)) {
+      line[strcspn(line, "\n")] = '\0';
+      char *t = line;
+      while (*t == ' ' || *t == '\t') t++;
+      snprintf(out, size, "%.100s", t);
+      found = 0;
+      break;
+    }
+  }
+  fclose(fd);
+  return found;
+}
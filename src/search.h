@@ -0,0 +1,89 @@
+/*
+ * search.h - Full-text search over diary notes
+ */
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "dry.h"
+#include "catalog.h"
+#include <stdint.h>
+
+/* A level-2 section (e.g. "** 17:06:00") of an indexed note */
+typedef struct {
+  uint32_t offset;    /* byte offset of the section header in the note */
+  char label[16];     /* header text, e.g. "17:06:00" ("" before the first header) */
+} SEARCH_SECTION;
+
+/* An indexed note */
+typedef struct {
+  char key[272];      /* YYYY-MM-DD/<id> */
+  long long mtime;
+  long long size;
+  SEARCH_SECTION *sections;
+  uint32_t nsections;
+  int dead;           /* removed, dropped on next save */
+} SEARCH_DOC;
+
+/* One posting: a term occurring tf times in a section of a note */
+typedef struct {
+  uint32_t doc;
+  uint32_t section;
+  uint32_t tf;
+} SEARCH_POSTING;
+
+typedef struct {
+  char *term;
+  SEARCH_POSTING *postings;
+  uint32_t count;
+  uint32_t cap;
+} SEARCH_TERM;
+
+/* Inverted index of a diary, stored in the diary metadata directory */
+typedef struct {
+  char dpath[4096];
+  SEARCH_DOC *docs;
+  uint32_t ndocs;
+  uint32_t docs_cap;
+  SEARCH_TERM *terms;   /* open addressing hash table */
+  uint32_t nterms;
+  uint32_t terms_cap;
+  int dirty;
+} SEARCH_INDEX;
+
+/* A ranked search hit */
+typedef struct {
+  uint32_t doc;
+  uint32_t section;
+  double score;
+} SEARCH_RESULT;
+
+/* Load the index of the diary mounted at dpath (empty if none). Returns 0 on success. */
+int search_load(SEARCH_INDEX *idx, const char *dpath);
+
+/*
+ * Bring the index up to date with the catalog: only notes that are new or
+ * whose size/mtime changed are read again. Returns number of notes indexed.
+ */
+int search_sync(SEARCH_INDEX *idx, CATALOG *cat);
+
+/* Write the index back if it changed. Returns 0 on success. */
+int search_save(SEARCH_INDEX *idx);
+
+/* Release memory held by the index */
+void search_free(SEARCH_INDEX *idx);
+
+/*
+ * Run a query (all terms must occur in the same section).
+ * Results are ranked by relevance and recency; at most max results are
+ * stored in results. Returns the number of results.
+ */
+int search_query(SEARCH_INDEX *idx, const char *query, SEARCH_RESULT *results, int max);
+
+/*
+ * Copy the first line of a result's section that matches the query into
+ * out. Returns 0 if a line was found.
+ */
+int search_snippet(const SEARCH_INDEX *idx, const SEARCH_RESULT *res, const char *query,
+                   char *out, size_t size);
+
+#endif /* SEARCH_H */
@@ -0,0 +1,587 @@
+/*
+ * serve.c - JSON-RPC server over stdio implementation
+ */
+#define _GNU_SOURCE
+#include "serve.h"
+#include "json.h"
+#include "libdry.h"
+#include "utils.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+
+#define SERVE_MAX_DIARIES 16
+#define SERVE_MAX_RESULTS 1000
+#define SERVE_MAX_MESSAGE (64 << 20)
+
+/* JSON-RPC error codes */
+#define RPC_PARSE_ERROR -32700
+#define RPC_INVALID_REQUEST -32600
+#define RPC_METHOD_NOT_FOUND -32601
+#define RPC_INVALID_PARAMS -32602
+#define RPC_DIARY_ERROR -32000    /* unknown diary, failed read or write */
+#define RPC_NOT_FOUND -32001      /* no such day, entry or section */
+#define RPC_LOCKED -32002         /* diary can't be unlocked */
+
+typedef struct {
+  const char *name;             /* default diary */
+  dry_diary *diaries[SERVE_MAX_DIARIES];
+  int count;
+} SERVER;
+
+typedef struct {
+  int code;
+  char message[512];
+} RPC_ERROR;
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t pos;
+  size_t cap;
+  int eof;
+} INPUT;
+
+typedef int (*RPC_METHOD_FN)(SERVER *s, const JSON *params, FILE *out, RPC_ERROR *err);
+
+static volatile sig_atomic_t stopping;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+static int rpc_fail(RPC_ERROR *err, int code, const char *fmt, ...) {
+  va_list ap;
+
+  err->code = code;
+  va_start(ap, fmt);
+  vsnprintf(err->message, sizeof(err->message), fmt, ap);
+  va_end(ap);
+  return 1;
+}
+
+/* Report the failure of a libdry call */
+static int rpc_status(RPC_ERROR *err, dry_status status) {
+  int code = status == DRY_ERR_INVALID     ? RPC_INVALID_PARAMS
+             : status == DRY_ERR_NOT_FOUND ? RPC_NOT_FOUND
+             : status == DRY_ERR_LOCKED    ? RPC_LOCKED
+                                           : RPC_DIARY_ERROR;
+  return rpc_fail(err, code, "%s", dry_last_error());
+}
+
+static const char *type_name(dry_entry_type type) {
+  return type == DRY_ENTRY_TEXT ? "text" : type == DRY_ENTRY_MEDIA ? "media" : "other";
+}
+
+static int write_json_data(const char *data, size_t len, void *arg) {
+  print_json_data(arg, data, len);
+  return 0;
+}
+
+/*
+ * Diaries
+ */
+
+static const char *diary_param(SERVER *s, const JSON *params) {
+  const char *name = json_get_string(params, "diary");
+  return name != NULL ? name : s->name;
+}
+
+/* Index of the open diary name in s, or -1 */
+static int find_diary(SERVER *s, const char *name) {
+  for (int i = 0; name != NULL && i < s->count; i++)
+    if (strcmp(dry_diary_name(s->diaries[i]), name) == 0)
+      return i;
+  return -1;
+}
+
+/* The diary of a request, unlocked on first use */
+static dry_diary *use_diary(SERVER *s, const JSON *params, RPC_ERROR *err) {
+  const char *name = diary_param(s, params);
+  int i = find_diary(s, name);
+  dry_diary *d;
+  dry_status rc;
+
+  if (i >= 0)
+    return s->diaries[i];
+  if (s->count == SERVE_MAX_DIARIES) {
+    rpc_fail(err, RPC_DIARY_ERROR, "too many diaries");
+    return NULL;
+  }
+  if ((rc = dry_open(name, json_get_string(params, "passphrase"), &d)) != DRY_OK) {
+    rpc_status(err, rc);
+    return NULL;
+  }
+  s->diaries[s->count++] = d;
+  return d;
+}
+
+/*
+ * Methods
+ */
+
+static void print_entry(FILE *out, const dry_entry *e) {
+  char hm[8];
+  struct tm tm;
+  time_t mtime = (time_t)e->mtime;
+
+  localtime_r(&mtime, &tm);
+  strftime(hm, sizeof(hm), "%H:%M", &tm);
+  fprintf(out, "{\"date\":\"%s\",\"time\":\"%s\",\"id\":", e->date, hm);
+  print_json_string(out, e->id);
+  fprintf(out, ",\"type\":\"%s\",\"size\":%lld,\"mtime\":%lld,\"main\":", type_name(e->type),
+          e->size, e->mtime);
+  if (e->main == NULL)
+    fputs("null", out);
+  else
+    print_json_string(out, e->main);
+  fputc('}', out);
+}
+
+/* Entries from..to grouped by day */
+static int print_days(FILE *out, dry_diary *d, const char *from, const char *to, RPC_ERROR *err) {
+  dry_iter *it;
+  dry_entry e;
+  char date[11] = "";
+  dry_status rc = dry_iter_open(d, from, to, &it);
+
+  if (rc != DRY_OK)
+    return rpc_status(err, rc);
+
+  fputc('[', out);
+  while (dry_iter_next(it, &e)) {
+    if (strcmp(e.date, date) != 0) {
+      fprintf(out, "%s{\"date\":\"%s\",\"entries\":[", date[0] ? "]}," : "", e.date);
+      snprintf(date, sizeof(date), "%s", e.date);
+    } else {
+      fputc(',', out);
+    }
+    print_entry(out, &e);
+  }
+  fputs(date[0] ? "]}]" : "]", out);
+  dry_iter_close(it);
+  return 0;
+}
+
+static int rpc_list(SERVER *s, const JSON *params, FILE *out, RPC_ERROR *err) {
+  const char *from = json_get_string(params, "from");
+  const char *to = json_get_string(params, "to");
+  const char *date = json_get_string(params, "date");
+
+  if (date != NULL)
+    from = to = date;
+
+  dry_diary *d = use_diary(s, params, err);
+  if (d == NULL)
+    return 1;
+
+  fputs("{\"diary\":", out);
+  print_json_string(out, dry_diary_name(d));
+  fputs(",\"days\":", out);
+  if (print_days(out, d, from, to, err) != 0)
+    return 1;
+  fputc('}', out);
+  return 0;
+}
+
+static int rpc_show(SERVER *s, const JSON *params, FILE *out, RPC_ERROR *err) {
+  const char *id = json_get_string(params, "id");
+  const char *date = json_get_string(params, "date");
+  const char *section = json_get_string(params, "section");
+  dry_status rc;
+
+  if (id == NULL && date == NULL)
+    return rpc_fail(err, RPC_INVALID_PARAMS, "show requires id or date");
+
+  dry_diary *d = use_diary(s, params, err);
+  if (d == NULL)
+    return 1;
+
+  fputs("{\"diary\":", out);
+  print_json_string(out, dry_diary_name(d));
+
+  if (id != NULL) {
+    dry_entry e;
+    if ((rc = dry_entry_find(d, id, &e)) != DRY_OK)
+      return rpc_status(err, rc);
+    if (section != NULL && e.type != DRY_ENTRY_TEXT)
+      return rpc_fail(err, RPC_INVALID_PARAMS, "%s is not a note", id);
+
+    fputs(",\"entry\":", out);
+    print_entry(out, &e);
+    fputs(",\"path\":", out);
+    print_json_string(out, e.path);
+    fputs(",\"content\":", out);
+    if (e.type != DRY_ENTRY_TEXT)
+      fputs("null", out);
+    else if ((rc = dry_read_note(d, id, section, write_json_data, out)) != DRY_OK)
+      return rpc_status(err, rc);
+    fputc('}', out);
+    return 0;
+  }
+
+  /* the day with the contents of its main note (the first one) */
+  char main[256] = "";
+  char day[11] = "";
+  dry_iter *it;
+  dry_entry e;
+  int count = 0;
+  if ((rc = dry_iter_open(d, date, date, &it)) != DRY_OK)
+    return rpc_status(err, rc);
+  while (dry_iter_next(it, &e)) {
+    if (day[0] == '\0') {
+      snprintf(day, sizeof(day), "%s", e.date);
+    } else if (strcmp(e.date, day) != 0) {
+      dry_iter_close(it);
+      return rpc_fail(err, RPC_INVALID_PARAMS, "show takes a single day, not %s", date);
+    }
+    fprintf(out, count++ ? "," : ",\"date\":\"%s\",\"entries\":[", e.date);
+    print_entry(out, &e);
+    if (main[0] == '\0' && e.type == DRY_ENTRY_TEXT)
+      snprintf(main, sizeof(main), "%s", e.id);
+  }
+  dry_iter_close(it);
+  if (count == 0)
+    return rpc_fail(err, RPC_NOT_FOUND, "no entries for %s in %s", date, dry_diary_name(d));
+  fputc(']', out);
+  if (section != NULL && main[0] == '\0')
+    return rpc_fail(err, RPC_NOT_FOUND, "no note for %s in %s", date, dry_diary_name(d));
+
+  fputs(",\"note\":", out);
+  if (main[0] == '\0') {
+    fputs("null,\"content\":null", out);
+  } else {
+    print_json_string(out, main);
+    fputs(",\"content\":", out);
+    if ((rc = dry_read_note(d, main, section, write_json_data, out)) != DRY_OK)
+      return rpc_status(err, rc);
+  }
+  fputc('}', out);
+  return 0;
+}
+
+static int rpc_append(SERVER *s, const JSON *params, FILE *out, RPC_ERROR *err) {
+  const char *text = json_get_string(params, "text");
+  time_t when = (time_t)json_get_int(params, "time", (long long)time(NULL));
+  char date[11], label[16];
+  struct tm tm;
+  dry_status rc;
+
+  if (text == NULL)
+    return rpc_fail(err, RPC_INVALID_PARAMS, "append requires text");
+
+  dry_diary *d = use_diary(s, params, err);
+  if (d == NULL)
+    return 1;
+  if ((rc = dry_append(d, text, when)) != DRY_OK)
+    return rpc_status(err, rc);
+
+  localtime_r(&when, &tm);
+  strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+  strftime(label, sizeof(label), "%H:%M:%S", &tm);
+  fputs("{\"diary\":", out);
+  print_json_string(out, dry_diary_name(d));
+  fprintf(out, ",\"date\":\"%s\",\"id\":\"%s.org\",\"section\":\"%s\"}", date, date, label);
+  return 0;
+}
+
+typedef struct {
+  FILE *out;
+  int count;
+} RESULTS;
+
+static int print_result(const dry_result *r, void *arg) {
+  RESULTS *res = arg;
+
+  fprintf(res->out, "%s{\"date\":\"%s\",\"id\":", res->count++ ? "," : "", r->date);
+  print_json_string(res->out, r->id);
+  fputs(",\"section\":", res->out);
+  print_json_string(res->out, r->section);
+  fprintf(res->out, ",\"score\":%.4f,\"snippet\":", r->score);
+  if (r->snippet != NULL)
+    print_json_string(res->out, r->snippet);
+  else
+    fputs("null", res->out);
+  fputc('}', res->out);
+  return 0;
+}
+
+static int rpc_search(SERVER *s, const JSON *params, FILE *out, RPC_ERROR *err) {
+  const char *query = json_get_string(params, "query");
+  long long limit = json_get_int(params, "limit", 20);
+  RESULTS res = {out, 0};
+  dry_status rc;
+
+  if (query == NULL || query[0] == '\0')
+    return rpc_fail(err, RPC_INVALID_PARAMS, "search requires query");
+  if (limit < 1 || limit > SERVE_MAX_RESULTS)
+    return rpc_fail(err, RPC_INVALID_PARAMS, "limit must be between 1 and %d", SERVE_MAX_RESULTS);
+
+  dry_diary *d = use_diary(s, params, err);
+  if (d == NULL)
+    return 1;
+
+  fputs("{\"diary\":", out);
+  print_json_string(out, dry_diary_name(d));
+  fputs(",\"results\":[", out);
+  if ((rc = dry_search(d, query, (int)limit, print_result, &res)) != DRY_OK)
+    return rpc_status(err, rc);
+  fputs("]}", out);
+  return 0;
+}
+
+static int rpc_unlock(SERVER *s, const JSON *params, FILE *out, RPC_ERROR *err) {
+  dry_diary *d = use_diary(s, params, err);
+
+  if (d == NULL)
+    return 1;
+  fputs("{\"diary\":", out);
+  print_json_string(out, dry_diary_name(d));
+  fputs(",\"locked\":false}", out);
+  return 0;
+}
+
+static int rpc_lock(SERVER *s, const JSON *params, FILE *out, RPC_ERROR *err) {
+  const char *name = diary_param(s, params);
+  int i = find_diary(s, name);
+
+  if (name == NULL)
+    return rpc_fail(err, RPC_INVALID_PARAMS, "no diary given and no default diary configured");
+  if (i >= 0) {
+    dry_close(s->diaries[i]);
+    s->diaries[i] = s->diaries[--s->count];
+  }
+  fputs("{\"diary\":", out);
+  print_json_string(out, name);
+  fputs(",\"locked\":true}", out);
+  return 0;
+}
+
+static const struct {
+  const char *name;
+  RPC_METHOD_FN fn;
+} methods[] = {
+  {"list", rpc_list},
+  {"show", rpc_show},
+  {"append", rpc_append},
+  {"search", rpc_search},
+  {"unlock", rpc_unlock},
+  {"lock", rpc_lock},
+};
+
+/*
+ * Requests
+ */
+
+/* Handle one request, writing its response after sep. Returns 1 if a response was written. */
+static int handle_request(SERVER *s, const JSON *req, FILE *out, const char *sep) {
+  const JSON *id = json_get(req, "id");
+  const char *method = json_get_string(req, "method");
+  const JSON *params = json_get(req, "params");
+  RPC_ERROR err = {0, ""};
+  char *result = NULL;
+  size_t len = 0;
+
+  if (req->type != JSON_OBJECT || method == NULL) {
+    rpc_fail(&err, RPC_INVALID_REQUEST, "invalid request");
+    id = NULL;
+  } else if (params != NULL && params->type != JSON_OBJECT) {
+    rpc_fail(&err, RPC_INVALID_PARAMS, "params must be an object");
+  } else {
+    RPC_METHOD_FN fn = NULL;
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++)
+      if (strcmp(methods[i].name, method) == 0)
+        fn = methods[i].fn;
+
+    FILE *res = fn != NULL ? open_memstream(&result, &len) : NULL;
+    if (fn == NULL)
+      rpc_fail(&err, RPC_METHOD_NOT_FOUND, "method not found: %s", method);
+    else if (res == NULL)
+      rpc_fail(&err, RPC_DIARY_ERROR, "out of memory");
+    else {
+      fn(s, params, res, &err);
+      fclose(res);
+    }
+
+    /* a notification gets no response */
+    if (id == NULL) {
+      free(result);
+      return 0;
+    }
+  }
+
+  fprintf(out, "%s{\"jsonrpc\":\"2.0\",\"id\":", sep);
+  if (id == NULL || id->type == JSON_ARRAY || id->type == JSON_OBJECT)
+    fputs("null", out);
+  else
+    json_print_scalar(out, id);
+  if (err.code != 0) {
+    fprintf(out, ",\"error\":{\"code\":%d,\"message\":", err.code);
+    print_json_string(out, err.message);
+    fputs("}}", out);
+  } else {
+    fprintf(out, ",\"result\":%.*s}", (int)len, result);
+  }
+  free(result);
+  return 1;
+}
+
+/* Handle a message (a request or a batch) and write its response */
+static void handle_message(SERVER *s, const char *msg, size_t len, int framed, FILE *out) {
+  JSON req;
+  char *body = NULL;
+  size_t blen = 0;
+  int n = 0;
+
+  FILE *b = open_memstream(&body, &blen);
+  if (b == NULL)
+    return;
+
+  if (json_parse(msg, len, &req) != 0) {
+    fprintf(b, "{\"jsonrpc\":\"2.0\",\"id\":null,\"error\":{\"code\":%d,\"message\":\"parse error\"}}",
+            RPC_PARSE_ERROR);
+    n = 1;
+  } else if (req.type == JSON_ARRAY && req.count > 0) {
+    fputc('[', b);
+    for (int i = 0; i < req.count; i++)
+      n += handle_request(s, &req.items[i], b, n > 0 ? "," : "");
+    fputc(']', b);
+  } else {
+    n = handle_request(s, &req, b, "");
+  }
+  json_free(&req);
+
+  fclose(b);
+  if (n > 0) {
+    if (framed)
+      fprintf(out, "Content-Length: %zu\r\n\r\n", blen);
+    fwrite(body, 1, blen, out);
+    if (!framed)
+      fputc('\n', out);
+  }
+  free(body);
+}
+
+/*
+ * Read more input. Pending responses are flushed first unless more input is
+ * already waiting, so pipelined requests are answered in one write.
+ */
+static int fill(INPUT *in, FILE *out) {
+  struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+
+  if (in->pos > 0) {
+    memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+    in->len -= in->pos;
+    in->pos = 0;
+  }
+  if (in->len == in->cap) {
+    size_t cap = in->cap ? in->cap * 2 : 65536;
+    char *buf = cap <= SERVE_MAX_MESSAGE ? realloc(in->buf, cap) : NULL;
+    if (buf == NULL) {
+      fprintf(stderr, "Error: request too large\n");
+      return 1;
+    }
+    in->buf = buf;
+    in->cap = cap;
+  }
+
+  if (poll(&pfd, 1, 0) <= 0 && fflush(out) != 0)
+    return 1;
+  for (;;) {
+    ssize_t n = read(STDIN_FILENO, in->buf + in->len, in->cap - in->len);
+    if (n >= 0) {
+      in->len += n;
+      in->eof = n == 0;
+      return 0;
+    }
+    if (errno != EINTR || stopping)
+      return 1;
+  }
+}
+
+/* Next message in the input: a line, or a body after Content-Length headers */
+static int next_message(INPUT *in, FILE *out, const char **msg, size_t *len, int *framed) {
+  for (;;) {
+    while (in->pos < in->len && isspace((unsigned char)in->buf[in->pos]))
+      in->pos++;
+
+    char *p = in->buf + in->pos;
+    size_t avail = in->len - in->pos;
+    if (avail >= 15 && strncasecmp(p, "Content-Length:", 15) == 0) {
+      char *headers_end = memmem(p, avail, "\r\n\r\n", 4);
+      if (headers_end != NULL) {
+        size_t skip = headers_end + 4 - p;
+        size_t body = strtoul(p + 15, NULL, 10);
+        if (body > SERVE_MAX_MESSAGE) {
+          fprintf(stderr, "Error: request too large\n");
+          return 0;
+        }
+        if (avail - skip >= body) {
+          *msg = p + skip;
+          *len = body;
+          *framed = 1;
+          in->pos += skip + body;
+          return 1;
+        }
+      }
+    } else if (avail > 0) {
+      char *nl = memchr(p, '\n', avail);
+      if (nl != NULL || in->eof) {
+        *msg = p;
+        *len = nl != NULL ? (size_t)(nl - p) : avail;
+        *framed = 0;
+        in->pos += *len + (nl != NULL);
+        return 1;
+      }
+    }
+
+    if (in->eof || stopping || fill(in, out) != 0)
+      return 0;
+  }
+}
+
+int serve_run(const char *name) {
+  SERVER s;
+  INPUT in = {NULL, 0, 0, 0, 0};
+  struct sigaction sa;
+  const char *msg;
+  size_t len;
+  int framed;
+
+  memset(&s, 0, sizeof(s));
+  s.name = name != NULL ? name : dry_default_diary();
+
+  /* responses go to a private copy of stdout; stray output goes to stderr */
+  int fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+  FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+  if (out == NULL) {
+    fprintf(stderr, "Error: can't write responses: %s\n", strerror(errno));
+    return 1;
+  }
+  fflush(stdout);
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+
+  /* lock the diaries when asked to stop, or when the client goes away */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  while (!stopping && next_message(&in, out, &msg, &len, &framed)) {
+    handle_message(&s, msg, len, framed, out);
+    if (ferror(out))
+      break;
+  }
+  fflush(out);
+
+  for (int i = 0; i < s.count; i++)
+    dry_close(s.diaries[i]);
+  free(in.buf);
+  fclose(out);
+  return 0;
+}
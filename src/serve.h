@@ -0,0 +1,33 @@
+/*
+ * serve.h - JSON-RPC server over stdio for editor integration
+ *
+ * dry serve reads JSON-RPC 2.0 requests on stdin and answers on stdout,
+ * one JSON document per line, or with LSP-style "Content-Length:" headers
+ * (answered the same way). Requests are handled in order; answers are
+ * flushed once no more requests are pending, so a client can pipeline many.
+ *
+ * Methods (params are named; diary defaults to the configured one):
+ *
+ *   list    {diary, date | from, to}    days and their entries
+ *   show    {diary, id | date, section} metadata and text of an entry or day
+ *   append  {diary, text, time}         add text to the day note under a header
+ *   search  {diary, query, limit}       ranked sections with a snippet
+ *   unlock  {diary, passphrase}         mount or unlock, kept until lock or exit
+ *   lock    {diary}
+ *
+ * Dates are range expressions as in dry list (2025-03-14, 2025-03, -7d, ...);
+ * from starts with the first day of its span and to ends with the last.
+ *
+ * Diaries are opened with libdry (see libdry.h) and stay unlocked between
+ * requests, with their catalog and search index in memory. Everything is
+ * locked again when stdin is closed.
+ */
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "dry.h"
+
+/* Serve requests until end of input or a signal (name = default diary) */
+int serve_run(const char *name);
+
+#endif /* SERVE_H */
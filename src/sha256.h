@@ -0,0 +1,29 @@
+/*
+ * sha256.h - SHA-256 message digest
+ *
+ * Self-contained so content checksums work in builds without libcrypto.
+ */
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_LEN 32
+#define SHA256_HEX_LEN (2 * SHA256_DIGEST_LEN + 1)
+
+typedef struct {
+  uint32_t h[8];
+  uint64_t len;               /* bytes hashed so far */
+  unsigned char block[64];
+  size_t fill;                /* bytes waiting in block */
+} SHA256_STATE;
+
+void sha256_init(SHA256_STATE *s);
+void sha256_update(SHA256_STATE *s, const void *data, size_t len);
+void sha256_final(SHA256_STATE *s, unsigned char digest[SHA256_DIGEST_LEN]);
+
+/* Lowercase hex form of a digest */
+void sha256_hex(const unsigned char digest[SHA256_DIGEST_LEN], char hex[SHA256_HEX_LEN]);
+
+#endif /* SHA256_H */
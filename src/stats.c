@@ -0,0 +1,507 @@
+/*
+ * stats.c - Activity statistics implementation
+ *
+ * The cache (.dry/stats) holds one line per day, tab separated:
+ *
+ *   <date> <signature> <entries> <notes> <media> <missing> <words> <seconds> <bytes>
+ *
+ * The signature hashes id, type, size and mtime of every entry of the day;
+ * notes are stat'ed again since editing one in place leaves the day
+ * directory (and so the catalog) untouched. Days with recordings that had
+ * no sidecar yet only have their sidecars read again.
+ */
+#include "stats.h"
+#include "media.h"
+#include "note.h"
+#include "store.h"
+#include "utils.h"
+#include <ctype.h>
+#include <pthread.h>
+
+#define STATS_FILE "stats"
+#define STATS_MAGIC "# dry stats v1"
+#define STATS_THREADS 8
+#define HEATMAP_WEEKS 53
+
+/* The days of one month, a range of the catalog */
+typedef struct {
+  int first;
+  int count;
+} STATS_MONTH;
+
+/* Work shared by the stats threads */
+typedef struct {
+  const CATALOG *cat;
+  const STATS_DIARY *cache;
+  STATS_DAY *days;        /* one per catalog day */
+  const STATS_MONTH *months;
+  int count;
+  int next;               /* next month, taken atomically */
+  int rescanned;
+  int refreshed;          /* days whose sidecars were read again */
+} STATS_WORK;
+
+typedef enum { GROUP_YEAR, GROUP_MONTH, GROUP_WEEK } GROUP_KIND;
+
+/* Totals of a year, month or week */
+typedef struct {
+  char key[11];
+  int days;
+  int entries;
+  long long words;
+  double seconds;
+  long long bytes;
+} STATS_GROUP;
+
+static uint64_t fnv(uint64_t h, const void *data, size_t len) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ p[i]) * 1099511628211ULL;
+  return h;
+}
+
+static long long count_words(const char *p, size_t len) {
+  long long words = 0;
+  int in_word = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    int space = isspace((unsigned char)p[i]);
+    if (!space && !in_word)
+      words++;
+    in_word = !space;
+  }
+  return words;
+}
+
+/* Words of a note without its headers */
+static long long note_words(const char *path) {
+  NOTE note;
+
+  if (note_load(&note, path) != 0)
+    return 0;
+  long long words = count_words(note.data, note.count > 0 ? note.sections[0].offset : note.len);
+  for (int i = 0; i < note.count; i++)
+    words += count_words(note.data + note.sections[i].body,
+                         note.sections[i].end - note.sections[i].body);
+  note_free(&note);
+  return words;
+}
+
+static int stats_day_cmp(const void *a, const void *b) {
+  return strcmp(((const STATS_DAY *)a)->date, ((const STATS_DAY *)b)->date);
+}
+
+static void day_media(const CATALOG *cat, const CATALOG_DAY *day, STATS_DAY *out) {
+  MEDIA_INFO info;
+
+  out->seconds = 0;
+  out->missing = 0;
+  for (int i = 0; i < day->count; i++) {
+    if (day->entries[i].type != MEDIA)
+      continue;
+    if (media_sidecar_load(cat->dpath, day->entries[i].id, &info) == 0)
+      out->seconds += info.duration;
+    else
+      out->missing++;
+  }
+}
+
+static void day_compute(STATS_WORK *work, int idx) {
+  const CATALOG_DAY *day = &work->cat->days[idx];
+  STATS_DAY *out = &work->days[idx];
+  char path[8400];
+  uint64_t sig = 14695981039346656037ULL;
+
+  memset(out, 0, sizeof(*out));
+  snprintf(out->date, sizeof(out->date), "%s", day->date);
+  for (int i = 0; i < day->count; i++) {
+    const CATALOG_ENTRY *e = &day->entries[i];
+    long long size = e->size, mtime = e->mtime;
+    struct stat st;
+
+    if (e->type == TEXT) {
+      catalog_entry_path(work->cat, day, e, path, sizeof(path));
+      if (stat(path, &st) == 0) {
+        size = store_plain_size(path, st.st_size);
+        mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+      }
+      out->notes++;
+    } else if (e->type == MEDIA) {
+      out->media++;
+    }
+    sig = fnv(sig, e->id, strlen(e->id) + 1);
+    sig = fnv(sig, &e->type, sizeof(e->type));
+    sig = fnv(sig, &size, sizeof(size));
+    sig = fnv(sig, &mtime, sizeof(mtime));
+    out->entries++;
+    out->bytes += size;
+  }
+  out->sig = sig;
+
+  const STATS_DAY *cached = bsearch(out, work->cache->days, work->cache->count, sizeof(STATS_DAY),
+                                    stats_day_cmp);
+  if (cached != NULL && cached->sig == sig) {
+    *out = *cached;
+    if (out->missing > 0) {
+      day_media(work->cat, day, out);
+      __atomic_fetch_add(&work->refreshed, 1, __ATOMIC_RELAXED);
+    }
+    return;
+  }
+
+  __atomic_fetch_add(&work->rescanned, 1, __ATOMIC_RELAXED);
+  for (int i = 0; i < day->count; i++) {
+    if (day->entries[i].type != TEXT)
+      continue;
+    catalog_entry_path(work->cat, day, &day->entries[i], path, sizeof(path));
+    out->words += note_words(path);
+  }
+  day_media(work->cat, day, out);
+}
+
+static void *stats_worker(void *arg) {
+  STATS_WORK *work = arg;
+  int m;
+
+  while ((m = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count)
+    for (int i = work->months[m].first; i < work->months[m].first + work->months[m].count; i++)
+      day_compute(work, i);
+  return NULL;
+}
+
+static void cache_load(const char *dpath, STATS_DIARY *cache) {
+  char path[4200];
+  char line[512];
+  int cap = 0;
+
+  memset(cache, 0, sizeof(*cache));
+  if (get_meta_path(dpath, STATS_FILE, path, sizeof(path)) != 0)
+    return;
+  FILE *fd = store_fopen(path, "r");
+  if (fd == NULL)
+    return;
+
+  if (fgets(line, sizeof(line), fd) == NULL || strncmp(line, STATS_MAGIC, strlen(STATS_MAGIC)) != 0) {
+    fclose(fd);
+    return;
+  }
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    STATS_DAY d = {0};
+    unsigned long long sig;
+
+    if (sscanf(line, "%10[^\t]\t%llx\t%d\t%d\t%d\t%d\t%lld\t%lf\t%lld", d.date, &sig, &d.entries,
+               &d.notes, &d.media, &d.missing, &d.words, &d.seconds, &d.bytes) != 9)
+      continue;
+    d.sig = sig;
+    if (cache->count == cap) {
+      cap = cap ? cap * 2 : 256;
+      STATS_DAY *days = realloc(cache->days, cap * sizeof(STATS_DAY));
+      if (days == NULL)
+        break;
+      cache->days = days;
+    }
+    cache->days[cache->count++] = d;
+  }
+  fclose(fd);
+  qsort(cache->days, cache->count, sizeof(STATS_DAY), stats_day_cmp);
+}
+
+static int cache_save(const char *dpath, const STATS_DIARY *stats) {
+  char path[4200];
+  char tmp[4300];
+
+  if (get_meta_path(dpath, STATS_FILE, path, sizeof(path)) != 0)
+    return 1;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *fd = store_fopen(tmp, "w");
+  if (fd == NULL)
+    return 1;
+
+  fprintf(fd, "%s\n", STATS_MAGIC);
+  for (int i = 0; i < stats->count; i++) {
+    const STATS_DAY *d = &stats->days[i];
+    fprintf(fd, "%s\t%016llx\t%d\t%d\t%d\t%d\t%lld\t%.3f\t%lld\n", d->date,
+            (unsigned long long)d->sig, d->entries, d->notes, d->media, d->missing, d->words,
+            d->seconds, d->bytes);
+  }
+  if (fclose(fd) != 0 || rename(tmp, path) != 0) {
+    unlink(tmp);
+    return 1;
+  }
+  return 0;
+}
+
+int stats_collect(CATALOG *cat, STATS_DIARY *stats) {
+  STATS_DIARY cache;
+  pthread_t threads[STATS_THREADS];
+  int started = 0;
+
+  memset(stats, 0, sizeof(*stats));
+  if (catalog_sync(cat, NULL, NULL) != 0)
+    return 1;
+
+  /* a missing or unreadable cache only means every day is read again */
+  cache_load(cat->dpath, &cache);
+
+  stats->days = calloc(cat->count > 0 ? cat->count : 1, sizeof(STATS_DAY));
+  STATS_MONTH *months = malloc((cat->count > 0 ? cat->count : 1) * sizeof(STATS_MONTH));
+  if (stats->days == NULL || months == NULL) {
+    free(months);
+    stats_free(&cache);
+    stats_free(stats);
+    return 1;
+  }
+
+  STATS_WORK work = {cat, &cache, stats->days, months, 0, 0, 0, 0};
+  for (int i = 0; i < cat->count; i++) {
+    if (i == 0 || strncmp(cat->days[i].date, cat->days[i - 1].date, 7) != 0)
+      months[work.count++] = (STATS_MONTH){i, 0};
+    months[work.count - 1].count++;
+  }
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int wanted = cpus < 1 ? 1 : cpus > STATS_THREADS ? STATS_THREADS : (int)cpus;
+  if (wanted > work.count)
+    wanted = work.count;
+  for (; started < wanted - 1; started++)
+    if (pthread_create(&threads[started], NULL, stats_worker, &work) != 0)
+      break;
+
+  /* the calling thread works too */
+  stats_worker(&work);
+
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+
+  stats->count = cat->count;
+  stats->rescanned = work.rescanned;
+  if ((work.rescanned > 0 || work.refreshed > 0 || cache.count != stats->count) &&
+      cache_save(cat->dpath, stats) != 0)
+    fprintf(stderr, "Warning: failed to update the stats cache\n");
+
+  free(months);
+  stats_free(&cache);
+  return 0;
+}
+
+void stats_free(STATS_DIARY *stats) {
+  free(stats->days);
+  memset(stats, 0, sizeof(*stats));
+}
+
+/* Days since 1970-01-01 of a civil date */
+static long days_from_civil(int y, int m, int d) {
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;
+  long doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+static long day_number(const char *date) {
+  int y = 1970, m = 1, d = 1;
+  sscanf(date, "%d-%d-%d", &y, &m, &d);
+  return days_from_civil(y, m, d);
+}
+
+static void group_key(const char *date, GROUP_KIND kind, char *key, size_t size) {
+  if (kind == GROUP_YEAR) {
+    snprintf(key, size, "%.4s", date);
+  } else if (kind == GROUP_MONTH) {
+    snprintf(key, size, "%.7s", date);
+  } else {
+    time_t t = (time_t)day_number(date) * 86400;
+    strftime(key, size, "%G-W%V", gmtime(&t));
+  }
+}
+
+/* Totals of the days with entries, per year, month or ISO week */
+static int group_days(const STATS_DIARY *stats, GROUP_KIND kind, STATS_GROUP **out) {
+  STATS_GROUP *groups = malloc((stats->count > 0 ? stats->count : 1) * sizeof(STATS_GROUP));
+  int count = 0;
+
+  *out = groups;
+  if (groups == NULL)
+    return 0;
+  for (int i = 0; i < stats->count; i++) {
+    const STATS_DAY *d = &stats->days[i];
+    char key[11];
+
+    if (d->entries == 0)
+      continue;
+    group_key(d->date, kind, key, sizeof(key));
+    if (count == 0 || strcmp(groups[count - 1].key, key) != 0) {
+      memset(&groups[count], 0, sizeof(STATS_GROUP));
+      snprintf(groups[count].key, sizeof(groups[count].key), "%s", key);
+      count++;
+    }
+    STATS_GROUP *g = &groups[count - 1];
+    g->days++;
+    g->entries += d->entries;
+    g->words += d->words;
+    g->seconds += d->seconds;
+    g->bytes += d->bytes;
+  }
+  return count;
+}
+
+/* Calendar of the last HEATMAP_WEEKS weeks, one row per weekday */
+static void print_heatmap(const STATS_DIARY *stats, FILE *out) {
+  static const char *weekdays[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
+  static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                 "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+  static const char levels[] = "-+*#";
+  int counts[HEATMAP_WEEKS * 7] = {0};
+  char labels[HEATMAP_WEEKS + 4];
+  int max = 0, free_from = 0;
+
+  time_t now = time(NULL);
+  struct tm *tm = localtime(&now);
+  long today = days_from_civil(tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday);
+  long weekday = ((today + 3) % 7 + 7) % 7;   /* 1970-01-01 was a Thursday */
+  long start = today - weekday - (HEATMAP_WEEKS - 1) * 7;
+
+  for (int i = 0; i < stats->count; i++) {
+    long n = day_number(stats->days[i].date);
+    if (n >= start && n <= today) {
+      counts[n - start] += stats->days[i].entries;
+      if (counts[n - start] > max)
+        max = counts[n - start];
+    }
+  }
+
+  /* month names above the week they start in */
+  memset(labels, ' ', sizeof(labels) - 1);
+  labels[sizeof(labels) - 1] = '\0';
+  for (int w = 0; w < HEATMAP_WEEKS; w++) {
+    time_t t = (time_t)(start + w * 7) * 86400;
+    struct tm *day = gmtime(&t);
+    if (day->tm_mday <= 7 && w >= free_from) {
+      memcpy(labels + w, months[day->tm_mon], 3);
+      free_from = w + 4;
+    }
+  }
+  for (int i = sizeof(labels) - 2; i >= 0 && labels[i] == ' '; i--)
+    labels[i] = '\0';
+  fprintf(out, "    %s\n", labels);
+
+  for (int row = 0; row < 7; row++) {
+    fprintf(out, "%s ", weekdays[row]);
+    for (int w = 0; w < HEATMAP_WEEKS; w++) {
+      long n = start + w * 7 + row;
+      int c = counts[n - start];
+      if (n > today)
+        break;
+      fputc(c == 0 ? '.' : levels[(c * 4 + max - 1) / max - 1], out);
+    }
+    fputc('\n', out);
+  }
+  fprintf(out, "    . none  - + * # up to %d entry(s) a day\n", max);
+}
+
+void stats_print(const STATS_DIARY *stats, FILE *out) {
+  STATS_GROUP *years;
+  const STATS_DAY *first = NULL, *last = NULL;
+  long long entries = 0, words = 0, bytes = 0;
+  double seconds = 0;
+  int days = 0, missing = 0;
+  char size[16], recorded[32];
+
+  for (int i = 0; i < stats->count; i++) {
+    const STATS_DAY *d = &stats->days[i];
+    if (d->entries == 0)
+      continue;
+    if (first == NULL)
+      first = d;
+    last = d;
+    days++;
+    entries += d->entries;
+    words += d->words;
+    seconds += d->seconds;
+    bytes += d->bytes;
+    missing += d->missing;
+  }
+  if (first == NULL) {
+    fprintf(out, "Activity: no entries\n");
+    return;
+  }
+
+  double span = day_number(last->date) - day_number(first->date) + 1;
+  format_size(bytes, size, sizeof(size));
+  media_format_duration(seconds, recorded, sizeof(recorded));
+  fprintf(out, "Activity: %lld entry(s) on %d day(s), %s to %s\n", entries, days, first->date,
+          last->date);
+  fprintf(out, "  per day:    %.2f\n", entries / span);
+  fprintf(out, "  per week:   %.1f\n", entries / span * 7);
+  fprintf(out, "  per month:  %.1f\n", entries / span * 30.44);
+  fprintf(out, "  words:      %lld\n", words);
+  fprintf(out, "  recorded:   %s", recorded);
+  if (missing > 0)
+    fprintf(out, " (%d recording(s) without metadata, see 'dry reindex')", missing);
+  fprintf(out, "\n  storage:    %s\n\n", size);
+
+  int count = group_days(stats, GROUP_YEAR, &years);
+  fprintf(out, "  %-4s  %5s  %7s  %9s  %9s  %7s\n", "year", "days", "entries", "words", "recorded",
+          "storage");
+  for (int i = 0; i < count; i++) {
+    format_size(years[i].bytes, size, sizeof(size));
+    media_format_duration(years[i].seconds, recorded, sizeof(recorded));
+    fprintf(out, "  %-4s  %5d  %7d  %9lld  %9s  %7s\n", years[i].key, years[i].days,
+            years[i].entries, years[i].words, recorded, size);
+  }
+  free(years);
+
+  fprintf(out, "\n");
+  print_heatmap(stats, out);
+}
+
+static void print_groups_json(const STATS_DIARY *stats, GROUP_KIND kind, const char *name,
+                              FILE *out) {
+  STATS_GROUP *groups;
+  int count = group_days(stats, kind, &groups);
+
+  fprintf(out, "\"%ss\":[", name);
+  for (int i = 0; i < count; i++)
+    fprintf(out, "%s{\"%s\":\"%s\",\"days\":%d,\"entries\":%d,\"words\":%lld,"
+            "\"seconds\":%.0f,\"bytes\":%lld}", i > 0 ? "," : "", name, groups[i].key,
+            groups[i].days, groups[i].entries, groups[i].words, groups[i].seconds,
+            groups[i].bytes);
+  fprintf(out, "]");
+  free(groups);
+}
+
+void stats_print_json(const STATS_DIARY *stats, FILE *out) {
+  long long entries = 0, words = 0, bytes = 0;
+  double seconds = 0;
+  int days = 0, missing = 0;
+
+  for (int i = 0; i < stats->count; i++) {
+    const STATS_DAY *d = &stats->days[i];
+    if (d->entries == 0)
+      continue;
+    days++;
+    entries += d->entries;
+    words += d->words;
+    seconds += d->seconds;
+    bytes += d->bytes;
+    missing += d->missing;
+  }
+
+  fprintf(out, "{\"days\":%d,\"entries\":%lld,\"words\":%lld,\"seconds\":%.0f,\"bytes\":%lld,"
+          "\"missing_metadata\":%d,", days, entries, words, seconds, bytes, missing);
+  print_groups_json(stats, GROUP_YEAR, "year", out);
+  fputc(',', out);
+  print_groups_json(stats, GROUP_MONTH, "month", out);
+  fputc(',', out);
+  print_groups_json(stats, GROUP_WEEK, "week", out);
+  fprintf(out, ",\"daily\":[");
+  int n = 0;
+  for (int i = 0; i < stats->count; i++) {
+    const STATS_DAY *d = &stats->days[i];
+    if (d->entries == 0)
+      continue;
+    fprintf(out, "%s{\"date\":\"%s\",\"entries\":%d,\"words\":%lld,\"seconds\":%.0f,\"bytes\":%lld}",
+            n++ > 0 ? "," : "", d->date, d->entries, d->words, d->seconds, d->bytes);
+  }
+  fprintf(out, "]}");
+}
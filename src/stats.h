@@ -0,0 +1,51 @@
+/*
+ * stats.h - Activity statistics of a diary
+ *
+ * Entries, words written, recorded time and storage are aggregated per day
+ * from the catalog. The months of the diary are spread over a few threads;
+ * the aggregates of each day are cached in the diary metadata directory
+ * (.dry/stats) with a signature of its entries, so a later run reads only
+ * the notes of days that changed since.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include "dry.h"
+#include "catalog.h"
+#include <stdint.h>
+
+/* Aggregates of one day */
+typedef struct {
+  char date[11];          /* YYYY-MM-DD */
+  uint64_t sig;           /* signature of the day's entries */
+  int entries;
+  int notes;              /* text entries */
+  int media;              /* recordings */
+  int missing;            /* recordings without a media sidecar */
+  long long words;        /* words in notes, headers excluded */
+  double seconds;         /* recorded time */
+  long long bytes;        /* size of the entries */
+} STATS_DAY;
+
+typedef struct {
+  STATS_DAY *days;        /* sorted by date */
+  int count;
+  int rescanned;          /* days whose notes were read this run */
+} STATS_DIARY;
+
+/*
+ * Compute the aggregates of every day of cat (synced first) and update the
+ * cache. Returns 0 on success.
+ */
+int stats_collect(CATALOG *cat, STATS_DIARY *stats);
+
+/* Release memory held by stats */
+void stats_free(STATS_DIARY *stats);
+
+/* Print totals, averages, a table per year and a heatmap of the last year */
+void stats_print(const STATS_DIARY *stats, FILE *out);
+
+/* Print the same as a JSON object, with per year, month, week and day arrays */
+void stats_print_json(const STATS_DIARY *stats, FILE *out);
+
+#endif /* STATS_H */
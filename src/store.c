@@ -0,0 +1,696 @@
+/*
+ * store.c - Native encrypted storage implementation
+ *
+ * Key file (.dry/key):
+ *   dry-store 1
+ *   scrypt <log2 N> <r> <p> <salt>
+ *   key <nonce> <wrapped key> <tag>
+ * with binary fields in hex. The diary key is sealed with
+ * ChaCha20-Poly1305 under the scrypt output.
+ *
+ * Encrypted file:
+ *   "DRYSTOR1" | salt (16) | chunk | chunk | ... | final chunk
+ * Each chunk is up to 64 KiB of ciphertext followed by its 16 byte tag,
+ * sealed with a per-file key HMAC-SHA256(diary key, salt). The nonce is the
+ * chunk number and the associated data says whether the chunk is the last
+ * one, so chunks can't be reordered, dropped or truncated unnoticed. An
+ * empty file still has one (empty) final chunk.
+ */
+#define _GNU_SOURCE
+#include "store.h"
+#include "utils.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <termios.h>
+
+#ifdef HAVE_LIBCRYPTO
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#endif
+
+#define STORE_KEY_FILE "key"
+#define STORE_MAGIC "DRYSTOR1"
+#define MAGIC_LEN 8
+#define SALT_LEN 16
+#define HEADER_LEN (MAGIC_LEN + SALT_LEN)
+#define KEY_LEN 32
+#define NONCE_LEN 12
+#define TAG_LEN 16
+#define CHUNK_LEN 65536
+
+/* scrypt cost: 32 MiB, about 0.1 s */
+#define SCRYPT_LOG_N 15
+#define SCRYPT_R 8
+#define SCRYPT_P 1
+#define SCRYPT_MAXMEM (64 * 1024 * 1024)
+
+#define KEY_AAD "dry-store key v1"
+
+int store_is_native(const char *dpath) {
+  char path[4096];
+  /* no get_meta_path(): it must not create .dry in an empty encfs mount point */
+  snprintf(path, sizeof(path), "%s/%s/%s", dpath, DRY_META_DIR, STORE_KEY_FILE);
+  return do_file_exist(path);
+}
+
+long long store_plain_size(const char *path, long long size) {
+  if (!store_active(path) || size < HEADER_LEN)
+    return size;
+  long long body = size - HEADER_LEN;
+  long long chunks = (body + CHUNK_LEN + TAG_LEN - 1) / (CHUNK_LEN + TAG_LEN);
+  return body - chunks * TAG_LEN;
+}
+
+int store_get_passphrase(const char *prompt, int confirm, char *buf, size_t size) {
+  const char *env = getenv("DRY_PASSWORD");
+  if (env == NULL || *env == '\0')
+    env = getenv("DRY_ENCFS_PASSWORD");
+  if (env != NULL && *env != '\0') {
+    if (snprintf(buf, size, "%s", env) >= (int)size)
+      return 1;
+    return 0;
+  }
+
+  FILE *tty = fopen("/dev/tty", "r+");
+  if (tty == NULL) {
+    msg_error("no terminal to ask the passphrase on (set DRY_PASSWORD)");
+    return 1;
+  }
+
+  struct termios old, noecho;
+  int fd = fileno(tty);
+  int restore = tcgetattr(fd, &old) == 0;
+  if (restore) {
+    noecho = old;
+    noecho.c_lflag &= ~ECHO;
+    tcsetattr(fd, TCSAFLUSH, &noecho);
+  }
+
+  char again[256];
+  int rc = 0;
+  for (int i = 0; i < (confirm ? 2 : 1) && rc == 0; i++) {
+    char *dst = i == 0 ? buf : again;
+    size_t len = i == 0 ? size : sizeof(again);
+    fprintf(tty, "%s", i == 0 ? prompt : "Repeat passphrase: ");
+    fflush(tty);
+    if (fgets(dst, len, tty) == NULL)
+      rc = 1;
+    else
+      dst[strcspn(dst, "\n")] = '\0';
+    fprintf(tty, "\n");
+  }
+
+  if (restore)
+    tcsetattr(fd, TCSAFLUSH, &old);
+  fclose(tty);
+
+  if (rc == 0 && confirm && strcmp(buf, again) != 0) {
+    msg_error("passphrases don't match");
+    rc = 1;
+  }
+  if (rc == 0 && *buf == '\0') {
+    msg_error("empty passphrase");
+    rc = 1;
+  }
+  memset(again, 0, sizeof(again));
+  return rc;
+}
+
+#ifdef HAVE_LIBCRYPTO
+
+/* Key of the open diary */
+static struct {
+  int open;
+  char dpath[4096];
+  size_t len;
+  unsigned char key[KEY_LEN];
+} store;
+
+/* Private directory for checked out files, removed at exit by the process that made it */
+static char checkout_dir[4096];
+static pid_t checkout_pid;
+
+int store_supported(void) {
+  return 1;
+}
+
+static void to_hex(const unsigned char *in, size_t len, char *out) {
+  for (size_t i = 0; i < len; i++)
+    sprintf(out + 2 * i, "%02x", in[i]);
+}
+
+static int from_hex(const char *in, unsigned char *out, size_t len) {
+  if (strlen(in) != 2 * len)
+    return 1;
+  for (size_t i = 0; i < len; i++) {
+    unsigned v;
+    if (sscanf(in + 2 * i, "%2x", &v) != 1)
+      return 1;
+    out[i] = v;
+  }
+  return 0;
+}
+
+/*
+ * One ChaCha20-Poly1305 operation. When decrypting, tag is checked and
+ * 1 is returned if the data was tampered with.
+ */
+static int aead(EVP_CIPHER_CTX *ctx, int enc, const unsigned char *key,
+                const unsigned char *nonce, const unsigned char *aad, int aad_len,
+                const unsigned char *in, int len, unsigned char *out, unsigned char *tag) {
+  unsigned char end[16];
+  int n;
+
+  if (!EVP_CipherInit_ex(ctx, EVP_chacha20_poly1305(), NULL, NULL, NULL, enc) ||
+      !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, NONCE_LEN, NULL) ||
+      !EVP_CipherInit_ex(ctx, NULL, NULL, key, nonce, enc))
+    return 1;
+  if (!enc && !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, TAG_LEN, tag))
+    return 1;
+  if (aad_len > 0 && !EVP_CipherUpdate(ctx, NULL, &n, aad, aad_len))
+    return 1;
+  if (len > 0 && !EVP_CipherUpdate(ctx, out, &n, in, len))
+    return 1;
+  if (!EVP_CipherFinal_ex(ctx, end, &n))
+    return 1;
+  if (enc && !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, TAG_LEN, tag))
+    return 1;
+  return 0;
+}
+
+static int derive_kek(const char *passphrase, const unsigned char *salt, int log_n, int r,
+                      int p, unsigned char *kek) {
+  if (log_n < 10 || log_n > 24 || r < 1 || r > 64 || p < 1 || p > 16)
+    return 1;
+  return !EVP_PBE_scrypt(passphrase, strlen(passphrase), salt, SALT_LEN,
+                         (uint64_t)1 << log_n, r, p, SCRYPT_MAXMEM, kek, KEY_LEN);
+}
+
+int store_create(const char *dpath, const char *passphrase) {
+  unsigned char key[KEY_LEN], kek[KEY_LEN], salt[SALT_LEN], nonce[NONCE_LEN];
+  unsigned char wrapped[KEY_LEN], tag[TAG_LEN];
+  char path[4096], hex[2 * KEY_LEN + 1];
+  int rc = 1;
+
+  if (make_dirs(dpath, 0700) != 0 || get_meta_path(dpath, STORE_KEY_FILE, path, sizeof(path)) != 0)
+    return 1;
+
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  if (ctx == NULL || RAND_bytes(key, KEY_LEN) != 1 || RAND_bytes(salt, SALT_LEN) != 1 ||
+      RAND_bytes(nonce, NONCE_LEN) != 1 ||
+      derive_kek(passphrase, salt, SCRYPT_LOG_N, SCRYPT_R, SCRYPT_P, kek) != 0 ||
+      aead(ctx, 1, kek, nonce, (const unsigned char *)KEY_AAD, strlen(KEY_AAD), key, KEY_LEN,
+           wrapped, tag) != 0)
+    goto out;
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  FILE *f = fd < 0 ? NULL : fdopen(fd, "w");
+  if (f == NULL) {
+    msg_error("can't create %s: %s", path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    goto out;
+  }
+  fprintf(f, "dry-store 1\n");
+  to_hex(salt, SALT_LEN, hex);
+  fprintf(f, "scrypt %d %d %d %s\n", SCRYPT_LOG_N, SCRYPT_R, SCRYPT_P, hex);
+  to_hex(nonce, NONCE_LEN, hex);
+  fprintf(f, "key %s ", hex);
+  to_hex(wrapped, KEY_LEN, hex);
+  fprintf(f, "%s ", hex);
+  to_hex(tag, TAG_LEN, hex);
+  fprintf(f, "%s\n", hex);
+  rc = fclose(f) != 0;
+  if (rc != 0)
+    unlink(path);
+
+out:
+  EVP_CIPHER_CTX_free(ctx);
+  OPENSSL_cleanse(key, sizeof(key));
+  OPENSSL_cleanse(kek, sizeof(kek));
+  return rc;
+}
+
+int store_open(const char *dpath, const char *passphrase) {
+  unsigned char kek[KEY_LEN], salt[SALT_LEN], nonce[NONCE_LEN];
+  unsigned char wrapped[KEY_LEN], tag[TAG_LEN];
+  char path[4096], line[256], s_hex[80], n_hex[80], k_hex[80], t_hex[80];
+  int version = 0, log_n = 0, r = 0, p = 0, fields = 0;
+
+  if (store.open && strcmp(store.dpath, dpath) == 0)
+    return 0;
+  if (get_meta_path(dpath, STORE_KEY_FILE, path, sizeof(path)) != 0)
+    return 1;
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    msg_error("can't read %s: %s", path, strerror(errno));
+    return 2;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "dry-store %d", &version) == 1)
+      fields |= 1;
+    else if (sscanf(line, "scrypt %d %d %d %79s", &log_n, &r, &p, s_hex) == 4)
+      fields |= 2;
+    else if (sscanf(line, "key %79s %79s %79s", n_hex, k_hex, t_hex) == 3)
+      fields |= 4;
+  }
+  fclose(f);
+
+  if (fields != 7 || version != 1 || from_hex(s_hex, salt, SALT_LEN) != 0 ||
+      from_hex(n_hex, nonce, NONCE_LEN) != 0 || from_hex(k_hex, wrapped, KEY_LEN) != 0 ||
+      from_hex(t_hex, tag, TAG_LEN) != 0) {
+    msg_error("%s is not a valid key file", path);
+    return 2;
+  }
+
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  int rc = ctx == NULL || derive_kek(passphrase, salt, log_n, r, p, kek) != 0 ||
+           aead(ctx, 0, kek, nonce, (const unsigned char *)KEY_AAD, strlen(KEY_AAD), wrapped,
+                KEY_LEN, store.key, tag) != 0;
+  EVP_CIPHER_CTX_free(ctx);
+  OPENSSL_cleanse(kek, sizeof(kek));
+
+  if (rc != 0) {
+    OPENSSL_cleanse(store.key, sizeof(store.key));
+    return 1;
+  }
+  snprintf(store.dpath, sizeof(store.dpath), "%s", dpath);
+  store.len = strlen(store.dpath);
+  while (store.len > 1 && store.dpath[store.len - 1] == '/')
+    store.dpath[--store.len] = '\0';
+  store.open = 1;
+  return 0;
+}
+
+void store_close(void) {
+  OPENSSL_cleanse(store.key, sizeof(store.key));
+  store.open = 0;
+  store_remove_checkouts();
+}
+
+int store_active(const char *path) {
+  if (!store.open || strncmp(path, store.dpath, store.len) != 0 || path[store.len] != '/')
+    return 0;
+  /* the key file itself is plain text */
+  const char *rel = path + store.len + 1;
+  return strcmp(rel, DRY_META_DIR "/" STORE_KEY_FILE) != 0;
+}
+
+/* State of an encrypted stream behind a FILE * */
+typedef struct {
+  FILE *fp;                       /* ciphertext */
+  int writing;
+  int failed;
+  unsigned char key[KEY_LEN];     /* per-file key */
+  uint64_t counter;               /* chunk number */
+  long long remaining;            /* reading: ciphertext bytes left */
+  size_t len, pos;                /* plaintext bytes in buf, read position */
+  unsigned char buf[CHUNK_LEN];
+  unsigned char out[CHUNK_LEN + TAG_LEN];
+  EVP_CIPHER_CTX *ctx;
+  char path[4096];                /* writing: target, replaced on close */
+  char tmp[4200];
+} STREAM;
+
+static void chunk_nonce(uint64_t counter, unsigned char *nonce) {
+  memset(nonce, 0, NONCE_LEN);
+  for (int i = 0; i < 8; i++)
+    nonce[i] = counter >> (8 * i);
+}
+
+static int file_key(const unsigned char *salt, unsigned char *key) {
+  unsigned int len = KEY_LEN;
+  return HMAC(EVP_sha256(), store.key, KEY_LEN, salt, SALT_LEN, key, &len) == NULL;
+}
+
+int store_keyed_id(const char *dpath, const char *in, char *out) {
+  unsigned char mac[KEY_LEN];
+  unsigned int len = KEY_LEN;
+
+  if (!store.open || strncmp(dpath, store.dpath, store.len) != 0 ||
+      strspn(dpath + store.len, "/") != strlen(dpath + store.len))
+    return 1;
+  if (HMAC(EVP_sha256(), store.key, KEY_LEN, (const unsigned char *)in, strlen(in), mac, &len) ==
+      NULL)
+    return 1;
+  to_hex(mac, KEY_LEN, out);
+  OPENSSL_cleanse(mac, sizeof(mac));
+  return 0;
+}
+
+static int seal_chunk(STREAM *s, int final) {
+  unsigned char nonce[NONCE_LEN];
+  unsigned char aad = final;
+
+  chunk_nonce(s->counter++, nonce);
+  if (aead(s->ctx, 1, s->key, nonce, &aad, 1, s->buf, s->len, s->out, s->out + s->len) != 0 ||
+      fwrite(s->out, 1, s->len + TAG_LEN, s->fp) != s->len + TAG_LEN) {
+    s->failed = 1;
+    return 1;
+  }
+  s->len = 0;
+  return 0;
+}
+
+static int open_chunk(STREAM *s) {
+  unsigned char nonce[NONCE_LEN];
+  long long clen = s->remaining < CHUNK_LEN + TAG_LEN ? s->remaining : CHUNK_LEN + TAG_LEN;
+  unsigned char aad = clen == s->remaining;
+
+  if (clen < TAG_LEN || fread(s->out, 1, clen, s->fp) != (size_t)clen) {
+    s->failed = 1;
+    return 1;
+  }
+  s->remaining -= clen;
+  s->len = clen - TAG_LEN;
+  s->pos = 0;
+  chunk_nonce(s->counter++, nonce);
+  if (aead(s->ctx, 0, s->key, nonce, &aad, 1, s->out, s->len, s->buf, s->out + s->len) != 0) {
+    s->failed = 1;
+    s->len = 0;
+    return 1;
+  }
+  return 0;
+}
+
+static ssize_t stream_read(void *cookie, char *buf, size_t size) {
+  STREAM *s = cookie;
+  size_t done = 0;
+
+  while (done < size) {
+    if (s->pos == s->len) {
+      if (s->remaining == 0 || s->failed)
+        break;
+      if (open_chunk(s) != 0) {
+        msg_error("%s: corrupted or tampered with", s->path);
+        errno = EIO;
+        return done > 0 ? (ssize_t)done : -1;
+      }
+      continue;
+    }
+    size_t n = s->len - s->pos < size - done ? s->len - s->pos : size - done;
+    memcpy(buf + done, s->buf + s->pos, n);
+    s->pos += n;
+    done += n;
+  }
+  return done;
+}
+
+static ssize_t stream_write(void *cookie, const char *buf, size_t size) {
+  STREAM *s = cookie;
+  size_t done = 0;
+
+  while (done < size) {
+    if (s->len == CHUNK_LEN && seal_chunk(s, 0) != 0) {
+      errno = EIO;
+      return -1;
+    }
+    size_t n = CHUNK_LEN - s->len < size - done ? CHUNK_LEN - s->len : size - done;
+    memcpy(s->buf + s->len, buf + done, n);
+    s->len += n;
+    done += n;
+  }
+  return done;
+}
+
+static void stream_free(STREAM *s) {
+  EVP_CIPHER_CTX_free(s->ctx);
+  OPENSSL_cleanse(s->key, sizeof(s->key));
+  OPENSSL_cleanse(s->buf, sizeof(s->buf));
+  free(s);
+}
+
+static int stream_close(void *cookie) {
+  STREAM *s = cookie;
+  int rc = 0;
+
+  if (s->writing) {
+    if (!s->failed)
+      seal_chunk(s, 1);
+    if (fflush(s->fp) != 0 || fsync(fileno(s->fp)) != 0)
+      s->failed = 1;
+    if (fclose(s->fp) != 0 || s->failed || rename(s->tmp, s->path) != 0) {
+      unlink(s->tmp);
+      errno = EIO;
+      rc = -1;
+    }
+  } else {
+    fclose(s->fp);
+    rc = s->failed ? -1 : 0;
+  }
+  stream_free(s);
+  return rc;
+}
+
+static FILE *open_reader(const char *path) {
+  unsigned char header[HEADER_LEN];
+  struct stat st;
+
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return NULL;
+
+  STREAM *s = calloc(1, sizeof(*s));
+  if (s == NULL || (s->ctx = EVP_CIPHER_CTX_new()) == NULL) {
+    free(s);
+    fclose(fp);
+    return NULL;
+  }
+  s->fp = fp;
+  snprintf(s->path, sizeof(s->path), "%s", path);
+
+  if (fstat(fileno(fp), &st) != 0 || fread(header, 1, HEADER_LEN, fp) != HEADER_LEN ||
+      memcmp(header, STORE_MAGIC, MAGIC_LEN) != 0 || file_key(header + MAGIC_LEN, s->key) != 0) {
+    msg_error("%s is not an encrypted diary file", path);
+    fclose(fp);
+    stream_free(s);
+    errno = EINVAL;
+    return NULL;
+  }
+  s->remaining = st.st_size - HEADER_LEN;
+
+  cookie_io_functions_t io = {.read = stream_read, .close = stream_close};
+  FILE *f = fopencookie(s, "r", io);
+  if (f == NULL) {
+    fclose(fp);
+    stream_free(s);
+  }
+  return f;
+}
+
+static FILE *open_writer(const char *path, int append) {
+  unsigned char header[HEADER_LEN];
+
+  STREAM *s = calloc(1, sizeof(*s));
+  if (s == NULL || (s->ctx = EVP_CIPHER_CTX_new()) == NULL) {
+    free(s);
+    return NULL;
+  }
+  s->writing = 1;
+  snprintf(s->path, sizeof(s->path), "%s", path);
+  snprintf(s->tmp, sizeof(s->tmp), "%s.XXXXXX", path);
+
+  int fd = mkstemp(s->tmp);
+  if (fd < 0) {
+    stream_free(s);
+    return NULL;
+  }
+  s->fp = fdopen(fd, "wb");
+
+  memcpy(header, STORE_MAGIC, MAGIC_LEN);
+  if (s->fp == NULL || RAND_bytes(header + MAGIC_LEN, SALT_LEN) != 1 ||
+      file_key(header + MAGIC_LEN, s->key) != 0 ||
+      fwrite(header, 1, HEADER_LEN, s->fp) != HEADER_LEN) {
+    if (s->fp != NULL)
+      fclose(s->fp);
+    else
+      close(fd);
+    unlink(s->tmp);
+    stream_free(s);
+    return NULL;
+  }
+
+  cookie_io_functions_t io = {.write = stream_write, .close = stream_close};
+  FILE *f = fopencookie(s, "w", io);
+  if (f == NULL) {
+    fclose(s->fp);
+    unlink(s->tmp);
+    stream_free(s);
+    return NULL;
+  }
+
+  /* appending rewrites the whole file under a fresh salt */
+  if (append && do_file_exist((char *)path)) {
+    char buf[8192];
+    size_t n;
+    FILE *old = open_reader(path);
+    if (old == NULL) {
+      s->failed = 1;
+      fclose(f);
+      return NULL;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), old)) > 0)
+      fwrite(buf, 1, n, f);
+    if (fclose(old) != 0)
+      s->failed = 1;
+  }
+  return f;
+}
+
+FILE *store_fopen(const char *path, const char *mode) {
+  if (!store_active(path))
+    return fopen(path, mode);
+  switch (mode[0]) {
+  case 'r':
+    return open_reader(path);
+  case 'w':
+    return open_writer(path, 0);
+  case 'a':
+    return open_writer(path, 1);
+  }
+  errno = EINVAL;
+  return NULL;
+}
+
+void store_remove_checkouts(void) {
+  if (checkout_dir[0] == '\0' || checkout_pid != getpid())
+    return;
+  DIR *dir = opendir(checkout_dir);
+  if (dir != NULL) {
+    struct dirent *ent;
+    char path[4400];
+    while ((ent = readdir(dir)) != NULL) {
+      if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+        continue;
+      snprintf(path, sizeof(path), "%s/%s", checkout_dir, ent->d_name);
+      unlink(path);
+    }
+    closedir(dir);
+  }
+  rmdir(checkout_dir);
+  checkout_dir[0] = '\0';
+}
+
+/* Copy between two streams. Returns 0 if everything was copied. */
+static int copy_stream(FILE *in, FILE *out) {
+  char buf[CHUNK_LEN];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    if (fwrite(buf, 1, n, out) != n)
+      return 1;
+  return ferror(in);
+}
+
+int store_checkout(const char *path, char *plain, size_t size) {
+  if (!store_active(path))
+    return snprintf(plain, size, "%s", path) >= (int)size;
+
+  /* a forked worker gets its own, see store_remove_checkouts() */
+  if (checkout_dir[0] == '\0' || checkout_pid != getpid()) {
+    const char *base = getenv("XDG_RUNTIME_DIR");
+    if (base == NULL || *base == '\0')
+      base = "/tmp";
+    snprintf(checkout_dir, sizeof(checkout_dir), "%s/dry-XXXXXX", base);
+    if (mkdtemp(checkout_dir) == NULL) {
+      msg_error("can't create a private directory in %s: %s", base, strerror(errno));
+      checkout_dir[0] = '\0';
+      return 1;
+    }
+    checkout_pid = getpid();
+  }
+
+  /* same name as in the diary: editors and players show it, pickers sniff the extension */
+  const char *name = strrchr(path, '/') + 1;
+  if (snprintf(plain, size, "%s/%s", checkout_dir, name) >= (int)size)
+    return 1;
+  if (!do_file_exist((char *)path))
+    return 0;
+
+  FILE *in = open_reader(path);
+  if (in == NULL)
+    return 1;
+  int fd = open(plain, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  FILE *out = fd < 0 ? NULL : fdopen(fd, "wb");
+  int rc = out == NULL || copy_stream(in, out) != 0;
+  if (out != NULL && fclose(out) != 0)
+    rc = 1;
+  else if (out == NULL && fd >= 0)
+    close(fd);
+  if (fclose(in) != 0)
+    rc = 1;
+  if (rc != 0)
+    unlink(plain);
+  return rc;
+}
+
+int store_checkin(const char *plain, const char *path) {
+  if (strcmp(plain, path) == 0 || !store_active(path))
+    return 0;
+
+  FILE *in = fopen(plain, "rb");
+  if (in == NULL)
+    return 1;
+  FILE *out = open_writer(path, 0);
+  int rc = out == NULL || copy_stream(in, out) != 0;
+  if (out != NULL && fclose(out) != 0)
+    rc = 1;
+  fclose(in);
+  unlink(plain);
+  return rc;
+}
+
+void store_release(const char *plain, const char *path) {
+  if (strcmp(plain, path) != 0 && store_active(path))
+    unlink(plain);
+}
+
+#else /* !HAVE_LIBCRYPTO */
+
+int store_supported(void) {
+  return 0;
+}
+
+int store_create(const char *dpath, const char *passphrase) {
+  msg_error("dry was built without native storage support (libcrypto)");
+  return 1;
+}
+
+int store_open(const char *dpath, const char *passphrase) {
+  msg_error("dry was built without native storage support (libcrypto)");
+  return 2;
+}
+
+void store_close(void) {
+}
+
+int store_active(const char *path) {
+  return 0;
+}
+
+FILE *store_fopen(const char *path, const char *mode) {
+  return fopen(path, mode);
+}
+
+int store_keyed_id(const char *dpath, const char *in, char *out) {
+  return 1;
+}
+
+int store_checkout(const char *path, char *plain, size_t size) {
+  return snprintf(plain, size, "%s", path) >= (int)size;
+}
+
+int store_checkin(const char *plain, const char *path) {
+  return 0;
+}
+
+void store_release(const char *plain, const char *path) {
+}
+
+void store_remove_checkouts(void) {
+}
+
+#endif /* HAVE_LIBCRYPTO */
@@ -0,0 +1,85 @@
+/*
+ * store.h - Native encrypted storage
+ *
+ * Alternative to encfs that needs no FUSE mount: entries and their metadata
+ * (catalog, search index, sidecars) are encrypted file by file with a
+ * streaming AEAD construction, ChaCha20-Poly1305 over 64 KiB chunks. Names
+ * are not hidden. The diary key is
+ * random and kept in .dry/key, wrapped with a key derived from the
+ * passphrase by scrypt. Opening a diary only derives and unwraps the key;
+ * files are then read and written directly.
+ *
+ * A diary is native if <diary>/.dry/key exists. All functions that take a
+ * path fall back to plain file access for anything outside the open
+ * native diary, so callers need not care which backend is in use.
+ */
+#ifndef STORE_H
+#define STORE_H
+
+#include "dry.h"
+
+/* Check whether the diary at dpath uses native storage */
+int store_is_native(const char *dpath);
+
+/* Check whether this build supports native storage */
+int store_supported(void);
+
+/* Create the key of a new native diary at dpath. Returns 0 on success. */
+int store_create(const char *dpath, const char *passphrase);
+
+/*
+ * Unlock the native diary at dpath. Returns 0 on success, 1 on a wrong
+ * passphrase, 2 if the key file can't be read (reported on stderr).
+ */
+int store_open(const char *dpath, const char *passphrase);
+
+/* Forget the key of the open diary and remove the copies checked out of it */
+void store_close(void);
+
+/* Check whether path is a file of the open native diary */
+int store_active(const char *path);
+
+/*
+ * fopen() for diary files: files of the open native diary are decrypted
+ * ("r") or encrypted ("w", "a") on the fly, anything else is opened as is.
+ * Written files replace the old contents atomically on fclose().
+ */
+FILE *store_fopen(const char *path, const char *mode);
+
+/* Size of the plaintext of a diary file that is size bytes on disk */
+long long store_plain_size(const char *path, long long size);
+
+/*
+ * Keyed name for in (hex HMAC-SHA256 with the diary key, 65 bytes with the
+ * terminator) so that names on disk reveal nothing about the contents.
+ * Returns 1 if dpath is not the open native diary.
+ */
+int store_keyed_id(const char *dpath, const char *in, char *out);
+
+/*
+ * Get a plaintext path for an external program (editor, pager, ffmpeg).
+ * Files of the open native diary are decrypted into a private temporary
+ * directory (if they exist); other paths are returned unchanged.
+ */
+int store_checkout(const char *path, char *plain, size_t size);
+
+/* Encrypt a checked out file back to path and remove the plaintext copy */
+int store_checkin(const char *plain, const char *path);
+
+/* Remove a checked out copy without writing it back */
+void store_release(const char *plain, const char *path);
+
+/*
+ * Remove the private directory of the copies this process checked out.
+ * store_close() does; dry also runs it at exit, but a process leaving
+ * with _exit() must call it itself.
+ */
+void store_remove_checkouts(void);
+
+/*
+ * Passphrase for a diary: $DRY_PASSWORD (or $DRY_ENCFS_PASSWORD), else
+ * prompted on the terminal, twice if confirm is set. Returns 0 on success.
+ */
+int store_get_passphrase(const char *prompt, int confirm, char *buf, size_t size);
+
+#endif /* STORE_H */
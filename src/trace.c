@@ -0,0 +1,185 @@
+/*
+ * trace.c - Opt-in phase tracing implementation
+ */
+#include "trace.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <sys/resource.h>
+
+/* A recorded phase, times in microseconds */
+typedef struct {
+  char name[64];
+  char *arg;
+  long long ts;         /* start, relative to trace_init() */
+  long long dur;        /* wall time, -1 while running */
+  long long cpu;        /* CPU time of dry itself */
+  long long child_cpu;  /* CPU time of children waited for during the phase */
+} TRACE_EVENT;
+
+static TRACE_EVENT *events;
+static int count;
+static int cap;
+static int enabled;
+static char out_path[2048];
+static int out_default;   /* out_path is the default file in a shared directory */
+static long long t0;
+
+static long long clock_us(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static long long children_cpu_us(void) {
+  struct rusage ru;
+  if (getrusage(RUSAGE_CHILDREN, &ru) != 0)
+    return 0;
+  return (long long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL +
+         ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/* Phases still open when tracing finishes end now */
+static void close_open_events(void) {
+  long long now = clock_us(CLOCK_MONOTONIC) - t0;
+  long long cpu = clock_us(CLOCK_PROCESS_CPUTIME_ID);
+  long long child = children_cpu_us();
+
+  for (int i = 0; i < count; i++) {
+    if (events[i].dur >= 0)
+      continue;
+    events[i].dur = now - events[i].ts;
+    events[i].cpu = cpu - events[i].cpu;
+    events[i].child_cpu = child - events[i].child_cpu;
+  }
+}
+
+void trace_finish(FILE *summary) {
+  long long total = clock_us(CLOCK_MONOTONIC) - t0;
+  long long children = 0, child_time = 0;
+  int slowest = -1;
+
+  if (!enabled)
+    return;
+  enabled = 0;
+  close_open_events();
+
+  /*
+   * private: phase details may name diary entries. The default name is
+   * predictable, so never write through a file or link planted there.
+   */
+  int flags = out_default ? O_EXCL | O_NOFOLLOW : O_TRUNC;
+  int out = open(out_path, O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0600);
+  FILE *fd = out >= 0 ? fdopen(out, "w") : NULL;
+  if (fd != NULL) {
+    fprintf(fd, "{\"traceEvents\": [\n");
+    fprintf(fd, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 1, "
+                "\"args\": {\"name\": \"dry\"}}", (int)getpid());
+    for (int i = 0; i < count; i++) {
+      TRACE_EVENT *e = &events[i];
+      fprintf(fd, ",\n  {\"name\": ");
+      print_json_string(fd, e->name);
+      fprintf(fd, ", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": 1, "
+                  "\"ts\": %lld, \"dur\": %lld, \"tdur\": %lld, \"args\": {",
+              strncmp(e->name, "exec ", 5) == 0 ? "child" : "phase", (int)getpid(),
+              e->ts, e->dur, e->cpu);
+      fprintf(fd, "\"cpu_ms\": %.3f, \"child_cpu_ms\": %.3f", e->cpu / 1000.0,
+              e->child_cpu / 1000.0);
+      if (e->arg != NULL) {
+        fprintf(fd, ", \"detail\": ");
+        print_json_string(fd, e->arg);
+      }
+      fprintf(fd, "}}");
+    }
+    fprintf(fd, "\n], \"displayTimeUnit\": \"ms\"}\n");
+    fclose(fd);
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (strncmp(events[i].name, "exec ", 5) == 0) {
+      children++;
+      child_time += events[i].dur;
+    }
+    /* the command itself ("dry <subcommand>") spans everything */
+    if (strncmp(events[i].name, "dry ", 4) != 0 &&
+        (slowest < 0 || events[i].dur > events[slowest].dur))
+      slowest = i;
+  }
+
+  if (summary != NULL) {
+    fprintf(summary, "dry trace: %.1f ms wall, %.1f ms cpu, %lld child(ren) %.1f ms",
+            total / 1000.0, clock_us(CLOCK_PROCESS_CPUTIME_ID) / 1000.0, children,
+            child_time / 1000.0);
+    if (slowest >= 0)
+      fprintf(summary, ", slowest %s %.1f ms", events[slowest].name,
+              events[slowest].dur / 1000.0);
+    fprintf(summary, " -> %s%s\n", out_path, fd == NULL ? " (write failed)" : "");
+  }
+
+  for (int i = 0; i < count; i++)
+    free(events[i].arg);
+  free(events);
+  events = NULL;
+  count = cap = 0;
+}
+
+void trace_init(const char *path) {
+  if (enabled)
+    return;
+
+  if (path == NULL) {
+    path = getenv("DRY_TRACE");
+    if (path == NULL || path[0] == '\0' || strcmp(path, "0") == 0)
+      return;
+  }
+
+  if (path[0] == '\0' || strcmp(path, "1") == 0) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir == NULL || dir[0] == '\0')
+      dir = getenv("TMPDIR");
+    if (dir == NULL || dir[0] == '\0')
+      dir = "/tmp";
+    snprintf(out_path, sizeof(out_path), "%s/dry-trace-%d.json", dir, (int)getpid());
+    out_default = 1;
+  } else
+    snprintf(out_path, sizeof(out_path), "%s", path);
+
+  t0 = clock_us(CLOCK_MONOTONIC);
+  enabled = 1;
+}
+
+int trace_enabled(void) {
+  return enabled;
+}
+
+int trace_begin(const char *name, const char *arg) {
+  if (!enabled)
+    return -1;
+
+  if (count == cap) {
+    int new_cap = cap ? cap * 2 : 64;
+    TRACE_EVENT *grown = realloc(events, new_cap * sizeof(TRACE_EVENT));
+    if (grown == NULL)
+      return -1;
+    events = grown;
+    cap = new_cap;
+  }
+
+  TRACE_EVENT *e = &events[count];
+  snprintf(e->name, sizeof(e->name), "%s", name);
+  e->arg = arg != NULL ? strdup(arg) : NULL;
+  e->dur = -1;
+  e->cpu = clock_us(CLOCK_PROCESS_CPUTIME_ID);
+  e->child_cpu = children_cpu_us();
+  e->ts = clock_us(CLOCK_MONOTONIC) - t0;
+  return count++;
+}
+
+void trace_end(int id) {
+  if (!enabled || id < 0 || id >= count || events[id].dur >= 0)
+    return;
+
+  TRACE_EVENT *e = &events[id];
+  e->dur = clock_us(CLOCK_MONOTONIC) - t0 - e->ts;
+  e->cpu = clock_us(CLOCK_PROCESS_CPUTIME_ID) - e->cpu;
+  e->child_cpu = children_cpu_us() - e->child_cpu;
+}
@@ -0,0 +1,36 @@
+/*
+ * trace.h - Opt-in phase tracing
+ *
+ * Enabled with DRY_TRACE=<file> (DRY_TRACE=1 for dry-trace-<pid>.json in
+ * $XDG_RUNTIME_DIR, $TMPDIR or /tmp) or --trace[=<file>]. Every phase
+ * records wall and CPU time; trace_finish() (dry calls it at exit) writes
+ * the phases as Chrome trace-event JSON (load it in Perfetto or
+ * chrome://tracing) and prints a one-line summary on stderr.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "dry.h"
+
+/*
+ * Enable tracing if path is set or DRY_TRACE is in the environment.
+ * path may be "" for the default output file.
+ */
+void trace_init(const char *path);
+
+/* Check whether tracing is enabled */
+int trace_enabled(void);
+
+/* Start a phase (arg may be NULL). Returns an id for trace_end(), -1 if disabled. */
+int trace_begin(const char *name, const char *arg);
+
+/* End a phase started with trace_begin() */
+void trace_end(int id);
+
+/*
+ * End open phases, write the trace file and the one-line summary to summary
+ * (NULL: none), and disable tracing
+ */
+void trace_finish(FILE *summary);
+
+#endif /* TRACE_H */
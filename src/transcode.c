@@ -0,0 +1,413 @@
+/*
+ * transcode.c - Background re-encoding of video recordings implementation
+ *
+ * Queue file: one path per line, relative to the diary mount point. The
+ * worker holds an exclusive flock on .dry/transcode.lock (which contains
+ * its pid) for as long as it runs.
+ */
+#include "transcode.h"
+#include "config.h"
+#include "crypto.h"
+#include "media.h"
+#include "proc.h"
+#include "store.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define TRANSCODE_QUEUE_FILE "transcode.queue"
+#define TRANSCODE_LOCK_FILE "transcode.lock"
+#define TRANSCODE_LOG_FILE "transcode.log"
+
+/* Worker priority: nice 10 and the idle I/O class */
+#define TRANSCODE_NICE 10
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_IDLE (3 << 13)
+
+typedef struct {
+  const char *name;
+  const char *codec;
+  const char *preset;
+  int crf;
+} TRANSCODE_PROFILE;
+
+static const TRANSCODE_PROFILE profiles[] = {
+  {"x264", "libx264", "medium", 23},
+  {"x265", "libx265", "medium", 28},
+  {"av1", "libsvtav1", "8", 35},
+};
+
+static volatile sig_atomic_t stopping;
+
+static const TRANSCODE_PROFILE *find_profile(const char *name) {
+  for (size_t i = 0; name != NULL && i < sizeof(profiles) / sizeof(profiles[0]); i++)
+    if (strcmp(profiles[i].name, name) == 0)
+      return &profiles[i];
+  return NULL;
+}
+
+int transcode_profile_valid(const char *profile) {
+  return strcmp(profile, "off") == 0 || find_profile(profile) != NULL;
+}
+
+/* ---- queue ------------------------------------------------------------ */
+
+static int open_queue(const char *dpath, int flags) {
+  char path[4200];
+
+  if (get_meta_path(dpath, TRANSCODE_QUEUE_FILE, path, sizeof(path)) != 0)
+    return -1;
+  return open(path, flags | O_CLOEXEC, 0600);
+}
+
+/* Read the whole queue from a locked descriptor (NUL-terminated, caller frees) */
+static char *read_queue(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return NULL;
+
+  char *buf = malloc(st.st_size + 1);
+  if (buf == NULL)
+    return NULL;
+  ssize_t n = pread(fd, buf, st.st_size, 0);
+  buf[n > 0 ? n : 0] = '\0';
+  return buf;
+}
+
+/* Find file as a whole line of the queue */
+static char *find_line(char *queue, const char *file) {
+  size_t len = strlen(file);
+  for (char *p = queue; *p != '\0';) {
+    char *end = strchr(p, '\n');
+    size_t n = end ? (size_t)(end - p) : strlen(p);
+    if (n == len && strncmp(p, file, len) == 0)
+      return p;
+    p += n + (end != NULL);
+  }
+  return NULL;
+}
+
+int transcode_queue(const char *dpath, const char *file) {
+  size_t dlen = strlen(dpath);
+  char line[4200];
+
+  if (find_profile(get_config()->transcode) == NULL)
+    return 1;
+
+  /* stored relative to the mount point */
+  if (strncmp(file, dpath, dlen) == 0 && file[dlen] == '/')
+    file += dlen + 1;
+
+  int fd = open_queue(dpath, O_RDWR | O_APPEND | O_CREAT);
+  if (fd < 0)
+    return 1;
+  flock(fd, LOCK_EX);
+
+  char *queue = read_queue(fd);
+  int rc = 0;
+  if (queue == NULL || find_line(queue, file) == NULL) {
+    int len = snprintf(line, sizeof(line), "%s\n", file);
+    rc = write(fd, line, len) != len;
+  }
+  free(queue);
+
+  close(fd);
+  return rc;
+}
+
+/* First queued file, 1 if the queue is empty */
+static int queue_peek(const char *dpath, char *file, size_t size) {
+  int fd = open_queue(dpath, O_RDONLY);
+  if (fd < 0)
+    return 1;
+  flock(fd, LOCK_SH);
+
+  char *queue = read_queue(fd);
+  close(fd);
+  if (queue == NULL)
+    return 1;
+
+  char *p = queue;
+  while (*p == '\n')
+    p++;
+  size_t n = strcspn(p, "\n");
+  int rc = n == 0 || n >= size;
+  if (!rc)
+    snprintf(file, size, "%.*s", (int)n, p);
+  free(queue);
+  return rc;
+}
+
+static void queue_drop(const char *dpath, const char *file) {
+  int fd = open_queue(dpath, O_RDWR);
+  if (fd < 0)
+    return;
+  flock(fd, LOCK_EX);
+
+  /* rewritten in place: appenders hold the same inode */
+  char *queue = read_queue(fd);
+  char *line = queue ? find_line(queue, file) : NULL;
+  if (line != NULL) {
+    char *next = line + strlen(file);
+    if (*next == '\n')
+      next++;
+    memmove(line, next, strlen(next) + 1);
+    size_t len = strlen(queue);
+    if (ftruncate(fd, 0) != 0 || pwrite(fd, queue, len, 0) != (ssize_t)len)
+      msg_warning("failed to update transcode queue");
+  }
+  free(queue);
+  close(fd);
+}
+
+/* ---- worker ----------------------------------------------------------- */
+
+/* The metadata directory disappears with the mount when the diary is locked */
+static int diary_gone(const char *dpath) {
+  char path[4200];
+  snprintf(path, sizeof(path), "%s/%s", dpath, DRY_META_DIR);
+  return access(path, F_OK) != 0;
+}
+
+static void log_job(const char *dpath, const char *file, const char *fmt, ...) {
+  char path[4200];
+  char now[32];
+  va_list ap;
+
+  if (get_meta_path(dpath, TRANSCODE_LOG_FILE, path, sizeof(path)) != 0)
+    return;
+  FILE *fd = fopen(path, "a");
+  if (fd == NULL)
+    return;
+
+  get_time(now, "%Y-%m-%d %H:%M:%S");
+  fprintf(fd, "%s %s: ", now, file);
+  va_start(ap, fmt);
+  vfprintf(fd, fmt, ap);
+  va_end(ap);
+  fprintf(fd, "\n");
+  fclose(fd);
+}
+
+/*
+ * Re-encode one recording. Returns 0 if the job is done (replaced, kept
+ * or gone), 1 if it should stay queued.
+ */
+static int transcode_file(const char *dpath, const char *file, const TRANSCODE_PROFILE *p) {
+  char in[4200];
+  char tmp[4300];
+  char src[4096];
+  char out[4096];
+  char crf[16];
+  struct stat st_in, st_out, st_src;
+
+  snprintf(in, sizeof(in), "%s/%s", dpath, file);
+  if (stat(in, &st_in) != 0)
+    return diary_gone(dpath);
+
+  /* hidden file in the same directory: skipped by listings, renamed over in */
+  const char *base = strrchr(in, '/') + 1;
+  snprintf(tmp, sizeof(tmp), "%.*s.%s.part.mkv", (int)(base - in), in, base);
+
+  /* native diaries: encode a decrypted copy in the private directory */
+  if (store_checkout(in, src, sizeof(src)) != 0)
+    return diary_gone(dpath);
+  if (store_checkout(tmp, out, sizeof(out)) != 0 || stat(src, &st_src) != 0) {
+    store_release(src, in);
+    return 1;
+  }
+  snprintf(crf, sizeof(crf), "%d",
+           get_config()->transcode_crf > 0 ? get_config()->transcode_crf : p->crf);
+
+  char *encode[] = {
+    "ffmpeg", "-nostdin", "-hide_banner", "-loglevel", "error", "-y",
+    "-i", src,
+    "-map", "0",
+    "-c:v", (char *)p->codec, "-preset", (char *)p->preset, "-crf", crf,
+    "-pix_fmt", "yuv420p",
+    "-c:a", "libopus", "-b:a", "96k",
+    "-threads", "0",
+    out, NULL
+  };
+  char *verify[] = {
+    "ffmpeg", "-nostdin", "-v", "error", "-xerror", "-i", out, "-f", "null", "-", NULL
+  };
+
+  int rc = proc_run(encode, PROC_QUIET);
+  if (rc == 0 && !stopping)
+    rc = proc_run(verify, PROC_QUIET);
+  store_release(src, in);
+  if (stopping) {
+    unlink(out);
+    return 1;
+  }
+
+  if (rc != 0 || stat(out, &st_out) != 0 || st_out.st_size == 0) {
+    unlink(out);
+    /* the diary went away under us (locked): try again next time */
+    if (diary_gone(dpath))
+      return 1;
+    log_job(dpath, file, "failed (%s, status %d), original kept", p->name, rc);
+    return 0;
+  }
+
+  if (st_out.st_size >= st_src.st_size) {
+    unlink(out);
+    log_job(dpath, file, "not smaller with %s, original kept", p->name);
+    return 0;
+  }
+
+  /* keep the recording time; the day directory changes, so the catalog rescans it */
+  struct timespec times[2] = {st_in.st_atim, st_in.st_mtim};
+  if (strcmp(out, tmp) != 0) {
+    /* encrypted under a new name, then renamed over in like a plain result */
+    if (store_checkin(out, tmp) != 0) {
+      unlink(out);
+      log_job(dpath, file, "failed to encrypt the result, original kept");
+      return 0;
+    }
+  }
+  utimensat(AT_FDCWD, tmp, times, 0);
+  if (rename(tmp, in) != 0) {
+    unlink(tmp);
+    log_job(dpath, file, "failed to replace: %s", strerror(errno));
+    return 0;
+  }
+
+  /* codecs changed, the thumbnails did not */
+  media_sidecar_create(dpath, in, 0);
+  log_job(dpath, file, "%lld -> %lld bytes (%s)", (long long)st_src.st_size,
+          (long long)st_out.st_size, p->name);
+  return 0;
+}
+
+static void on_term(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+/* The lock file names the worker only while it holds the lock (pid 0: none) */
+static void write_pid(int lock_fd, pid_t pid) {
+  char buf[32];
+  int len = pid > 0 ? snprintf(buf, sizeof(buf), "%d\n", (int)pid) : 0;
+  if (ftruncate(lock_fd, 0) != 0 || pwrite(lock_fd, buf, len, 0) != len)
+    return;
+}
+
+static void run_worker(const char *name, const char *dpath, int lock_fd, int close_diary) {
+  const TRANSCODE_PROFILE *p = find_profile(get_config()->transcode);
+  struct sigaction sa = {0};
+  char file[4096];
+
+  /* own process group, so transcode_stop() reaches ffmpeg as well */
+  setpgid(0, 0);
+  sa.sa_handler = on_term;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+
+  setpriority(PRIO_PROCESS, 0, TRANSCODE_NICE);
+  syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_IDLE);
+  write_pid(lock_fd, getpid());
+
+  while (!stopping && !diary_gone(dpath)) {
+    if (queue_peek(dpath, file, sizeof(file)) != 0) {
+      /* recheck after unlocking: a job queued meanwhile may have found us busy */
+      write_pid(lock_fd, 0);
+      flock(lock_fd, LOCK_UN);
+      if (queue_peek(dpath, file, sizeof(file)) != 0 || flock(lock_fd, LOCK_EX | LOCK_NB) != 0)
+        break;
+      write_pid(lock_fd, getpid());
+      continue;
+    }
+
+    if (transcode_file(dpath, file, p) != 0)
+      break;
+    queue_drop(dpath, file);
+  }
+  write_pid(lock_fd, 0);
+
+  if (close_diary && !stopping)
+    encdiary(1, name, get_config()->path);
+}
+
+int transcode_start(const char *name, const char *dpath, int close_diary) {
+  char path[4200];
+  char file[4096];
+
+  if (find_profile(get_config()->transcode) == NULL)
+    return 1;
+  if (queue_peek(dpath, file, sizeof(file)) != 0)
+    return 1;
+
+  if (get_meta_path(dpath, TRANSCODE_LOCK_FILE, path, sizeof(path)) != 0)
+    return 1;
+  int lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (lock_fd < 0)
+    return 1;
+  if (flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+    /* a worker is running: it picks the job up and owns the mount until done */
+    close(lock_fd);
+    return 0;
+  }
+  write_pid(lock_fd, 0);
+
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(lock_fd);
+    return 1;
+  }
+
+  if (pid == 0) {
+    /* detach like the agent; the lock (and any agent lease) is inherited */
+    setsid();
+    if (fork() != 0)
+      _exit(0);
+    int null = open("/dev/null", O_RDWR);
+    if (null >= 0) {
+      dup2(null, STDIN_FILENO);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+      if (null > STDERR_FILENO)
+        close(null);
+    }
+    run_worker(name, dpath, lock_fd, close_diary);
+    /* _exit() skips the atexit handlers: no decrypted copy may outlive us */
+    store_remove_checkouts();
+    _exit(0);
+  }
+
+  waitpid(pid, NULL, 0);
+  close(lock_fd);
+  return 0;
+}
+
+void transcode_stop(const char *dpath) {
+  char path[4200];
+  char pid[32] = "";
+
+  if (get_meta_path(dpath, TRANSCODE_LOCK_FILE, path, sizeof(path)) != 0)
+    return;
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    ssize_t n = pread(fd, pid, sizeof(pid) - 1, 0);
+    pid[n > 0 ? n : 0] = '\0';
+    /* the worker leads its own process group: ffmpeg gets the signal too */
+    if (atoi(pid) > 1)
+      kill(-atoi(pid), SIGTERM);
+
+    /* wait up to ~10s for the worker to let go of the mount */
+    for (int i = 0; i < 200 && flock(fd, LOCK_EX | LOCK_NB) != 0; i++)
+      usleep(50000);
+  }
+  close(fd);
+}
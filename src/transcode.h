@@ -0,0 +1,33 @@
+/*
+ * transcode.h - Background re-encoding of video recordings
+ *
+ * Recordings are captured as MJPEG with PCM audio, which is cheap to record
+ * but huge. New recordings are queued in the diary metadata directory
+ * (.dry/transcode.queue, inside the encrypted mount, so pending jobs survive
+ * lock/unlock) and re-encoded by a detached low-priority worker with the
+ * configured profile. A result that decodes cleanly and is smaller replaces
+ * the original under the same name, so "file:" links in notes stay valid.
+ */
+#ifndef TRANSCODE_H
+#define TRANSCODE_H
+
+#include "dry.h"
+
+/* Check whether a transcode profile is known ("off", "x264", "x265", "av1") */
+int transcode_profile_valid(const char *profile);
+
+/* Queue a recording of the diary mounted at dpath (no-op when transcoding is off) */
+int transcode_queue(const char *dpath, const char *file);
+
+/*
+ * Start a background worker for the pending jobs of diary name, unless
+ * transcoding is off or nothing is queued. With close_diary the worker
+ * closes the diary when it is done. Returns 0 if a worker (started now or
+ * already running) owns the mount; the caller must then not close it.
+ */
+int transcode_start(const char *name, const char *dpath, int close_diary);
+
+/* Stop a running worker; its current job stays queued. */
+void transcode_stop(const char *dpath);
+
+#endif /* TRANSCODE_H */
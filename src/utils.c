@@ -2,6 +2,13 @@
  * utils.c - Utility functions implementation
  */
 #include "utils.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+
+/* Threads used by stat_batch, and the least work worth starting them for */
+#define STAT_THREADS 8
+#define STAT_MIN_BATCH 32
 
 void expand_tilde(const char *input, char *output) {
   if (input[0] == '~' && (input[1] == '/' || input[1] == '\0')) {
@@ -18,6 +25,251 @@ int do_file_exist(char *path) {
   return !stat(path, &st);
 }
 
+int make_dirs(const char *path, mode_t mode) {
+  char buf[4096];
+  struct stat st;
+
+  if (snprintf(buf, sizeof(buf), "%s", path) >= (int)sizeof(buf)) {
+    errno = ENAMETOOLONG;
+    return 1;
+  }
+
+  /* create each missing component, like mkdir -p */
+  for (char *p = buf + 1;; p++) {
+    if (*p != '/' && *p != '\0')
+      continue;
+    char c = *p;
+    *p = '\0';
+    if (mkdir(buf, mode) != 0 && (errno != EEXIST || stat(buf, &st) != 0 || !S_ISDIR(st.st_mode))) {
+      if (errno == EEXIST)
+        errno = ENOTDIR;
+      return 1;
+    }
+    *p = c;
+    if (c == '\0')
+      return 0;
+  }
+}
+
+int get_meta_path(const char *dpath, const char *file, char *path, size_t size) {
+  snprintf(path, size, "%s/%s", dpath, DRY_META_DIR);
+  if (mkdir(path, 0700) != 0 && errno != EEXIST)
+    return 1;
+
+  snprintf(path, size, "%s/%s/%s", dpath, DRY_META_DIR, file);
+  return 0;
+}
+
+/* Copy path without trailing or doubled slashes */
+static void normalize_path(const char *in, char *out, size_t size) {
+  size_t n = 0;
+  for (; *in && n + 1 < size; in++) {
+    if (*in == '/' && n > 0 && out[n - 1] == '/')
+      continue;
+    out[n++] = *in;
+  }
+  while (n > 1 && out[n - 1] == '/')
+    n--;
+  out[n] = '\0';
+}
+
+/* Decode the octal escapes (\040 etc.) used in mountinfo fields */
+static void unescape_mount_path(char *s) {
+  char *out = s;
+  while (*s) {
+    if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3' && s[2] >= '0' && s[2] <= '7' &&
+        s[3] >= '0' && s[3] <= '7') {
+      *out++ = (char)((s[1] - '0') * 64 + (s[2] - '0') * 8 + (s[3] - '0'));
+      s += 4;
+    } else {
+      *out++ = *s++;
+    }
+  }
+  *out = '\0';
+}
+
+int mount_table_load(MOUNT_TABLE *table) {
+  char line[8192];
+  int cap = 0;
+
+  table->paths = NULL;
+  table->count = 0;
+
+  FILE *fd = fopen("/proc/self/mountinfo", "r");
+  if (fd == NULL)
+    return 1;
+
+  /* "<id> <parent> <major:minor> <root> <mount point> ..." */
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    char *field = line;
+    for (int i = 0; i < 4 && field != NULL; i++) {
+      field = strchr(field, ' ');
+      if (field != NULL)
+        field++;
+    }
+    if (field == NULL)
+      continue;
+    field[strcspn(field, " ")] = '\0';
+    unescape_mount_path(field);
+
+    if (table->count == cap) {
+      cap = cap ? cap * 2 : 64;
+      char **paths = realloc(table->paths, cap * sizeof(char *));
+      if (paths == NULL)
+        break;
+      table->paths = paths;
+    }
+    table->paths[table->count] = strdup(field);
+    if (table->paths[table->count] != NULL)
+      table->count++;
+  }
+
+  fclose(fd);
+  return 0;
+}
+
+int mount_table_has(const MOUNT_TABLE *table, const char *path) {
+  char real[PATH_MAX];
+  char norm[4096];
+
+  /* mountinfo lists resolved paths: a diary may be registered through a link */
+  if (realpath(path, real) != NULL)
+    path = real;
+  normalize_path(path, norm, sizeof(norm));
+
+  for (int i = 0; i < table->count; i++)
+    if (strcmp(table->paths[i], norm) == 0)
+      return 1;
+  return 0;
+}
+
+void mount_table_free(MOUNT_TABLE *table) {
+  for (int i = 0; i < table->count; i++)
+    free(table->paths[i]);
+  free(table->paths);
+  table->paths = NULL;
+  table->count = 0;
+}
+
+int is_mount_point(const char *path) {
+  MOUNT_TABLE table;
+  int found;
+
+  if (mount_table_load(&table) != 0)
+    return 0;
+  found = mount_table_has(&table, path);
+  mount_table_free(&table);
+  return found;
+}
+
+void format_size(long long size, char *out, size_t out_size) {
+  const char *units = "BKMGT";
+  double value = (double)size;
+  int unit = 0;
+
+  while (value >= 1024 && unit < 4) {
+    value /= 1024;
+    unit++;
+  }
+  if (unit == 0)
+    snprintf(out, out_size, "%lld%c", size, units[unit]);
+  else
+    snprintf(out, out_size, "%.1f%c", value, units[unit]);
+}
+
+/* Work shared by the stat_batch threads */
+typedef struct {
+  char *const *paths;
+  struct stat *st;
+  char *ok;
+  int count;
+  int next;     /* next index to stat, taken atomically */
+} STAT_WORK;
+
+static void *stat_worker(void *arg) {
+  STAT_WORK *work = arg;
+  int i;
+
+  while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count)
+    work->ok[i] = stat(work->paths[i], &work->st[i]) == 0;
+  return NULL;
+}
+
+void stat_batch(char *const *paths, int count, struct stat *st, char *ok) {
+  STAT_WORK work = {paths, st, ok, count, 0};
+  pthread_t threads[STAT_THREADS];
+  int started = 0;
+
+  if (count >= STAT_MIN_BATCH) {
+    int wanted = count / STAT_MIN_BATCH < STAT_THREADS ? count / STAT_MIN_BATCH : STAT_THREADS;
+    for (; started < wanted - 1; started++)
+      if (pthread_create(&threads[started], NULL, stat_worker, &work) != 0)
+        break;
+  }
+
+  /* the calling thread works too, and does everything for small batches */
+  stat_worker(&work);
+
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+}
+
+void print_json_data(FILE *out, const char *s, size_t len) {
+  fputc('"', out);
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)s[i];
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c == '\n')
+      fputs("\\n", out);
+    else if (c == '\t')
+      fputs("\\t", out);
+    else if (c < 0x20)
+      fprintf(out, "\\u%04x", c);
+    else
+      fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+void print_json_string(FILE *out, const char *s) {
+  print_json_data(out, s, strlen(s));
+}
+
+static MSG_SINK msg_sink;
+static void *msg_arg;
+
+void msg_set_sink(MSG_SINK fn, void *arg) {
+  msg_sink = fn;
+  msg_arg = arg;
+}
+
+static void msg_send(MSG_LEVEL level, const char *fmt, va_list ap) {
+  char message[1024];
+
+  vsnprintf(message, sizeof(message), fmt, ap);
+  if (msg_sink != NULL)
+    msg_sink(level, message, msg_arg);
+  else
+    fprintf(stderr, "%s: %s\n", level == MSG_ERROR ? "Error" : "Warning", message);
+}
+
+void msg_error(const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  msg_send(MSG_ERROR, fmt, ap);
+  va_end(ap);
+}
+
+void msg_warning(const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  msg_send(MSG_WARNING, fmt, ap);
+  va_end(ap);
+}
+
 size_t get_time(char *buffer, const char *fmt) {
   time_t timer;
   struct tm *tm_info;
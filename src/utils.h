@@ -12,6 +12,61 @@ void expand_tilde(const char *input, char *output);
 /* Check if file or directory exists */
 int do_file_exist(char *path);
 
+/* Create a directory and its missing parents (mkdir -p). Returns 0 on success. */
+int make_dirs(const char *path, mode_t mode);
+
+/* Build path to a file in the diary metadata directory, creating the directory */
+int get_meta_path(const char *dpath, const char *file, char *path, size_t size);
+
+/* Mount points of the process, read once from /proc/self/mountinfo */
+typedef struct {
+  char **paths;
+  int count;
+} MOUNT_TABLE;
+
+/* Read the mount table. Returns 0 on success. */
+int mount_table_load(MOUNT_TABLE *table);
+
+/* Check if path is a mount point in the table */
+int mount_table_has(const MOUNT_TABLE *table, const char *path);
+
+/* Release the mount table */
+void mount_table_free(MOUNT_TABLE *table);
+
+/* Check if path is a mount point (single lookup, no child process) */
+int is_mount_point(const char *path);
+
+/*
+ * stat() count paths, spreading the calls over a small pool of threads so
+ * that FUSE round-trips overlap. ok[i] is set to 1 if st[i] is valid.
+ */
+void stat_batch(char *const *paths, int count, struct stat *st, char *ok);
+
+/* Format a byte count in a short human readable form (e.g. 1.2K) */
+void format_size(long long size, char *out, size_t out_size);
+
+/* Print s as a quoted JSON string */
+void print_json_string(FILE *out, const char *s);
+
+/* Same for len bytes of s, which need not be NUL-terminated */
+void print_json_data(FILE *out, const char *s, size_t len);
+
+/* Diagnostics of the core modules */
+typedef enum { MSG_WARNING, MSG_ERROR } MSG_LEVEL;
+
+/* Receives a diagnostic (without "Error: " prefix or newline) */
+typedef void (*MSG_SINK)(MSG_LEVEL level, const char *message, void *arg);
+
+/*
+ * Send diagnostics to fn instead of stderr, where they are printed as
+ * "Error: ..." or "Warning: ..." (NULL goes back to stderr)
+ */
+void msg_set_sink(MSG_SINK fn, void *arg);
+
+/* Report a failure, or a problem that was worked around (printf-style) */
+void msg_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void msg_warning(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
 /* Format current time into buffer */
 size_t get_time(char *buffer, const char *fmt);
 
@@ -0,0 +1,264 @@
+/*
+ * walk.c - Streaming walker over the YYYY/MM/DD diary tree
+ *
+ * Directories are read with getdents64(2) into a fixed buffer and opened
+ * relative to their parent with openat(2), so paths are never resolved
+ * from the root again while descending.
+ */
+#include "walk.h"
+#include "trace.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+
+#define WALK_BUF_SIZE 32768
+
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+typedef struct {
+  char *name;
+  unsigned char type;
+} WALK_NAME;
+
+/* Sorted names of one directory */
+typedef struct {
+  WALK_NAME *names;
+  int count;
+  int cap;
+} WALK_LIST;
+
+static int name_cmp(const void *a, const void *b) {
+  return strcmp(((const WALK_NAME *)a)->name, ((const WALK_NAME *)b)->name);
+}
+
+static int all_digits(const char *s, size_t len) {
+  if (strlen(s) != len)
+    return 0;
+  for (size_t i = 0; i < len; i++)
+    if (!isdigit((unsigned char)s[i]))
+      return 0;
+  return 1;
+}
+
+static void list_free(WALK_LIST *list) {
+  for (int i = 0; i < list->count; i++)
+    free(list->names[i].name);
+  free(list->names);
+  list->names = NULL;
+  list->count = list->cap = 0;
+}
+
+/*
+ * Read the names of directory fd: digits of length digits (0 for any
+ * non-hidden name). Returns 0 on success.
+ */
+static int list_read(int fd, size_t digits, WALK_LIST *list) {
+  char buf[WALK_BUF_SIZE];
+  long n;
+
+  list->names = NULL;
+  list->count = list->cap = 0;
+
+  while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+    for (long off = 0; off < n;) {
+      struct linux_dirent64 *de = (struct linux_dirent64 *)(buf + off);
+      off += de->d_reclen;
+
+      if (de->d_name[0] == '.')
+        continue;
+      if (digits > 0 && !all_digits(de->d_name, digits))
+        continue;
+
+      if (list->count == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 32;
+        WALK_NAME *names = realloc(list->names, cap * sizeof(WALK_NAME));
+        if (names == NULL) {
+          list_free(list);
+          return 1;
+        }
+        list->names = names;
+        list->cap = cap;
+      }
+
+      list->names[list->count].name = strdup(de->d_name);
+      if (list->names[list->count].name == NULL) {
+        list_free(list);
+        return 1;
+      }
+      list->names[list->count++].type = de->d_type;
+    }
+  }
+
+  if (n < 0) {
+    list_free(list);
+    return 1;
+  }
+
+  qsort(list->names, list->count, sizeof(WALK_NAME), name_cmp);
+  return 0;
+}
+
+/* Open a directory by name relative to parent and read it */
+static int list_open(int parent, const char *name, size_t digits, WALK_LIST *list, int *fd) {
+  *fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (*fd < 0)
+    return 1;
+  if (list_read(*fd, digits, list) != 0) {
+    close(*fd);
+    return 1;
+  }
+  return 0;
+}
+
+/* Compare the first len chars of key with bound; a NULL bound is open */
+static int before(const char *key, const char *bound, size_t len) {
+  return bound != NULL && strncmp(key, bound, len) < 0;
+}
+
+static int after(const char *key, const char *bound, size_t len) {
+  return bound != NULL && strncmp(key, bound, len) > 0;
+}
+
+/* Hand every file of an open day directory to fn */
+static int walk_files(int day_fd, const char *date, const char *dir, WALK_FN fn, void *arg) {
+  WALK_LIST files;
+  WALK_ENTRY entry;
+  char path[4096];
+  int rc = 0;
+
+  if (list_read(day_fd, 0, &files) != 0)
+    return 0;
+
+  strcpy(entry.date, date);
+  entry.dirfd = day_fd;
+  entry.path = path;
+  for (int f = 0; rc == 0 && f < files.count; f++) {
+    snprintf(path, sizeof(path), "%s/%s", dir, files.names[f].name);
+    entry.name = files.names[f].name;
+    entry.d_type = files.names[f].type;
+    rc = fn(&entry, arg);
+  }
+
+  list_free(&files);
+  return rc;
+}
+
+/* Callback data of walk_diary, files of each day are read in turn */
+typedef struct {
+  const char *dpath;
+  WALK_FN fn;
+  void *arg;
+} WALK_FILES;
+
+static int walk_day_files(const char *date, int dirfd, void *arg) {
+  WALK_FILES *wf = arg;
+  char dir[4096];
+
+  snprintf(dir, sizeof(dir), "%s/%.4s/%.2s/%.2s", wf->dpath, date, date + 5, date + 8);
+  return walk_files(dirfd, date, dir, wf->fn, wf->arg);
+}
+
+int walk_diary(const char *dpath, const char *from, const char *to, WALK_FN fn, void *arg) {
+  WALK_FILES wf = {dpath, fn, arg};
+  return walk_days(dpath, from, to, walk_day_files, &wf);
+}
+
+/*
+ * Walk the days between from and to, newest first if reverse. Names are
+ * sorted, so the walk stops at the first year past the range.
+ */
+static int walk_tree(const char *dpath, const char *from, const char *to, int reverse,
+                     WALK_DAY_FN fn, void *arg) {
+  WALK_LIST years, months, days;
+  int root_fd, year_fd, month_fd, day_fd;
+  char key[11];
+  int rc = 0;
+
+  root_fd = open(dpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd < 0)
+    return -1;
+  if (list_read(root_fd, 4, &years) != 0) {
+    close(root_fd);
+    return -1;
+  }
+
+  int span = trace_begin("walk", from != NULL && from == to ? from : NULL);
+
+  for (int i = 0; rc == 0 && i < years.count; i++) {
+    const char *year = years.names[reverse ? years.count - 1 - i : i].name;
+    if (reverse ? before(year, from, 4) : after(year, to, 4))
+      break;
+    if (before(year, from, 4) || after(year, to, 4))
+      continue;
+    if (list_open(root_fd, year, 2, &months, &year_fd) != 0)
+      continue;
+
+    for (int j = 0; rc == 0 && j < months.count; j++) {
+      const char *month = months.names[reverse ? months.count - 1 - j : j].name;
+      snprintf(key, sizeof(key), "%s-%s", year, month);
+      if (before(key, from, 7) || after(key, to, 7))
+        continue;
+      if (list_open(year_fd, month, 2, &days, &month_fd) != 0)
+        continue;
+
+      for (int k = 0; rc == 0 && k < days.count; k++) {
+        const char *day = days.names[reverse ? days.count - 1 - k : k].name;
+        snprintf(key, sizeof(key), "%s-%s-%s", year, month, day);
+        if (before(key, from, 10) || after(key, to, 10))
+          continue;
+        day_fd = openat(month_fd, day, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (day_fd < 0)
+          continue;
+
+        rc = fn(key, day_fd, arg);
+        close(day_fd);
+      }
+
+      list_free(&days);
+      close(month_fd);
+    }
+
+    list_free(&months);
+    close(year_fd);
+  }
+
+  list_free(&years);
+  close(root_fd);
+  trace_end(span);
+  return rc;
+}
+
+int walk_days(const char *dpath, const char *from, const char *to, WALK_DAY_FN fn, void *arg) {
+  return walk_tree(dpath, from, to, 0, fn, arg);
+}
+
+int walk_days_reverse(const char *dpath, const char *from, const char *to, WALK_DAY_FN fn, void *arg) {
+  return walk_tree(dpath, from, to, 1, fn, arg);
+}
+
+int walk_day(const char *dpath, const char *date, WALK_FN fn, void *arg) {
+  char dir[4096];
+  int rc;
+
+  if (strlen(date) != 10)
+    return -1;
+
+  snprintf(dir, sizeof(dir), "%s/%.4s/%.2s/%.2s", dpath, date, date + 5, date + 8);
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  int span = trace_begin("walk_day", date);
+  rc = walk_files(fd, date, dir, fn, arg);
+  close(fd);
+  trace_end(span);
+  return rc;
+}
@@ -0,0 +1,46 @@
+/*
+ * walk.h - Streaming walker over the YYYY/MM/DD diary tree
+ *
+ * Entries are produced in chronological order (years, months, days and file
+ * names sorted) without spawning processes. Only one directory per level is
+ * open at a time and only the names of those directories are held in memory,
+ * so there is no limit on the number of entries.
+ */
+#ifndef WALK_H
+#define WALK_H
+
+#include "dry.h"
+
+/* One file of a day directory, valid during the callback only */
+typedef struct {
+  char date[11];          /* YYYY-MM-DD of the day directory */
+  const char *name;       /* file name */
+  const char *path;       /* absolute path */
+  int dirfd;              /* open day directory (for fstatat/openat) */
+  unsigned char d_type;   /* DT_* type, DT_UNKNOWN if the filesystem doesn't say */
+} WALK_ENTRY;
+
+/* Called for every entry; return non-zero to stop the walk */
+typedef int (*WALK_FN)(const WALK_ENTRY *entry, void *arg);
+
+/* Called for every day directory (dirfd valid during the call only) */
+typedef int (*WALK_DAY_FN)(const char *date, int dirfd, void *arg);
+
+/*
+ * Walk the diary mounted at dpath. from and to (YYYY-MM-DD, inclusive,
+ * NULL for no bound) prune years, months and days outside the range.
+ * Hidden files are skipped. Returns 0 when done, -1 if dpath can't be read,
+ * or the non-zero value returned by fn.
+ */
+int walk_diary(const char *dpath, const char *from, const char *to, WALK_FN fn, void *arg);
+
+/* Walk the day directories only, without reading their contents */
+int walk_days(const char *dpath, const char *from, const char *to, WALK_DAY_FN fn, void *arg);
+
+/* Same, newest day first, so the latest days are reached without walking the rest */
+int walk_days_reverse(const char *dpath, const char *from, const char *to, WALK_DAY_FN fn, void *arg);
+
+/* Walk the entries of a single day (YYYY-MM-DD) */
+int walk_day(const char *dpath, const char *date, WALK_FN fn, void *arg);
+
+#endif /* WALK_H */
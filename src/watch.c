@@ -0,0 +1,459 @@
+/*
+ * watch.c - Diary watcher implementation
+ *
+ * Each directory of the tree (root, years, months, days) has an inotify
+ * watch. An event names the days it may affect: a year, a month or a day.
+ * The range is written to the journal as soon as it is seen, and applied
+ * with catalog_sync() (which replays the journal) once no event arrived
+ * for WATCH_DEBOUNCE_MS, or WATCH_MAX_DELAY_MS after the first one.
+ */
+#include "watch.h"
+#include "catalog.h"
+#include "search.h"
+#include "utils.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+
+#define WATCH_DEBOUNCE_MS 300
+#define WATCH_MAX_DELAY_MS 5000
+
+/* Journal size after which it is started afresh */
+#define WATCH_JOURNAL_MAX 65536
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | \
+                    IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | \
+                    IN_ONLYDIR | IN_EXCL_UNLINK)
+
+/* A watched directory: the diary (level 0), a year, a month or a day */
+typedef struct {
+  int wd;
+  int level;
+  char key[11];       /* "", YYYY, YYYY-MM or YYYY-MM-DD */
+} WATCH_DIR;
+
+/* Days with changes that were not applied yet ("" for no bound) */
+typedef struct {
+  char from[11];
+  char to[11];
+} WATCH_RANGE;
+
+typedef struct {
+  const char *dpath;
+  int ifd;              /* inotify descriptor */
+  int journal;          /* journal descriptor, holds its lock */
+  WATCH_DIR *dirs;      /* sorted by wd */
+  int ndirs;
+  int dirs_cap;
+  WATCH_RANGE *pending;
+  int npending;
+  int pending_cap;
+  long long first;      /* time of the first and last pending event (ms) */
+  long long last;
+  int gone;             /* the diary was unmounted or moved */
+} WATCHER;
+
+static volatile sig_atomic_t stopping;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+static long long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int all_digits(const char *s, size_t len) {
+  if (strlen(s) != len)
+    return 0;
+  for (size_t i = 0; i < len; i++)
+    if (!isdigit((unsigned char)s[i]))
+      return 0;
+  return 1;
+}
+
+/* Binary search by wd; returns index or -(insert position) - 1 */
+static int find_dir(const WATCHER *w, int wd) {
+  int lo = 0, hi = w->ndirs - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (w->dirs[mid].wd == wd)
+      return mid;
+    if (w->dirs[mid].wd < wd)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return -lo - 1;
+}
+
+/* Name of the children of a directory at level (years, months, days or any file) */
+static int child_name_valid(int level, const char *name) {
+  if (name[0] == '.')
+    return 0;
+  return level == 3 || all_digits(name, level == 0 ? 4 : 2);
+}
+
+static void child_key(const WATCH_DIR *dir, const char *name, char *key, size_t size) {
+  snprintf(key, size, "%s%s%s", dir->key, dir->level > 0 ? "-" : "", name);
+}
+
+/* Watch the directory of key and, since it may have been filled already, its children */
+static int add_dir(WATCHER *w, int level, const char *key) {
+  char path[4200];
+
+  if (level == 0)
+    snprintf(path, sizeof(path), "%s", w->dpath);
+  else
+    snprintf(path, sizeof(path), "%s/%.4s%s%.2s%s%.2s", w->dpath, key, level > 1 ? "/" : "",
+             level > 1 ? key + 5 : "", level > 2 ? "/" : "", level > 2 ? key + 8 : "");
+
+  int wd = inotify_add_watch(w->ifd, path, WATCH_MASK);
+  if (wd < 0) {
+    if (errno == ENOENT || errno == ENOTDIR)
+      return 0;
+    fprintf(stderr, "Error: can't watch %s: %s%s\n", path, strerror(errno),
+            errno == ENOSPC ? " (raise fs.inotify.max_user_watches)" : "");
+    return 1;
+  }
+
+  int idx = find_dir(w, wd);
+  if (idx < 0) {
+    if (w->ndirs == w->dirs_cap) {
+      int cap = w->dirs_cap ? w->dirs_cap * 2 : 256;
+      WATCH_DIR *dirs = realloc(w->dirs, cap * sizeof(WATCH_DIR));
+      if (dirs == NULL)
+        return 1;
+      w->dirs = dirs;
+      w->dirs_cap = cap;
+    }
+    idx = -idx - 1;
+    memmove(&w->dirs[idx + 1], &w->dirs[idx], (w->ndirs - idx) * sizeof(WATCH_DIR));
+    w->ndirs++;
+  }
+  w->dirs[idx].wd = wd;
+  w->dirs[idx].level = level;
+  snprintf(w->dirs[idx].key, sizeof(w->dirs[idx].key), "%s", key);
+
+  if (level == 3)
+    return 0;
+
+  DIR *dir = opendir(path);
+  if (dir == NULL)
+    return 0;
+  WATCH_DIR parent = w->dirs[idx];
+  struct dirent *de;
+  int rc = 0;
+  while (rc == 0 && (de = readdir(dir)) != NULL) {
+    char child[11];
+    if (!child_name_valid(level, de->d_name))
+      continue;
+    child_key(&parent, de->d_name, child, sizeof(child));
+    rc = add_dir(w, level + 1, child);
+  }
+  closedir(dir);
+  return rc;
+}
+
+/* Record that the days of key (a year, month or day; NULL for all) changed */
+static int mark(WATCHER *w, const char *key) {
+  WATCH_RANGE r = {"", ""};
+  size_t len = key ? strlen(key) : 0;
+
+  if (key != NULL) {
+    snprintf(r.from, sizeof(r.from), "%s%s", key, "0000-00-00" + len);
+    snprintf(r.to, sizeof(r.to), "%s%s", key, "9999-99-99" + len);
+  }
+
+  if (w->npending == 0)
+    w->first = now_ms();
+  w->last = now_ms();
+
+  /* already pending as such or as part of a larger range */
+  for (int i = 0; i < w->npending; i++) {
+    const WATCH_RANGE *p = &w->pending[i];
+    if ((p->from[0] == '\0' || (r.from[0] != '\0' && strcmp(r.from, p->from) >= 0)) &&
+        (p->to[0] == '\0' || (r.to[0] != '\0' && strcmp(r.to, p->to) <= 0)))
+      return 0;
+  }
+
+  if (w->npending == w->pending_cap) {
+    int cap = w->pending_cap ? w->pending_cap * 2 : 16;
+    WATCH_RANGE *pending = realloc(w->pending, cap * sizeof(WATCH_RANGE));
+    if (pending == NULL)
+      return 1;
+    w->pending = pending;
+    w->pending_cap = cap;
+  }
+  w->pending[w->npending++] = r;
+
+  return catalog_journal_add(w->journal, r.from[0] ? r.from : NULL, r.to[0] ? r.to : NULL);
+}
+
+static int handle_event(WATCHER *w, const struct inotify_event *ev) {
+  if (ev->mask & IN_Q_OVERFLOW) {
+    /* events were lost: anything may have changed */
+    return mark(w, NULL);
+  }
+
+  int idx = find_dir(w, ev->wd);
+  if (idx < 0)
+    return 0;
+  WATCH_DIR *dir = &w->dirs[idx];
+
+  if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+    /* the event in the parent directory marks its days */
+    if (dir->level == 0) {
+      w->gone = 1;
+    } else if (ev->mask & IN_IGNORED) {
+      memmove(&w->dirs[idx], &w->dirs[idx + 1], (w->ndirs - idx - 1) * sizeof(WATCH_DIR));
+      w->ndirs--;
+    }
+    return 0;
+  }
+
+  if (ev->len == 0 || !child_name_valid(dir->level, ev->name))
+    return 0;
+
+  char key[11];
+  if (dir->level == 3)
+    snprintf(key, sizeof(key), "%s", dir->key);
+  else
+    child_key(dir, ev->name, key, sizeof(key));
+
+  if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)) && dir->level < 3 &&
+      add_dir(w, dir->level + 1, key) != 0)
+    return 1;
+
+  return mark(w, key);
+}
+
+/* Read the queued events. Returns 0 on success. */
+static int read_events(WATCHER *w) {
+  char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  for (;;) {
+    ssize_t n = read(w->ifd, buf, sizeof(buf));
+    if (n < 0)
+      return errno == EAGAIN || errno == EINTR ? 0 : 1;
+    for (char *p = buf; p < buf + n;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      if (handle_event(w, ev) != 0)
+        return 1;
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+}
+
+static void print_ranges(const WATCHER *w) {
+  for (int i = 0; i < w->npending; i++) {
+    const WATCH_RANGE *r = &w->pending[i];
+    const char *sep = i > 0 ? ", " : "";
+    if (r->from[0] == '\0')
+      printf("%sall days", sep);
+    else if (strcmp(r->from, r->to) == 0)
+      printf("%s%s", sep, r->from);
+    else
+      printf("%s%.*s", sep, strncmp(r->from + 5, "00", 2) == 0 ? 4 : 7, r->from);
+  }
+}
+
+/* Apply the journal to the catalog and search index. Returns 0 on success. */
+static int flush(WATCHER *w, int verbose) {
+  CATALOG cat;
+  SEARCH_INDEX idx;
+  int notes = -1;
+
+  if (catalog_load(&cat, w->dpath) != 0 || catalog_sync(&cat, NULL, NULL) != 0) {
+    fprintf(stderr, "Error: failed to update catalog of %s\n", w->dpath);
+    catalog_free(&cat);
+    return 1;
+  }
+
+  if (search_load(&idx, w->dpath) == 0 && (notes = search_sync(&idx, &cat)) >= 0)
+    search_save(&idx);
+  search_free(&idx);
+
+  /* everything recorded is in the catalog now */
+  struct stat st;
+  if (fstat(w->journal, &st) == 0 && st.st_size > WATCH_JOURNAL_MAX)
+    catalog_journal_reset(w->journal, &cat);
+  int rc = catalog_save(&cat);
+  catalog_free(&cat);
+
+  if (verbose && w->npending > 0) {
+    printf("Updated ");
+    print_ranges(w);
+    printf(" (%d note(s) reindexed)\n", notes > 0 ? notes : 0);
+    fflush(stdout);
+  }
+  w->npending = 0;
+  return rc;
+}
+
+static void watcher_free(WATCHER *w) {
+  if (w->ifd >= 0)
+    close(w->ifd);
+  if (w->journal >= 0)
+    close(w->journal);
+  free(w->dirs);
+  free(w->pending);
+}
+
+/*
+ * Take the journal, watch the tree and catch up with it. Returns 0 on
+ * success, 1 if another watcher runs, -1 on failure.
+ */
+static int watcher_open(WATCHER *w, const char *dpath) {
+  memset(w, 0, sizeof(*w));
+  w->dpath = dpath;
+  w->ifd = -1;
+
+  w->journal = catalog_journal_start(dpath);
+  if (w->journal < 0)
+    return w->journal == -2 ? 1 : -1;
+
+  w->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (w->ifd < 0) {
+    fprintf(stderr, "Error: inotify: %s\n", strerror(errno));
+    return -1;
+  }
+
+  /* changes made until the tree is watched are found by walking it */
+  if (add_dir(w, 0, "") != 0 || flush(w, 0) != 0)
+    return -1;
+  return 0;
+}
+
+static void watcher_loop(WATCHER *w, int verbose) {
+  struct sigaction sa = {0};
+
+  /* no SA_RESTART: poll() returns on a signal */
+  sa.sa_handler = on_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+
+  while (!stopping && !w->gone) {
+    int timeout = -1;
+    if (w->npending > 0) {
+      long long now = now_ms();
+      long long quiet = w->last + WATCH_DEBOUNCE_MS - now;
+      long long late = w->first + WATCH_MAX_DELAY_MS - now;
+      long long wait = quiet < late ? quiet : late;
+      timeout = wait > 0 ? (int)wait : 0;
+    }
+
+    struct pollfd pfd = {w->ifd, POLLIN, 0};
+    int n = poll(&pfd, 1, timeout);
+    if (n < 0 && errno != EINTR)
+      break;
+    if (n > 0 && read_events(w) != 0)
+      break;
+
+    long long now = now_ms();
+    if (w->npending > 0 &&
+        (now >= w->last + WATCH_DEBOUNCE_MS || now >= w->first + WATCH_MAX_DELAY_MS))
+      flush(w, verbose);
+  }
+
+  /* the unmount took the catalog along */
+  if (!w->gone && w->npending > 0)
+    flush(w, verbose);
+}
+
+int watch_run(const char *dpath) {
+  WATCHER w;
+
+  int rc = watcher_open(&w, dpath);
+  if (rc != 0) {
+    if (rc > 0)
+      fprintf(stderr, "Error: %s is already watched\n", dpath);
+    watcher_free(&w);
+    return 1;
+  }
+
+  printf("Watching %s (%d directories), Ctrl-C to stop\n", dpath, w.ndirs);
+  fflush(stdout);
+  watcher_loop(&w, 1);
+  if (w.gone)
+    printf("%s went away, stopped watching\n", dpath);
+
+  watcher_free(&w);
+  return 0;
+}
+
+int watch_start(const char *dpath) {
+  int ready[2];
+  char status = 1;
+
+  if (catalog_journal_owner(dpath) > 0)
+    return 1;
+  if (pipe(ready) != 0)
+    return -1;
+
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(ready[0]);
+    close(ready[1]);
+    return -1;
+  }
+
+  if (pid == 0) {
+    /* detach like the transcode worker */
+    close(ready[0]);
+    setsid();
+    if (fork() != 0)
+      _exit(0);
+
+    WATCHER w;
+    status = watcher_open(&w, dpath);
+    if (write(ready[1], &status, 1) != 1 || status != 0) {
+      watcher_free(&w);
+      _exit(1);
+    }
+    close(ready[1]);
+
+    int null = open("/dev/null", O_RDWR);
+    if (null >= 0) {
+      dup2(null, STDIN_FILENO);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+      if (null > STDERR_FILENO)
+        close(null);
+    }
+    watcher_loop(&w, 0);
+    watcher_free(&w);
+    _exit(0);
+  }
+
+  close(ready[1]);
+  waitpid(pid, NULL, 0);
+  if (read(ready[0], &status, 1) != 1)
+    status = -1;
+  close(ready[0]);
+  return status;
+}
+
+int watch_stop(const char *dpath) {
+  pid_t pid = catalog_journal_owner(dpath);
+
+  if (pid <= 1)
+    return 1;
+  kill(pid, SIGTERM);
+
+  /* wait up to ~10s for it to save the catalog and let go of the mount */
+  for (int i = 0; i < 200 && catalog_journal_owner(dpath) > 0; i++)
+    usleep(50000);
+  return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * watch.h - Keep the catalog and search index of an open diary current
+ *
+ * A watcher puts inotify watches on the YYYY/MM/DD tree of a diary and
+ * records every day that changes in the catalog journal right away (see
+ * catalog.h), so other commands only rescan those days instead of walking
+ * the whole tree, and notice edits made in place that leave directories
+ * alone. The catalog and search index are brought up to date once the
+ * tree has been quiet for a moment. Only changes made through the mount
+ * are seen (not ones made to the encrypted directory directly).
+ */
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "dry.h"
+
+/* Watch the diary mounted at dpath until a signal, printing what was updated */
+int watch_run(const char *dpath);
+
+/*
+ * Start a detached watcher for the diary mounted at dpath, and wait until
+ * it watches the whole tree. Returns 0 if it runs, 1 if one was already
+ * running, -1 on failure.
+ */
+int watch_start(const char *dpath);
+
+/*
+ * Stop the watcher of the diary at dpath once it applied pending changes.
+ * Returns 0 if one was running.
+ */
+int watch_stop(const char *dpath);
+
+#endif /* WATCH_H */
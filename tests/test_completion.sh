@@ -111,6 +111,12 @@ test_no_encfs_dependency() {
     ! grep -qE "^\s*(encfs|fusermount)" "$COMPLETION_FILE"
 }
 
+test_uses_complete_command() {
+    # Candidates come from the binary, not from listing diary directories
+    grep -q "__complete" "$COMPLETION_FILE" &&
+    ! grep -qE '\bls\b' "$COMPLETION_FILE"
+}
+
 test_bash_completion_function() {
     # Source in bash subshell and check function exists
     bash -c "source '$COMPLETION_FILE' 2>/dev/null; type _dry_completions" 2>/dev/null || 
@@ -141,6 +147,7 @@ main() {
     run_test "defines list filters" test_defines_list_filters
     run_test "reads diaries.ref" test_reads_diaries_ref
     run_test "no encfs dependency" test_no_encfs_dependency
+    run_test "uses dry __complete" test_uses_complete_command
     
     echo ""
     echo "========================================"
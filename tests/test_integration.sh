@@ -448,6 +448,103 @@ test_delete_runs_file_manager() {
     [[ $? -eq 0 ]]
 }
 
+# =============================================================================
+# Catalog Tests
+# =============================================================================
+
+test_reindex_builds_catalog() {
+    run_dry_with_diary -d "$TEST_DIARY" list >/dev/null 2>&1 || true
+    
+    mkdir -p "$TEST_MOUNT_PATH/2024/02/29"
+    echo "leap day" > "$TEST_MOUNT_PATH/2024/02/29/2024-02-29.org"
+    
+    local output
+    output=$(run_dry_with_diary -d "$TEST_DIARY" reindex 2>&1)
+    
+    echo "$output" | grep -q "Indexed" &&
+    grep -q "2024-02-29.org" "$TEST_MOUNT_PATH/.dry/catalog"
+}
+
+test_list_uses_catalog() {
+    run_dry_with_diary -d "$TEST_DIARY" reindex >/dev/null 2>&1 || true
+    
+    local output
+    output=$(run_dry_with_diary -d "$TEST_DIARY" list 2024-02-29 2>&1)
+    
+    echo "$output" | grep -q "2024-02-29.org" &&
+    echo "$output" | grep -q "text"
+}
+
+test_list_json() {
+    local output
+    output=$(run_dry_with_diary -d "$TEST_DIARY" list --json 2024-02-29 2>&1)
+    
+    echo "$output" | head -1 | grep -q '^\[' &&
+    echo "$output" | grep -q '"id": "2024-02-29.org"' &&
+    echo "$output" | grep -q '"type": "text"'
+}
+
+test_list_type_filter() {
+    local output
+    output=$(run_dry_with_diary -d "$TEST_DIARY" list --type media 2024-02-29 2>&1)
+    
+    ! echo "$output" | grep -q "2024-02-29.org"
+}
+
+test_show_busy_day() {
+    # More entries than the old fixed 256-slot list
+    run_dry_with_diary -d "$TEST_DIARY" list >/dev/null 2>&1 || true
+    
+    mkdir -p "$TEST_MOUNT_PATH/2024/05/05"
+    for i in $(seq -w 1 300); do
+        echo "entry $i" > "$TEST_MOUNT_PATH/2024/05/05/2024-05-05_10-$i.txt"
+    done
+    
+    local output
+    output=$(run_dry_with_diary -d "$TEST_DIARY" show --head 2024-05-05 2>&1)
+    
+    echo "$output" | grep -q "300 file(s)" &&
+    echo "$output" | grep -q "\[300/300\] 2024-05-05_10-300.txt"
+}
+
+test_list_drops_removed_days() {
+    mkdir -p "$TEST_MOUNT_PATH/2024/06/06"
+    echo "gone soon" > "$TEST_MOUNT_PATH/2024/06/06/2024-06-06.org"
+    run_dry_with_diary -d "$TEST_DIARY" list 2024 >/dev/null 2>&1
+    rm -rf "$TEST_MOUNT_PATH/2024/06"
+    
+    local output
+    output=$(run_dry_with_diary -d "$TEST_DIARY" list 2024 2>&1)
+    
+    ! echo "$output" | grep -q "2024-06-06"
+}
+
+# =============================================================================
+# Search Tests
+# =============================================================================
+
+test_search_finds_section() {
+    run_dry_with_diary -d "$TEST_DIARY" list >/dev/null 2>&1 || true
+    
+    mkdir -p "$TEST_MOUNT_PATH/2024/03/01"
+    printf '* 2024-03-01\n** 10:15:00\nCalibrated the spectrometer\n' \
+        > "$TEST_MOUNT_PATH/2024/03/01/2024-03-01.org"
+    run_dry_with_diary -d "$TEST_DIARY" reindex >/dev/null 2>&1
+    
+    local output
+    output=$(run_dry_with_diary -d "$TEST_DIARY" search spectrometer 2>&1)
+    
+    echo "$output" | grep -q "2024-03-01.org \*\* 10:15:00" &&
+    [[ -f "$TEST_MOUNT_PATH/.dry/search.idx" ]]
+}
+
+test_search_requires_all_terms() {
+    local output
+    output=$(run_dry_with_diary -d "$TEST_DIARY" search spectrometer unrelatedword 2>&1)
+    
+    echo "$output" | grep -q "^0 result(s)"
+}
+
 # =============================================================================
 # Main
 # =============================================================================
@@ -492,6 +589,20 @@ main() {
     run_test "delete shows deleting message" test_delete_requires_confirmation
     run_test "delete runs file manager" test_delete_runs_file_manager
     
+    echo ""
+    echo "[Catalog]"
+    run_test "reindex builds catalog" test_reindex_builds_catalog
+    run_test "list answers from catalog" test_list_uses_catalog
+    run_test "list prints JSON" test_list_json
+    run_test "list filters by type" test_list_type_filter
+    run_test "show lists every entry of a busy day" test_show_busy_day
+    run_test "list drops removed days" test_list_drops_removed_days
+    
+    echo ""
+    echo "[Search]"
+    run_test "search reports note section" test_search_finds_section
+    run_test "search requires all terms" test_search_requires_all_terms
+    
     # Summary
     echo ""
     echo "========================================"